@@ -7,9 +7,13 @@
 #include <linux/uaccess.h>
 #include <linux/slab.h>
 #include <linux/spinlock.h>
+#include <linux/mm.h>
 #include "../../include/ctrlxt_kernel.h"
 #include "../../include/quantum.h"
 #include "../../include/quantum_memory.h"
+#include "../../include/quantum_device.h"
+#include "../../include/quantum_backend.h"
+#include "../../include/quantum_classical.h"
 
 /* Quantum device structure */
 struct ctrlxt_quantum_device {
@@ -23,6 +27,7 @@ struct ctrlxt_quantum_device {
     atomic_t operation_count;
     struct quantum_memory_block *memory;
     unsigned long capabilities;
+    struct ctrlxt_qc_interface *qc;     /* interface of the opener */
     void *private_data;
 };
 
@@ -40,6 +45,13 @@ static int quantum_open(struct inode *inode, struct file *file)
         return -EBUSY;
     }
     
+    /* The opener gets an interface of its own for buffers and conversions */
+    dev->qc = ctrlxt_qc_alloc(NULL);
+    if (IS_ERR(dev->qc)) {
+        atomic_dec(&dev->open_count);
+        return PTR_ERR(dev->qc);
+    }
+    
     file->private_data = dev;
     return 0;
 }
@@ -48,10 +60,259 @@ static int quantum_release(struct inode *inode, struct file *file)
 {
     struct ctrlxt_quantum_device *dev = file->private_data;
     
+    /* Mappings still open keep their buffers until they go */
+    ctrlxt_qc_free(dev->qc);
+    dev->qc = NULL;
+    
     atomic_dec(&dev->open_count);
     return 0;
 }
 
+/* Map a registered interface buffer, the offset comes from QUANTUM_IOCTL_BUFFER_REGISTER */
+static int quantum_mmap(struct file *file, struct vm_area_struct *vma)
+{
+    struct ctrlxt_quantum_device *dev = file->private_data;
+    
+    return ctrlxt_qc_buffer_mmap(dev->qc, vma);
+}
+
+/* Copy a circuit and its amplitude query in, run it and copy the results out */
+static int quantum_ioctl_amplitudes(void __user *arg)
+{
+    struct quantum_amplitude_params params;
+    struct quantum_circuit_analysis analysis;
+    struct quantum_circuit circuit;
+    struct quantum_amp *amps = NULL;
+    u64 *indices = NULL;
+    int ret;
+
+    if (copy_from_user(&params, arg, sizeof(params)))
+        return -EFAULT;
+
+    if (params.num_ops > QUANTUM_CIRCUIT_MAX_OPS || params.count == 0 ||
+        params.count > QUANTUM_AMPLITUDE_MAX_QUERY)
+        return -EINVAL;
+
+    circuit.num_qubits = params.num_qubits;
+    circuit.num_ops = params.num_ops;
+    circuit.ops = kvmalloc_array(params.num_ops, sizeof(*circuit.ops), GFP_KERNEL);
+    indices = kvmalloc_array(params.count, sizeof(*indices), GFP_KERNEL);
+    amps = kvmalloc_array(params.count, sizeof(*amps), GFP_KERNEL);
+    if ((params.num_ops && !circuit.ops) || !indices || !amps) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    if (copy_from_user(circuit.ops, (void __user *)params.ops, params.num_ops * sizeof(*circuit.ops)) ||
+        copy_from_user(indices, (void __user *)params.indices, params.count * sizeof(*indices))) {
+        ret = -EFAULT;
+        goto out;
+    }
+
+    ret = quantum_backend_amplitudes(&circuit, params.backend, indices, params.count, amps,
+                                     &analysis);
+    if (ret == 0 && copy_to_user((void __user *)params.amps, amps, params.count * sizeof(*amps)))
+        ret = -EFAULT;
+
+    /* Report the backend analysis picked */
+    if (ret == 0 && params.backend == QUANTUM_BACKEND_AUTO) {
+        params.backend = analysis.backend;
+        if (copy_to_user(arg, &params, sizeof(params)))
+            ret = -EFAULT;
+    }
+
+out:
+    kvfree(circuit.ops);
+    kvfree(indices);
+    kvfree(amps);
+    return ret;
+}
+
+/* Sample the register and copy out the full count table or its top k */
+static int quantum_ioctl_sample(struct ctrlxt_quantum_device *dev, void __user *arg)
+{
+    struct quantum_sample_params params;
+    struct quantum_histogram hist;
+    size_t n;
+    int ret;
+
+    if (copy_from_user(&params, arg, sizeof(params)))
+        return -EFAULT;
+
+    ret = quantum_state_sample(dev->state, params.shots, &hist);
+    if (ret < 0)
+        return ret;
+
+    n = quantum_histogram_finish(&hist, params.top_k ? QUANTUM_HIST_BY_COUNT :
+                                 QUANTUM_HIST_BY_OUTCOME);
+    params.distinct = n;
+    if (params.top_k)
+        n = min_t(size_t, n, params.top_k);
+    params.count = min_t(size_t, n, params.count);
+
+    if (copy_to_user((void __user *)params.counts, hist.slots,
+                     params.count * sizeof(*hist.slots)) ||
+        copy_to_user(arg, &params, sizeof(params)))
+        ret = -EFAULT;
+
+    quantum_histogram_free(&hist);
+    return ret;
+}
+
+/* Copy a Pauli-sum Hamiltonian in and evolve the register under it */
+static int quantum_ioctl_evolve(struct ctrlxt_quantum_device *dev, void __user *arg)
+{
+    struct quantum_evolve_params params;
+    struct quantum_hamiltonian ham;
+    int ret;
+
+    if (copy_from_user(&params, arg, sizeof(params)))
+        return -EFAULT;
+
+    if (!dev->state || params.num_terms > QUANTUM_HAMILTONIAN_MAX_TERMS)
+        return -EINVAL;
+
+    ham.num_qubits = dev->state->num_qubits;
+    ham.num_terms = params.num_terms;
+    ham.terms = kvmalloc_array(params.num_terms, sizeof(*ham.terms), GFP_KERNEL);
+    if (params.num_terms && !ham.terms)
+        return -ENOMEM;
+
+    if (copy_from_user(ham.terms, (void __user *)params.terms,
+                       params.num_terms * sizeof(*ham.terms)))
+        ret = -EFAULT;
+    else
+        ret = quantum_state_evolve(dev->state, &ham, &params.evolution);
+
+    kvfree(ham.terms);
+    return ret;
+}
+
+/* Run a variational job, only the best point and the trace go back */
+static int quantum_ioctl_variational(void __user *arg)
+{
+    struct quantum_variational_params params;
+    struct quantum_hamiltonian ham;
+    struct quantum_variational job;
+    struct quantum_param_op *ops;
+    s32 *points;
+    s64 *trace;
+    int ret;
+
+    if (copy_from_user(&params, arg, sizeof(params)))
+        return -EFAULT;
+
+    if (params.num_ops > QUANTUM_CIRCUIT_MAX_OPS ||
+        params.num_terms > QUANTUM_HAMILTONIAN_MAX_TERMS ||
+        params.num_params > QUANTUM_VARIATIONAL_MAX_PARAMS ||
+        params.trace_len > QUANTUM_VARIATIONAL_MAX_BUDGET)
+        return -EINVAL;
+
+    ops = kvmalloc_array(params.num_ops, sizeof(*ops), GFP_KERNEL);
+    ham.terms = kvmalloc_array(params.num_terms, sizeof(*ham.terms), GFP_KERNEL);
+    points = kvmalloc_array(params.num_params, sizeof(*points), GFP_KERNEL);
+    trace = kvmalloc_array(params.trace_len, sizeof(*trace), GFP_KERNEL);
+    if ((params.num_ops && !ops) || (params.num_terms && !ham.terms) ||
+        (params.num_params && !points) || (params.trace_len && !trace)) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    if (copy_from_user(ops, (void __user *)params.ops, params.num_ops * sizeof(*ops)) ||
+        copy_from_user(ham.terms, (void __user *)params.terms,
+                       params.num_terms * sizeof(*ham.terms)) ||
+        copy_from_user(points, (void __user *)params.params,
+                       params.num_params * sizeof(*points))) {
+        ret = -EFAULT;
+        goto out;
+    }
+
+    ham.num_qubits = params.num_qubits;
+    ham.num_terms = params.num_terms;
+    job = (struct quantum_variational) {
+        .num_qubits = params.num_qubits,
+        .num_ops = params.num_ops,
+        .ops = ops,
+        .observable = &ham,
+        .optimizer = params.optimizer,
+        .budget = params.budget,
+        .step = params.step,
+        .tolerance = params.tolerance,
+        .seed = params.seed,
+        .num_params = params.num_params,
+        .params = points,
+        .trace_len = params.trace_len,
+        .trace = trace,
+    };
+
+    ret = quantum_variational_run(&job);
+    if (ret < 0)
+        goto out;
+
+    params.iterations = job.iterations;
+    params.evaluations = job.evaluations;
+    params.energy = job.energy;
+    if (copy_to_user((void __user *)params.params, points, params.num_params * sizeof(*points)) ||
+        copy_to_user((void __user *)params.trace, trace,
+                     min(job.iterations, params.trace_len) * sizeof(*trace)) ||
+        copy_to_user(arg, &params, sizeof(params)))
+        ret = -EFAULT;
+
+out:
+    kvfree(trace);
+    kvfree(points);
+    kvfree(ham.terms);
+    kvfree(ops);
+    return ret;
+}
+
+static int quantum_ioctl_buffer_register(struct ctrlxt_quantum_device *dev, void __user *arg)
+{
+    struct quantum_buffer_params params;
+    int id;
+    
+    if (copy_from_user(&params, arg, sizeof(params)))
+        return -EFAULT;
+    
+    if (params.size > QC_BUFFER_REG_MAX)
+        return -EINVAL;
+    
+    id = ctrlxt_qc_buffer_register(dev->qc, params.size);
+    if (id < 0)
+        return id;
+    
+    params.id = id;
+    params.mmap_offset = (u64)id << QC_BUFFER_MMAP_SHIFT;
+    if (copy_to_user(arg, &params, sizeof(params))) {
+        ctrlxt_qc_buffer_unregister(dev->qc, id);
+        return -EFAULT;
+    }
+    
+    return 0;
+}
+
+static int quantum_ioctl_buffer_io(struct ctrlxt_quantum_device *dev, void __user *arg)
+{
+    struct quantum_buffer_io_params params;
+    struct qc_request req;
+    
+    if (copy_from_user(&params, arg, sizeof(params)))
+        return -EFAULT;
+    
+    if (params.op != QC_REQ_CONVERT && params.op != QC_REQ_MEASURE &&
+        params.op != QC_REQ_MEASURE_ALL && params.op != QC_REQ_SAMPLE)
+        return -EINVAL;
+    
+    req = (struct qc_request){
+        .op = params.op,
+        .flags = QC_REQ_F_BUFFER,
+        .buffer = params.id,
+        .offset = params.offset,
+        .size = params.size,
+    };
+    return ctrlxt_qc_execute(dev->qc, &req);
+}
+
 static long quantum_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
     struct ctrlxt_quantum_device *dev = file->private_data;
@@ -63,7 +324,13 @@ static long quantum_ioctl(struct file *file, unsigned int cmd, unsigned long arg
             break;
             
         case QUANTUM_IOCTL_MEASURE:
-            ret = quantum_state_measure(dev->state, (void *)arg);
+            {
+                u8 out[sizeof(u64)];
+                ret = quantum_state_measure(dev->state, out);
+                if (ret == 0 && copy_to_user((void __user *)arg, out,
+                                             DIV_ROUND_UP(dev->state->num_qubits, 8)))
+                    ret = -EFAULT;
+            }
             break;
             
         case QUANTUM_IOCTL_APPLY_GATE:
@@ -86,6 +353,38 @@ static long quantum_ioctl(struct file *file, unsigned int cmd, unsigned long arg
             }
             break;
             
+        case QUANTUM_IOCTL_AMPLITUDES:
+            ret = quantum_ioctl_amplitudes((void __user *)arg);
+            break;
+            
+        case QUANTUM_IOCTL_SET_LAYOUT:
+            ret = quantum_state_set_layout(dev->state, arg);
+            break;
+            
+        case QUANTUM_IOCTL_SAMPLE:
+            ret = quantum_ioctl_sample(dev, (void __user *)arg);
+            break;
+            
+        case QUANTUM_IOCTL_EVOLVE:
+            ret = quantum_ioctl_evolve(dev, (void __user *)arg);
+            break;
+            
+        case QUANTUM_IOCTL_VARIATIONAL:
+            ret = quantum_ioctl_variational((void __user *)arg);
+            break;
+            
+        case QUANTUM_IOCTL_BUFFER_REGISTER:
+            ret = quantum_ioctl_buffer_register(dev, (void __user *)arg);
+            break;
+            
+        case QUANTUM_IOCTL_BUFFER_UNREGISTER:
+            ret = arg < QC_MAX_BUFFERS ? ctrlxt_qc_buffer_unregister(dev->qc, arg) : -ENOENT;
+            break;
+            
+        case QUANTUM_IOCTL_BUFFER_IO:
+            ret = quantum_ioctl_buffer_io(dev, (void __user *)arg);
+            break;
+            
         case QUANTUM_IOCTL_FREE_MEMORY:
             if (dev->memory) {
                 ctrlxt_qmem_free(dev->memory);
@@ -108,6 +407,7 @@ static const struct file_operations quantum_fops = {
     .owner = THIS_MODULE,
     .open = quantum_open,
     .release = quantum_release,
+    .mmap = quantum_mmap,
     .unlocked_ioctl = quantum_ioctl,
     .compat_ioctl = quantum_ioctl,
 };
@@ -189,6 +489,30 @@ error:
     return ret;
 }
 
+/* Save the device register as 2^n amplitudes in index order, whatever its layout */
+int ctrlxt_quantum_device_save_state(void *buffer, size_t size)
+{
+    if (!quantum_dev || !buffer)
+        return -EINVAL;
+    
+    if (size < quantum_dev->state->dim * sizeof(struct quantum_amp))
+        return -ENOSPC;
+    
+    return quantum_state_save(quantum_dev->state, buffer);
+}
+
+/* Load a saved register into the device register, keeping its layout */
+int ctrlxt_quantum_device_load_state(const void *buffer, size_t size)
+{
+    if (!quantum_dev || !buffer)
+        return -EINVAL;
+    
+    if (size != quantum_dev->state->dim * sizeof(struct quantum_amp))
+        return -EINVAL;
+    
+    return quantum_state_restore(quantum_dev->state, buffer);
+}
+
 /* Module initialization */
 static int __init quantum_init(void)
 {
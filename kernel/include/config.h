@@ -16,6 +16,9 @@
 #define CONFIG_QUANTUM_MAX_QUBITS 1024
 #define CONFIG_QUANTUM_MAX_QUBITS_PER_BLOCK 64
 
+/* Quantum-classical interface configuration */
+#define CONFIG_QUANTUM_QC_PERCPU_DEFAULT 1  /* default interface per CPU for kernel callers */
+
 /* Network configuration */
 #define CONFIG_QUANTUM_NETWORK_BUFFER_SIZE 4096
 #define CONFIG_QUANTUM_NETWORK_MAX_CONNECTIONS 1024
@@ -34,6 +34,18 @@ struct quantum_perf_stats {
     atomic_t min_time;
 };
 
+/* Simulation backend record, see quantum_backend.h */
+#define QUANTUM_PERF_MAX_BACKENDS 8
+
+struct quantum_perf_backend_stats {
+    unsigned long runs;
+    unsigned long failures;
+    unsigned long auto_selected;
+    u64 predicted_cost;         /* analysis estimates of auto-selected runs */
+    u64 total_ns;
+    u64 max_ns;
+};
+
 struct quantum_perf_context {
     struct quantum_perf_stats stats;
     unsigned long start_time;
@@ -56,6 +68,11 @@ int quantum_perf_stats_init(struct quantum_perf_stats *stats);
 int quantum_perf_stats_update(struct quantum_perf_stats *stats, int success, unsigned long time);
 int quantum_perf_stats_reset(struct quantum_perf_stats *stats);
 
+/* Backend selection records */
+void quantum_perf_record_backend(unsigned int backend, u64 predicted_cost, u64 elapsed_ns,
+                                 int result);
+int quantum_perf_get_backend_stats(unsigned int backend, struct quantum_perf_backend_stats *stats);
+
 /* Context management */
 struct quantum_perf_context *quantum_perf_context_create(unsigned int flags);
 void quantum_perf_context_destroy(struct quantum_perf_context *ctx);
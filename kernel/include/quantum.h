@@ -0,0 +1,277 @@
+#ifndef _QUANTUM_H
+#define _QUANTUM_H
+
+#include <linux/types.h>
+#include <linux/compiler.h>
+#include "config.h"
+
+/* Quantum gate types */
+enum quantum_gate_type {
+    QUANTUM_GATE_I = 0,
+    QUANTUM_GATE_H,
+    QUANTUM_GATE_X,
+    QUANTUM_GATE_Y,
+    QUANTUM_GATE_Z,
+    QUANTUM_GATE_PHASE,     /* diag(1, e^(i*angle)), S gate without params */
+    QUANTUM_GATE_T,
+    QUANTUM_GATE_RX,
+    QUANTUM_GATE_RY,
+    QUANTUM_GATE_RZ,
+    QUANTUM_GATE_CNOT,
+    QUANTUM_GATE_CZ,
+    QUANTUM_GATE_CPHASE,    /* controlled PHASE(angle) */
+    QUANTUM_GATE_SWAP,
+    QUANTUM_GATE_QFT,       /* macro gates on qubits [qubit, qubit + target) */
+    QUANTUM_GATE_IQFT,
+    QUANTUM_GATE_DIFFUSION, /* Grover diffusion 2|s><s| - I */
+    QUANTUM_GATE_COUNT
+};
+
+/* Angle flag of QFT/IQFT: skip the final (or initial) bit reversal */
+#define QUANTUM_MACRO_NO_SWAP 0x1
+
+static inline bool quantum_gate_is_macro(enum quantum_gate_type gate)
+{
+    return gate >= QUANTUM_GATE_QFT && gate <= QUANTUM_GATE_DIFFUSION;
+}
+
+/* State vector limits */
+#define QUANTUM_STATE_MAX_QUBITS 26  /* 2^26 amplitudes, 512MB */
+#define QUANTUM_STATE_CDF_MAX_QUBITS 22  /* cached running sums up to 32MB */
+
+/*
+ * Amplitudes are stored as Q2.30 fixed point so no FPU state is needed in
+ * kernel context. QAMP_ONE represents 1.0.
+ */
+#define QAMP_SHIFT    30
+#define QAMP_ONE      (1 << QAMP_SHIFT)
+#define QAMP_SQRT1_2  759250125  /* 1/sqrt(2) */
+
+/* Angles are binary radians, QUANTUM_ANGLE_TURN represents 2*pi */
+#define QUANTUM_ANGLE_TURN  (1U << 16)
+#define QUANTUM_ANGLE_PI    (QUANTUM_ANGLE_TURN / 2)
+
+/* Complex amplitude */
+struct quantum_amp {
+    s32 re;
+    s32 im;
+};
+
+/* State representations */
+enum quantum_state_repr {
+    QUANTUM_REPR_DENSE = 0,     /* 2^n amplitudes in amps */
+    QUANTUM_REPR_DD,            /* decision diagram in dd, see quantum_dd.h */
+    QUANTUM_REPR_REAL,          /* 2^n real amplitudes in re, dense after the first complex gate */
+    QUANTUM_REPR_SPLIT,         /* 2^n amplitudes in lanes, see quantum_state_set_layout() */
+};
+
+/*
+ * Amplitude layouts of vector states. Split layouts store blocks of
+ * 2^block_shift real parts followed by as many imaginary parts, so complex
+ * arithmetic runs on whole lanes without shuffling re and im apart.
+ */
+enum quantum_state_layout {
+    QUANTUM_LAYOUT_AOS = 0,     /* interleaved re/im, QUANTUM_REPR_DENSE */
+    QUANTUM_LAYOUT_SOA,         /* one block of all real parts then all imaginary parts */
+    QUANTUM_LAYOUT_AOSOA4,      /* blocks of 4 */
+    QUANTUM_LAYOUT_AOSOA8,      /* blocks of 8 */
+};
+
+struct quantum_dd;
+
+/*
+ * Measurement distribution of a vector state, cached for one generation.
+ * A state fresh from quantum_state_init() is the point distribution of
+ * basis, otherwise sums holds the running sums of |amplitude|^2.
+ */
+struct quantum_cdf {
+    u64 generation;             /* state generation described, 0 for none */
+    bool point;
+    u64 basis;
+    u64 *sums;
+};
+
+/* Quantum register */
+struct quantum_state {
+    unsigned int num_qubits;
+    size_t dim;
+    enum quantum_state_repr repr;
+    struct quantum_amp *amps;
+    struct quantum_dd *dd;
+    s32 *re;
+    s32 *lanes;
+    unsigned int block_shift;   /* 2^block_shift lanes per block of a split state, 0 for dense */
+    u64 generation;             /* bumped by every change of the amplitudes */
+    struct quantum_cdf cdf;
+};
+
+/* Amplitudes are about to change, cached distributions no longer apply */
+static inline void quantum_state_changed(struct quantum_state *state)
+{
+    state->generation++;
+}
+
+/* Real part of amplitude i in vector lanes, the imaginary part is one block further */
+static inline size_t quantum_lane_pos(size_t i, unsigned int block_shift)
+{
+    return ((i >> block_shift) << (block_shift + 1)) | (i & (((size_t)1 << block_shift) - 1));
+}
+
+/* Lanes of a vector state, a dense state is a split state with blocks of one */
+static inline s32 *quantum_state_lanes(const struct quantum_state *state)
+{
+    return state->repr == QUANTUM_REPR_SPLIT ? state->lanes : (s32 *)state->amps;
+}
+
+/* Load and store amplitude i of vector lanes, dense vectors take the direct path */
+static inline struct quantum_amp quantum_lanes_load(const s32 *lanes, unsigned int block_shift,
+                                                    size_t i)
+{
+    struct quantum_amp a;
+
+    if (likely(!block_shift))
+        return ((const struct quantum_amp *)lanes)[i];
+
+    i = quantum_lane_pos(i, block_shift);
+    a.re = lanes[i];
+    a.im = lanes[i + ((size_t)1 << block_shift)];
+    return a;
+}
+
+static inline void quantum_lanes_store(s32 *lanes, unsigned int block_shift, size_t i,
+                                       struct quantum_amp a)
+{
+    if (likely(!block_shift)) {
+        ((struct quantum_amp *)lanes)[i] = a;
+        return;
+    }
+
+    i = quantum_lane_pos(i, block_shift);
+    lanes[i] = a.re;
+    lanes[i + ((size_t)1 << block_shift)] = a.im;
+}
+
+/* Optional arguments for quantum_gate_apply() */
+struct quantum_gate_args {
+    int target;     /* second qubit of two-qubit gates */
+    u32 angle;      /* rotation angle for RX/RY/RZ/PHASE/CPHASE */
+};
+
+/* A single gate of a submitted circuit */
+struct quantum_op {
+    enum quantum_gate_type gate;
+    int qubit;      /* target of one-qubit gates, control of two-qubit gates */
+    int target;     /* second qubit of two-qubit gates, register width of macro gates */
+    u32 angle;
+};
+
+/* Gate list executed against |0...0> */
+struct quantum_circuit {
+    unsigned int num_qubits;
+    size_t num_ops;
+    struct quantum_op *ops;
+};
+
+/* Fixed point helpers */
+static inline s32 qamp_mul_re(struct quantum_amp a, struct quantum_amp b)
+{
+    return (s32)(((s64)a.re * b.re - (s64)a.im * b.im) >> QAMP_SHIFT);
+}
+
+static inline s32 qamp_mul_im(struct quantum_amp a, struct quantum_amp b)
+{
+    return (s32)(((s64)a.re * b.im + (s64)a.im * b.re) >> QAMP_SHIFT);
+}
+
+static inline struct quantum_amp qamp_mul(struct quantum_amp a, struct quantum_amp b)
+{
+    struct quantum_amp r = { qamp_mul_re(a, b), qamp_mul_im(a, b) };
+
+    return r;
+}
+
+/* |a|^2 in Q30 */
+static inline u64 qamp_norm(struct quantum_amp a)
+{
+    return ((s64)a.re * a.re + (s64)a.im * a.im) >> QAMP_SHIFT;
+}
+
+/* |amplitude i|^2 in Q30 of a dense, split or real state */
+static inline u64 quantum_state_norm(const struct quantum_state *state, size_t i)
+{
+    size_t pos, block;
+
+    if (state->repr == QUANTUM_REPR_REAL)
+        return ((s64)state->re[i] * state->re[i]) >> QAMP_SHIFT;
+
+    if (state->repr == QUANTUM_REPR_SPLIT) {
+        pos = quantum_lane_pos(i, state->block_shift);
+        block = (size_t)1 << state->block_shift;
+        return ((s64)state->lanes[pos] * state->lanes[pos] +
+                (s64)state->lanes[pos + block] * state->lanes[pos + block]) >> QAMP_SHIFT;
+    }
+
+    return qamp_norm(state->amps[i]);
+}
+
+/* cos/sin of a binary-radian angle in Q30 */
+s32 quantum_angle_cos(u32 angle);
+s32 quantum_angle_sin(u32 angle);
+
+/* e^(i*angle) for an angle in 2^-32 turns */
+struct quantum_amp quantum_angle_twiddle(u32 angle);
+
+/* State management */
+struct quantum_state *quantum_state_alloc(unsigned int num_qubits);
+struct quantum_state *quantum_state_alloc_repr(unsigned int num_qubits,
+                                              enum quantum_state_repr repr);
+void quantum_state_free(struct quantum_state *state);
+int quantum_state_init(struct quantum_state *state, unsigned long value);
+int quantum_state_copy(struct quantum_state *dst, const struct quantum_state *src);
+int quantum_state_convert(struct quantum_state *state, enum quantum_state_repr repr);
+int quantum_state_amplitude(const struct quantum_state *state, u64 index,
+                            struct quantum_amp *amp);
+int quantum_state_set_layout(struct quantum_state *state, enum quantum_state_layout layout);
+
+/* Save or restore all 2^n amplitudes in index order, whatever the representation */
+int quantum_state_save(const struct quantum_state *state, struct quantum_amp *amps);
+int quantum_state_restore(struct quantum_state *state, const struct quantum_amp *amps);
+
+/* Gate application */
+int quantum_gate_matrix(enum quantum_gate_type gate, u32 angle, struct quantum_amp mat[4]);
+int quantum_gate_apply(enum quantum_gate_type gate, struct quantum_state *state,
+                       int qubit, void *params, size_t param_size);
+int quantum_state_apply_op(struct quantum_state *state, const struct quantum_op *op);
+int quantum_circuit_run(struct quantum_state *state, const struct quantum_circuit *circuit);
+
+/* Pauli string with X on the qubits in x and Z on the ones in z, fused into one pass */
+int quantum_state_apply_pauli(struct quantum_state *state, u64 x, u64 z);
+
+/* Gates built from H, X, Z, RY, CNOT, CZ, SWAP and half-turn phases keep amplitudes real */
+bool quantum_op_is_real(const struct quantum_op *op);
+bool quantum_circuit_is_real(const struct quantum_circuit *circuit);
+
+/* Zero every amplitude whose qubit differs from value, without renormalizing */
+u64 quantum_state_project(struct quantum_state *state, int qubit, int value);
+
+/*
+ * Running sums of |amplitude|^2 of a vector state, built on first use and
+ * kept until the state changes. NULL for diagrams, states above
+ * QUANTUM_STATE_CDF_MAX_QUBITS or on allocation failure. May sleep.
+ */
+const u64 *quantum_state_cdf(struct quantum_state *state);
+
+/* Basis state of a draw r below sums[dim - 1] */
+size_t quantum_state_cdf_search(const u64 *sums, size_t dim, u64 r);
+
+/* Measurement, result holds DIV_ROUND_UP(num_qubits, 8) bit-packed bytes */
+int quantum_state_measure(struct quantum_state *state, void *result);
+int quantum_state_measure_qubit(struct quantum_state *state, int qubit, int *result);
+int quantum_state_measure_parity(struct quantum_state *state, u64 mask, int *result);
+int quantum_state_get_value(struct quantum_state *state);
+
+/* Parallel execution across online CPUs, may sleep */
+unsigned int quantum_parallel_width(void);
+void quantum_parallel_for(unsigned int count, void (*fn)(void *arg, unsigned int idx), void *arg);
+
+#endif /* _QUANTUM_H */
@@ -0,0 +1,61 @@
+#ifndef _QUANTUM_BACKEND_H
+#define _QUANTUM_BACKEND_H
+
+#include <linux/types.h>
+#include "quantum.h"
+
+/* Simulation backends */
+enum quantum_backend {
+    QUANTUM_BACKEND_STATEVECTOR = 0,  /* full 2^n state vector */
+    QUANTUM_BACKEND_HYBRID,           /* Schrödinger-Feynman path sum */
+    QUANTUM_BACKEND_TN,               /* tensor-network contraction */
+    QUANTUM_BACKEND_DD,               /* decision diagram */
+    QUANTUM_BACKEND_COUNT
+};
+
+/* Let circuit analysis pick the backend */
+#define QUANTUM_BACKEND_AUTO  0xffU
+
+/* Submission limits */
+#define QUANTUM_CIRCUIT_MAX_OPS      65536
+#define QUANTUM_AMPLITUDE_MAX_QUERY  4096
+#define QUANTUM_BACKEND_MEM_LIMIT    (1ULL << 30)  /* predicted bytes a selected backend may use */
+
+/* Circuit properties and predicted per-backend cost */
+struct quantum_circuit_analysis {
+    bool clifford;                      /* H, S, CNOT, CZ, Paulis and quarter-turn rotations only */
+    bool real;                          /* amplitudes stay real, see quantum_op_is_real() */
+    unsigned int depth;                 /* gate layers */
+    unsigned int two_qubit_gates;
+    unsigned int max_cut;               /* most two-qubit gates spanning one contiguous cut */
+    unsigned int branching;             /* gates that can split a basis state */
+    u64 cost[QUANTUM_BACKEND_COUNT];    /* predicted multiply-adds, U64_MAX when unsupported */
+    u64 memory[QUANTUM_BACKEND_COUNT];  /* predicted bytes */
+    enum quantum_backend backend;       /* cheapest within the memory limit, COUNT if none */
+};
+
+/* Get backend name */
+const char *quantum_backend_name(enum quantum_backend backend);
+
+/* Analyze a circuit for a query of count amplitudes, may sleep */
+int quantum_circuit_analyze(const struct quantum_circuit *circuit, size_t count,
+                            struct quantum_circuit_analysis *analysis);
+
+/*
+ * Cheapest backend of an analysis within QUANTUM_BACKEND_MEM_LIMIT. With
+ * need_state only backends that hold a full register are considered.
+ * Returns QUANTUM_BACKEND_COUNT when nothing fits.
+ */
+enum quantum_backend quantum_backend_select(const struct quantum_circuit_analysis *analysis,
+                                            bool need_state);
+
+/*
+ * Compute <index|C|0...0> for each index with the given backend or
+ * QUANTUM_BACKEND_AUTO. The analysis, if requested, records the pick. Every
+ * run is recorded in the performance statistics. May sleep.
+ */
+int quantum_backend_amplitudes(const struct quantum_circuit *circuit, unsigned int backend,
+                               const u64 *indices, size_t count, struct quantum_amp *out,
+                               struct quantum_circuit_analysis *analysis);
+
+#endif /* _QUANTUM_BACKEND_H */
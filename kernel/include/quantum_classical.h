@@ -3,6 +3,10 @@
 
 #include <linux/types.h>
 #include "quantum.h"
+#include "quantum_encode.h"
+
+struct vm_area_struct;
+struct ctrlxt_qc_interface;
 
 /* Quantum-classical interface statistics */
 struct quantum_classical_stats {
@@ -15,7 +19,7 @@ struct quantum_classical_stats {
 #define QC_BUFFER_SIZE_DEF 1024  /* Default buffer size (1KB) */
 #define QC_BUFFER_SIZE_MAX 8192  /* Maximum buffer size (8KB) */
 
-/* Conversion flags */
+/* Conversion flags, see quantum_state_encode() */
 #define QC_CONV_NONE      0x00
 #define QC_CONV_SUPERPOS  0x01  /* Create superposition state */
 #define QC_CONV_ENTANGLE  0x02  /* Create entangled state */
@@ -28,60 +32,174 @@ struct quantum_classical_stats {
 #define QC_MEAS_BASIS_Y   0x04  /* Measure in Y basis */
 #define QC_MEAS_BELL      0x08  /* Perform Bell measurement */
 
+/* Asynchronous requests in flight, completions included until they are reaped */
+#define QC_RING_SIZE      64
+#define QC_RING_BATCH     16    /* requests run per register lock by the worker */
+
+/* Request operations */
+#define QC_REQ_CONVERT    1     /* ctrlxt_qc_classical_to_quantum() */
+#define QC_REQ_MEASURE    2     /* ctrlxt_qc_quantum_to_classical() */
+#define QC_REQ_GATE       3     /* ctrlxt_qc_controlled_operation() */
+#define QC_REQ_MEASURE_ALL 4    /* ctrlxt_qc_measure_all() */
+#define QC_REQ_SAMPLE     5     /* ctrlxt_qc_sample() */
+
+/* Request flags */
+#define QC_REQ_F_BUFFER   0x01  /* size bytes at offset of a registered buffer instead of data */
+
+/* Registered buffers, converted in place and mappable by user processes */
+#define QC_MAX_BUFFERS        16
+#define QC_BUFFER_REG_MAX     (256UL << 20)   /* 256 MiB */
+#define QC_BUFFER_MMAP_SHIFT  32              /* mmap offset of buffer id is id << shift */
+
+/* Queued request, data must stay valid until its completion is reaped */
+struct qc_request {
+    u32 op;                         /* QC_REQ_* */
+    u32 size;                       /* bytes at data */
+    void *data;                     /* read by CONVERT, written by the others */
+    u32 flags;                      /* QC_REQ_F_* */
+    u32 buffer;                     /* registered buffer id with QC_REQ_F_BUFFER */
+    u64 offset;                     /* of the bytes in that buffer */
+    enum quantum_gate_type gate;    /* QC_REQ_GATE */
+    int qubit;
+    u64 user_data;                  /* handed back in the completion */
+};
+
+struct qc_completion {
+    u64 user_data;
+    s32 result;                     /* 0 or a negative error */
+    u32 op;
+};
+
+/* Register width of interfaces allocated with default parameters */
+#define QC_DEFAULT_QUBITS 8
+
 /* Interface parameters */
 struct qc_params {
     size_t buffer_size;
     unsigned int conversion_flags;
     unsigned int measurement_type;
     bool error_correction;
+    unsigned int num_qubits;        /* register width, only read by ctrlxt_qc_alloc() */
 };
 
 /* Initialize quantum-classical interface */
 int ctrlxt_qc_init(void);
 
-/* Convert classical data to quantum state */
-int ctrlxt_qc_classical_to_quantum(const void *data, size_t size);
-
-/* Convert quantum state to classical data */
-int ctrlxt_qc_quantum_to_classical(void *data, size_t size);
-
-/* Apply quantum operation with classical control */
-int ctrlxt_qc_controlled_operation(enum quantum_gate_type gate, int qubit, const void *control_data);
+/*
+ * Interface with a register, request ring, buffers, parameters and
+ * statistics of its own, NULL params for the defaults. Interfaces never
+ * contend with each other, so every user or job should get its own.
+ * May sleep.
+ */
+struct ctrlxt_qc_interface *ctrlxt_qc_alloc(const struct qc_params *params);
+
+/* Run the queued requests and free the interface, may sleep */
+void ctrlxt_qc_free(struct ctrlxt_qc_interface *qc);
+
+/*
+ * Default interface of the calling CPU for kernel callers without one of
+ * their own, NULL unless CONFIG_QUANTUM_QC_PERCPU_DEFAULT is set. Keep the
+ * pointer for the whole job, the defaults are shared by every caller that
+ * ran on the same CPU.
+ */
+struct ctrlxt_qc_interface *ctrlxt_qc_get_default(void);
+
+/* Replace the register with the encoding of classical data, may sleep */
+int ctrlxt_qc_classical_to_quantum(struct ctrlxt_qc_interface *qc, const void *data, size_t size);
+
+/* Convert quantum state to classical data, may sleep */
+int ctrlxt_qc_quantum_to_classical(struct ctrlxt_qc_interface *qc, void *data, size_t size);
+
+/*
+ * Collapse the whole register in one pass and write the outcome bit-packed
+ * to the first DIV_ROUND_UP(num_qubits, 8) of size bytes, one bit per
+ * qubit instead of a byte per measurement. May sleep.
+ */
+int ctrlxt_qc_measure_all(struct ctrlxt_qc_interface *qc, void *data, size_t size);
+
+/*
+ * Fill size bytes with size * 8 / num_qubits shots of the register without
+ * collapsing it, bit-packed back to back and zero after the last, see
+ * quantum_state_sample_packed(). Large runs belong in a registered buffer.
+ * May sleep.
+ */
+int ctrlxt_qc_sample(struct ctrlxt_qc_interface *qc, void *data, size_t size);
+
+/* Replace the interface register with the result of a circuit, may sleep */
+int ctrlxt_qc_submit_circuit(struct ctrlxt_qc_interface *qc, const struct quantum_circuit *circuit);
+
+/* Apply quantum operation with classical control, may sleep */
+int ctrlxt_qc_controlled_operation(struct ctrlxt_qc_interface *qc, enum quantum_gate_type gate,
+                                   int qubit, const void *control_data);
+
+/*
+ * Queue requests for the interface worker without waiting for them, also
+ * from atomic context. Returns how many were queued, fewer than count
+ * once the ring is full, or -EINVAL for a malformed request.
+ */
+int ctrlxt_qc_submit(struct ctrlxt_qc_interface *qc, const struct qc_request *reqs,
+                     unsigned int count);
+
+/* Move up to max completions out in order, with wait sleeping until one is there */
+int ctrlxt_qc_reap(struct ctrlxt_qc_interface *qc, struct qc_completion *cqes, unsigned int max,
+                   bool wait);
+
+/* Run one request right away, may sleep */
+int ctrlxt_qc_execute(struct ctrlxt_qc_interface *qc, const struct qc_request *req);
+
+/*
+ * Register a zeroed buffer of up to QC_BUFFER_REG_MAX bytes and return its
+ * id. Requests with QC_REQ_F_BUFFER read and write it in place, so bulk
+ * data is neither copied nor bound by the buffer_size parameter.
+ */
+int ctrlxt_qc_buffer_register(struct ctrlxt_qc_interface *qc, size_t size);
+
+/* Drop a buffer id, the memory goes once no mapping or request uses it */
+int ctrlxt_qc_buffer_unregister(struct ctrlxt_qc_interface *qc, unsigned int id);
+
+/* Map the buffer the mmap offset of vma selects, from a driver's mmap */
+int ctrlxt_qc_buffer_mmap(struct ctrlxt_qc_interface *qc, struct vm_area_struct *vma);
 
 /* Get interface statistics */
-void ctrlxt_qc_get_stats(struct quantum_classical_stats *stats);
+void ctrlxt_qc_get_stats(struct ctrlxt_qc_interface *qc, struct quantum_classical_stats *stats);
 
 /* Set interface parameters */
-int ctrlxt_qc_set_params(struct qc_params *params);
+int ctrlxt_qc_set_params(struct ctrlxt_qc_interface *qc, struct qc_params *params);
 
 /* Get current interface parameters */
-int ctrlxt_qc_get_params(struct qc_params *params);
+int ctrlxt_qc_get_params(struct ctrlxt_qc_interface *qc, struct qc_params *params);
 
 /* Reset interface statistics */
-void ctrlxt_qc_reset_stats(void);
+void ctrlxt_qc_reset_stats(struct ctrlxt_qc_interface *qc);
 
 /* Enable/disable error correction */
-int ctrlxt_qc_set_error_correction(bool enable);
+int ctrlxt_qc_set_error_correction(struct ctrlxt_qc_interface *qc, bool enable);
 
-/* Get interface status */
-bool ctrlxt_qc_is_active(void);
+/* Requests queued and not completed yet */
+bool ctrlxt_qc_is_active(struct ctrlxt_qc_interface *qc);
 
 /* Get current buffer size */
-size_t ctrlxt_qc_get_buffer_size(void);
+size_t ctrlxt_qc_get_buffer_size(struct ctrlxt_qc_interface *qc);
 
 /* Set buffer size */
-int ctrlxt_qc_set_buffer_size(size_t size);
+int ctrlxt_qc_set_buffer_size(struct ctrlxt_qc_interface *qc, size_t size);
 
 /* Get conversion flags */
-unsigned int ctrlxt_qc_get_conversion_flags(void);
+unsigned int ctrlxt_qc_get_conversion_flags(struct ctrlxt_qc_interface *qc);
 
 /* Set conversion flags */
-int ctrlxt_qc_set_conversion_flags(unsigned int flags);
+int ctrlxt_qc_set_conversion_flags(struct ctrlxt_qc_interface *qc, unsigned int flags);
+
+/* Get the encoding conversions replace the register with */
+enum quantum_encoding ctrlxt_qc_get_encoding(struct ctrlxt_qc_interface *qc);
+
+/* Set the encoding, phase encoding by default */
+int ctrlxt_qc_set_encoding(struct ctrlxt_qc_interface *qc, enum quantum_encoding encoding);
 
 /* Get measurement type */
-unsigned int ctrlxt_qc_get_measurement_type(void);
+unsigned int ctrlxt_qc_get_measurement_type(struct ctrlxt_qc_interface *qc);
 
-/* Set measurement type */
-int ctrlxt_qc_set_measurement_type(unsigned int type);
+/* Set measurement type, -EOPNOTSUPP for anything but the Z basis */
+int ctrlxt_qc_set_measurement_type(struct ctrlxt_qc_interface *qc, unsigned int type);
 
 #endif /* _QUANTUM_CLASSICAL_H */ 
\ No newline at end of file
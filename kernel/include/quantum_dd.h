@@ -0,0 +1,50 @@
+#ifndef _QUANTUM_DD_H
+#define _QUANTUM_DD_H
+
+#include <linux/types.h>
+#include "quantum.h"
+
+/* Decision-diagram limits, recursion depth follows the qubit count */
+#define QUANTUM_DD_MAX_QUBITS  40
+#define QUANTUM_DD_MAX_NODES   (1U << 22)  /* 256MB of nodes */
+#define QUANTUM_DD_NODE_BYTES  64
+
+/* Node manager of one decision-diagram state, see quantum_dd.c */
+struct quantum_dd;
+
+/* Decision-diagram statistics */
+struct quantum_dd_stats {
+    u64 nodes;
+    u64 peak_nodes;
+    u64 gc_runs;
+    u64 unique_lookups;
+    u64 unique_hits;
+    u64 compute_lookups;
+    u64 compute_hits;
+};
+
+/* Manager lifetime, a new diagram holds |0...0>, may sleep */
+struct quantum_dd *quantum_dd_create(unsigned int num_qubits);
+void quantum_dd_destroy(struct quantum_dd *dd);
+
+/* State preparation and conversion from or to a dense vector of 2^n amplitudes */
+int quantum_dd_init(struct quantum_dd *dd, u64 value);
+int quantum_dd_copy(struct quantum_dd *dst, const struct quantum_dd *src);
+int quantum_dd_from_dense(struct quantum_dd *dd, const struct quantum_amp *amps);
+int quantum_dd_to_dense(const struct quantum_dd *dd, struct quantum_amp *amps);
+
+/* Gates operate on the diagram directly, op must already be validated */
+int quantum_dd_apply_op(struct quantum_dd *dd, const struct quantum_op *op);
+
+/* Readout, same semantics as the state vector functions in quantum.h */
+int quantum_dd_amplitude(const struct quantum_dd *dd, u64 index, struct quantum_amp *amp);
+u64 quantum_dd_project(struct quantum_dd *dd, int qubit, int value);
+int quantum_dd_measure_qubit(struct quantum_dd *dd, int qubit, int *result);
+int quantum_dd_measure(struct quantum_dd *dd, u64 *outcome);
+int quantum_dd_sample(const struct quantum_dd *dd, u64 *outcome);
+u64 quantum_dd_argmax(struct quantum_dd *dd);
+
+/* Get decision-diagram statistics */
+void quantum_dd_get_stats(const struct quantum_dd *dd, struct quantum_dd_stats *stats);
+
+#endif /* _QUANTUM_DD_H */
@@ -0,0 +1,125 @@
+#ifndef _QUANTUM_DECODER_H
+#define _QUANTUM_DECODER_H
+
+#include <linux/types.h>
+
+/*
+ * Edge of a detector graph. The fault behind it flips the detectors at
+ * both ends, a fault seen by a single detector ends on the boundary node.
+ */
+struct qec_edge {
+    u32 a;
+    u32 b;
+    s32 fault;                      /* data qubit flipped, -1 for a faulty measurement */
+    u32 weight;                     /* log-likelihood of the fault, see qec_edge_weight() */
+};
+
+/* Detector graph, node num_nodes - 1 is the boundary */
+struct qec_graph {
+    u32 num_nodes;
+    u32 num_edges;
+    u32 num_faults;                 /* width of correction bitmaps */
+    struct qec_edge *edges;
+    u32 *offsets;                   /* edges of node v are adj[offsets[v] .. offsets[v + 1]) */
+    u32 *adj;
+};
+
+/* Allocate a graph, the caller fills edges and then builds the adjacency */
+int qec_graph_alloc(struct qec_graph *graph, u32 num_nodes, u32 num_edges, u32 num_faults);
+int qec_graph_finish(struct qec_graph *graph);
+void qec_graph_free(struct qec_graph *graph);
+
+static inline u32 qec_graph_boundary(const struct qec_graph *graph)
+{
+    return graph->num_nodes - 1;
+}
+
+/* Edge weights in quarter bits, log2((1 - p) / p) for a fault rate p in parts per million */
+#define QEC_PPM                 1000000
+#define QEC_WEIGHT_MAX          255
+
+u32 qec_edge_weight(u32 ppm);
+
+/* Weigh data faults and measurement faults of a graph by their rates */
+void qec_graph_set_weights(struct qec_graph *graph, u32 data_ppm, u32 measure_ppm);
+
+/*
+ * Union-find decoder workspace. Clusters grow by half edges around the odd
+ * ones until every cluster is even or touches the boundary, then a spanning
+ * forest of each cluster is peeled into a correction. Only the nodes and
+ * edges a decode reached are reset, so the cost follows the number of
+ * defects and not the size of the graph. The graph is shared read-only,
+ * concurrent decodes need a workspace each.
+ */
+struct qec_uf {
+    const struct qec_graph *graph;
+    u32 *parent;
+    u32 *size;
+    u32 *next;                      /* circular list of the nodes of a cluster */
+    u8 *flags;
+    u8 *support;                    /* per edge, 2 is fully grown */
+    u32 *touched;                   /* nodes reached */
+    u32 *grown;                     /* edges with any support */
+    u32 *fused;                     /* edges fully grown in the last step */
+    u32 *odd;                       /* roots of odd clusters */
+    u32 *queue;                     /* breadth-first order of the forest */
+    u32 *tree;                      /* edge to the parent in the forest */
+};
+
+int qec_uf_init(struct qec_uf *uf, const struct qec_graph *graph);
+void qec_uf_free(struct qec_uf *uf);
+
+/*
+ * Decode the given defect nodes into a bitmap of graph->num_faults faults.
+ * A node listed twice cancels, -EINVAL for a node outside the graph or a
+ * syndrome no set of edges explains.
+ */
+int qec_uf_decode(struct qec_uf *uf, const u32 *defects, u32 num_defects,
+                  unsigned long *correction);
+
+/*
+ * Shortest path lengths between all nodes of a graph, computed once in
+ * parallel and then shared read-only by every matching workspace on the
+ * graph, so decoding a round only looks distances up.
+ */
+#define QEC_PATHS_MAX_NODES     4096
+
+struct qec_paths {
+    const struct qec_graph *graph;
+    u16 *dist;                      /* num_nodes x num_nodes, U16_MAX for unreachable */
+};
+
+int qec_paths_init(struct qec_paths *paths, const struct qec_graph *graph);
+void qec_paths_free(struct qec_paths *paths);
+
+static inline u16 qec_paths_dist(const struct qec_paths *paths, u32 a, u32 b)
+{
+    return paths->dist[(size_t)a * paths->graph->num_nodes + b];
+}
+
+/* Larger syndromes are left to union-find */
+#define QEC_MWPM_MAX_DEFECTS    64
+
+struct qec_mwpm_work;
+
+/*
+ * Minimum-weight perfect matching decoder. Every defect gets a boundary
+ * copy, pairs of defects are only joined when matching them beats sending
+ * both to the boundary, and the resulting sparse graph is matched exactly
+ * by a weighted blossom algorithm. Matched pairs are then traced back
+ * along shortest paths into a correction.
+ */
+struct qec_mwpm {
+    const struct qec_paths *paths;
+    struct qec_uf fallback;
+    struct qec_mwpm_work *work;
+};
+
+int qec_mwpm_init(struct qec_mwpm *mwpm, const struct qec_paths *paths);
+void qec_mwpm_free(struct qec_mwpm *mwpm);
+
+/* Same contract as qec_uf_decode() */
+int qec_mwpm_decode(struct qec_mwpm *mwpm, const u32 *defects, u32 num_defects,
+                    unsigned long *correction);
+
+#endif /* _QUANTUM_DECODER_H */
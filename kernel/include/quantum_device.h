@@ -5,6 +5,9 @@
 #include <linux/ioctl.h>
 #include "quantum.h"
 #include "quantum_memory.h"
+#include "quantum_sample.h"
+#include "quantum_evolve.h"
+#include "quantum_variational.h"
 
 /* IOCTL commands */
 #define QUANTUM_IOC_MAGIC 'q'
@@ -17,6 +20,14 @@
 #define QUANTUM_IOCTL_GET_STATS   _IOR(QUANTUM_IOC_MAGIC, 6, struct quantum_device_stats)
 #define QUANTUM_IOCTL_SET_CAPS    _IOW(QUANTUM_IOC_MAGIC, 7, unsigned long)
 #define QUANTUM_IOCTL_GET_CAPS    _IOR(QUANTUM_IOC_MAGIC, 8, unsigned long)
+#define QUANTUM_IOCTL_AMPLITUDES  _IOWR(QUANTUM_IOC_MAGIC, 9, struct quantum_amplitude_params)
+#define QUANTUM_IOCTL_SET_LAYOUT  _IOW(QUANTUM_IOC_MAGIC, 10, unsigned int)  /* enum quantum_state_layout */
+#define QUANTUM_IOCTL_SAMPLE      _IOWR(QUANTUM_IOC_MAGIC, 11, struct quantum_sample_params)
+#define QUANTUM_IOCTL_EVOLVE      _IOW(QUANTUM_IOC_MAGIC, 12, struct quantum_evolve_params)
+#define QUANTUM_IOCTL_VARIATIONAL _IOWR(QUANTUM_IOC_MAGIC, 13, struct quantum_variational_params)
+#define QUANTUM_IOCTL_BUFFER_REGISTER _IOWR(QUANTUM_IOC_MAGIC, 14, struct quantum_buffer_params)
+#define QUANTUM_IOCTL_BUFFER_UNREGISTER _IOW(QUANTUM_IOC_MAGIC, 15, unsigned int)
+#define QUANTUM_IOCTL_BUFFER_IO   _IOW(QUANTUM_IOC_MAGIC, 16, struct quantum_buffer_io_params)
 
 /* Device capabilities */
 #define QUANTUM_CAP_NONE         0x00
@@ -39,6 +50,76 @@ struct quantum_memory_params {
     unsigned long flags;
 };
 
+/* Circuit amplitude query, pointers refer to user memory */
+struct quantum_amplitude_params {
+    unsigned int backend;           /* enum quantum_backend, or AUTO to get the pick back */
+    unsigned int num_qubits;
+    size_t num_ops;
+    struct quantum_op *ops;
+    size_t count;
+    u64 *indices;
+    struct quantum_amp *amps;       /* count results */
+};
+
+/* Shot histogram of the device register without collapsing it, counts refers to user memory */
+struct quantum_sample_params {
+    u64 shots;
+    u32 top_k;                      /* most frequent outcomes first, 0 for all by outcome */
+    u32 count;                      /* in: entries counts holds, out: entries written */
+    u64 distinct;                   /* out: distinct outcomes seen */
+    struct quantum_count *counts;
+};
+
+/* exp(-i*H*time) on the device register, terms refers to user memory */
+struct quantum_evolve_params {
+    struct quantum_evolution evolution;
+    size_t num_terms;
+    struct quantum_pauli_term *terms;
+};
+
+/*
+ * Variational job on a private register, see struct quantum_variational.
+ * Pointers refer to user memory, the device register is left alone.
+ */
+struct quantum_variational_params {
+    unsigned int num_qubits;
+    u32 optimizer;                  /* enum quantum_optimizer */
+    u32 budget;
+    s32 step;
+    s32 tolerance;
+    u64 seed;
+    size_t num_ops;
+    struct quantum_param_op *ops;
+    size_t num_terms;
+    struct quantum_pauli_term *terms;
+    size_t num_params;
+    s32 *params;                    /* in: starting point, out: best point found */
+    u32 trace_len;
+    s64 *trace;                     /* out: best energy after every iteration */
+    u32 iterations;                 /* out */
+    u32 evaluations;                /* out */
+    s64 energy;                     /* out */
+};
+
+/*
+ * Interface buffer registered through the open device, unregistered when
+ * it is closed. Mapping the device at mmap_offset shares it with the
+ * interface, see ctrlxt_qc_buffer_register().
+ */
+struct quantum_buffer_params {
+    u64 size;
+    u32 id;                         /* out */
+    u64 mmap_offset;                /* out */
+};
+
+/* Conversion in place of size bytes at offset of a registered buffer */
+struct quantum_buffer_io_params {
+    u32 op;                         /* QC_REQ_CONVERT, QC_REQ_MEASURE, _MEASURE_ALL or _SAMPLE */
+    u32 id;
+    u64 offset;
+    u32 size;
+};
+
 struct quantum_device_stats {
     atomic_t open_count;
     atomic_t operation_count;
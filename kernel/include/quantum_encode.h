@@ -0,0 +1,36 @@
+#ifndef _QUANTUM_ENCODE_H
+#define _QUANTUM_ENCODE_H
+
+#include <linux/types.h>
+#include "quantum.h"
+
+#define QUANTUM_ENCODE_MIN_SLICE  (1U << 14)  /* amplitudes worth a worker of their own */
+
+/* Encodings of classical bytes into a register */
+enum quantum_encoding {
+    QUANTUM_ENCODE_PHASE = 0,   /* byte i puts qubit i in (|0> + i^(byte & 1)|1>)/sqrt(2) */
+    QUANTUM_ENCODE_BASIS,       /* little-endian bits of the bytes select a basis state */
+    QUANTUM_ENCODE_ANGLE,       /* byte i puts qubit i in RY(byte*pi/256)|0> */
+    QUANTUM_ENCODE_AMPLITUDE,   /* byte i is the magnitude of amplitude i, normalized */
+    QUANTUM_ENCODE_COUNT
+};
+
+/* Encoding flags */
+#define QUANTUM_ENCODE_SUPERPOS  0x01  /* basis: equal weight on every record of the bytes */
+#define QUANTUM_ENCODE_ENTANGLE  0x02  /* followed by CNOTs from qubit q to q + 1, q ascending */
+
+/*
+ * Replace the register with the encoding of size bytes, built in a single
+ * pass over the amplitudes instead of a gate per byte. Phase and angle
+ * encodings take at most one byte per qubit and leave the qubits above
+ * size in |0>. Basis encoding takes DIV_ROUND_UP(num_qubits, 8) bytes,
+ * or any number of such records with QUANTUM_ENCODE_SUPERPOS, weighting
+ * each basis state by the square root of how often it occurs. Amplitude
+ * encoding takes at most 2^n bytes, the amplitudes above size are zero.
+ * The CNOT ladder of QUANTUM_ENCODE_ENTANGLE permutes basis states, so it
+ * is folded into the pass. May sleep.
+ */
+int quantum_state_encode(struct quantum_state *state, enum quantum_encoding encoding,
+                         unsigned int flags, const void *data, size_t size);
+
+#endif /* _QUANTUM_ENCODE_H */
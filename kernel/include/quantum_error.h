@@ -2,6 +2,8 @@
 #define _QUANTUM_ERROR_H
 
 #include <linux/types.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
 #include "quantum.h"
 
 /* Quantum error correction statistics */
@@ -9,17 +11,13 @@ struct quantum_error_stats {
     atomic_t error_count;
     atomic_t correction_count;
     unsigned int success_rate;
+    u64 latency_ns;                 /* mean from readout to correction of a round */
+    u64 max_latency_ns;
 };
 
 /* Quantum error correction initialization */
 int ctrlxt_qec_init(void);
 
-/* Apply quantum error correction to a quantum state */
-int ctrlxt_qec_apply(struct quantum_state *state);
-
-/* Get quantum error correction statistics */
-void ctrlxt_qec_get_stats(struct quantum_error_stats *stats);
-
 /* Error correction codes */
 #define QEC_CODE_NONE    0
 #define QEC_CODE_BITFLIP 1
@@ -27,6 +25,10 @@ void ctrlxt_qec_get_stats(struct quantum_error_stats *stats);
 #define QEC_CODE_SHOR    3
 #define QEC_CODE_SURFACE 4
 
+/* Decoders of codes with a detector graph */
+#define QEC_DECODER_UNION_FIND  0   /* almost linear time */
+#define QEC_DECODER_MATCHING    1   /* minimum-weight perfect matching, more accurate */
+
 /* Error types */
 #define QEC_ERROR_NONE   0
 #define QEC_ERROR_X      1  /* Bit flip */
@@ -50,12 +52,123 @@ void ctrlxt_qec_get_stats(struct quantum_error_stats *stats);
 /* Error correction parameters */
 struct qec_params {
     unsigned int code_type;
-    unsigned int error_threshold;
-    unsigned int max_iterations;
-    bool adaptive_correction;
+    unsigned int error_threshold;   /* logical errors per gate in ppm, 0 for the default budget */
+    unsigned int max_iterations;    /* most gates between adaptive rounds, 0 for the default */
+    bool adaptive_correction;       /* rounds only as often as the error rate needs */
+    unsigned int distance;          /* QEC_CODE_SURFACE, 0 for the smallest */
+    unsigned int decoder;           /* QEC_DECODER_* */
 };
 
-/* Set error correction parameters */
+/* Codes protected by a context fit in the low qubits of a register */
+#define QEC_MAX_DATA_QUBITS   64
+#define QEC_MAX_STABILIZERS   64
+
+/* Codes with at most this many stabilizers decode by table lookup */
+#define QEC_LUT_MAX_STABILIZERS 8
+
+/* Amplitudes of batched registers worth a worker of their own */
+#define QEC_BATCH_MIN_SLICE     (1U << 14)
+
+/* Adaptive correction defaults, the error rate averages over 1 << QEC_ADAPTIVE_SHIFT rounds */
+#define QEC_ADAPTIVE_BUDGET_PPM 10
+#define QEC_ADAPTIVE_MAX_GATES  64
+#define QEC_ADAPTIVE_SHIFT      3
+
+/* Stabilizer generator or correction, X on the data qubits in x, Z on the ones in z, Y on both */
+struct qec_stabilizer {
+    u64 x;
+    u64 z;
+};
+
+struct qec_surface_decoder;
+
+/*
+ * Stabilizers of a code, bit i of a syndrome is the outcome of stabilizers[i].
+ * Codes with an extraction circuit measure stabilizer i on ancilla
+ * num_data + i instead, the circuit leaves it in the Z basis. Small codes
+ * look the correction of a syndrome up in lut[syndrome].
+ */
+struct qec_code {
+    unsigned int type;              /* QEC_CODE_* */
+    unsigned int num_data;
+    unsigned int num_ancillas;
+    unsigned int num_stabilizers;
+    unsigned int distance;          /* corrects up to (distance - 1) / 2 errors */
+    const struct qec_stabilizer *stabilizers;
+    const struct quantum_op *circuit;
+    size_t circuit_len;
+    const struct qec_stabilizer *lut;       /* 1 << num_stabilizers corrections */
+    struct qec_surface_decoder *surface;    /* QEC_CODE_SURFACE */
+};
+
+/*
+ * Error correction context of one protected register. Contexts share no
+ * state, so corrections of unrelated registers run on separate cores.
+ * The code occupies qubits [0, code.num_data) of the register. Codes
+ * without ancillas are measured ideally, each stabilizer as a projective
+ * parity measurement, the surface code runs its extraction circuit on
+ * ancillas above the data qubits and resets them after reading.
+ */
+struct ctrlxt_qec_ctx {
+    struct list_head list;
+    struct quantum_state *state;
+    struct qec_params params;
+    struct qec_code code;
+    u64 syndrome;                   /* outcome bits of the last round */
+    struct mutex lock;              /* held across a round, which may sleep */
+    atomic_t error_count;           /* rounds with a non-trivial syndrome */
+    atomic_t correction_count;      /* rounds run */
+    u64 latency_ns;                 /* summed over latency_rounds, under lock */
+    u64 max_latency_ns;
+    u64 latency_rounds;
+    u64 error_rate;                 /* Q32 decoded errors per gate, moving average */
+    unsigned int interval;          /* gates between adaptive rounds */
+    unsigned int pending_gates;     /* since the last round */
+};
+
+/* Context for a register with the given parameters, NULL for the current defaults */
+struct ctrlxt_qec_ctx *ctrlxt_qec_alloc(struct quantum_state *state,
+                                        const struct qec_params *params);
+void ctrlxt_qec_free(struct ctrlxt_qec_ctx *ctx);
+
+/* Move a context to another register, which must hold the code */
+int ctrlxt_qec_bind(struct ctrlxt_qec_ctx *ctx, struct quantum_state *state);
+
+/* One round of syndrome extraction and correction on the register of a context, may sleep */
+int ctrlxt_qec_apply(struct ctrlxt_qec_ctx *ctx);
+
+/*
+ * One round on each of count contexts, which must protect distinct
+ * registers. Every context runs even if another fails, the return value
+ * is then one of the errors. May sleep.
+ */
+int ctrlxt_qec_apply_batch(struct ctrlxt_qec_ctx **ctxs, unsigned int count);
+
+/*
+ * Count one gate on the register of a context and run a round when one is
+ * due, after every gate unless the context corrects adaptively. Adaptive
+ * contexts start out correcting every gate and stretch the interval while
+ * the decoded error rate keeps the chance of more than (distance - 1) / 2
+ * errors between rounds within the logical error budget. May sleep.
+ */
+int ctrlxt_qec_step(struct ctrlxt_qec_ctx *ctx);
+
+/*
+ * Decode the rounds of a surface code context on a worker instead, in
+ * windows of window rounds that commit their first commit rounds, 0 for
+ * the defaults. Rounds then only extract and queue the syndrome and apply
+ * what the worker has committed so far.
+ */
+int ctrlxt_qec_stream_start(struct ctrlxt_qec_ctx *ctx, unsigned int window, unsigned int commit);
+
+/* Decode and apply the queued rounds, then go back to correcting each round in place */
+int ctrlxt_qec_stream_stop(struct ctrlxt_qec_ctx *ctx);
+
+/* Statistics of one context, or summed over all contexts */
+void ctrlxt_qec_ctx_get_stats(struct ctrlxt_qec_ctx *ctx, struct quantum_error_stats *stats);
+void ctrlxt_qec_get_stats(struct quantum_error_stats *stats);
+
+/* Defaults of new contexts */
 int ctrlxt_qec_set_params(struct qec_params *params);
 
 /* Get current error correction parameters */
@@ -64,7 +177,7 @@ int ctrlxt_qec_get_params(struct qec_params *params);
 /* Reset error correction statistics */
 void ctrlxt_qec_reset_stats(void);
 
-/* Enable/disable adaptive error correction */
+/* Adaptive correction of new contexts and of the live ones */
 int ctrlxt_qec_set_adaptive(bool enable);
 
 /* Get error correction status */
@@ -76,4 +189,7 @@ unsigned int ctrlxt_qec_get_code_type(void);
 /* Set error correction code type */
 int ctrlxt_qec_set_code_type(unsigned int code_type);
 
+/* Set the decoder of new contexts */
+int ctrlxt_qec_set_decoder(unsigned int decoder);
+
 #endif /* _QUANTUM_ERROR_H */ 
\ No newline at end of file
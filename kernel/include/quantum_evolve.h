@@ -0,0 +1,79 @@
+#ifndef _QUANTUM_EVOLVE_H
+#define _QUANTUM_EVOLVE_H
+
+#include <linux/types.h>
+#include "quantum.h"
+
+/* Hamiltonian limits */
+#define QUANTUM_HAMILTONIAN_MAX_TERMS  (1U << 14)
+#define QUANTUM_EVOLVE_MAX_STEPS       (1U << 20)
+
+/*
+ * Commuting Pauli terms are fused into one pass as long as they flip at
+ * most this many qubits, 8KB of gathered amplitudes per worker.
+ */
+#define QUANTUM_EVOLVE_MAX_SPAN   10
+
+/* Smallest slice of a pass handed to one worker, in amplitudes */
+#define QUANTUM_EVOLVE_MIN_SLICE  (1U << 14)
+
+/* Krylov subspace limits, every basis vector is a full state */
+#define QUANTUM_KRYLOV_MAX_QUBITS  14
+#define QUANTUM_KRYLOV_MAX_DIM     32
+#define QUANTUM_KRYLOV_DEFAULT_DIM 16
+
+/* Coefficients and times are Q16 fixed point, the sum of |coeff| stays below 2^15 */
+#define QUANTUM_COEFF_SHIFT  16
+
+/*
+ * coeff * P for the Pauli string P with X on the qubits set in x, Z on the
+ * qubits set in z and Y on the qubits set in both.
+ */
+struct quantum_pauli_term {
+    u64 x;
+    u64 z;
+    s32 coeff;
+};
+
+/* Hamiltonian as a sum of Pauli terms */
+struct quantum_hamiltonian {
+    unsigned int num_qubits;
+    size_t num_terms;
+    struct quantum_pauli_term *terms;
+};
+
+/* Time evolution methods */
+enum quantum_evolve_method {
+    QUANTUM_EVOLVE_TROTTER1 = 0,    /* first-order product of the term exponentials */
+    QUANTUM_EVOLVE_TROTTER2,        /* symmetric second-order product */
+    QUANTUM_EVOLVE_KRYLOV,          /* Lanczos projection, up to QUANTUM_KRYLOV_MAX_QUBITS */
+};
+
+/*
+ * A time evolution run. Krylov steps are exact to the Q30 resolution as
+ * long as time * sum(|coeff|) / steps stays well below krylov_dim.
+ */
+struct quantum_evolution {
+    u32 method;         /* enum quantum_evolve_method */
+    u32 steps;
+    u32 time;           /* Q16 */
+    u32 krylov_dim;     /* Krylov subspace size, 0 for QUANTUM_KRYLOV_DEFAULT_DIM */
+};
+
+/*
+ * Apply exp(-i*H*time) to the state. Trotter steps group the terms into
+ * layers of commuting terms and run each layer as one pass over the state.
+ * Diagrams and real states are converted to dense first. May sleep, a
+ * fatal signal ends it with -EINTR and leaves a Trotter evolution part-way.
+ */
+int quantum_state_evolve(struct quantum_state *state, const struct quantum_hamiltonian *ham,
+                         const struct quantum_evolution *evolution);
+
+/*
+ * Expectation value <psi|H|psi> in Q16 of a vector state, one pass over the
+ * state per distinct set of flipped qubits. May sleep.
+ */
+int quantum_state_expectation(struct quantum_state *state, const struct quantum_hamiltonian *ham,
+                              s64 *energy);
+
+#endif /* _QUANTUM_EVOLVE_H */
@@ -0,0 +1,69 @@
+#ifndef _QUANTUM_FRAME_H
+#define _QUANTUM_FRAME_H
+
+#include <linux/types.h>
+#include <linux/prandom.h>
+#include "quantum.h"
+#include "quantum_error.h"
+#include "quantum_decoder.h"
+
+/* Shots advance together, one bit each in up to eight 64-bit words per qubit */
+#define QEC_FRAME_WORD_SHOTS    64
+#define QEC_FRAME_MAX_WORDS     8
+#define QEC_FRAME_MAX_SHOTS     (QEC_FRAME_WORD_SHOTS * QEC_FRAME_MAX_WORDS)
+
+/* Fault rates in parts per million */
+struct qec_frame_noise {
+    u32 data_ppm;                   /* depolarizing of every data qubit before a round */
+    u32 gate_ppm;                   /* depolarizing of both qubits after two-qubit gates */
+    u32 measure_ppm;                /* flipped readout, the last round reads exactly */
+};
+
+/*
+ * Pauli-frame sampler of the syndrome extraction of a code. Instead of
+ * amplitudes every shot carries the Pauli error it picked up so far, X and
+ * Z bits of one qubit for all shots packed into words, and each Clifford
+ * gate of the circuit updates whole words at once. A readout flips where
+ * the frame anticommutes with it, so detectors come out as the frame
+ * difference of consecutive rounds without ever simulating the state.
+ * Codes with a circuit run it on their ancillas as ctrlxt_qec_apply()
+ * does, the others read their stabilizers off the frame directly.
+ */
+struct qec_frame {
+    const struct qec_code *code;
+    unsigned int num_qubits;
+    unsigned int num_checks;
+    unsigned int words;
+    u64 thresholds[3];              /* Q32 rates of data, gate and measure faults */
+    u64 *x;                         /* num_qubits x words */
+    u64 *z;
+    u64 *last;                      /* readout flips of the previous round, num_checks x words */
+    struct rnd_state rnd;
+};
+
+/*
+ * Sampler of shots (rounded up to whole words) for a code, which must stay
+ * alive with it. The circuit may only hold Clifford gates, -EINVAL
+ * otherwise. A zero seed draws one.
+ */
+int qec_frame_init(struct qec_frame *frame, const struct qec_code *code, unsigned int shots,
+                   const struct qec_frame_noise *noise, u64 seed);
+void qec_frame_free(struct qec_frame *frame);
+
+static inline unsigned int qec_frame_shots(const struct qec_frame *frame)
+{
+    return frame->words * QEC_FRAME_WORD_SHOTS;
+}
+
+/*
+ * Sample rounds of extraction from a clean register. Detector k of round t
+ * compares readout k with the round before and lands for shot s in bit
+ * s % 64 of detectors[(t * num_checks + k) * words + s / 64].
+ */
+int qec_frame_sample(struct qec_frame *frame, unsigned int rounds, u64 *detectors);
+
+/* Data qubits one shot ends up flipped on, X components or with z the Z ones */
+void qec_frame_errors(const struct qec_frame *frame, unsigned int shot, bool z,
+                      unsigned long *errors);
+
+#endif /* _QUANTUM_FRAME_H */
@@ -0,0 +1,28 @@
+#ifndef _QUANTUM_HYBRID_H
+#define _QUANTUM_HYBRID_H
+
+#include <linux/types.h>
+#include "quantum.h"
+
+/* Hybrid Schrödinger-Feynman limits */
+#define QUANTUM_HYBRID_MAX_QUBITS (2 * QUANTUM_STATE_MAX_QUBITS)
+#define QUANTUM_HYBRID_MAX_CUTS   24  /* at most 2^24 paths */
+
+/*
+ * Pick the split point s so that qubits [0, s) and [s, n) are simulated as
+ * two state vectors with the cheapest total path sum. Returns 0 when no
+ * split fits the limits. The number of cut gates is stored in num_cuts.
+ */
+unsigned int quantum_hybrid_choose_split(const struct quantum_circuit *circuit,
+                                         unsigned int *num_cuts);
+
+/*
+ * Compute <index|C|0...0> for each of count basis indices by summing the
+ * Schmidt paths of every gate crossing the split. A split of 0 selects one
+ * with quantum_hybrid_choose_split(). Paths run in parallel, may sleep,
+ * -EINTR if the caller is killed.
+ */
+int quantum_hybrid_amplitudes(const struct quantum_circuit *circuit, unsigned int split,
+                              const u64 *indices, size_t count, struct quantum_amp *out);
+
+#endif /* _QUANTUM_HYBRID_H */
@@ -0,0 +1,28 @@
+#ifndef _QUANTUM_MACRO_H
+#define _QUANTUM_MACRO_H
+
+#include <linux/types.h>
+#include "quantum.h"
+
+/*
+ * Gate-level QFTs are fused from this width on. Wider than the maximum, the
+ * controlled phases fall below the 16-bit angle resolution and the circuit
+ * is no longer an exact QFT.
+ */
+#define QUANTUM_MACRO_MIN_MATCH  3
+#define QUANTUM_MACRO_MAX_MATCH  16
+
+/* Smallest slice of a pass handed to one worker */
+#define QUANTUM_MACRO_MIN_SLICE  (1U << 14)
+
+/*
+ * Recognize a gate-level QFT or inverse QFT at the start of ops. Returns the
+ * number of ops it spans and fills macro with the equivalent macro gate, or
+ * returns 0 when ops does not start with one.
+ */
+size_t quantum_macro_match(const struct quantum_op *ops, size_t count, struct quantum_op *macro);
+
+/* Run a macro gate on a dense or split state, op must already be validated, may sleep */
+int quantum_macro_apply(struct quantum_state *state, const struct quantum_op *op);
+
+#endif /* _QUANTUM_MACRO_H */
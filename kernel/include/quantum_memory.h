@@ -3,6 +3,7 @@
 
 #include <linux/types.h>
 #include "quantum.h"
+#include "quantum_error.h"
 
 /* Memory block flags */
 #define QMEM_FLAG_NONE        0x00
@@ -10,6 +11,7 @@
 #define QMEM_FLAG_ENTANGLED   0x02  /* Block contains entangled states */
 #define QMEM_FLAG_PERSISTENT  0x04  /* Block should persist across operations */
 #define QMEM_FLAG_SHARED      0x08  /* Block can be shared between processes */
+#define QMEM_FLAG_REAL        0x10  /* Start with real amplitudes, see QUANTUM_REPR_REAL */
 
 /* Memory pool sizes */
 #define QMEM_POOL_SIZE        (1024 * 1024)  /* 1MB memory pool */
@@ -23,6 +25,7 @@ struct quantum_memory_block {
     size_t size;
     unsigned long flags;
     atomic_t ref_count;
+    struct ctrlxt_qec_ctx *qec;     /* with QMEM_FLAG_ERROR_COR */
     void *private_data;
 };
 
@@ -60,6 +63,7 @@ int ctrlxt_qmem_block_init(struct quantum_memory_block *block, int initial_state
 int ctrlxt_qmem_block_measure(struct quantum_memory_block *block, void *result);
 int ctrlxt_qmem_block_apply_gate(struct quantum_memory_block *block, enum quantum_gate_type gate, int qubit);
 int ctrlxt_qmem_block_entangle(struct quantum_memory_block *block1, struct quantum_memory_block *block2);
+int ctrlxt_qmem_block_correct(struct quantum_memory_block *block);
 
 /* Memory pool operations */
 int ctrlxt_qmem_pool_resize(size_t new_size);
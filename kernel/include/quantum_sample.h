@@ -0,0 +1,67 @@
+#ifndef _QUANTUM_SAMPLE_H
+#define _QUANTUM_SAMPLE_H
+
+#include <linux/types.h>
+#include "quantum.h"
+
+/* Sampling limits */
+#define QUANTUM_SAMPLE_MAX_SHOTS   (1ULL << 24)
+#define QUANTUM_SAMPLE_MIN_SLICE   (1U << 12)  /* shots worth a worker of their own */
+#define QUANTUM_SAMPLE_SWEEP_DRAWS (1U << 16)  /* packed shots per sweep without cached sums */
+
+/* Count of one measured basis state */
+struct quantum_count {
+    u64 outcome;
+    u64 count;
+};
+
+/*
+ * Outcome histogram, an open-addressing hash table of 2^bits slots where a
+ * zero count marks a free slot. quantum_histogram_finish() turns the table
+ * into a sorted array of its used entries.
+ */
+struct quantum_histogram {
+    struct quantum_count *slots;
+    unsigned int bits;
+    size_t used;
+    u64 shots;
+};
+
+/* Order of a finished histogram */
+enum quantum_histogram_order {
+    QUANTUM_HIST_BY_OUTCOME = 0,    /* ascending basis state */
+    QUANTUM_HIST_BY_COUNT,          /* most frequent first, ties by basis state */
+};
+
+/* Histogram lifetime, sized for the given number of distinct outcomes, may sleep */
+int quantum_histogram_init(struct quantum_histogram *hist, size_t distinct);
+void quantum_histogram_free(struct quantum_histogram *hist);
+
+/* Add count shots of outcome, -ENOSPC when the table is full */
+int quantum_histogram_add(struct quantum_histogram *hist, u64 outcome, u64 count);
+
+/* Sort the used entries to the front of slots, returns their number */
+size_t quantum_histogram_finish(struct quantum_histogram *hist,
+                                enum quantum_histogram_order order);
+
+/*
+ * Draw shots outcomes from the state without collapsing it and count them in
+ * hist, which must not be initialized yet. Vector states are sampled by
+ * every worker into its own table, the tables are merged at the end. The
+ * state caches its distribution for later runs, see quantum_state_cdf().
+ * May sleep.
+ */
+int quantum_state_sample(struct quantum_state *state, u64 shots,
+                         struct quantum_histogram *hist);
+
+/*
+ * Draw shots outcomes from the state without collapsing it and write them
+ * bit-packed in draw order, shot s taking num_qubits bits from bit
+ * s * num_qubits of out in the layout of quantum_state_measure(). Writes
+ * DIV_ROUND_UP(shots * num_qubits, 8) bytes, size must hold them. Workers
+ * fill whole bytes of their own, no histogram is built. May sleep.
+ */
+int quantum_state_sample_packed(struct quantum_state *state, u64 shots,
+                                void *out, size_t size);
+
+#endif /* _QUANTUM_SAMPLE_H */
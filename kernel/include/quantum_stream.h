@@ -0,0 +1,72 @@
+#ifndef _QUANTUM_STREAM_H
+#define _QUANTUM_STREAM_H
+
+#include <linux/types.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include "quantum_decoder.h"
+#include "quantum_surface.h"
+
+/* Rounds buffered between extraction and decoding */
+#define QEC_STREAM_RING         256
+
+/* Per-round latency from push to committed correction */
+struct qec_stream_stats {
+    u64 rounds;                     /* committed */
+    u64 windows;                    /* decoded */
+    u64 latency_ns;                 /* of the last committed round */
+    u64 max_latency_ns;
+    u64 total_latency_ns;
+};
+
+/*
+ * Sliding-window decoder of an unbounded stream of surface code rounds.
+ * Rounds are pushed into a ring and a dedicated worker decodes windows of
+ * the oldest window rounds as soon as they are complete, but only commits
+ * the corrections of their first commit rounds. The rest of each window
+ * is decoded again with the rounds that follow, so a round waits for at
+ * most window rounds plus one decode. Readout faults across the commit
+ * line carry into the first detector of the next window.
+ */
+struct qec_stream {
+    const struct qec_surface *code;
+    unsigned int window;
+    unsigned int commit;
+    unsigned int slot_longs;        /* longs of one round of 2 * num_checks readouts */
+    struct qec_graph graphs[QEC_CHECK_TYPES];
+    struct qec_uf uf[QEC_CHECK_TYPES];
+    u32 *defects;
+    unsigned long *fault;           /* decoded faults of a window */
+    unsigned long *ring;            /* QEC_STREAM_RING rounds of readouts */
+    u64 *pushed_ns;                 /* arrival of each ring round */
+    unsigned long *last;            /* readouts of the round before base */
+    unsigned long *carry;           /* detector flips into the next window, per type */
+    unsigned long *fix;             /* committed corrections not taken yet, X then Z */
+    u64 head;                       /* rounds pushed */
+    u64 base;                       /* rounds committed */
+    struct qec_stream_stats stats;
+    int error;                      /* of the worker, returned by the next push */
+    spinlock_t lock;                /* ring counters, corrections and stats */
+    struct mutex decode_lock;       /* one window at a time */
+    struct workqueue_struct *wq;
+    struct work_struct work;
+};
+
+/* Stream of a code that must outlive it, 0 picks 2d rounds per window and d per commit */
+int qec_stream_init(struct qec_stream *stream, const struct qec_surface *code,
+                    unsigned int window, unsigned int commit);
+void qec_stream_free(struct qec_stream *stream);
+
+/* Queue one round of readouts, Z checks first, -EBUSY while the ring is full */
+int qec_stream_push(struct qec_stream *stream, const unsigned long *readouts);
+
+/* Wait for the worker and decode the rounds left, the last one read exactly */
+int qec_stream_flush(struct qec_stream *stream);
+
+/* Move the corrections committed since the last call into x and z, false for none */
+bool qec_stream_take(struct qec_stream *stream, unsigned long *x, unsigned long *z);
+
+void qec_stream_get_stats(struct qec_stream *stream, struct qec_stream_stats *stats);
+
+#endif /* _QUANTUM_STREAM_H */
@@ -0,0 +1,82 @@
+#ifndef _QUANTUM_SURFACE_H
+#define _QUANTUM_SURFACE_H
+
+#include <linux/types.h>
+#include "quantum.h"
+#include "quantum_decoder.h"
+
+/* Odd distances of rotated surface codes */
+#define QEC_SURFACE_MIN_DISTANCE  3
+#define QEC_SURFACE_MAX_DISTANCE  25
+
+/* Missing corner of a boundary check */
+#define QEC_SURFACE_NONE          U16_MAX
+
+/* Z checks see X errors, X checks see Z errors */
+enum qec_check_type {
+    QEC_CHECK_Z = 0,
+    QEC_CHECK_X,
+    QEC_CHECK_TYPES,
+};
+
+/* Check on up to four data qubits, corners in NW, NE, SW, SE order */
+struct qec_check {
+    u16 data[4];
+};
+
+/*
+ * Rotated surface code of distance d. Data qubit (r, c) is r * d + c, the
+ * checks sit on the corners between them, alternating in the bulk with
+ * weight-two X checks on the top and bottom edges and Z checks on the left
+ * and right ones. Logical X runs down column 0 and logical Z along row 0.
+ */
+struct qec_surface {
+    unsigned int distance;
+    unsigned int num_data;
+    unsigned int num_checks;        /* of each type, (d * d - 1) / 2 */
+    struct qec_check *checks[QEC_CHECK_TYPES];
+};
+
+int qec_surface_init(struct qec_surface *code, unsigned int distance);
+void qec_surface_free(struct qec_surface *code);
+
+/*
+ * One round of syndrome extraction. The ancilla of Z check k is qubit
+ * num_data + k, the ancilla of X check k follows all Z ancillas. The
+ * circuit leaves each check parity in the Z basis of its ancilla, in four
+ * CNOT layers ordered so that no two gates share a qubit and a single
+ * ancilla fault spreads to at most one data qubit along a logical.
+ */
+size_t qec_surface_circuit_len(const struct qec_surface *code);
+size_t qec_surface_circuit(const struct qec_surface *code, struct quantum_op *ops);
+
+/*
+ * Detector graph of the checks of one type over rounds of extraction,
+ * detector t * num_checks + k compares check k of round t with round t - 1.
+ * Data errors connect the checks of one round, measurement errors the same
+ * check of consecutive rounds, the last round is assumed to be exact.
+ * Every edge weighs 1 until qec_graph_set_weights() applies a noise model.
+ */
+int qec_surface_graph(const struct qec_surface *code, enum qec_check_type type,
+                      unsigned int rounds, struct qec_graph *graph);
+
+/*
+ * Detector graph of a window of rounds out of a longer stream. Faults are
+ * told apart by round, data qubit q of round t is fault t * num_data + q
+ * and a wrong readout of check k in round t is fault
+ * rounds * num_data + t * num_checks + k. Open windows let the readouts
+ * of their last round end on the boundary, later rounds may still explain
+ * them.
+ */
+int qec_surface_window_graph(const struct qec_surface *code, enum qec_check_type type,
+                             unsigned int rounds, bool open, struct qec_graph *graph);
+
+/* Parities of the checks of one type under the given error bitmap */
+void qec_surface_syndrome(const struct qec_surface *code, enum qec_check_type type,
+                          const unsigned long *errors, unsigned long *syndrome);
+
+/* An error without syndrome flips the logical qubit */
+bool qec_surface_logical(const struct qec_surface *code, enum qec_check_type type,
+                         const unsigned long *errors);
+
+#endif /* _QUANTUM_SURFACE_H */
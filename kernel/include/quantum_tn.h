@@ -0,0 +1,43 @@
+#ifndef _QUANTUM_TN_H
+#define _QUANTUM_TN_H
+
+#include <linux/types.h>
+#include "quantum.h"
+
+/* Tensor-network limits */
+#define QUANTUM_TN_MAX_TENSORS  4096
+#define QUANTUM_TN_MAX_RANK     22   /* largest intermediate after slicing, 4M entries */
+#define QUANTUM_TN_MAX_SLICED   16   /* at most 2^16 slices */
+#define QUANTUM_TN_ORDER_TRIALS 8    /* greedy runs, the first is deterministic */
+#define QUANTUM_TN_MAX_MARGINAL 16   /* qubits kept open by a marginal query */
+
+/* Contraction plan summary */
+struct quantum_tn_info {
+    unsigned int num_tensors;
+    unsigned int max_rank;      /* after slicing */
+    unsigned int sliced_edges;
+    u64 flops;                  /* multiply-adds per slice */
+};
+
+/* Plan the amplitude network of a circuit without contracting it */
+int quantum_tn_estimate(const struct quantum_circuit *circuit, struct quantum_tn_info *info);
+
+/*
+ * Compute <index|C|0...0> for each of count basis indices by contracting the
+ * circuit as a tensor network. The contraction order is planned once and
+ * reused for every index; slices and indices are contracted in parallel.
+ * May sleep, -EINTR if the caller is killed. info is optional.
+ */
+int quantum_tn_amplitudes(const struct quantum_circuit *circuit, const u64 *indices,
+                          size_t count, struct quantum_amp *out,
+                          struct quantum_tn_info *info);
+
+/*
+ * Marginal distribution of the qubits in mask, summed over all others with a
+ * doubled <0|C^+ P C|0> network. probs receives 2^popcount(mask) Q30 values,
+ * entry j holding the outcome whose k-th kept qubit equals bit k of j.
+ */
+int quantum_tn_marginal(const struct quantum_circuit *circuit, u64 mask, u64 *probs,
+                        struct quantum_tn_info *info);
+
+#endif /* _QUANTUM_TN_H */
@@ -0,0 +1,59 @@
+#ifndef _QUANTUM_VARIATIONAL_H
+#define _QUANTUM_VARIATIONAL_H
+
+#include <linux/types.h>
+#include "quantum.h"
+#include "quantum_evolve.h"
+
+/* Variational job limits */
+#define QUANTUM_VARIATIONAL_MAX_PARAMS  256
+#define QUANTUM_VARIATIONAL_MAX_BUDGET  (1U << 20)   /* circuit evaluations */
+
+/* Default first parameter change, 1/16 turn */
+#define QUANTUM_VARIATIONAL_DEFAULT_STEP  (QUANTUM_ANGLE_TURN / 16)
+
+/* Iterations without an improvement beyond the tolerance before a job stops */
+#define QUANTUM_VARIATIONAL_PATIENCE  16
+
+/* Gate of a parametric circuit, its angle is op.angle + scale * params[param] */
+struct quantum_param_op {
+    struct quantum_op op;
+    s32 param;          /* parameter index, -1 for a fixed angle */
+    s32 scale;
+};
+
+/* Classical optimizers of a variational job */
+enum quantum_optimizer {
+    QUANTUM_OPTIMIZER_SPSA = 0,     /* two evaluations per iteration for any number of parameters */
+    QUANTUM_OPTIMIZER_NELDER_MEAD,  /* integer simplex, few parameters */
+};
+
+/*
+ * Minimize <psi(params)|observable|psi(params)> where psi(params) is the
+ * circuit run from |0...0>. Parameters are angles in binary radians and
+ * energies are Q16. Only the best point, its energy and the best energy
+ * after every iteration leave the job.
+ */
+struct quantum_variational {
+    unsigned int num_qubits;
+    size_t num_ops;
+    const struct quantum_param_op *ops;
+    const struct quantum_hamiltonian *observable;
+    u32 optimizer;          /* enum quantum_optimizer */
+    u32 budget;             /* circuit evaluations */
+    s32 step;               /* first parameter change, 0 for QUANTUM_VARIATIONAL_DEFAULT_STEP */
+    s32 tolerance;          /* improvement that counts as progress, 0 to spend the whole budget */
+    u64 seed;               /* SPSA perturbations, 0 for a random seed */
+    size_t num_params;
+    s32 *params;            /* in: starting point, out: best point found */
+    u32 trace_len;
+    s64 *trace;             /* out: best energy after every iteration, up to trace_len */
+    u32 iterations;         /* out */
+    u32 evaluations;        /* out */
+    s64 energy;             /* out: energy at params */
+};
+
+/* Run a variational job on a private register. May sleep, -EINTR if the caller is killed. */
+int quantum_variational_run(struct quantum_variational *job);
+
+#endif /* _QUANTUM_VARIATIONAL_H */
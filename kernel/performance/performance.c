@@ -21,6 +21,7 @@ static struct quantum_perf_context *global_context;
 
 /* Performance statistics */
 static struct quantum_perf_stats global_stats;
+static struct quantum_perf_backend_stats backend_stats[QUANTUM_PERF_MAX_BACKENDS];
 
 /* Initialize performance monitoring */
 int quantum_perf_init(void)
@@ -199,11 +200,48 @@ int quantum_perf_reset_stats(void)
 {
     spin_lock(&perf_lock);
     memset(&global_stats, 0, sizeof(global_stats));
+    memset(backend_stats, 0, sizeof(backend_stats));
     spin_unlock(&perf_lock);
     
     return 0;
 }
 
+/* Record one simulation run, predicted_cost is 0 unless analysis picked the backend */
+void quantum_perf_record_backend(unsigned int backend, u64 predicted_cost, u64 elapsed_ns,
+                                 int result)
+{
+    struct quantum_perf_backend_stats *stats;
+
+    if (backend >= QUANTUM_PERF_MAX_BACKENDS)
+        return;
+
+    spin_lock(&perf_lock);
+    stats = &backend_stats[backend];
+    stats->runs++;
+    if (result < 0)
+        stats->failures++;
+    if (predicted_cost) {
+        stats->auto_selected++;
+        stats->predicted_cost += predicted_cost;
+    }
+    stats->total_ns += elapsed_ns;
+    stats->max_ns = max(stats->max_ns, elapsed_ns);
+    spin_unlock(&perf_lock);
+}
+
+/* Get backend selection statistics */
+int quantum_perf_get_backend_stats(unsigned int backend, struct quantum_perf_backend_stats *stats)
+{
+    if (!stats || backend >= QUANTUM_PERF_MAX_BACKENDS)
+        return -EINVAL;
+
+    spin_lock(&perf_lock);
+    memcpy(stats, &backend_stats[backend], sizeof(*stats));
+    spin_unlock(&perf_lock);
+
+    return 0;
+}
+
 /* Start performance sampling */
 int quantum_perf_start_sampling(struct quantum_perf_context *ctx)
 {
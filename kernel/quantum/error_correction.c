@@ -3,163 +3,901 @@
 #include <linux/kernel.h>
 #include <linux/slab.h>
 #include <linux/string.h>
+#include <linux/mutex.h>
+#include <linux/list.h>
+#include <linux/bitops.h>
+#include <linux/bitmap.h>
+#include <linux/ktime.h>
 #include "../include/ctrlxt_kernel.h"
 #include "../include/quantum.h"
+#include "../include/quantum_error.h"
+#include "../include/quantum_surface.h"
+#include "../include/quantum_stream.h"
 
-/* Quantum error correction structure */
-struct ctrlxt_qec {
-    struct quantum_device *qdev;
-    struct quantum_state *ancilla;
-    struct quantum_state *syndrome;
-    spinlock_t lock;
-    atomic_t error_count;
-    atomic_t correction_count;
+/* Repetition codes with checks on neighbouring qubits */
+static const struct qec_stabilizer qec_bitflip_stabilizers[] = {
+    { 0, 0x003 }, { 0, 0x006 },
 };
 
-static struct ctrlxt_qec qec;
+static const struct qec_stabilizer qec_phaseflip_stabilizers[] = {
+    { 0x003, 0 }, { 0x006, 0 },
+};
+
+/* Shor code, bit-flip checks inside every block of three then phase-flip checks across blocks */
+static const struct qec_stabilizer qec_shor_stabilizers[] = {
+    { 0, 0x003 }, { 0, 0x006 },
+    { 0, 0x018 }, { 0, 0x030 },
+    { 0, 0x0c0 }, { 0, 0x180 },
+    { 0x03f, 0 }, { 0x1f8, 0 },
+};
+
+/*
+ * Minimum-weight correction of every syndrome of a small code. The table
+ * is filled breadth-first from the empty correction, one single-qubit
+ * Pauli at a time, so each syndrome first appears with the fewest factors
+ * and ties go to the lowest qubit.
+ */
+struct qec_lut {
+    unsigned int num_data;
+    unsigned int num_stabilizers;
+    const struct qec_stabilizer *stabilizers;
+    struct qec_stabilizer *table;
+    bool ready;
+};
+
+static struct qec_stabilizer qec_bitflip_table[1 << ARRAY_SIZE(qec_bitflip_stabilizers)];
+static struct qec_stabilizer qec_phaseflip_table[1 << ARRAY_SIZE(qec_phaseflip_stabilizers)];
+static struct qec_stabilizer qec_shor_table[1 << ARRAY_SIZE(qec_shor_stabilizers)];
+
+#define QEC_LUT(n, stabs, tab) \
+    { .num_data = n, .num_stabilizers = ARRAY_SIZE(stabs), .stabilizers = stabs, .table = tab }
+
+static struct qec_lut qec_luts[] = {
+    [QEC_CODE_BITFLIP] = QEC_LUT(3, qec_bitflip_stabilizers, qec_bitflip_table),
+    [QEC_CODE_PHASEFLIP] = QEC_LUT(3, qec_phaseflip_stabilizers, qec_phaseflip_table),
+    [QEC_CODE_SHOR] = QEC_LUT(9, qec_shor_stabilizers, qec_shor_table),
+};
+static DEFINE_MUTEX(qec_lut_lock);
+
+/* Syndrome of a Pauli, the stabilizers it anticommutes with */
+static unsigned int qec_pauli_syndrome(const struct qec_lut *lut, u64 x, u64 z)
+{
+    const struct qec_stabilizer *stab;
+    unsigned int i, syndrome = 0;
+
+    for (i = 0; i < lut->num_stabilizers; i++) {
+        stab = &lut->stabilizers[i];
+        syndrome |= (hweight64((x & stab->z) ^ (z & stab->x)) & 1) << i;
+    }
+    return syndrome;
+}
+
+static void qec_lut_fill(struct qec_lut *lut)
+{
+    static const u8 paulis[3][2] = { { 1, 0 }, { 0, 1 }, { 1, 1 } };   /* X, Z, Y */
+    DECLARE_BITMAP(seen, 1 << QEC_LUT_MAX_STABILIZERS);
+    u16 queue[1 << QEC_LUT_MAX_STABILIZERS];
+    unsigned int head = 0, tail = 1, q, p, s, t;
+    struct qec_stabilizer fix;
+
+    BUILD_BUG_ON(ARRAY_SIZE(qec_shor_stabilizers) > QEC_LUT_MAX_STABILIZERS);
+    bitmap_zero(seen, 1 << lut->num_stabilizers);
+    memset(lut->table, 0, sizeof(*lut->table) << lut->num_stabilizers);
+    queue[0] = 0;
+    __set_bit(0, seen);
+
+    while (head < tail) {
+        s = queue[head++];
+        for (q = 0; q < lut->num_data; q++) {
+            for (p = 0; p < ARRAY_SIZE(paulis); p++) {
+                t = s ^ qec_pauli_syndrome(lut, (u64)paulis[p][0] << q, (u64)paulis[p][1] << q);
+                if (test_bit(t, seen))
+                    continue;
+
+                fix.x = lut->table[s].x ^ ((u64)paulis[p][0] << q);
+                fix.z = lut->table[s].z ^ ((u64)paulis[p][1] << q);
+                lut->table[t] = fix;
+                __set_bit(t, seen);
+                queue[tail++] = t;
+            }
+        }
+    }
+}
+
+/* Table of a code, built on first use */
+static const struct qec_stabilizer *qec_lut_get(unsigned int code_type)
+{
+    struct qec_lut *lut = &qec_luts[code_type];
+
+    if (!smp_load_acquire(&lut->ready)) {
+        mutex_lock(&qec_lut_lock);
+        if (!lut->ready) {
+            qec_lut_fill(lut);
+            smp_store_release(&lut->ready, true);
+        }
+        mutex_unlock(&qec_lut_lock);
+    }
+    return lut->table;
+}
+
+/* Defaults of new contexts and the list of live ones */
+static struct qec_params qec_defaults = {
+    .code_type = QEC_CODE_BITFLIP,
+};
+static LIST_HEAD(qec_contexts);
+static DEFINE_MUTEX(qec_contexts_lock);
+
+/* Surface code of a context with its extraction circuit and single-round decoders */
+struct qec_surface_decoder {
+    struct qec_surface code;
+    struct quantum_op *circuit;
+    unsigned int decoder;           /* QEC_DECODER_* */
+    struct qec_graph graphs[QEC_CHECK_TYPES];
+    struct qec_uf uf[QEC_CHECK_TYPES];
+    struct qec_paths paths[QEC_CHECK_TYPES];
+    struct qec_mwpm mwpm[QEC_CHECK_TYPES];
+    struct qec_stream *stream;      /* windowed decoding on a worker */
+    u64 applied_syndrome;           /* of the stream corrections applied so far */
+    bool stopping;
+};
+
+static void qec_surface_decoder_free(struct qec_surface_decoder *dec)
+{
+    int type;
+
+    if (!dec)
+        return;
+
+    if (dec->stream) {
+        qec_stream_free(dec->stream);
+        kfree(dec->stream);
+    }
+    for (type = 0; type < QEC_CHECK_TYPES; type++) {
+        qec_mwpm_free(&dec->mwpm[type]);
+        qec_paths_free(&dec->paths[type]);
+        qec_uf_free(&dec->uf[type]);
+        qec_graph_free(&dec->graphs[type]);
+    }
+    kfree(dec->circuit);
+    qec_surface_free(&dec->code);
+    kfree(dec);
+}
+
+/* Surface code whose data and ancilla qubits fit a context */
+static int qec_surface_code_init(struct qec_code *code, unsigned int distance,
+                                 unsigned int decoder)
+{
+    struct qec_surface_decoder *dec;
+    int type, ret;
+
+    if (distance == 0)
+        distance = QEC_SURFACE_MIN_DISTANCE;
+    if (distance > QEC_SURFACE_MAX_DISTANCE || 2 * distance * distance - 1 > QEC_MAX_DATA_QUBITS)
+        return -EINVAL;
+
+    dec = kzalloc(sizeof(*dec), GFP_KERNEL);
+    if (!dec)
+        return -ENOMEM;
+    dec->decoder = decoder;
+
+    ret = qec_surface_init(&dec->code, distance);
+    if (ret == 0) {
+        dec->circuit = kmalloc_array(qec_surface_circuit_len(&dec->code),
+                                     sizeof(*dec->circuit), GFP_KERNEL);
+        ret = dec->circuit ? 0 : -ENOMEM;
+    }
+    for (type = 0; type < QEC_CHECK_TYPES && ret == 0; type++) {
+        ret = qec_surface_graph(&dec->code, type, 1, &dec->graphs[type]);
+        if (ret < 0)
+            break;
+        if (decoder == QEC_DECODER_MATCHING) {
+            ret = qec_paths_init(&dec->paths[type], &dec->graphs[type]);
+            if (ret == 0)
+                ret = qec_mwpm_init(&dec->mwpm[type], &dec->paths[type]);
+        } else {
+            ret = qec_uf_init(&dec->uf[type], &dec->graphs[type]);
+        }
+    }
+    if (ret < 0) {
+        qec_surface_decoder_free(dec);
+        return ret;
+    }
+
+    code->num_data = dec->code.num_data;
+    code->num_ancillas = 2 * dec->code.num_checks;
+    code->num_stabilizers = code->num_ancillas;
+    code->distance = dec->code.distance;
+    code->stabilizers = NULL;
+    code->circuit = dec->circuit;
+    code->circuit_len = qec_surface_circuit(&dec->code, dec->circuit);
+    code->surface = dec;
+    return 0;
+}
+
+/* Stabilizers and decoder of the code selected by params */
+static int qec_code_init(struct qec_code *code, const struct qec_params *params)
+{
+    const struct qec_lut *lut;
+
+    memset(code, 0, sizeof(*code));
+    code->type = params->code_type;
+    if (params->decoder > QEC_DECODER_MATCHING)
+        return -EINVAL;
+
+    if (params->code_type == QEC_CODE_NONE)
+        return 0;
+    if (params->code_type == QEC_CODE_SURFACE)
+        return qec_surface_code_init(code, params->distance, params->decoder);
+    if (params->code_type >= ARRAY_SIZE(qec_luts))
+        return -EINVAL;
+
+    lut = &qec_luts[params->code_type];
+    code->num_data = lut->num_data;
+    code->num_stabilizers = lut->num_stabilizers;
+    code->distance = 3;
+    code->stabilizers = lut->stabilizers;
+    code->lut = qec_lut_get(params->code_type);
+    return 0;
+}
+
+static void qec_code_free(struct qec_code *code)
+{
+    qec_surface_decoder_free(code->surface);
+    code->surface = NULL;
+}
 
 /* Initialize quantum error correction */
 int __init ctrlxt_qec_init(void)
 {
-    int ret;
-    
+    unsigned int type;
+
     pr_info("CTRLxT_STUDIOS: Initializing quantum error correction\n");
-    
-    /* Initialize QEC structure */
-    spin_lock_init(&qec.lock);
-    atomic_set(&qec.error_count, 0);
-    atomic_set(&qec.correction_count, 0);
-    
-    /* Allocate quantum states */
-    qec.ancilla = quantum_state_alloc(3);  // 3 ancilla qubits for syndrome measurement
-    qec.syndrome = quantum_state_alloc(3); // 3 qubits for syndrome storage
-    
-    if (!qec.ancilla || !qec.syndrome) {
-        pr_err("CTRLxT_STUDIOS: Failed to allocate quantum states for error correction\n");
-        return -ENOMEM;
+    for (type = 0; type < ARRAY_SIZE(qec_luts); type++)
+        if (qec_luts[type].table)
+            qec_lut_get(type);
+    return 0;
+}
+
+/* Allocate a context protecting qubits [0, num_data) of state */
+struct ctrlxt_qec_ctx *ctrlxt_qec_alloc(struct quantum_state *state,
+                                        const struct qec_params *params)
+{
+    struct ctrlxt_qec_ctx *ctx;
+    int ret;
+
+    ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+    if (!ctx)
+        return ERR_PTR(-ENOMEM);
+
+    if (params) {
+        ctx->params = *params;
+    } else {
+        mutex_lock(&qec_contexts_lock);
+        ctx->params = qec_defaults;
+        mutex_unlock(&qec_contexts_lock);
     }
-    
-    /* Initialize ancilla qubits to |0⟩ */
-    ret = quantum_state_init(qec.ancilla, 0);
+
+    ret = qec_code_init(&ctx->code, &ctx->params);
+    if (ret == 0)
+        ret = ctrlxt_qec_bind(ctx, state);
     if (ret < 0) {
-        pr_err("CTRLxT_STUDIOS: Failed to initialize ancilla qubits\n");
-        goto error;
+        qec_code_free(&ctx->code);
+        kfree(ctx);
+        return ERR_PTR(ret);
     }
-    
-    /* Initialize syndrome qubits to |0⟩ */
-    ret = quantum_state_init(qec.syndrome, 0);
-    if (ret < 0) {
-        pr_err("CTRLxT_STUDIOS: Failed to initialize syndrome qubits\n");
-        goto error;
+
+    mutex_init(&ctx->lock);
+    atomic_set(&ctx->error_count, 0);
+    atomic_set(&ctx->correction_count, 0);
+    ctx->error_rate = 1ULL << 32;
+    ctx->interval = 1;
+
+    mutex_lock(&qec_contexts_lock);
+    list_add(&ctx->list, &qec_contexts);
+    mutex_unlock(&qec_contexts_lock);
+
+    return ctx;
+}
+
+/* Free a context, the register stays with its owner */
+void ctrlxt_qec_free(struct ctrlxt_qec_ctx *ctx)
+{
+    if (IS_ERR_OR_NULL(ctx))
+        return;
+
+    mutex_lock(&qec_contexts_lock);
+    list_del(&ctx->list);
+    mutex_unlock(&qec_contexts_lock);
+
+    qec_code_free(&ctx->code);
+    kfree(ctx);
+}
+
+/* Point a context at a register large enough for its code and ancillas */
+int ctrlxt_qec_bind(struct ctrlxt_qec_ctx *ctx, struct quantum_state *state)
+{
+    if (!ctx || !state || state->num_qubits < ctx->code.num_data + ctx->code.num_ancillas)
+        return -EINVAL;
+
+    ctx->state = state;
+    return 0;
+}
+
+/*
+ * Rotate the support of a stabilizer so that measuring it is a Z parity,
+ * H for X and H*S^dagger for Y, or rotate back with undo.
+ */
+static int qec_rotate(struct quantum_state *state, const struct qec_stabilizer *stab, bool undo)
+{
+    struct quantum_op h = { QUANTUM_GATE_H, 0, -1, 0 };
+    struct quantum_op s = { QUANTUM_GATE_PHASE, 0, -1, 0 };
+    u64 mask;
+    bool y;
+    int ret = 0;
+
+    for (mask = stab->x; mask && ret == 0; mask &= mask - 1) {
+        h.qubit = s.qubit = __ffs64(mask);
+        y = stab->z & BIT_ULL(h.qubit);
+
+        if (undo) {
+            ret = quantum_state_apply_op(state, &h);
+            s.angle = QUANTUM_ANGLE_TURN / 4;
+            if (ret == 0 && y)
+                ret = quantum_state_apply_op(state, &s);
+        } else {
+            s.angle = 3 * QUANTUM_ANGLE_TURN / 4;
+            if (y)
+                ret = quantum_state_apply_op(state, &s);
+            if (ret == 0)
+                ret = quantum_state_apply_op(state, &h);
+        }
+    }
+
+    return ret;
+}
+
+/* Run the extraction circuit, then read and reset every ancilla */
+static int measure_ancillas(struct ctrlxt_qec_ctx *ctx)
+{
+    const struct qec_code *code = &ctx->code;
+    struct quantum_op x = { QUANTUM_GATE_X, 0, -1, 0 };
+    unsigned int i;
+    size_t k;
+    int ret, bit;
+
+    for (k = 0; k < code->circuit_len; k++) {
+        ret = quantum_state_apply_op(ctx->state, &code->circuit[k]);
+        if (ret < 0)
+            return ret;
     }
-    
-    pr_info("CTRLxT_STUDIOS: Quantum error correction initialized successfully\n");
+
+    for (i = 0; i < code->num_ancillas; i++) {
+        x.qubit = code->num_data + i;
+        ret = quantum_state_measure_parity(ctx->state, BIT_ULL(x.qubit), &bit);
+        if (ret == 0 && bit)
+            ret = quantum_state_apply_op(ctx->state, &x);
+        if (ret < 0)
+            return ret;
+
+        ctx->syndrome |= (u64)bit << i;
+    }
+
     return 0;
+}
+
+/* Measure every stabilizer into the syndrome register of the context */
+static int measure_syndrome(struct ctrlxt_qec_ctx *ctx)
+{
+    const struct qec_stabilizer *stab;
+    unsigned int i;
+    int ret, bit;
+
+    ctx->syndrome = 0;
+    if (ctx->code.circuit) {
+        ret = measure_ancillas(ctx);
+        if (ret < 0)
+            return ret;
+    }
+
+    for (i = 0; i < ctx->code.num_stabilizers && ctx->code.stabilizers; i++) {
+        stab = &ctx->code.stabilizers[i];
+
+        ret = qec_rotate(ctx->state, stab, false);
+        if (ret == 0)
+            ret = quantum_state_measure_parity(ctx->state, stab->x | stab->z, &bit);
+        if (ret == 0)
+            ret = qec_rotate(ctx->state, stab, true);
+        if (ret < 0)
+            return ret;
+
+        ctx->syndrome |= (u64)bit << i;
+    }
+
+    if (ctx->syndrome)
+        atomic_inc(&ctx->error_count);
+    return 0;
+}
+
+/*
+ * Decode both check types of a surface code, X fixes what Z checks see and
+ * Z the rest. Returns the number of qubits corrected.
+ */
+static int surface_correction(struct ctrlxt_qec_ctx *ctx)
+{
+    struct qec_surface_decoder *dec = ctx->code.surface;
+    unsigned int m = dec->code.num_checks;
+    DECLARE_BITMAP(correction, QEC_MAX_DATA_QUBITS);
+    u32 defects[QEC_MAX_STABILIZERS];
+    u64 fix[QEC_CHECK_TYPES] = { 0 };
+    unsigned int q;
+    u32 num_defects;
+    u64 bits;
+    int type, ret;
+
+    for (type = 0; type < QEC_CHECK_TYPES; type++) {
+        num_defects = 0;
+        bits = (ctx->syndrome >> (type * m)) & (BIT_ULL(m) - 1);
+        for (; bits; bits &= bits - 1)
+            defects[num_defects++] = __ffs64(bits);
+        if (!num_defects)
+            continue;
+
+        if (dec->decoder == QEC_DECODER_MATCHING)
+            ret = qec_mwpm_decode(&dec->mwpm[type], defects, num_defects, correction);
+        else
+            ret = qec_uf_decode(&dec->uf[type], defects, num_defects, correction);
+        if (ret < 0)
+            return ret;
+
+        for_each_set_bit(q, correction, dec->code.num_data)
+            fix[type] |= BIT_ULL(q);
+    }
+
+    ret = quantum_state_apply_pauli(ctx->state, fix[QEC_CHECK_Z], fix[QEC_CHECK_X]);
+    return ret < 0 ? ret : hweight64(fix[QEC_CHECK_Z] | fix[QEC_CHECK_X]);
+}
+
+/* Apply what the stream committed, later readouts see the code as if it had not been */
+static int stream_apply(struct ctrlxt_qec_ctx *ctx)
+{
+    struct qec_surface_decoder *dec = ctx->code.surface;
+    DECLARE_BITMAP(syndrome, QEC_MAX_STABILIZERS);
+    DECLARE_BITMAP(x, QEC_MAX_DATA_QUBITS);
+    DECLARE_BITMAP(z, QEC_MAX_DATA_QUBITS);
+    unsigned int m = dec->code.num_checks, q;
+    u64 fix[QEC_CHECK_TYPES] = { 0 };
+    int ret;
+
+    if (!qec_stream_take(dec->stream, x, z))
+        return 0;
+
+    for_each_set_bit(q, x, dec->code.num_data)
+        fix[QEC_CHECK_Z] |= BIT_ULL(q);
+    for_each_set_bit(q, z, dec->code.num_data)
+        fix[QEC_CHECK_X] |= BIT_ULL(q);
+
+    qec_surface_syndrome(&dec->code, QEC_CHECK_Z, x, syndrome);
+    for_each_set_bit(q, syndrome, m)
+        dec->applied_syndrome ^= BIT_ULL(q);
+    qec_surface_syndrome(&dec->code, QEC_CHECK_X, z, syndrome);
+    for_each_set_bit(q, syndrome, m)
+        dec->applied_syndrome ^= BIT_ULL(m + q);
+
+    ret = quantum_state_apply_pauli(ctx->state, fix[QEC_CHECK_Z], fix[QEC_CHECK_X]);
+    return ret < 0 ? ret : hweight64(fix[QEC_CHECK_Z] | fix[QEC_CHECK_X]);
+}
+
+/* Queue the round for the worker and apply the corrections it committed meanwhile */
+static int stream_correction(struct ctrlxt_qec_ctx *ctx)
+{
+    struct qec_surface_decoder *dec = ctx->code.surface;
+    DECLARE_BITMAP(readouts, QEC_MAX_STABILIZERS);
+    u64 bits = ctx->syndrome ^ dec->applied_syndrome;
+    int ret;
+
+    bitmap_zero(readouts, QEC_MAX_STABILIZERS);
+    for (; bits; bits &= bits - 1)
+        __set_bit(__ffs64(bits), readouts);
+
+    ret = qec_stream_push(dec->stream, readouts);
+    return ret < 0 ? ret : stream_apply(ctx);
+}
+
+/* Apply the correction of the syndrome as one Pauli string, returns its weight */
+static int apply_correction(struct ctrlxt_qec_ctx *ctx)
+{
+    const struct qec_stabilizer *fix;
+    int ret;
+
+    if (ctx->code.surface)
+        return surface_correction(ctx);
+    if (!ctx->code.lut)
+        return 0;
+
+    fix = &ctx->code.lut[ctx->syndrome];
+    ret = quantum_state_apply_pauli(ctx->state, fix->x, fix->z);
+    return ret < 0 ? ret : hweight64(fix->x | fix->z);
+}
+
+/* Poisson odds of at least errors faults in gates at a Q32 rate per gate, Q32 */
+static u64 qec_failure(u64 rate, unsigned int gates, unsigned int errors)
+{
+    u64 mu, p = 1ULL << 32;
+    unsigned int i;
+
+    /* An error per interval or more, no budget covers that */
+    if (rate >= div_u64(1ULL << 32, gates))
+        return U64_MAX;
+
+    mu = rate * gates;
+    for (i = 1; i <= errors; i++)
+        p = div_u64((p * mu) >> 32, i);
+    return p;
+}
+
+/*
+ * Fold the errors decoded in a round into the rate and stretch the next
+ * interval as far as the logical error budget allows. Failures per gate
+ * grow with the interval, so the longest one is found by bisection.
+ */
+static void qec_adapt(struct ctrlxt_qec_ctx *ctx, unsigned int errors)
+{
+    u64 rate = div_u64((u64)errors << 32, max(ctx->pending_gates, 1U));
+    u32 ppm = ctx->params.error_threshold ? ctx->params.error_threshold : QEC_ADAPTIVE_BUDGET_PPM;
+    u64 budget = div_u64((u64)min_t(u32, ppm, QEC_PPM) << 32, QEC_PPM);
+    unsigned int lo = 1, hi, mid;
+
+    ctx->error_rate -= ctx->error_rate >> QEC_ADAPTIVE_SHIFT;
+    ctx->error_rate += min_t(u64, rate, 1ULL << 32) >> QEC_ADAPTIVE_SHIFT;
+    ctx->pending_gates = 0;
+
+    hi = ctx->params.max_iterations ? ctx->params.max_iterations : QEC_ADAPTIVE_MAX_GATES;
+    while (lo < hi) {
+        mid = lo + (hi - lo + 1) / 2;
+        if (qec_failure(ctx->error_rate, mid, ctx->code.distance / 2 + 1) <= budget * mid)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    ctx->interval = lo;
+}
+
+/* Extract, decode and correct one round under the context lock */
+static int qec_round(struct ctrlxt_qec_ctx *ctx)
+{
+    struct qec_surface_decoder *dec;
+    u64 start, latency;
+    int ret;
+
+    mutex_lock(&ctx->lock);
+    dec = ctx->code.surface;
+    if (dec && dec->stopping) {
+        mutex_unlock(&ctx->lock);
+        return -EBUSY;
+    }
+
+    /* Measure syndrome */
+    ret = measure_syndrome(ctx);
+    if (ret == 0 && dec && dec->stream) {
+        ret = stream_correction(ctx);
+    } else if (ret == 0) {
+        /* Correct the round in place */
+        start = ktime_get_ns();
+        ret = apply_correction(ctx);
+        latency = ktime_get_ns() - start;
+        ctx->latency_ns += latency;
+        ctx->max_latency_ns = max(ctx->max_latency_ns, latency);
+        ctx->latency_rounds++;
+    }
+
+    if (ret >= 0) {
+        qec_adapt(ctx, ret);
+        atomic_inc(&ctx->correction_count);
+        ret = 0;
+    }
+    mutex_unlock(&ctx->lock);
 
-error:
-    if (qec.ancilla)
-        quantum_state_free(qec.ancilla);
-    if (qec.syndrome)
-        quantum_state_free(qec.syndrome);
     return ret;
 }
 
-/* Apply quantum error correction */
-int ctrlxt_qec_apply(struct quantum_state *state)
+/* Apply quantum error correction, rounds of different contexts run in parallel */
+int ctrlxt_qec_apply(struct ctrlxt_qec_ctx *ctx)
 {
+    if (!ctx || !ctx->state)
+        return -EINVAL;
+
+    return qec_round(ctx);
+}
+
+/* Count a gate, the round runs outside the lock taken here */
+int ctrlxt_qec_step(struct ctrlxt_qec_ctx *ctx)
+{
+    bool due;
+
+    if (!ctx || !ctx->state)
+        return -EINVAL;
+
+    mutex_lock(&ctx->lock);
+    ctx->pending_gates++;
+    due = !ctx->params.adaptive_correction || ctx->pending_gates >= ctx->interval;
+    mutex_unlock(&ctx->lock);
+
+    return due ? qec_round(ctx) : 0;
+}
+
+/* Rounds of a batch, each worker takes every workers-th context */
+struct qec_batch_job {
+    struct ctrlxt_qec_ctx **ctxs;
+    unsigned int count;
+    unsigned int workers;
+    int error;
+};
+
+static void qec_batch_worker(void *arg, unsigned int idx)
+{
+    struct qec_batch_job *job = arg;
+    unsigned int i;
     int ret;
-    unsigned long flags;
-    
-    if (!state)
+
+    for (i = idx; i < job->count; i += job->workers) {
+        ret = qec_round(job->ctxs[i]);
+        if (ret < 0)
+            WRITE_ONCE(job->error, ret);
+    }
+}
+
+/*
+ * One round on every context of an array from a single dispatch. Each
+ * round is already fused into one pass of extraction, a table or union-find
+ * decode and a single Pauli correction, so what a batch saves is the
+ * per-call scheduling: the registers are spread over the cores at once.
+ */
+int ctrlxt_qec_apply_batch(struct ctrlxt_qec_ctx **ctxs, unsigned int count)
+{
+    struct qec_batch_job job = { .ctxs = ctxs, .count = count };
+    unsigned int i;
+    u64 amps = 0;
+
+    if (!ctxs && count)
         return -EINVAL;
-    
-    spin_lock_irqsave(&qec.lock, flags);
-    
-    /* Measure syndrome */
-    ret = measure_syndrome(state);
-    if (ret < 0) {
-        spin_unlock_irqrestore(&qec.lock, flags);
-        return ret;
+    for (i = 0; i < count; i++) {
+        if (!ctxs[i] || !ctxs[i]->state)
+            return -EINVAL;
+        amps += ctxs[i]->state->dim;
     }
-    
-    /* Apply correction based on syndrome */
-    ret = apply_correction(state);
+
+    /* Small registers are cheaper to correct in a row than to hand out */
+    job.workers = clamp_t(u64, amps / QEC_BATCH_MIN_SLICE, 1, min(quantum_parallel_width(), count));
+    quantum_parallel_for(job.workers, qec_batch_worker, &job);
+    return job.error;
+}
+
+/* Hand the decoding of a surface code context to a stream */
+int ctrlxt_qec_stream_start(struct ctrlxt_qec_ctx *ctx, unsigned int window, unsigned int commit)
+{
+    struct qec_surface_decoder *dec;
+    struct qec_stream *stream;
+    int ret;
+
+    if (!ctx || !ctx->code.surface)
+        return -EINVAL;
+
+    dec = ctx->code.surface;
+    stream = kzalloc(sizeof(*stream), GFP_KERNEL);
+    if (!stream)
+        return -ENOMEM;
+    ret = qec_stream_init(stream, &dec->code, window, commit);
     if (ret < 0) {
-        spin_unlock_irqrestore(&qec.lock, flags);
+        kfree(stream);
         return ret;
     }
-    
-    atomic_inc(&qec.correction_count);
-    spin_unlock_irqrestore(&qec.lock, flags);
-    
-    return 0;
+
+    mutex_lock(&ctx->lock);
+    if (dec->stream || dec->stopping) {
+        ret = -EBUSY;
+    } else {
+        dec->stream = stream;
+        dec->applied_syndrome = 0;
+        stream = NULL;
+    }
+    mutex_unlock(&ctx->lock);
+
+    if (stream) {
+        qec_stream_free(stream);
+        kfree(stream);
+    }
+    return ret;
 }
 
-/* Measure error syndrome */
-static int measure_syndrome(struct quantum_state *state)
+/* Rounds are refused while the worker drains, the stream's latency joins the context's */
+int ctrlxt_qec_stream_stop(struct ctrlxt_qec_ctx *ctx)
 {
+    struct qec_stream_stats stats;
+    struct qec_surface_decoder *dec;
+    struct qec_stream *stream;
     int ret;
-    
-    /* Apply CNOT gates for syndrome measurement */
-    ret = quantum_gate_apply(QUANTUM_GATE_CNOT, state, 0, qec.ancilla, 0);
-    if (ret < 0)
-        return ret;
-    
-    ret = quantum_gate_apply(QUANTUM_GATE_CNOT, state, 1, qec.ancilla, 1);
-    if (ret < 0)
-        return ret;
-    
-    ret = quantum_gate_apply(QUANTUM_GATE_CNOT, state, 2, qec.ancilla, 2);
-    if (ret < 0)
-        return ret;
-    
-    /* Measure ancilla qubits */
-    ret = quantum_state_measure(qec.ancilla, qec.syndrome);
+
+    if (!ctx || !ctx->code.surface)
+        return -EINVAL;
+
+    dec = ctx->code.surface;
+    mutex_lock(&ctx->lock);
+    ret = !dec->stream || dec->stopping ? -EINVAL : 0;
+    dec->stopping = ret == 0 || dec->stopping;
+    mutex_unlock(&ctx->lock);
     if (ret < 0)
         return ret;
-    
-    atomic_inc(&qec.error_count);
-    return 0;
+
+    ret = qec_stream_flush(dec->stream);
+    qec_stream_get_stats(dec->stream, &stats);
+
+    mutex_lock(&ctx->lock);
+    if (ret == 0)
+        ret = min(stream_apply(ctx), 0);
+    ctx->latency_ns += stats.total_latency_ns;
+    ctx->max_latency_ns = max(ctx->max_latency_ns, stats.max_latency_ns);
+    ctx->latency_rounds += stats.rounds;
+    stream = dec->stream;
+    dec->stream = NULL;
+    dec->applied_syndrome = 0;
+    dec->stopping = false;
+    mutex_unlock(&ctx->lock);
+
+    qec_stream_free(stream);
+    kfree(stream);
+    return ret;
 }
 
-/* Apply correction based on syndrome */
-static int apply_correction(struct quantum_state *state)
-{
-    int syndrome;
-    
-    /* Get syndrome value */
-    syndrome = quantum_state_get_value(qec.syndrome);
-    
-    /* Apply appropriate correction based on syndrome */
-    switch (syndrome) {
-        case 1: // Bit flip on qubit 0
-            return quantum_gate_apply(QUANTUM_GATE_X, state, 0, NULL, 0);
-        case 2: // Bit flip on qubit 1
-            return quantum_gate_apply(QUANTUM_GATE_X, state, 1, NULL, 0);
-        case 3: // Bit flip on qubit 2
-            return quantum_gate_apply(QUANTUM_GATE_X, state, 2, NULL, 0);
-        case 4: // Phase flip on qubit 0
-            return quantum_gate_apply(QUANTUM_GATE_Z, state, 0, NULL, 0);
-        case 5: // Phase flip on qubit 1
-            return quantum_gate_apply(QUANTUM_GATE_Z, state, 1, NULL, 0);
-        case 6: // Phase flip on qubit 2
-            return quantum_gate_apply(QUANTUM_GATE_Z, state, 2, NULL, 0);
-        case 7: // Both bit and phase flip
-            return quantum_gate_apply(QUANTUM_GATE_Y, state, 0, NULL, 0);
-        default: // No error
-            return 0;
-    }
-}
-
-/* Get error statistics */
+/* Success rate in percent of corrected rounds */
+static void qec_fill_stats(struct quantum_error_stats *stats, int errors, int corrections)
+{
+    atomic_set(&stats->error_count, errors);
+    atomic_set(&stats->correction_count, corrections);
+    stats->success_rate = corrections ? (corrections - errors) * 100U / corrections : 100;
+}
+
+/* Add the round latencies of a context, including those of a running stream */
+static void qec_add_latency(struct ctrlxt_qec_ctx *ctx, struct quantum_error_stats *stats,
+                            u64 *rounds)
+{
+    struct qec_stream_stats stream = { 0 };
+
+    mutex_lock(&ctx->lock);
+    if (ctx->code.surface && ctx->code.surface->stream)
+        qec_stream_get_stats(ctx->code.surface->stream, &stream);
+    stats->latency_ns += ctx->latency_ns + stream.total_latency_ns;
+    stats->max_latency_ns = max3(stats->max_latency_ns, ctx->max_latency_ns,
+                                 stream.max_latency_ns);
+    *rounds += ctx->latency_rounds + stream.rounds;
+    mutex_unlock(&ctx->lock);
+}
+
+/* Get error statistics of one context */
+void ctrlxt_qec_ctx_get_stats(struct ctrlxt_qec_ctx *ctx, struct quantum_error_stats *stats)
+{
+    u64 rounds = 0;
+
+    if (!ctx || !stats)
+        return;
+
+    qec_fill_stats(stats, atomic_read(&ctx->error_count), atomic_read(&ctx->correction_count));
+    stats->latency_ns = stats->max_latency_ns = 0;
+    qec_add_latency(ctx, stats, &rounds);
+    stats->latency_ns = rounds ? div64_u64(stats->latency_ns, rounds) : 0;
+}
+
+/* Get error statistics summed over all contexts */
 void ctrlxt_qec_get_stats(struct quantum_error_stats *stats)
 {
+    struct ctrlxt_qec_ctx *ctx;
+    int errors = 0, corrections = 0;
+    u64 rounds = 0;
+
     if (!stats)
         return;
-    
-    stats->error_count = atomic_read(&qec.error_count);
-    stats->correction_count = atomic_read(&qec.correction_count);
-    stats->success_rate = (stats->correction_count * 100) / stats->error_count;
+
+    stats->latency_ns = stats->max_latency_ns = 0;
+    mutex_lock(&qec_contexts_lock);
+    list_for_each_entry(ctx, &qec_contexts, list) {
+        errors += atomic_read(&ctx->error_count);
+        corrections += atomic_read(&ctx->correction_count);
+        qec_add_latency(ctx, stats, &rounds);
+    }
+    mutex_unlock(&qec_contexts_lock);
+
+    qec_fill_stats(stats, errors, corrections);
+    stats->latency_ns = rounds ? div64_u64(stats->latency_ns, rounds) : 0;
+}
+
+/* Reset the statistics of every context */
+void ctrlxt_qec_reset_stats(void)
+{
+    struct ctrlxt_qec_ctx *ctx;
+
+    mutex_lock(&qec_contexts_lock);
+    list_for_each_entry(ctx, &qec_contexts, list) {
+        atomic_set(&ctx->error_count, 0);
+        atomic_set(&ctx->correction_count, 0);
+        mutex_lock(&ctx->lock);
+        ctx->latency_ns = ctx->max_latency_ns = ctx->latency_rounds = 0;
+        mutex_unlock(&ctx->lock);
+    }
+    mutex_unlock(&qec_contexts_lock);
+}
+
+/* Set the parameters of new contexts */
+int ctrlxt_qec_set_params(struct qec_params *params)
+{
+    struct qec_code code;
+
+    if (!params || qec_code_init(&code, params) < 0)
+        return -EINVAL;
+    qec_code_free(&code);
+
+    mutex_lock(&qec_contexts_lock);
+    qec_defaults = *params;
+    mutex_unlock(&qec_contexts_lock);
+    return 0;
+}
+
+/* Get the parameters of new contexts */
+int ctrlxt_qec_get_params(struct qec_params *params)
+{
+    if (!params)
+        return -EINVAL;
+
+    mutex_lock(&qec_contexts_lock);
+    *params = qec_defaults;
+    mutex_unlock(&qec_contexts_lock);
+    return 0;
+}
+
+/* Get the code type of new contexts */
+unsigned int ctrlxt_qec_get_code_type(void)
+{
+    return READ_ONCE(qec_defaults.code_type);
+}
+
+/* Set the code type of new contexts */
+int ctrlxt_qec_set_code_type(unsigned int code_type)
+{
+    struct qec_params params;
+
+    ctrlxt_qec_get_params(&params);
+    params.code_type = code_type;
+    return ctrlxt_qec_set_params(&params);
+}
+
+/* Set the decoder of new contexts */
+int ctrlxt_qec_set_decoder(unsigned int decoder)
+{
+    struct qec_params params;
+
+    ctrlxt_qec_get_params(&params);
+    params.decoder = decoder;
+    return ctrlxt_qec_set_params(&params);
+}
+
+/* Adaptive correction of new contexts and of the live ones */
+int ctrlxt_qec_set_adaptive(bool enable)
+{
+    struct ctrlxt_qec_ctx *ctx;
+
+    mutex_lock(&qec_contexts_lock);
+    qec_defaults.adaptive_correction = enable;
+    list_for_each_entry(ctx, &qec_contexts, list) {
+        mutex_lock(&ctx->lock);
+        ctx->params.adaptive_correction = enable;
+        mutex_unlock(&ctx->lock);
+    }
+    mutex_unlock(&qec_contexts_lock);
+    return 0;
+}
+
+/* New contexts correct errors */
+bool ctrlxt_qec_is_active(void)
+{
+    return ctrlxt_qec_get_code_type() != QEC_CODE_NONE;
 }
 
 /* Module initialization */
@@ -171,11 +909,6 @@ static int __init qec_init(void)
 /* Module cleanup */
 static void __exit qec_exit(void)
 {
-    if (qec.ancilla)
-        quantum_state_free(qec.ancilla);
-    if (qec.syndrome)
-        quantum_state_free(qec.syndrome);
-    
     pr_info("CTRLxT_STUDIOS: Quantum error correction unloaded\n");
 }
 
@@ -185,4 +918,4 @@ module_exit(qec_exit);
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("CTRLxT_STUDIOS");
 MODULE_DESCRIPTION("CTRLxT_STUDIOS Omni-Kernel-Prime Quantum Error Correction");
-MODULE_VERSION(CTRLXT_KERNEL_VERSION); 
\ No newline at end of file
+MODULE_VERSION(CTRLXT_KERNEL_VERSION);
@@ -0,0 +1,339 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/ktime.h>
+#include <linux/overflow.h>
+#include "../include/ctrlxt_kernel.h"
+#include "../include/quantum.h"
+#include "../include/quantum_backend.h"
+#include "../include/quantum_hybrid.h"
+#include "../include/quantum_tn.h"
+#include "../include/quantum_dd.h"
+#include "../include/performance.h"
+
+#define BACKEND_ANALYSIS_MAX_QUBITS 64
+#define BACKEND_ANALYSIS_CHEAP      (1ULL << 24)  /* state-vector cost not worth planning around */
+#define BACKEND_DD_NODE_COST        8             /* hashing and normalization per node visit */
+
+static const char * const quantum_backend_names[QUANTUM_BACKEND_COUNT] = {
+    [QUANTUM_BACKEND_STATEVECTOR] = "statevector",
+    [QUANTUM_BACKEND_HYBRID] = "hybrid",
+    [QUANTUM_BACKEND_TN] = "tensor-network",
+    [QUANTUM_BACKEND_DD] = "decision-diagram",
+};
+
+/* Get backend name */
+const char *quantum_backend_name(enum quantum_backend backend)
+{
+    if (backend >= QUANTUM_BACKEND_COUNT)
+        return "unknown";
+
+    return quantum_backend_names[backend];
+}
+
+/* Run the circuit on a full register and read the amplitudes back */
+static int state_amplitudes(const struct quantum_circuit *circuit, enum quantum_state_repr repr,
+                            const u64 *indices, size_t count, struct quantum_amp *out)
+{
+    unsigned int max_qubits;
+    struct quantum_state *state;
+    size_t i;
+    int ret;
+
+    max_qubits = repr == QUANTUM_REPR_DD ? QUANTUM_DD_MAX_QUBITS : QUANTUM_STATE_MAX_QUBITS;
+    if (circuit->num_qubits > max_qubits)
+        return -E2BIG;
+
+    state = quantum_state_alloc_repr(circuit->num_qubits, repr);
+    if (!state)
+        return -ENOMEM;
+
+    ret = quantum_circuit_run(state, circuit);
+    for (i = 0; ret == 0 && i < count; i++)
+        ret = quantum_state_amplitude(state, indices[i], &out[i]);
+
+    quantum_state_free(state);
+    return ret;
+}
+
+/* Rotation by a multiple of a quarter turn, Clifford up to a global phase */
+static bool quarter_turn(u32 angle)
+{
+    return angle % (QUANTUM_ANGLE_TURN / 4) == 0;
+}
+
+static bool op_is_two_qubit(const struct quantum_op *op)
+{
+    return op->gate >= QUANTUM_GATE_CNOT && op->gate <= QUANTUM_GATE_SWAP;
+}
+
+static bool op_is_clifford(const struct quantum_op *op)
+{
+    switch (op->gate) {
+        case QUANTUM_GATE_I:
+        case QUANTUM_GATE_H:
+        case QUANTUM_GATE_X:
+        case QUANTUM_GATE_Y:
+        case QUANTUM_GATE_Z:
+        case QUANTUM_GATE_CNOT:
+        case QUANTUM_GATE_CZ:
+        case QUANTUM_GATE_SWAP:
+            return true;
+        case QUANTUM_GATE_PHASE:
+        case QUANTUM_GATE_RX:
+        case QUANTUM_GATE_RY:
+        case QUANTUM_GATE_RZ:
+            return quarter_turn(op->angle);
+        case QUANTUM_GATE_CPHASE:
+            return op->angle % (QUANTUM_ANGLE_TURN / 2) == 0;
+        default:
+            return false;
+    }
+}
+
+/* Gates that can turn a basis state into a superposition */
+static bool op_is_branching(const struct quantum_op *op)
+{
+    switch (op->gate) {
+        case QUANTUM_GATE_H:
+            return true;
+        case QUANTUM_GATE_RX:
+        case QUANTUM_GATE_RY:
+            return op->angle % (QUANTUM_ANGLE_TURN / 2) != 0;
+        default:
+            return false;
+    }
+}
+
+static u64 pow2_sat(unsigned int e)
+{
+    return e >= 63 ? U64_MAX : 1ULL << e;
+}
+
+static u64 mul_sat(u64 a, u64 b)
+{
+    u64 r;
+
+    return check_mul_overflow(a, b, &r) ? U64_MAX : r;
+}
+
+/* Analyze a circuit and predict the cost of every backend */
+int quantum_circuit_analyze(const struct quantum_circuit *circuit, size_t count,
+                            struct quantum_circuit_analysis *analysis)
+{
+    unsigned int layer[BACKEND_ANALYSIS_MAX_QUBITS] = { 0 };
+    int cross[BACKEND_ANALYSIS_MAX_QUBITS] = { 0 };
+    unsigned int n, k, d, split, cuts, width, support, end, span;
+    const struct quantum_op *op;
+    struct quantum_tn_info info;
+    u64 ops, nodes = 0, level, widest = 1, half;
+    int running = 0, b;
+    bool macro = false;
+    size_t i;
+
+    if (!circuit || !analysis || count == 0 || circuit->num_qubits == 0 ||
+        circuit->num_ops > QUANTUM_CIRCUIT_MAX_OPS)
+        return -EINVAL;
+
+    n = circuit->num_qubits;
+    if (n > BACKEND_ANALYSIS_MAX_QUBITS)
+        return -E2BIG;
+
+    memset(analysis, 0, sizeof(*analysis));
+    analysis->clifford = true;
+    analysis->real = true;
+    for (b = 0; b < QUANTUM_BACKEND_COUNT; b++) {
+        analysis->cost[b] = U64_MAX;
+        analysis->memory[b] = U64_MAX;
+    }
+
+    /* Depth, branching and the two-qubit gates spanning each cut */
+    for (i = 0; i < circuit->num_ops; i++) {
+        op = &circuit->ops[i];
+        if (op->qubit < 0 || op->qubit >= n || op->gate >= QUANTUM_GATE_COUNT)
+            return -EINVAL;
+
+        analysis->clifford &= op_is_clifford(op);
+        analysis->real &= quantum_op_is_real(op);
+        analysis->branching += op_is_branching(op);
+        d = layer[op->qubit] + 1;
+
+        /*
+         * A macro gate entangles its whole register, as much as a cut through
+         * it can carry. Only the state backends run macro gates.
+         */
+        if (quantum_gate_is_macro(op->gate)) {
+            if (op->target < 1 || op->target > n - op->qubit)
+                return -EINVAL;
+            macro = true;
+            analysis->branching += op->target;
+            analysis->two_qubit_gates += op->target * (op->target - 1) / 2;
+            end = op->qubit + op->target;
+            for (k = op->qubit; k < end; k++)
+                d = max(d, layer[k] + 1);
+            for (k = op->qubit; k < end; k++)
+                layer[k] = d;
+            for (k = op->qubit; k + 1 < end; k++) {
+                span = min(k + 1 - op->qubit, end - 1 - k);
+                cross[k] += span;
+                cross[k + 1] -= span;
+            }
+        }
+
+        if (op_is_two_qubit(op)) {
+            if (op->target < 0 || op->target >= n || op->target == op->qubit)
+                return -EINVAL;
+            d = max(d, layer[op->target] + 1);
+            layer[op->target] = d;
+            analysis->two_qubit_gates++;
+            cross[min(op->qubit, op->target)]++;
+            cross[max(op->qubit, op->target)]--;
+        }
+
+        layer[op->qubit] = d;
+        analysis->depth = max(analysis->depth, d);
+    }
+
+    /*
+     * Diagram nodes of qubit k are distinct sub-states of qubits [0, k], so
+     * their number is bounded by the Schmidt rank across that cut and by the
+     * support the branching gates can create.
+     */
+    support = min(n, analysis->branching);
+    for (k = 0; k < n; k++) {
+        running += cross[k];
+        analysis->max_cut = max_t(unsigned int, analysis->max_cut, running);
+        level = pow2_sat(min3((unsigned int)running, support, min(k + 1, n - 1 - k)));
+        nodes += level;
+        widest = max(widest, level);
+    }
+
+    ops = max_t(u64, circuit->num_ops, 1);
+
+    /* State vector: every gate touches every amplitude, real circuits store half */
+    if (n <= QUANTUM_STATE_MAX_QUBITS) {
+        analysis->cost[QUANTUM_BACKEND_STATEVECTOR] = (ops << n) >> analysis->real;
+        analysis->memory[QUANTUM_BACKEND_STATEVECTOR] = analysis->real ?
+            sizeof(s32) << n : sizeof(struct quantum_amp) << n;
+    }
+
+    /*
+     * Decision diagram: a gate visits every node and each addition below the
+     * target may pair every node of a level. Dead nodes wait for a sweep.
+     */
+    if (n <= QUANTUM_DD_MAX_QUBITS && nodes <= QUANTUM_DD_MAX_NODES) {
+        analysis->cost[QUANTUM_BACKEND_DD] =
+            mul_sat(mul_sat(ops, nodes * BACKEND_DD_NODE_COST), widest) + count * n;
+        analysis->memory[QUANTUM_BACKEND_DD] = 2 * nodes * QUANTUM_DD_NODE_BYTES;
+    }
+
+    /* Planning the path-sum and tensor backends costs more than a small state vector */
+    if (analysis->cost[QUANTUM_BACKEND_STATEVECTOR] <= BACKEND_ANALYSIS_CHEAP || macro)
+        goto select;
+
+    width = quantum_parallel_width();
+
+    /* Hybrid: every path reruns both halves */
+    split = quantum_hybrid_choose_split(circuit, &cuts);
+    if (split) {
+        half = (1ULL << split) + (1ULL << (n - split));
+        analysis->cost[QUANTUM_BACKEND_HYBRID] = mul_sat(mul_sat(pow2_sat(cuts), ops), half);
+        analysis->memory[QUANTUM_BACKEND_HYBRID] =
+            sizeof(struct quantum_amp) * half * min_t(u64, pow2_sat(cuts), width);
+    }
+
+    /* Tensor network: the planned contraction per slice and per query */
+    if (quantum_tn_estimate(circuit, &info) == 0) {
+        analysis->cost[QUANTUM_BACKEND_TN] =
+            mul_sat(mul_sat(info.flops, pow2_sat(info.sliced_edges)), count);
+        analysis->memory[QUANTUM_BACKEND_TN] =
+            (3 * sizeof(struct quantum_amp) << info.max_rank) * width;
+    }
+
+select:
+    analysis->backend = quantum_backend_select(analysis, false);
+    return 0;
+}
+
+/* Cheapest backend within the memory limit */
+enum quantum_backend quantum_backend_select(const struct quantum_circuit_analysis *analysis,
+                                            bool need_state)
+{
+    enum quantum_backend backend, best = QUANTUM_BACKEND_COUNT;
+    u64 cost, best_cost = U64_MAX;
+
+    for (backend = 0; backend < QUANTUM_BACKEND_COUNT; backend++) {
+        if (need_state && backend != QUANTUM_BACKEND_STATEVECTOR && backend != QUANTUM_BACKEND_DD)
+            continue;
+        if (analysis->cost[backend] == U64_MAX ||
+            analysis->memory[backend] > QUANTUM_BACKEND_MEM_LIMIT)
+            continue;
+
+        /* Clifford weights come from a small exact set, so diagram nodes share well */
+        cost = analysis->cost[backend];
+        if (analysis->clifford && backend == QUANTUM_BACKEND_DD)
+            cost /= 2;
+
+        if (cost < best_cost) {
+            best_cost = cost;
+            best = backend;
+        }
+    }
+
+    return best;
+}
+
+static int backend_run(const struct quantum_circuit *circuit, enum quantum_backend backend,
+                       const u64 *indices, size_t count, struct quantum_amp *out)
+{
+    switch (backend) {
+        case QUANTUM_BACKEND_STATEVECTOR:
+            return state_amplitudes(circuit, quantum_circuit_is_real(circuit) ?
+                                    QUANTUM_REPR_REAL : QUANTUM_REPR_DENSE,
+                                    indices, count, out);
+        case QUANTUM_BACKEND_HYBRID:
+            return quantum_hybrid_amplitudes(circuit, 0, indices, count, out);
+        case QUANTUM_BACKEND_TN:
+            return quantum_tn_amplitudes(circuit, indices, count, out, NULL);
+        case QUANTUM_BACKEND_DD:
+            return state_amplitudes(circuit, QUANTUM_REPR_DD, indices, count, out);
+        default:
+            return -EINVAL;
+    }
+}
+
+/* Compute amplitudes with the requested or the analyzed backend */
+int quantum_backend_amplitudes(const struct quantum_circuit *circuit, unsigned int backend,
+                               const u64 *indices, size_t count, struct quantum_amp *out,
+                               struct quantum_circuit_analysis *analysis)
+{
+    struct quantum_circuit_analysis local;
+    u64 predicted = 0;
+    ktime_t start;
+    int ret;
+
+    if (!circuit || !indices || !out || count == 0 || count > QUANTUM_AMPLITUDE_MAX_QUERY ||
+        circuit->num_ops > QUANTUM_CIRCUIT_MAX_OPS)
+        return -EINVAL;
+
+    if (backend == QUANTUM_BACKEND_AUTO) {
+        if (!analysis)
+            analysis = &local;
+        ret = quantum_circuit_analyze(circuit, count, analysis);
+        if (ret < 0)
+            return ret;
+        if (analysis->backend == QUANTUM_BACKEND_COUNT)
+            return -E2BIG;
+        backend = analysis->backend;
+        predicted = analysis->cost[backend];
+    } else if (backend >= QUANTUM_BACKEND_COUNT) {
+        return -EINVAL;
+    }
+
+    start = ktime_get();
+    ret = backend_run(circuit, backend, indices, count, out);
+    quantum_perf_record_backend(backend, predicted, ktime_to_ns(ktime_sub(ktime_get(), start)), ret);
+
+    return ret;
+}
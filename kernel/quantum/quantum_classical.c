@@ -2,177 +2,899 @@
 #include <linux/init.h>
 #include <linux/kernel.h>
 #include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
 #include <linux/string.h>
 #include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+#include <linux/percpu.h>
+#include <linux/ktime.h>
 #include "../include/ctrlxt_kernel.h"
 #include "../include/quantum.h"
 #include "../include/quantum_error.h"
+#include "../include/quantum_sample.h"
+#include "../include/quantum_classical.h"
+#include "../include/quantum_backend.h"
+#include "../include/performance.h"
 
-/* Quantum-classical interface structure */
+/* Registered buffer, freed with its last reference */
+struct qc_buffer {
+    void *data;                         /* vmalloc_user, page aligned */
+    size_t size;
+    atomic_t refs;                      /* table slot, mappings and running requests */
+};
+
+/*
+ * Quantum-classical interface, one per user or job. Requests run under
+ * state_lock with interrupts on, the spinlock only guards the ring
+ * counters and the buffer table. Queued requests go from sq[sq_head,
+ * sq_tail) to the worker and come back in cq[cq_head, cq_tail),
+ * submitters stop while QC_RING_SIZE are unreaped. Interfaces share
+ * nothing but the workqueue, so their users never wait on each other.
+ */
 struct ctrlxt_qc_interface {
-    struct quantum_device *qdev;
     struct quantum_state *quantum_state;
-    void *classical_buffer;
-    size_t buffer_size;
+    struct ctrlxt_qec_ctx *qec;         /* protects quantum_state, NULL when it is too small */
+    struct mutex state_lock;            /* register, its context and the parameters */
+    struct qc_params params;
+    enum quantum_encoding encoding;
     spinlock_t lock;
+    struct qc_request *sq;
+    struct qc_completion *cq;
+    u32 sq_head, sq_tail, cq_head, cq_tail;
+    struct qc_buffer *buffers[QC_MAX_BUFFERS];
+    wait_queue_head_t cq_wait;
+    struct work_struct work;
     atomic_t conversion_count;
     atomic_t measurement_count;
 };
 
-static struct ctrlxt_qc_interface qc_interface;
+/* Runs the rings of all interfaces, one worker per interface at a time */
+static struct workqueue_struct *qc_wq;
 
-/* Initialize quantum-classical interface */
-int __init ctrlxt_qc_init(void)
+#ifdef CONFIG_QUANTUM_QC_PERCPU_DEFAULT
+static DEFINE_PER_CPU(struct ctrlxt_qc_interface *, qc_default);
+#endif
+
+static const struct qc_params qc_default_params = {
+    .buffer_size = QC_BUFFER_SIZE_DEF,
+    .conversion_flags = QC_CONV_NONE,
+    .measurement_type = QC_MEAS_BASIS_Z,
+    .error_correction = true,
+    .num_qubits = QC_DEFAULT_QUBITS,
+};
+
+static void qc_ring_worker(struct work_struct *work);
+
+static int qc_check_params(const struct qc_params *params)
 {
+    if (params->buffer_size < QC_BUFFER_SIZE_MIN || params->buffer_size > QC_BUFFER_SIZE_MAX)
+        return -EINVAL;
+    if (params->conversion_flags & ~(QC_CONV_SUPERPOS | QC_CONV_ENTANGLE | QC_CONV_ERROR_COR))
+        return -EINVAL;
+    if (params->measurement_type != QC_MEAS_NONE && params->measurement_type != QC_MEAS_BASIS_Z)
+        return -EOPNOTSUPP;
+    return 0;
+}
+
+/* Allocate an interface with a register of its own */
+struct ctrlxt_qc_interface *ctrlxt_qc_alloc(const struct qc_params *params)
+{
+    struct ctrlxt_qc_interface *qc;
     int ret;
     
-    pr_info("CTRLxT_STUDIOS: Initializing quantum-classical interface\n");
+    params = params ? params : &qc_default_params;
+    ret = qc_check_params(params);
+    if (ret < 0)
+        return ERR_PTR(ret);
+    if (params->num_qubits == 0 || params->num_qubits > QUANTUM_STATE_MAX_QUBITS)
+        return ERR_PTR(-EINVAL);
     
-    /* Initialize interface structure */
-    spin_lock_init(&qc_interface.lock);
-    atomic_set(&qc_interface.conversion_count, 0);
-    atomic_set(&qc_interface.measurement_count, 0);
+    qc = kzalloc(sizeof(*qc), GFP_KERNEL);
+    if (!qc)
+        return ERR_PTR(-ENOMEM);
     
-    /* Allocate quantum state */
-    qc_interface.quantum_state = quantum_state_alloc(8);  // 8 qubits for interface
-    if (!qc_interface.quantum_state) {
-        pr_err("CTRLxT_STUDIOS: Failed to allocate quantum state for interface\n");
-        return -ENOMEM;
+    mutex_init(&qc->state_lock);
+    spin_lock_init(&qc->lock);
+    init_waitqueue_head(&qc->cq_wait);
+    INIT_WORK(&qc->work, qc_ring_worker);
+    atomic_set(&qc->conversion_count, 0);
+    atomic_set(&qc->measurement_count, 0);
+    qc->params = *params;
+    qc->encoding = QUANTUM_ENCODE_PHASE;
+    
+    /* Register in |0...0> */
+    qc->quantum_state = quantum_state_alloc(params->num_qubits);
+    if (!qc->quantum_state) {
+        ret = -ENOMEM;
+        goto error;
     }
     
-    /* Initialize quantum state to |0⟩ */
-    ret = quantum_state_init(qc_interface.quantum_state, 0);
-    if (ret < 0) {
-        pr_err("CTRLxT_STUDIOS: Failed to initialize quantum state\n");
+    ret = quantum_state_init(qc->quantum_state, 0);
+    if (ret < 0)
         goto error;
+    
+    /* Error correction context of the register, unless the code does not fit */
+    qc->qec = ctrlxt_qec_alloc(qc->quantum_state, NULL);
+    if (IS_ERR(qc->qec)) {
+        ret = PTR_ERR(qc->qec);
+        qc->qec = NULL;
+        if (ret != -EINVAL)
+            goto error;
     }
     
-    /* Allocate classical buffer */
-    qc_interface.buffer_size = 1024;  // 1KB buffer
-    qc_interface.classical_buffer = kzalloc(qc_interface.buffer_size, GFP_KERNEL);
-    if (!qc_interface.classical_buffer) {
-        pr_err("CTRLxT_STUDIOS: Failed to allocate classical buffer\n");
+    /* Request ring */
+    qc->sq = kcalloc(QC_RING_SIZE, sizeof(*qc->sq), GFP_KERNEL);
+    qc->cq = kcalloc(QC_RING_SIZE, sizeof(*qc->cq), GFP_KERNEL);
+    if (!qc->sq || !qc->cq) {
+        ret = -ENOMEM;
         goto error;
     }
     
+    return qc;
+    
+error:
+    kfree(qc->sq);
+    kfree(qc->cq);
+    ctrlxt_qec_free(qc->qec);
+    if (qc->quantum_state)
+        quantum_state_free(qc->quantum_state);
+    kfree(qc);
+    return ERR_PTR(ret);
+}
+
+/* Free an interface, mapped buffers stay until they are unmapped */
+void ctrlxt_qc_free(struct ctrlxt_qc_interface *qc)
+{
+    unsigned int id;
+    
+    if (IS_ERR_OR_NULL(qc))
+        return;
+    
+    /* Queued requests still run, their completions are dropped */
+    while (flush_work(&qc->work))
+        ;
+    
+    for (id = 0; id < QC_MAX_BUFFERS; id++)
+        ctrlxt_qc_buffer_unregister(qc, id);
+    kfree(qc->sq);
+    kfree(qc->cq);
+    ctrlxt_qec_free(qc->qec);
+    if (qc->quantum_state)
+        quantum_state_free(qc->quantum_state);
+    kfree(qc);
+}
+
+/* Interface of the calling CPU, callers keep the pointer for the whole job */
+struct ctrlxt_qc_interface *ctrlxt_qc_get_default(void)
+{
+#ifdef CONFIG_QUANTUM_QC_PERCPU_DEFAULT
+    return per_cpu(qc_default, raw_smp_processor_id());
+#else
+    return NULL;
+#endif
+}
+
+/* Initialize quantum-classical interface */
+int __init ctrlxt_qc_init(void)
+{
+#ifdef CONFIG_QUANTUM_QC_PERCPU_DEFAULT
+    struct ctrlxt_qc_interface *qc;
+    unsigned int cpu;
+    int ret;
+#endif
+    
+    pr_info("CTRLxT_STUDIOS: Initializing quantum-classical interface\n");
+    
+    qc_wq = alloc_workqueue("ctrlxt_qc", WQ_UNBOUND, 0);
+    if (!qc_wq) {
+        pr_err("CTRLxT_STUDIOS: Failed to allocate interface workqueue\n");
+        return -ENOMEM;
+    }
+    
+#ifdef CONFIG_QUANTUM_QC_PERCPU_DEFAULT
+    /* Default interfaces for kernel callers, one per CPU so they do not contend */
+    for_each_possible_cpu(cpu) {
+        qc = ctrlxt_qc_alloc(NULL);
+        if (IS_ERR(qc)) {
+            pr_err("CTRLxT_STUDIOS: Failed to allocate default interface\n");
+            ret = PTR_ERR(qc);
+            goto error;
+        }
+        per_cpu(qc_default, cpu) = qc;
+    }
+#endif
+    
     pr_info("CTRLxT_STUDIOS: Quantum-classical interface initialized successfully\n");
     return 0;
-
+    
+#ifdef CONFIG_QUANTUM_QC_PERCPU_DEFAULT
 error:
-    if (qc_interface.quantum_state)
-        quantum_state_free(qc_interface.quantum_state);
-    if (qc_interface.classical_buffer)
-        kfree(qc_interface.classical_buffer);
+    for_each_possible_cpu(cpu) {
+        ctrlxt_qc_free(per_cpu(qc_default, cpu));
+        per_cpu(qc_default, cpu) = NULL;
+    }
+    destroy_workqueue(qc_wq);
     return ret;
+#endif
 }
 
-/* Convert classical data to quantum state */
-int ctrlxt_qc_classical_to_quantum(const void *data, size_t size)
+/* Encode bytes into the register in place, in one pass over its amplitudes */
+static int qc_convert(struct ctrlxt_qc_interface *qc, const void *data, size_t size)
 {
+    unsigned int flags = 0;
     int ret;
-    unsigned long flags;
-    size_t i;
     
-    if (!data || size > qc_interface.buffer_size)
-        return -EINVAL;
+    if (qc->params.conversion_flags & QC_CONV_SUPERPOS)
+        flags |= QUANTUM_ENCODE_SUPERPOS;
+    if (qc->params.conversion_flags & QC_CONV_ENTANGLE)
+        flags |= QUANTUM_ENCODE_ENTANGLE;
     
-    spin_lock_irqsave(&qc_interface.lock, flags);
+    ret = quantum_state_encode(qc->quantum_state, qc->encoding, flags, data, size);
+    if (ret < 0)
+        return ret;
     
-    /* Copy classical data to buffer */
-    memcpy(qc_interface.classical_buffer, data, size);
+    atomic_inc(&qc->conversion_count);
+    return 0;
+}
+
+/*
+ * Measure the register once per byte. Each byte keeps qubits 0-7 of its
+ * outcome, ctrlxt_qc_measure_all() returns every qubit.
+ */
+static int qc_measure(struct ctrlxt_qc_interface *qc, void *data, size_t size)
+{
+    u8 result[sizeof(u64)];     /* outcomes are u64, diagram registers exceed 32 qubits */
+    int ret;
+    size_t i;
     
-    /* Convert each byte to quantum state */
     for (i = 0; i < size; i++) {
-        unsigned char byte = ((unsigned char *)qc_interface.classical_buffer)[i];
-        
-        /* Apply Hadamard gate to create superposition */
-        ret = quantum_gate_apply(QUANTUM_GATE_H, qc_interface.quantum_state, i, NULL, 0);
-        if (ret < 0) {
-            spin_unlock_irqrestore(&qc_interface.lock, flags);
+        ret = quantum_state_measure(qc->quantum_state, result);
+        if (ret < 0)
             return ret;
-        }
-        
-        /* Apply phase rotation based on classical data */
-        if (byte & 0x01) {
-            ret = quantum_gate_apply(QUANTUM_GATE_PHASE, qc_interface.quantum_state, i, NULL, 0);
-            if (ret < 0) {
-                spin_unlock_irqrestore(&qc_interface.lock, flags);
-                return ret;
-            }
-        }
+        ((unsigned char *)data)[i] = result[0];
     }
     
-    atomic_inc(&qc_interface.conversion_count);
-    spin_unlock_irqrestore(&qc_interface.lock, flags);
+    atomic_inc(&qc->measurement_count);
+    return 0;
+}
+
+/* Collapse the register once, its outcome bit-packed into the first bytes */
+static int qc_measure_all(struct ctrlxt_qc_interface *qc, void *data, size_t size)
+{
+    int ret;
+    
+    if (size < DIV_ROUND_UP(qc->quantum_state->num_qubits, 8))
+        return -EINVAL;
+    
+    ret = quantum_state_measure(qc->quantum_state, data);
+    if (ret < 0)
+        return ret;
     
+    atomic_inc(&qc->measurement_count);
     return 0;
 }
 
-/* Convert quantum state to classical data */
-int ctrlxt_qc_quantum_to_classical(void *data, size_t size)
+/* As many bit-packed shots as fit, the register stays as it is */
+static int qc_sample(struct ctrlxt_qc_interface *qc, void *data, size_t size)
 {
+    unsigned int bits = qc->quantum_state->num_qubits;
+    u64 shots = (u64)size * 8 / bits;
+    size_t used = DIV_ROUND_UP(shots * bits, 8);
     int ret;
-    unsigned long flags;
-    size_t i;
     
-    if (!data || size > qc_interface.buffer_size)
+    if (shots == 0)
         return -EINVAL;
     
-    spin_lock_irqsave(&qc_interface.lock, flags);
+    ret = quantum_state_sample_packed(qc->quantum_state, shots, data, size);
+    if (ret < 0)
+        return ret;
     
-    /* Measure each qubit and store result */
-    for (i = 0; i < size; i++) {
-        ret = quantum_state_measure(qc_interface.quantum_state, &((unsigned char *)data)[i]);
-        if (ret < 0) {
-            spin_unlock_irqrestore(&qc_interface.lock, flags);
-            return ret;
+    memset((u8 *)data + used, 0, size - used);
+    atomic_inc(&qc->measurement_count);
+    return 0;
+}
+
+/* Apply a gate, correcting as often as the error rate of the register needs */
+static int qc_gate(struct ctrlxt_qc_interface *qc, enum quantum_gate_type gate, int qubit)
+{
+    int ret;
+    
+    ret = quantum_gate_apply(gate, qc->quantum_state, qubit, NULL, 0);
+    if (ret < 0)
+        return ret;
+    
+    return qc->qec && qc->params.error_correction ? ctrlxt_qec_step(qc->qec) : 0;
+}
+
+/* Take a reference on a registered buffer, NULL once its id is gone */
+static struct qc_buffer *qc_buffer_get(struct ctrlxt_qc_interface *qc, unsigned int id)
+{
+    struct qc_buffer *buf = NULL;
+    unsigned long flags;
+    
+    spin_lock_irqsave(&qc->lock, flags);
+    if (id < QC_MAX_BUFFERS && qc->buffers[id]) {
+        buf = qc->buffers[id];
+        atomic_inc(&buf->refs);
+    }
+    spin_unlock_irqrestore(&qc->lock, flags);
+    
+    return buf;
+}
+
+/* Buffers outlive their interface while mapped, so they count on their own */
+static void qc_buffer_put(struct qc_buffer *buf)
+{
+    if (buf && atomic_dec_and_test(&buf->refs)) {
+        vfree(buf->data);
+        kfree(buf);
+    }
+}
+
+static int qc_check(struct ctrlxt_qc_interface *qc, const struct qc_request *req)
+{
+    switch (req->op) {
+        case QC_REQ_CONVERT:
+        case QC_REQ_MEASURE:
+        case QC_REQ_MEASURE_ALL:
+        case QC_REQ_SAMPLE:
+            if (req->flags & ~QC_REQ_F_BUFFER)
+                return -EINVAL;
+            if (req->flags & QC_REQ_F_BUFFER)
+                return req->buffer < QC_MAX_BUFFERS ? 0 : -EINVAL;
+            return req->data && req->size <= READ_ONCE(qc->params.buffer_size) ? 0 : -EINVAL;
+        case QC_REQ_GATE:
+            return 0;
+        default:
+            return -EINVAL;
+    }
+}
+
+/* Run one request, the caller holds state_lock */
+static int qc_execute(struct ctrlxt_qc_interface *qc, const struct qc_request *req)
+{
+    struct qc_buffer *buf = NULL;
+    void *data = req->data;
+    int ret;
+    
+    /* The buffer stays allocated while the request runs, even if unregistered meanwhile */
+    if (req->op != QC_REQ_GATE && (req->flags & QC_REQ_F_BUFFER)) {
+        buf = qc_buffer_get(qc, req->buffer);
+        if (!buf)
+            return -ENOENT;
+        if (req->offset > buf->size || req->size > buf->size - req->offset) {
+            qc_buffer_put(buf);
+            return -EINVAL;
         }
+        data = buf->data + req->offset;
+    }
+    
+    switch (req->op) {
+        case QC_REQ_CONVERT:
+            ret = qc_convert(qc, data, req->size);
+            break;
+        case QC_REQ_MEASURE:
+            ret = qc_measure(qc, data, req->size);
+            break;
+        case QC_REQ_MEASURE_ALL:
+            ret = qc_measure_all(qc, data, req->size);
+            break;
+        case QC_REQ_SAMPLE:
+            ret = qc_sample(qc, data, req->size);
+            break;
+        case QC_REQ_GATE:
+            ret = qc_gate(qc, req->gate, req->qubit);
+            break;
+        default:
+            ret = -EINVAL;
+            break;
     }
     
-    atomic_inc(&qc_interface.measurement_count);
-    spin_unlock_irqrestore(&qc_interface.lock, flags);
+    qc_buffer_put(buf);
+    return ret;
+}
+
+int ctrlxt_qc_execute(struct ctrlxt_qc_interface *qc, const struct qc_request *req)
+{
+    int ret;
+    
+    if (!qc || !req)
+        return -EINVAL;
+    
+    ret = qc_check(qc, req);
+    if (ret < 0)
+        return ret;
+    
+    mutex_lock(&qc->state_lock);
+    ret = qc_execute(qc, req);
+    mutex_unlock(&qc->state_lock);
     
+    return ret;
+}
+
+/* Convert classical data to quantum state */
+int ctrlxt_qc_classical_to_quantum(struct ctrlxt_qc_interface *qc, const void *data, size_t size)
+{
+    struct qc_request req = { .op = QC_REQ_CONVERT, .data = (void *)data, .size = size };
+    
+    if (size > U32_MAX)
+        return -EINVAL;
+    
+    return ctrlxt_qc_execute(qc, &req);
+}
+
+/* Convert quantum state to classical data */
+int ctrlxt_qc_quantum_to_classical(struct ctrlxt_qc_interface *qc, void *data, size_t size)
+{
+    struct qc_request req = { .op = QC_REQ_MEASURE, .data = data, .size = size };
+    
+    if (size > U32_MAX)
+        return -EINVAL;
+    
+    return ctrlxt_qc_execute(qc, &req);
+}
+
+/* Collapse the register once into bit-packed bytes */
+int ctrlxt_qc_measure_all(struct ctrlxt_qc_interface *qc, void *data, size_t size)
+{
+    struct qc_request req = { .op = QC_REQ_MEASURE_ALL, .data = data, .size = size };
+    
+    if (size > U32_MAX)
+        return -EINVAL;
+    
+    return ctrlxt_qc_execute(qc, &req);
+}
+
+/* Stream bit-packed shots of the register into data */
+int ctrlxt_qc_sample(struct ctrlxt_qc_interface *qc, void *data, size_t size)
+{
+    struct qc_request req = { .op = QC_REQ_SAMPLE, .data = data, .size = size };
+    
+    if (size > U32_MAX)
+        return -EINVAL;
+    
+    return ctrlxt_qc_execute(qc, &req);
+}
+
+/* Run a circuit on the register representation picked by analysis */
+int ctrlxt_qc_submit_circuit(struct ctrlxt_qc_interface *qc, const struct quantum_circuit *circuit)
+{
+    struct quantum_circuit_analysis analysis;
+    struct quantum_state *state, *old;
+    struct ctrlxt_qec_ctx *qec, *old_qec;
+    enum quantum_state_repr repr;
+    enum quantum_backend backend;
+    ktime_t start;
+    int ret;
+    
+    if (!qc || !circuit)
+        return -EINVAL;
+    
+    ret = quantum_circuit_analyze(circuit, 1, &analysis);
+    if (ret < 0)
+        return ret;
+    
+    /* The interface keeps a full register, so only register backends qualify */
+    backend = quantum_backend_select(&analysis, true);
+    if (backend == QUANTUM_BACKEND_COUNT)
+        return -E2BIG;
+    
+    if (backend == QUANTUM_BACKEND_DD)
+        repr = QUANTUM_REPR_DD;
+    else
+        repr = analysis.real ? QUANTUM_REPR_REAL : QUANTUM_REPR_DENSE;
+    
+    state = quantum_state_alloc_repr(circuit->num_qubits, repr);
+    if (!state)
+        return -ENOMEM;
+    
+    start = ktime_get();
+    ret = quantum_circuit_run(state, circuit);
+    quantum_perf_record_backend(backend, analysis.cost[backend],
+                                ktime_to_ns(ktime_sub(ktime_get(), start)), ret);
+    if (ret < 0) {
+        quantum_state_free(state);
+        return ret;
+    }
+    
+    /* The new register gets a context of its own unless the code does not fit */
+    qec = ctrlxt_qec_alloc(state, NULL);
+    if (IS_ERR(qec) && PTR_ERR(qec) != -EINVAL) {
+        quantum_state_free(state);
+        return PTR_ERR(qec);
+    }
+    
+    mutex_lock(&qc->state_lock);
+    old = qc->quantum_state;
+    old_qec = qc->qec;
+    qc->quantum_state = state;
+    qc->qec = IS_ERR(qec) ? NULL : qec;
+    mutex_unlock(&qc->state_lock);
+    
+    ctrlxt_qec_free(old_qec);
+    quantum_state_free(old);
     return 0;
 }
 
 /* Apply quantum operation with classical control */
-int ctrlxt_qc_controlled_operation(enum quantum_gate_type gate, int qubit, const void *control_data)
+int ctrlxt_qc_controlled_operation(struct ctrlxt_qc_interface *qc, enum quantum_gate_type gate,
+                                   int qubit, const void *control_data)
 {
+    struct qc_request req = { .op = QC_REQ_GATE, .gate = gate, .qubit = qubit };
+    
+    if (!control_data)
+        return -EINVAL;
+    
+    return ctrlxt_qc_execute(qc, &req);
+}
+
+/*
+ * Take a batch off the ring, run it under a single hold of the register
+ * and post its completions. The worker requeues itself while requests
+ * remain, so a long queue never holds the register for longer than a
+ * batch at a time.
+ */
+static void qc_ring_worker(struct work_struct *work)
+{
+    struct ctrlxt_qc_interface *qc = container_of(work, struct ctrlxt_qc_interface, work);
+    struct qc_request batch[QC_RING_BATCH];
+    s32 results[QC_RING_BATCH];
+    unsigned long flags;
+    unsigned int n, i;
+    bool more;
+    
+    spin_lock_irqsave(&qc->lock, flags);
+    n = min_t(u32, qc->sq_tail - qc->sq_head, QC_RING_BATCH);
+    for (i = 0; i < n; i++)
+        batch[i] = qc->sq[(qc->sq_head + i) % QC_RING_SIZE];
+    qc->sq_head += n;
+    spin_unlock_irqrestore(&qc->lock, flags);
+    
+    mutex_lock(&qc->state_lock);
+    for (i = 0; i < n; i++)
+        results[i] = qc_execute(qc, &batch[i]);
+    mutex_unlock(&qc->state_lock);
+    
+    spin_lock_irqsave(&qc->lock, flags);
+    for (i = 0; i < n; i++) {
+        qc->cq[qc->cq_tail % QC_RING_SIZE] = (struct qc_completion){
+            .user_data = batch[i].user_data,
+            .result = results[i],
+            .op = batch[i].op,
+        };
+        qc->cq_tail++;
+    }
+    more = qc->sq_head != qc->sq_tail;
+    spin_unlock_irqrestore(&qc->lock, flags);
+    
+    if (n)
+        wake_up_all(&qc->cq_wait);
+    if (more)
+        queue_work(qc_wq, &qc->work);
+}
+
+/* Queue requests, the worker runs them in order */
+int ctrlxt_qc_submit(struct ctrlxt_qc_interface *qc, const struct qc_request *reqs,
+                     unsigned int count)
+{
+    unsigned long flags;
+    unsigned int i, n;
     int ret;
+    
+    if (!qc || (!reqs && count))
+        return -EINVAL;
+    for (i = 0; i < count; i++) {
+        ret = qc_check(qc, &reqs[i]);
+        if (ret < 0)
+            return ret;
+    }
+    
+    spin_lock_irqsave(&qc->lock, flags);
+    n = min_t(u32, count, QC_RING_SIZE - (qc->sq_tail - qc->cq_head));
+    for (i = 0; i < n; i++)
+        qc->sq[(qc->sq_tail + i) % QC_RING_SIZE] = reqs[i];
+    qc->sq_tail += n;
+    spin_unlock_irqrestore(&qc->lock, flags);
+    
+    if (n)
+        queue_work(qc_wq, &qc->work);
+    return n;
+}
+
+/* Completions posted and not reaped yet, or nothing left to wait for */
+static bool qc_reap_ready(struct ctrlxt_qc_interface *qc)
+{
     unsigned long flags;
+    bool ready;
     
-    if (!control_data)
+    spin_lock_irqsave(&qc->lock, flags);
+    ready = qc->cq_head != qc->cq_tail || qc->cq_head == qc->sq_tail;
+    spin_unlock_irqrestore(&qc->lock, flags);
+    
+    return ready;
+}
+
+/* Reap completions in submission order */
+int ctrlxt_qc_reap(struct ctrlxt_qc_interface *qc, struct qc_completion *cqes, unsigned int max,
+                   bool wait)
+{
+    unsigned long flags;
+    unsigned int i, n;
+    int ret;
+    
+    if (!qc || (!cqes && max))
         return -EINVAL;
     
-    spin_lock_irqsave(&qc_interface.lock, flags);
+    if (wait && max) {
+        ret = wait_event_interruptible(qc->cq_wait, qc_reap_ready(qc));
+        if (ret < 0)
+            return ret;
+    }
     
-    /* Apply quantum gate based on classical control data */
-    ret = quantum_gate_apply(gate, qc_interface.quantum_state, qubit, NULL, 0);
-    if (ret < 0) {
-        spin_unlock_irqrestore(&qc_interface.lock, flags);
-        return ret;
+    spin_lock_irqsave(&qc->lock, flags);
+    n = min_t(u32, max, qc->cq_tail - qc->cq_head);
+    for (i = 0; i < n; i++)
+        cqes[i] = qc->cq[(qc->cq_head + i) % QC_RING_SIZE];
+    qc->cq_head += n;
+    spin_unlock_irqrestore(&qc->lock, flags);
+    
+    return n;
+}
+
+/* Register a buffer in the first free slot */
+int ctrlxt_qc_buffer_register(struct ctrlxt_qc_interface *qc, size_t size)
+{
+    struct qc_buffer *buf;
+    unsigned long flags;
+    int id;
+    
+    if (!qc || size == 0 || size > QC_BUFFER_REG_MAX)
+        return -EINVAL;
+    
+    buf = kzalloc(sizeof(*buf), GFP_KERNEL);
+    if (!buf)
+        return -ENOMEM;
+    
+    buf->data = vmalloc_user(size);
+    if (!buf->data) {
+        kfree(buf);
+        return -ENOMEM;
+    }
+    buf->size = size;
+    atomic_set(&buf->refs, 1);
+    
+    spin_lock_irqsave(&qc->lock, flags);
+    for (id = 0; id < QC_MAX_BUFFERS && qc->buffers[id]; id++)
+        ;
+    if (id < QC_MAX_BUFFERS)
+        qc->buffers[id] = buf;
+    spin_unlock_irqrestore(&qc->lock, flags);
+    
+    if (id == QC_MAX_BUFFERS) {
+        qc_buffer_put(buf);
+        return -ENOSPC;
+    }
+    
+    return id;
+}
+
+/* Free the slot, mappings and running requests keep the memory */
+int ctrlxt_qc_buffer_unregister(struct ctrlxt_qc_interface *qc, unsigned int id)
+{
+    struct qc_buffer *buf = NULL;
+    unsigned long flags;
+    
+    if (!qc)
+        return -EINVAL;
+    
+    spin_lock_irqsave(&qc->lock, flags);
+    if (id < QC_MAX_BUFFERS) {
+        buf = qc->buffers[id];
+        qc->buffers[id] = NULL;
     }
+    spin_unlock_irqrestore(&qc->lock, flags);
+    
+    if (!buf)
+        return -ENOENT;
+    
+    qc_buffer_put(buf);
+    return 0;
+}
+
+/* A forked or split mapping holds the buffer as well */
+static void qc_buffer_vm_open(struct vm_area_struct *vma)
+{
+    struct qc_buffer *buf = vma->vm_private_data;
+    
+    atomic_inc(&buf->refs);
+}
+
+static void qc_buffer_vm_close(struct vm_area_struct *vma)
+{
+    qc_buffer_put(vma->vm_private_data);
+}
+
+static const struct vm_operations_struct qc_buffer_vm_ops = {
+    .open = qc_buffer_vm_open,
+    .close = qc_buffer_vm_close,
+};
+
+/* The offset above QC_BUFFER_MMAP_SHIFT picks the buffer, the rest is the offset into it */
+int ctrlxt_qc_buffer_mmap(struct ctrlxt_qc_interface *qc, struct vm_area_struct *vma)
+{
+    unsigned int shift = QC_BUFFER_MMAP_SHIFT - PAGE_SHIFT;
+    struct qc_buffer *buf;
+    int ret;
+    
+    if (!qc)
+        return -EINVAL;
     
-    /* Apply error correction */
-    ret = ctrlxt_qec_apply(qc_interface.quantum_state);
+    buf = qc_buffer_get(qc, vma->vm_pgoff >> shift);
+    if (!buf)
+        return -ENOENT;
+    
+    /* Checks that the mapping fits in the buffer */
+    ret = remap_vmalloc_range(vma, buf->data, vma->vm_pgoff & ((1UL << shift) - 1));
     if (ret < 0) {
-        spin_unlock_irqrestore(&qc_interface.lock, flags);
+        qc_buffer_put(buf);
         return ret;
     }
     
-    spin_unlock_irqrestore(&qc_interface.lock, flags);
-    
+    vma->vm_private_data = buf;
+    vma->vm_ops = &qc_buffer_vm_ops;
     return 0;
 }
 
 /* Get interface statistics */
-void ctrlxt_qc_get_stats(struct quantum_classical_stats *stats)
+void ctrlxt_qc_get_stats(struct ctrlxt_qc_interface *qc, struct quantum_classical_stats *stats)
 {
-    if (!stats)
+    if (!qc || !stats)
         return;
     
-    stats->conversion_count = atomic_read(&qc_interface.conversion_count);
-    stats->measurement_count = atomic_read(&qc_interface.measurement_count);
+    atomic_set(&stats->conversion_count, atomic_read(&qc->conversion_count));
+    atomic_set(&stats->measurement_count, atomic_read(&qc->measurement_count));
+}
+
+void ctrlxt_qc_reset_stats(struct ctrlxt_qc_interface *qc)
+{
+    if (!qc)
+        return;
+    
+    atomic_set(&qc->conversion_count, 0);
+    atomic_set(&qc->measurement_count, 0);
+}
+
+int ctrlxt_qc_set_params(struct ctrlxt_qc_interface *qc, struct qc_params *params)
+{
+    int ret;
+    
+    if (!qc || !params)
+        return -EINVAL;
+    
+    ret = qc_check_params(params);
+    if (ret < 0)
+        return ret;
+    
+    mutex_lock(&qc->state_lock);
+    qc->params = *params;
+    mutex_unlock(&qc->state_lock);
+    
+    return 0;
+}
+
+int ctrlxt_qc_get_params(struct ctrlxt_qc_interface *qc, struct qc_params *params)
+{
+    if (!qc || !params)
+        return -EINVAL;
+    
+    mutex_lock(&qc->state_lock);
+    *params = qc->params;
+    params->num_qubits = qc->quantum_state->num_qubits;
+    mutex_unlock(&qc->state_lock);
+    
+    return 0;
+}
+
+int ctrlxt_qc_set_error_correction(struct ctrlxt_qc_interface *qc, bool enable)
+{
+    if (!qc)
+        return -EINVAL;
+    
+    mutex_lock(&qc->state_lock);
+    qc->params.error_correction = enable;
+    mutex_unlock(&qc->state_lock);
+    
+    return 0;
+}
+
+/* Requests queued and not completed yet */
+bool ctrlxt_qc_is_active(struct ctrlxt_qc_interface *qc)
+{
+    unsigned long flags;
+    bool active;
+    
+    if (!qc)
+        return false;
+    
+    spin_lock_irqsave(&qc->lock, flags);
+    active = qc->cq_tail != qc->sq_tail;
+    spin_unlock_irqrestore(&qc->lock, flags);
+    
+    return active;
+}
+
+size_t ctrlxt_qc_get_buffer_size(struct ctrlxt_qc_interface *qc)
+{
+    return qc ? READ_ONCE(qc->params.buffer_size) : 0;
+}
+
+int ctrlxt_qc_set_buffer_size(struct ctrlxt_qc_interface *qc, size_t size)
+{
+    if (!qc || size < QC_BUFFER_SIZE_MIN || size > QC_BUFFER_SIZE_MAX)
+        return -EINVAL;
+    
+    mutex_lock(&qc->state_lock);
+    WRITE_ONCE(qc->params.buffer_size, size);
+    mutex_unlock(&qc->state_lock);
+    
+    return 0;
+}
+
+unsigned int ctrlxt_qc_get_conversion_flags(struct ctrlxt_qc_interface *qc)
+{
+    return qc ? READ_ONCE(qc->params.conversion_flags) : 0;
+}
+
+int ctrlxt_qc_set_conversion_flags(struct ctrlxt_qc_interface *qc, unsigned int flags)
+{
+    if (!qc || (flags & ~(QC_CONV_SUPERPOS | QC_CONV_ENTANGLE | QC_CONV_ERROR_COR)))
+        return -EINVAL;
+    
+    mutex_lock(&qc->state_lock);
+    qc->params.conversion_flags = flags;
+    mutex_unlock(&qc->state_lock);
+    
+    return 0;
+}
+
+unsigned int ctrlxt_qc_get_measurement_type(struct ctrlxt_qc_interface *qc)
+{
+    return qc ? READ_ONCE(qc->params.measurement_type) : 0;
+}
+
+/* Measurements run in the Z basis only */
+int ctrlxt_qc_set_measurement_type(struct ctrlxt_qc_interface *qc, unsigned int type)
+{
+    if (!qc)
+        return -EINVAL;
+    if (type != QC_MEAS_NONE && type != QC_MEAS_BASIS_Z)
+        return -EOPNOTSUPP;
+    
+    mutex_lock(&qc->state_lock);
+    qc->params.measurement_type = type;
+    mutex_unlock(&qc->state_lock);
+    
+    return 0;
+}
+
+enum quantum_encoding ctrlxt_qc_get_encoding(struct ctrlxt_qc_interface *qc)
+{
+    return qc ? READ_ONCE(qc->encoding) : QUANTUM_ENCODE_PHASE;
+}
+
+int ctrlxt_qc_set_encoding(struct ctrlxt_qc_interface *qc, enum quantum_encoding encoding)
+{
+    if (!qc || encoding >= QUANTUM_ENCODE_COUNT)
+        return -EINVAL;
+    
+    mutex_lock(&qc->state_lock);
+    qc->encoding = encoding;
+    mutex_unlock(&qc->state_lock);
+    
+    return 0;
 }
 
 /* Module initialization */
@@ -184,10 +906,15 @@ static int __init qc_init(void)
 /* Module cleanup */
 static void __exit qc_exit(void)
 {
-    if (qc_interface.quantum_state)
-        quantum_state_free(qc_interface.quantum_state);
-    if (qc_interface.classical_buffer)
-        kfree(qc_interface.classical_buffer);
+#ifdef CONFIG_QUANTUM_QC_PERCPU_DEFAULT
+    unsigned int cpu;
+    
+    for_each_possible_cpu(cpu) {
+        ctrlxt_qc_free(per_cpu(qc_default, cpu));
+        per_cpu(qc_default, cpu) = NULL;
+    }
+#endif
+    destroy_workqueue(qc_wq);
     
     pr_info("CTRLxT_STUDIOS: Quantum-classical interface unloaded\n");
 }
@@ -198,4 +925,4 @@ module_exit(qc_exit);
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("CTRLxT_STUDIOS");
 MODULE_DESCRIPTION("CTRLxT_STUDIOS Omni-Kernel-Prime Quantum-Classical Interface");
-MODULE_VERSION(CTRLXT_KERNEL_VERSION); 
\ No newline at end of file
+MODULE_VERSION(CTRLXT_KERNEL_VERSION);
@@ -0,0 +1,1020 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/string.h>
+#include <linux/random.h>
+#include <linux/math64.h>
+#include <linux/bitops.h>
+#include <linux/hash.h>
+#include <linux/int_sqrt.h>
+#include <linux/sched.h>
+#include "../include/ctrlxt_kernel.h"
+#include "../include/quantum.h"
+#include "../include/quantum_dd.h"
+
+#define QDD_TERMINAL_VAR    0xffff
+#define QDD_WEIGHT_SNAP     8       /* node weights are rounded to multiples of 2^-22 */
+#define QDD_CHUNK_NODES     1024
+#define QDD_UNIQUE_BITS_MIN 10
+#define QDD_UNIQUE_BITS_MAX 22
+#define QDD_COMPUTE_BITS    12
+#define QDD_GC_MIN_NODES    4096
+
+/* Compute-table operations */
+enum qdd_op_kind {
+    QDD_OP_ADD = 1,
+    QDD_OP_APPLY,
+    QDD_OP_PROJECT,
+    QDD_OP_PROB,
+    QDD_OP_MAXP,
+    QDD_OP_IMPORT,
+};
+
+#define QDD_KEY(kind, qubit, arg) (((u64)(kind) << 56) | ((u64)(qubit) << 48) | (u64)(arg))
+
+/* Q30 weight, wider than struct quantum_amp so partial sums cannot overflow */
+struct qdd_weight {
+    s64 re;
+    s64 im;
+};
+
+struct qdd_node;
+
+/* Weighted edge, a zero weight always points at the terminal */
+struct qdd_edge {
+    struct qdd_node *node;
+    struct qdd_weight w;
+};
+
+/*
+ * Node for qubit var. Child weights are normalized so |w0|^2 + |w1|^2 = 1
+ * and the first non-zero weight is real and positive, which makes every
+ * node a unit vector and equal sub-states share one node. 64 bytes.
+ */
+struct qdd_node {
+    struct qdd_edge e[2];
+    struct qdd_node *next;      /* unique-table chain or free list */
+    u16 var;
+    u16 mark;
+};
+
+struct qdd_chunk {
+    struct qdd_chunk *next;
+    struct qdd_node nodes[QDD_CHUNK_NODES];
+};
+
+/* Direct-mapped cache entry, b and the weights are only used by ADD */
+struct qdd_compute_entry {
+    u64 key;
+    const struct qdd_node *a;
+    const struct qdd_node *b;
+    struct qdd_weight wa;
+    struct qdd_weight wb;
+    struct qdd_edge result;
+};
+
+struct quantum_dd {
+    unsigned int num_qubits;
+    struct qdd_edge root;
+    struct qdd_node terminal;
+    struct qdd_node **unique;
+    unsigned int unique_bits;
+    struct qdd_compute_entry *compute;
+    struct qdd_chunk *chunks;
+    struct qdd_node *free_list;
+    u64 gc_limit;
+    int error;                  /* set when a node allocation fails mid-operation */
+    struct quantum_dd_stats stats;
+};
+
+static const struct qdd_weight qdd_weight_zero;
+
+static inline bool qdd_weight_is_zero(struct qdd_weight w)
+{
+    return !w.re && !w.im;
+}
+
+static inline struct qdd_weight qdd_wmul(struct qdd_weight a, struct qdd_weight b)
+{
+    struct qdd_weight r = {
+        (a.re * b.re - a.im * b.im) >> QAMP_SHIFT,
+        (a.re * b.im + a.im * b.re) >> QAMP_SHIFT,
+    };
+
+    return r;
+}
+
+/* |w|^2 in Q30 */
+static inline u64 qdd_wnorm(struct qdd_weight w)
+{
+    return ((u64)(w.re * w.re) + (u64)(w.im * w.im)) >> QAMP_SHIFT;
+}
+
+static inline s64 qdd_snap(s64 x)
+{
+    return ((x + (1 << (QDD_WEIGHT_SNAP - 1))) >> QDD_WEIGHT_SNAP) * (1 << QDD_WEIGHT_SNAP);
+}
+
+static inline s64 qdd_shift(s64 x, int shift)
+{
+    return shift >= 0 ? x >> shift : x * (1LL << -shift);
+}
+
+static inline struct qdd_edge qdd_zero(struct quantum_dd *dd)
+{
+    struct qdd_edge e = { &dd->terminal, { 0, 0 } };
+
+    return e;
+}
+
+static inline bool qdd_edge_equal(const struct qdd_edge *a, const struct qdd_edge *b)
+{
+    return a->node == b->node && a->w.re == b->w.re && a->w.im == b->w.im;
+}
+
+static struct quantum_amp qdd_to_amp(struct qdd_weight w)
+{
+    struct quantum_amp amp = {
+        clamp_t(s64, w.re, S32_MIN, S32_MAX),
+        clamp_t(s64, w.im, S32_MIN, S32_MAX),
+    };
+
+    return amp;
+}
+
+static struct qdd_node *qdd_node_alloc(struct quantum_dd *dd)
+{
+    struct qdd_chunk *chunk;
+    struct qdd_node *node;
+    unsigned int i;
+
+    if (!dd->free_list) {
+        if (dd->stats.nodes >= QUANTUM_DD_MAX_NODES)
+            return NULL;
+
+        chunk = kvmalloc(sizeof(*chunk), GFP_KERNEL);
+        if (!chunk)
+            return NULL;
+
+        chunk->next = dd->chunks;
+        dd->chunks = chunk;
+        for (i = 0; i < QDD_CHUNK_NODES; i++) {
+            chunk->nodes[i].next = dd->free_list;
+            dd->free_list = &chunk->nodes[i];
+        }
+    }
+
+    node = dd->free_list;
+    dd->free_list = node->next;
+    dd->stats.nodes++;
+    dd->stats.peak_nodes = max(dd->stats.peak_nodes, dd->stats.nodes);
+    return node;
+}
+
+static u32 qdd_unique_hash(u16 var, const struct qdd_edge *e, unsigned int bits)
+{
+    u64 h = var ^ (unsigned long)e[0].node ^ ((u64)(unsigned long)e[1].node << 1);
+
+    h = (h ^ e[0].w.re) * GOLDEN_RATIO_64;
+    h = (h ^ e[0].w.im) * GOLDEN_RATIO_64;
+    h = (h ^ e[1].w.re) * GOLDEN_RATIO_64;
+    h = (h ^ e[1].w.im) * GOLDEN_RATIO_64;
+    return h >> (64 - bits);
+}
+
+/* Double the unique table, keeping the old one if memory is short */
+static void qdd_unique_grow(struct quantum_dd *dd)
+{
+    unsigned int bits = dd->unique_bits + 1;
+    struct qdd_node **table, *node, *next;
+    size_t i;
+    u32 h;
+
+    table = kvcalloc((size_t)1 << bits, sizeof(*table), GFP_KERNEL);
+    if (!table)
+        return;
+
+    for (i = 0; i < (size_t)1 << dd->unique_bits; i++) {
+        for (node = dd->unique[i]; node; node = next) {
+            next = node->next;
+            h = qdd_unique_hash(node->var, node->e, bits);
+            node->next = table[h];
+            table[h] = node;
+        }
+    }
+
+    kvfree(dd->unique);
+    dd->unique = table;
+    dd->unique_bits = bits;
+}
+
+/*
+ * Normalize the children of a new node and return the shared node together
+ * with the factor that was pulled out of it.
+ */
+static struct qdd_edge qdd_make_node(struct quantum_dd *dd, u16 var,
+                                     struct qdd_edge e0, struct qdd_edge e1)
+{
+    struct qdd_edge child[2] = { e0, e1 };
+    struct qdd_weight scaled[2], u;
+    struct qdd_edge res;
+    struct qdd_node *node;
+    u64 norm[2], total;
+    s64 max = 0, n, ref_abs;
+    int shift, shift_ref, i, ref;
+    u32 h;
+
+    for (i = 0; i < 2; i++)
+        max = max3(max, abs(child[i].w.re), abs(child[i].w.im));
+    if (max == 0)
+        return qdd_zero(dd);
+
+    /* Scale the largest component into [2^29, 2^30) so the products below fit */
+    shift = fls64(max) - QAMP_SHIFT;
+    for (i = 0; i < 2; i++) {
+        scaled[i].re = qdd_shift(child[i].w.re, shift);
+        scaled[i].im = qdd_shift(child[i].w.im, shift);
+        norm[i] = scaled[i].re * scaled[i].re + scaled[i].im * scaled[i].im;
+    }
+
+    /* Branches below the weight resolution are dropped */
+    total = norm[0] + norm[1];
+    for (i = 0; i < 2; i++) {
+        if (norm[i] <= total >> (2 * (QAMP_SHIFT - QDD_WEIGHT_SNAP))) {
+            scaled[i] = qdd_weight_zero;
+            norm[i] = 0;
+        }
+    }
+    total = norm[0] + norm[1];
+    n = int_sqrt64(total);
+
+    /*
+     * Phase of the first non-zero child, which becomes real. A small child is
+     * scaled up first, u must keep unit magnitude or the other child drifts.
+     */
+    ref = norm[0] ? 0 : 1;
+    u = scaled[ref];
+    shift_ref = QAMP_SHIFT - fls64(max(abs(u.re), abs(u.im)));
+    u.re = qdd_shift(u.re, -shift_ref);
+    u.im = qdd_shift(u.im, -shift_ref);
+    ref_abs = int_sqrt64(u.re * u.re + u.im * u.im);
+    u.re = div64_s64(u.re * QAMP_ONE, ref_abs);
+    u.im = div64_s64(u.im * QAMP_ONE, ref_abs);
+
+    for (i = 0; i < 2; i++) {
+        child[i].w.re = qdd_snap(div64_s64(scaled[i].re * u.re + scaled[i].im * u.im, n));
+        child[i].w.im = qdd_snap(div64_s64(scaled[i].im * u.re - scaled[i].re * u.im, n));
+        if (i == ref)
+            child[i].w.im = 0;
+        if (qdd_weight_is_zero(child[i].w))
+            child[i] = qdd_zero(dd);
+    }
+
+    /* Pulled-out factor n * u, back in unscaled Q30 */
+    res.w.re = (n * u.re) >> (QAMP_SHIFT - shift);
+    res.w.im = (n * u.im) >> (QAMP_SHIFT - shift);
+
+    /* One gate can rebuild millions of nodes, give the CPU up every chunk's worth */
+    if ((++dd->stats.unique_lookups & (QDD_CHUNK_NODES - 1)) == 0)
+        cond_resched();
+
+    h = qdd_unique_hash(var, child, dd->unique_bits);
+    for (node = dd->unique[h]; node; node = node->next) {
+        if (node->var == var && qdd_edge_equal(&node->e[0], &child[0]) &&
+            qdd_edge_equal(&node->e[1], &child[1])) {
+            dd->stats.unique_hits++;
+            res.node = node;
+            return res;
+        }
+    }
+
+    node = qdd_node_alloc(dd);
+    if (!node) {
+        dd->error = -ENOMEM;
+        return qdd_zero(dd);
+    }
+
+    node->e[0] = child[0];
+    node->e[1] = child[1];
+    node->var = var;
+    node->mark = 0;
+    node->next = dd->unique[h];
+    dd->unique[h] = node;
+
+    if (dd->stats.nodes > (2ULL << dd->unique_bits) && dd->unique_bits < QDD_UNIQUE_BITS_MAX)
+        qdd_unique_grow(dd);
+
+    res.node = node;
+    return res;
+}
+
+/* Find the cache slot of an operation, *hit tells whether it holds the result */
+static struct qdd_compute_entry *qdd_compute_slot(struct quantum_dd *dd, u64 key,
+                                                  const struct qdd_node *a, const struct qdd_node *b,
+                                                  struct qdd_weight wa, struct qdd_weight wb,
+                                                  bool *hit)
+{
+    struct qdd_compute_entry *entry;
+    u64 h;
+
+    h = (key ^ (unsigned long)a) * GOLDEN_RATIO_64;
+    h = (h ^ (unsigned long)b ^ wa.re ^ ((u64)wa.im << 1)) * GOLDEN_RATIO_64;
+    h = (h ^ wb.re ^ ((u64)wb.im << 1)) * GOLDEN_RATIO_64;
+    entry = &dd->compute[h >> (64 - QDD_COMPUTE_BITS)];
+
+    dd->stats.compute_lookups++;
+    *hit = entry->key == key && entry->a == a && entry->b == b &&
+           entry->wa.re == wa.re && entry->wa.im == wa.im &&
+           entry->wb.re == wb.re && entry->wb.im == wb.im;
+    if (*hit)
+        dd->stats.compute_hits++;
+
+    return entry;
+}
+
+static void qdd_compute_store(struct qdd_compute_entry *entry, u64 key,
+                              const struct qdd_node *a, const struct qdd_node *b,
+                              struct qdd_weight wa, struct qdd_weight wb, struct qdd_edge result)
+{
+    entry->key = key;
+    entry->a = a;
+    entry->b = b;
+    entry->wa = wa;
+    entry->wb = wb;
+    entry->result = result;
+}
+
+static inline struct qdd_edge qdd_scale(struct quantum_dd *dd, struct qdd_edge e, struct qdd_weight w)
+{
+    e.w = qdd_wmul(e.w, w);
+    return qdd_weight_is_zero(e.w) ? qdd_zero(dd) : e;
+}
+
+/* Child c of e with the weight of e folded in */
+static inline struct qdd_edge qdd_child(struct quantum_dd *dd, struct qdd_edge e, int c)
+{
+    return qdd_scale(dd, e.node->e[c], e.w);
+}
+
+/* Sum of two diagrams over the same qubits */
+static struct qdd_edge qdd_add(struct quantum_dd *dd, struct qdd_edge a, struct qdd_edge b)
+{
+    struct qdd_compute_entry *entry;
+    struct qdd_edge out[2], res;
+    bool hit;
+    int c;
+
+    if (qdd_weight_is_zero(a.w))
+        return b;
+    if (qdd_weight_is_zero(b.w))
+        return a;
+
+    if (a.node == b.node) {
+        a.w.re += b.w.re;
+        a.w.im += b.w.im;
+        return qdd_weight_is_zero(a.w) ? qdd_zero(dd) : a;
+    }
+
+    if (a.node > b.node)
+        swap(a, b);
+
+    entry = qdd_compute_slot(dd, QDD_KEY(QDD_OP_ADD, 0, 0), a.node, b.node, a.w, b.w, &hit);
+    if (hit)
+        return entry->result;
+
+    for (c = 0; c < 2; c++)
+        out[c] = qdd_add(dd, qdd_child(dd, a, c), qdd_child(dd, b, c));
+
+    res = qdd_make_node(dd, a.node->var, out[0], out[1]);
+    qdd_compute_store(entry, QDD_KEY(QDD_OP_ADD, 0, 0), a.node, b.node, a.w, b.w, res);
+    return res;
+}
+
+/* Apply the 2x2 matrix m to one qubit, key identifies m in the cache */
+static struct qdd_edge qdd_apply_mat(struct quantum_dd *dd, struct qdd_edge e, u16 qubit,
+                                     const struct qdd_weight *m, u64 key)
+{
+    struct qdd_compute_entry *entry;
+    struct qdd_node *node = e.node;
+    struct qdd_edge out[2], res;
+    bool hit;
+    int r;
+
+    if (qdd_weight_is_zero(e.w))
+        return e;
+
+    entry = qdd_compute_slot(dd, key, node, NULL, qdd_weight_zero, qdd_weight_zero, &hit);
+    if (hit)
+        return qdd_scale(dd, entry->result, e.w);
+
+    for (r = 0; r < 2; r++) {
+        if (node->var == qubit)
+            out[r] = qdd_add(dd, qdd_scale(dd, node->e[0], m[2 * r]),
+                             qdd_scale(dd, node->e[1], m[2 * r + 1]));
+        else
+            out[r] = qdd_apply_mat(dd, node->e[r], qubit, m, key);
+    }
+
+    res = qdd_make_node(dd, node->var, out[0], out[1]);
+    qdd_compute_store(entry, key, node, NULL, qdd_weight_zero, qdd_weight_zero, res);
+    return qdd_scale(dd, res, e.w);
+}
+
+/* Zero the branch where qubit != value, without renormalizing */
+static struct qdd_edge qdd_project(struct quantum_dd *dd, struct qdd_edge e, u16 qubit, int value)
+{
+    u64 key = QDD_KEY(QDD_OP_PROJECT, qubit, value);
+    struct qdd_compute_entry *entry;
+    struct qdd_node *node = e.node;
+    struct qdd_edge out[2], res;
+    bool hit;
+    int c;
+
+    if (qdd_weight_is_zero(e.w))
+        return e;
+
+    entry = qdd_compute_slot(dd, key, node, NULL, qdd_weight_zero, qdd_weight_zero, &hit);
+    if (hit)
+        return qdd_scale(dd, entry->result, e.w);
+
+    for (c = 0; c < 2; c++) {
+        if (node->var == qubit)
+            out[c] = c == value ? node->e[c] : qdd_zero(dd);
+        else
+            out[c] = qdd_project(dd, node->e[c], qubit, value);
+    }
+
+    res = qdd_make_node(dd, node->var, out[0], out[1]);
+    qdd_compute_store(entry, key, node, NULL, qdd_weight_zero, qdd_weight_zero, res);
+    return qdd_scale(dd, res, e.w);
+}
+
+/* Probability in Q30 that qubit reads one in the unit state below node */
+static u64 qdd_prob_one(struct quantum_dd *dd, const struct qdd_node *node, u16 qubit)
+{
+    u64 key = QDD_KEY(QDD_OP_PROB, qubit, 0);
+    struct qdd_compute_entry *entry;
+    struct qdd_edge res = qdd_zero(dd);
+    u64 p = 0;
+    bool hit;
+    int c;
+
+    entry = qdd_compute_slot(dd, key, node, NULL, qdd_weight_zero, qdd_weight_zero, &hit);
+    if (hit)
+        return entry->result.w.re;
+
+    if (node->var == qubit) {
+        p = qdd_wnorm(node->e[1].w);
+    } else {
+        for (c = 0; c < 2; c++) {
+            if (!qdd_weight_is_zero(node->e[c].w))
+                p += (qdd_wnorm(node->e[c].w) * qdd_prob_one(dd, node->e[c].node, qubit)) >> QAMP_SHIFT;
+        }
+    }
+
+    res.w.re = p;
+    qdd_compute_store(entry, key, node, NULL, qdd_weight_zero, qdd_weight_zero, res);
+    return p;
+}
+
+/* Largest basis-state probability in Q30 below node */
+static u64 qdd_max_prob(struct quantum_dd *dd, const struct qdd_node *node)
+{
+    u64 key = QDD_KEY(QDD_OP_MAXP, 0, 0);
+    struct qdd_compute_entry *entry;
+    struct qdd_edge res = qdd_zero(dd);
+    u64 p = 0, q;
+    bool hit;
+    int c;
+
+    if (node->var == QDD_TERMINAL_VAR)
+        return QAMP_ONE;
+
+    entry = qdd_compute_slot(dd, key, node, NULL, qdd_weight_zero, qdd_weight_zero, &hit);
+    if (hit)
+        return entry->result.w.re;
+
+    for (c = 0; c < 2; c++) {
+        if (qdd_weight_is_zero(node->e[c].w))
+            continue;
+        q = (qdd_wnorm(node->e[c].w) * qdd_max_prob(dd, node->e[c].node)) >> QAMP_SHIFT;
+        p = max(p, q);
+    }
+
+    res.w.re = p;
+    qdd_compute_store(entry, key, node, NULL, qdd_weight_zero, qdd_weight_zero, res);
+    return p;
+}
+
+/* Rebuild a node of another manager in dd */
+static struct qdd_edge qdd_import(struct quantum_dd *dd, const struct qdd_node *node)
+{
+    u64 key = QDD_KEY(QDD_OP_IMPORT, 0, 0);
+    struct qdd_compute_entry *entry;
+    struct qdd_edge out[2], res;
+    bool hit;
+    int c;
+
+    if (node->var == QDD_TERMINAL_VAR) {
+        res.node = &dd->terminal;
+        res.w.re = QAMP_ONE;
+        res.w.im = 0;
+        return res;
+    }
+
+    entry = qdd_compute_slot(dd, key, node, NULL, qdd_weight_zero, qdd_weight_zero, &hit);
+    if (hit)
+        return entry->result;
+
+    for (c = 0; c < 2; c++) {
+        if (qdd_weight_is_zero(node->e[c].w))
+            out[c] = qdd_zero(dd);
+        else
+            out[c] = qdd_scale(dd, qdd_import(dd, node->e[c].node), node->e[c].w);
+    }
+
+    res = qdd_make_node(dd, node->var, out[0], out[1]);
+    qdd_compute_store(entry, key, node, NULL, qdd_weight_zero, qdd_weight_zero, res);
+    return res;
+}
+
+static struct qdd_edge qdd_build_dense(struct quantum_dd *dd, const struct quantum_amp *amps,
+                                       int var, size_t offset)
+{
+    struct qdd_edge e0, e1;
+
+    if (var < 0) {
+        e0.node = &dd->terminal;
+        e0.w.re = amps[offset].re;
+        e0.w.im = amps[offset].im;
+        return qdd_weight_is_zero(e0.w) ? qdd_zero(dd) : e0;
+    }
+
+    e0 = qdd_build_dense(dd, amps, var - 1, offset);
+    e1 = qdd_build_dense(dd, amps, var - 1, offset | ((size_t)1 << var));
+    return qdd_make_node(dd, var, e0, e1);
+}
+
+static void qdd_expand_dense(const struct qdd_node *node, struct qdd_weight w, int var,
+                             size_t offset, struct quantum_amp *amps)
+{
+    int c;
+
+    if (var < 0) {
+        amps[offset] = qdd_to_amp(w);
+        return;
+    }
+
+    for (c = 0; c < 2; c++) {
+        if (!qdd_weight_is_zero(node->e[c].w))
+            qdd_expand_dense(node->e[c].node, qdd_wmul(w, node->e[c].w), var - 1,
+                             offset | ((size_t)c << var), amps);
+    }
+}
+
+static void qdd_mark(struct qdd_node *node)
+{
+    if (node->var == QDD_TERMINAL_VAR || node->mark)
+        return;
+
+    node->mark = 1;
+    qdd_mark(node->e[0].node);
+    qdd_mark(node->e[1].node);
+}
+
+/* Free every node unreachable from the root and drop the cached results */
+static void qdd_gc(struct quantum_dd *dd)
+{
+    struct qdd_node **link, *node;
+    size_t i;
+
+    qdd_mark(dd->root.node);
+
+    for (i = 0; i < (size_t)1 << dd->unique_bits; i++) {
+        if ((i & (QDD_CHUNK_NODES - 1)) == 0)
+            cond_resched();
+
+        link = &dd->unique[i];
+        while ((node = *link)) {
+            if (node->mark) {
+                node->mark = 0;
+                link = &node->next;
+                continue;
+            }
+            *link = node->next;
+            node->next = dd->free_list;
+            dd->free_list = node;
+            dd->stats.nodes--;
+        }
+    }
+
+    memset(dd->compute, 0, sizeof(*dd->compute) << QDD_COMPUTE_BITS);
+    dd->gc_limit = max_t(u64, QDD_GC_MIN_NODES, 2 * dd->stats.nodes);
+    dd->stats.gc_runs++;
+}
+
+/* Install the result of an operation, or discard it if a node allocation failed */
+static int qdd_commit(struct quantum_dd *dd, struct qdd_edge root)
+{
+    int ret = dd->error;
+
+    dd->error = 0;
+    if (ret) {
+        qdd_gc(dd);
+        return ret;
+    }
+
+    dd->root = root;
+    if (dd->stats.nodes > dd->gc_limit)
+        qdd_gc(dd);
+
+    return 0;
+}
+
+/* Scale w to unit magnitude, keeping its phase */
+static struct qdd_weight qdd_unit(struct qdd_weight w)
+{
+    s64 mag = int_sqrt64((u64)(w.re * w.re) + (u64)(w.im * w.im));
+
+    if (mag) {
+        w.re = div64_s64(w.re * QAMP_ONE, mag);
+        w.im = div64_s64(w.im * QAMP_ONE, mag);
+    }
+
+    return w;
+}
+
+/* Create a manager holding |0...0> */
+struct quantum_dd *quantum_dd_create(unsigned int num_qubits)
+{
+    struct quantum_dd *dd;
+
+    if (num_qubits == 0 || num_qubits > QUANTUM_DD_MAX_QUBITS)
+        return NULL;
+
+    dd = kzalloc(sizeof(*dd), GFP_KERNEL);
+    if (!dd)
+        return NULL;
+
+    dd->num_qubits = num_qubits;
+    dd->terminal.var = QDD_TERMINAL_VAR;
+    dd->root = qdd_zero(dd);
+    dd->unique_bits = QDD_UNIQUE_BITS_MIN;
+    dd->unique = kvcalloc((size_t)1 << dd->unique_bits, sizeof(*dd->unique), GFP_KERNEL);
+    dd->compute = kvcalloc((size_t)1 << QDD_COMPUTE_BITS, sizeof(*dd->compute), GFP_KERNEL);
+    dd->gc_limit = QDD_GC_MIN_NODES;
+
+    if (!dd->unique || !dd->compute || quantum_dd_init(dd, 0)) {
+        quantum_dd_destroy(dd);
+        return NULL;
+    }
+
+    return dd;
+}
+
+/* Free a manager and all of its nodes */
+void quantum_dd_destroy(struct quantum_dd *dd)
+{
+    struct qdd_chunk *chunk, *next;
+
+    if (!dd)
+        return;
+
+    for (chunk = dd->chunks; chunk; chunk = next) {
+        next = chunk->next;
+        kvfree(chunk);
+    }
+
+    kvfree(dd->unique);
+    kvfree(dd->compute);
+    kfree(dd);
+}
+
+/* Reset to the basis state |value>, one node per qubit */
+int quantum_dd_init(struct quantum_dd *dd, u64 value)
+{
+    struct qdd_edge e = { &dd->terminal, { QAMP_ONE, 0 } };
+    struct qdd_edge child[2];
+    unsigned int q;
+    int bit;
+
+    for (q = 0; q < dd->num_qubits; q++) {
+        bit = (value >> q) & 1;
+        child[bit] = e;
+        child[!bit] = qdd_zero(dd);
+        e = qdd_make_node(dd, q, child[0], child[1]);
+    }
+
+    return qdd_commit(dd, e);
+}
+
+/* Copy a diagram between managers of equal width */
+int quantum_dd_copy(struct quantum_dd *dst, const struct quantum_dd *src)
+{
+    struct qdd_edge root;
+    int ret;
+
+    if (dst->num_qubits != src->num_qubits)
+        return -EINVAL;
+
+    if (dst == src)
+        return 0;
+
+    root = qdd_weight_is_zero(src->root.w) ? qdd_zero(dst) :
+           qdd_scale(dst, qdd_import(dst, src->root.node), src->root.w);
+    ret = qdd_commit(dst, root);
+
+    /* Import entries are keyed by foreign nodes that may be freed later */
+    memset(dst->compute, 0, sizeof(*dst->compute) << QDD_COMPUTE_BITS);
+    return ret;
+}
+
+/* Build the diagram of a dense vector, equal sub-vectors share nodes */
+int quantum_dd_from_dense(struct quantum_dd *dd, const struct quantum_amp *amps)
+{
+    if (dd->num_qubits > QUANTUM_STATE_MAX_QUBITS)
+        return -E2BIG;
+
+    return qdd_commit(dd, qdd_build_dense(dd, amps, dd->num_qubits - 1, 0));
+}
+
+/* Expand the diagram into 2^n amplitudes */
+int quantum_dd_to_dense(const struct quantum_dd *dd, struct quantum_amp *amps)
+{
+    if (dd->num_qubits > QUANTUM_STATE_MAX_QUBITS)
+        return -E2BIG;
+
+    memset(amps, 0, sizeof(*amps) << dd->num_qubits);
+    if (!qdd_weight_is_zero(dd->root.w))
+        qdd_expand_dense(dd->root.node, dd->root.w, dd->num_qubits - 1, 0, amps);
+
+    return 0;
+}
+
+static int qdd_apply_gate(struct quantum_dd *dd, enum quantum_gate_type gate, int qubit,
+                          int target, u32 angle)
+{
+    struct quantum_op op = { .gate = gate, .qubit = qubit, .target = target, .angle = angle };
+
+    return quantum_dd_apply_op(dd, &op);
+}
+
+/*
+ * QFT and inverse QFT gate by gate, a diagram has no dense array to run an
+ * FFT over. Phases below the 16-bit angle resolution are dropped.
+ */
+static int qdd_apply_qft(struct quantum_dd *dd, const struct quantum_op *op)
+{
+    bool inverse = op->gate == QUANTUM_GATE_IQFT;
+    bool reverse = !(op->angle & QUANTUM_MACRO_NO_SWAP);
+    int base = op->qubit, width = op->target;
+    int j, k, s, c, ret = 0;
+    u32 angle;
+
+    for (j = 0; inverse && reverse && j < width / 2 && !ret; j++)
+        ret = qdd_apply_gate(dd, QUANTUM_GATE_SWAP, base + j, base + width - 1 - j, 0);
+
+    for (k = 0; k < width && !ret; k++) {
+        s = inverse ? k : width - 1 - k;
+        if (!inverse)
+            ret = qdd_apply_gate(dd, QUANTUM_GATE_H, base + s, -1, 0);
+
+        for (c = 0; c < s && !ret; c++) {
+            angle = s - c + 1 < 32 ? QUANTUM_ANGLE_TURN >> (s - c + 1) : 0;
+            if (angle)
+                ret = qdd_apply_gate(dd, QUANTUM_GATE_CPHASE, base + c, base + s,
+                                     inverse ? QUANTUM_ANGLE_TURN - angle : angle);
+        }
+
+        if (inverse && !ret)
+            ret = qdd_apply_gate(dd, QUANTUM_GATE_H, base + s, -1, 0);
+    }
+
+    for (j = 0; !inverse && reverse && j < width / 2 && !ret; j++)
+        ret = qdd_apply_gate(dd, QUANTUM_GATE_SWAP, base + j, base + width - 1 - j, 0);
+
+    return ret;
+}
+
+/* Diffusion as H^n (2|0><0| - I) H^n, the projector onto |0...0> is a chain of projections */
+static int qdd_apply_diffusion(struct quantum_dd *dd, const struct quantum_op *op)
+{
+    const struct qdd_weight two = { 2LL * QAMP_ONE, 0 }, minus = { -QAMP_ONE, 0 };
+    struct qdd_edge zero;
+    int q, ret;
+
+    for (q = op->qubit; q < op->qubit + op->target; q++) {
+        ret = qdd_apply_gate(dd, QUANTUM_GATE_H, q, -1, 0);
+        if (ret < 0)
+            return ret;
+    }
+
+    zero = dd->root;
+    for (q = op->qubit; q < op->qubit + op->target; q++)
+        zero = qdd_project(dd, zero, q, 0);
+
+    ret = qdd_commit(dd, qdd_add(dd, qdd_scale(dd, zero, two), qdd_scale(dd, dd->root, minus)));
+    if (ret < 0)
+        return ret;
+
+    for (q = op->qubit; q < op->qubit + op->target; q++) {
+        ret = qdd_apply_gate(dd, QUANTUM_GATE_H, q, -1, 0);
+        if (ret < 0)
+            return ret;
+    }
+
+    return 0;
+}
+
+/* Apply one gate to the diagram */
+int quantum_dd_apply_op(struct quantum_dd *dd, const struct quantum_op *op)
+{
+    enum quantum_gate_type gate = op->gate;
+    struct quantum_op cnot = *op;
+    struct quantum_amp mat[4];
+    struct qdd_weight m[4];
+    struct qdd_edge res, on;
+    u32 angle = op->angle;
+    int i, ret;
+    u64 key;
+
+    switch (op->gate) {
+        case QUANTUM_GATE_I:
+            return 0;
+        case QUANTUM_GATE_SWAP:
+            /* Three alternating CNOTs */
+            cnot.gate = QUANTUM_GATE_CNOT;
+            for (i = 0; i < 3; i++) {
+                ret = quantum_dd_apply_op(dd, &cnot);
+                if (ret < 0)
+                    return ret;
+                swap(cnot.qubit, cnot.target);
+            }
+            return 0;
+        case QUANTUM_GATE_QFT:
+        case QUANTUM_GATE_IQFT:
+            return qdd_apply_qft(dd, op);
+        case QUANTUM_GATE_DIFFUSION:
+            return qdd_apply_diffusion(dd, op);
+        case QUANTUM_GATE_CNOT:
+            gate = QUANTUM_GATE_X;
+            break;
+        case QUANTUM_GATE_CZ:
+            gate = QUANTUM_GATE_Z;
+            break;
+        case QUANTUM_GATE_CPHASE:
+            gate = QUANTUM_GATE_PHASE;
+            break;
+        default:
+            break;
+    }
+
+    ret = quantum_gate_matrix(gate, angle, mat);
+    if (ret < 0)
+        return ret;
+
+    for (i = 0; i < 4; i++) {
+        m[i].re = mat[i].re;
+        m[i].im = mat[i].im;
+    }
+
+    if (gate != QUANTUM_GATE_RX && gate != QUANTUM_GATE_RY &&
+        gate != QUANTUM_GATE_RZ && gate != QUANTUM_GATE_PHASE)
+        angle = 0;
+
+    if (gate == op->gate) {
+        key = QDD_KEY(QDD_OP_APPLY, op->qubit, ((u64)gate << 32) | angle);
+        res = qdd_apply_mat(dd, dd->root, op->qubit, m, key);
+    } else {
+        /* Controlled gate: |0><0| x I + |1><1| x U on the control */
+        key = QDD_KEY(QDD_OP_APPLY, op->target, ((u64)gate << 32) | angle);
+        on = qdd_project(dd, dd->root, op->qubit, 1);
+        on = qdd_apply_mat(dd, on, op->target, m, key);
+        res = qdd_add(dd, qdd_project(dd, dd->root, op->qubit, 0), on);
+    }
+
+    return qdd_commit(dd, res);
+}
+
+/* Read one amplitude by walking a single path */
+int quantum_dd_amplitude(const struct quantum_dd *dd, u64 index, struct quantum_amp *amp)
+{
+    const struct qdd_node *node = dd->root.node;
+    struct qdd_weight w = dd->root.w;
+    int q;
+
+    if (dd->num_qubits < 64 && index >> dd->num_qubits)
+        return -EINVAL;
+
+    for (q = dd->num_qubits - 1; q >= 0 && !qdd_weight_is_zero(w); q--) {
+        w = qdd_wmul(w, node->e[(index >> q) & 1].w);
+        node = node->e[(index >> q) & 1].node;
+    }
+
+    *amp = qdd_to_amp(w);
+    return 0;
+}
+
+/* Zero the branch where qubit != value, returns the remaining norm in Q30 */
+u64 quantum_dd_project(struct quantum_dd *dd, int qubit, int value)
+{
+    struct qdd_edge root = qdd_project(dd, dd->root, qubit, !!value);
+
+    if (qdd_commit(dd, root))
+        return 0;
+
+    return qdd_wnorm(dd->root.w);
+}
+
+/* Measure a single qubit and collapse the diagram */
+int quantum_dd_measure_qubit(struct quantum_dd *dd, int qubit, int *result)
+{
+    struct qdd_edge root;
+    int outcome, ret;
+    u64 p1;
+
+    if (qdd_weight_is_zero(dd->root.w))
+        return -EIO;
+
+    /* Nodes are unit vectors, so the root weight only carries a global factor */
+    p1 = qdd_prob_one(dd, dd->root.node, qubit);
+    outcome = mul_u64_u32_shr(QAMP_ONE, get_random_u32(), 32) < p1;
+
+    root = qdd_project(dd, dd->root, qubit, outcome);
+    root.w = qdd_unit(root.w);
+    ret = qdd_commit(dd, root);
+    if (ret < 0)
+        return ret;
+
+    *result = outcome;
+    return 0;
+}
+
+/* Sample the whole register along one path, leaving the diagram as it is */
+int quantum_dd_sample(const struct quantum_dd *dd, u64 *outcome)
+{
+    const struct qdd_node *node = dd->root.node;
+    u64 p0, p1, value = 0;
+    int q, bit;
+
+    if (qdd_weight_is_zero(dd->root.w))
+        return -EIO;
+
+    for (q = dd->num_qubits - 1; q >= 0; q--) {
+        p0 = qdd_wnorm(node->e[0].w);
+        p1 = qdd_wnorm(node->e[1].w);
+        bit = mul_u64_u32_shr(p0 + p1, get_random_u32(), 32) >= p0;
+        value |= (u64)bit << q;
+        node = node->e[bit].node;
+    }
+
+    *outcome = value;
+    return 0;
+}
+
+/* Sample the whole register and collapse to the outcome */
+int quantum_dd_measure(struct quantum_dd *dd, u64 *outcome)
+{
+    int ret = quantum_dd_sample(dd, outcome);
+
+    if (ret < 0)
+        return ret;
+
+    return quantum_dd_init(dd, *outcome);
+}
+
+/* Most probable basis state */
+u64 quantum_dd_argmax(struct quantum_dd *dd)
+{
+    const struct qdd_node *node = dd->root.node;
+    u64 value = 0, best, p;
+    int q, c, bit;
+
+    if (qdd_weight_is_zero(dd->root.w))
+        return 0;
+
+    for (q = dd->num_qubits - 1; q >= 0; q--) {
+        best = 0;
+        bit = 0;
+        for (c = 0; c < 2; c++) {
+            if (qdd_weight_is_zero(node->e[c].w))
+                continue;
+            p = (qdd_wnorm(node->e[c].w) * qdd_max_prob(dd, node->e[c].node)) >> QAMP_SHIFT;
+            if (p > best) {
+                best = p;
+                bit = c;
+            }
+        }
+        value |= (u64)bit << q;
+        node = node->e[bit].node;
+    }
+
+    return value;
+}
+
+/* Get decision-diagram statistics */
+void quantum_dd_get_stats(const struct quantum_dd *dd, struct quantum_dd_stats *stats)
+{
+    *stats = dd->stats;
+}
@@ -0,0 +1,998 @@
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/bitmap.h>
+#include <linux/bitops.h>
+#include <linux/log2.h>
+#include "../include/quantum.h"
+#include "../include/quantum_decoder.h"
+
+/* Node flags of the union-find workspace */
+#define UF_DEFECT    0x01           /* unmatched defect, changes while peeling */
+#define UF_ODD       0x02           /* root of a cluster with an odd number of defects */
+#define UF_BOUNDARY  0x04           /* root of a cluster holding the boundary */
+#define UF_TOUCHED   0x08
+#define UF_VISITED   0x10
+#define UF_LISTED    0x20
+#define UF_INTERIOR  0x40           /* every edge fully grown, nothing left to grow */
+
+/* Allocate a graph, the caller fills edges and then builds the adjacency */
+int qec_graph_alloc(struct qec_graph *graph, u32 num_nodes, u32 num_edges, u32 num_faults)
+{
+    memset(graph, 0, sizeof(*graph));
+    if (num_nodes < 2 || num_edges == 0)
+        return -EINVAL;
+
+    graph->edges = kvmalloc_array(num_edges, sizeof(*graph->edges), GFP_KERNEL);
+    graph->offsets = kvcalloc(num_nodes + 1, sizeof(*graph->offsets), GFP_KERNEL);
+    graph->adj = kvmalloc_array(2 * (size_t)num_edges, sizeof(*graph->adj), GFP_KERNEL);
+    if (!graph->edges || !graph->offsets || !graph->adj) {
+        qec_graph_free(graph);
+        return -ENOMEM;
+    }
+
+    graph->num_nodes = num_nodes;
+    graph->num_edges = num_edges;
+    graph->num_faults = num_faults;
+    return 0;
+}
+
+/* Bucket the edges by node */
+int qec_graph_finish(struct qec_graph *graph)
+{
+    const struct qec_edge *edge;
+    u32 v, e;
+
+    memset(graph->offsets, 0, (graph->num_nodes + 1) * sizeof(*graph->offsets));
+    for (e = 0; e < graph->num_edges; e++) {
+        edge = &graph->edges[e];
+        if (edge->a >= graph->num_nodes || edge->b >= graph->num_nodes || edge->a == edge->b ||
+            edge->fault >= (s32)graph->num_faults || edge->weight == 0)
+            return -EINVAL;
+        graph->offsets[edge->a + 1]++;
+        graph->offsets[edge->b + 1]++;
+    }
+
+    for (v = 0; v < graph->num_nodes; v++)
+        graph->offsets[v + 1] += graph->offsets[v];
+
+    for (e = 0; e < graph->num_edges; e++) {
+        edge = &graph->edges[e];
+        graph->adj[graph->offsets[edge->a]++] = e;
+        graph->adj[graph->offsets[edge->b]++] = e;
+    }
+
+    /* The fill above advanced every offset to the start of the next node */
+    for (v = graph->num_nodes; v > 0; v--)
+        graph->offsets[v] = graph->offsets[v - 1];
+    graph->offsets[0] = 0;
+    return 0;
+}
+
+void qec_graph_free(struct qec_graph *graph)
+{
+    kvfree(graph->edges);
+    kvfree(graph->offsets);
+    kvfree(graph->adj);
+    memset(graph, 0, sizeof(*graph));
+}
+
+/* log2(x) in Q8 for x >= 1, one fraction bit per squaring */
+static u32 qec_log2_q8(u32 x)
+{
+    u32 whole = ilog2(x), frac = 0, i;
+    u64 m = ((u64)x << 30) >> whole;
+
+    for (i = 0; i < 8; i++) {
+        m = (m * m) >> 30;
+        frac <<= 1;
+        if (m >= 2ULL << 30) {
+            m >>= 1;
+            frac |= 1;
+        }
+    }
+    return (whole << 8) | frac;
+}
+
+/* Edge weight in quarter bits, log2((1 - p) / p) for a fault rate p in parts per million */
+u32 qec_edge_weight(u32 ppm)
+{
+    s32 weight;
+
+    if (ppm == 0)
+        return QEC_WEIGHT_MAX;
+    if (ppm >= QEC_PPM / 2)
+        return 1;
+
+    weight = ((s32)qec_log2_q8(QEC_PPM - ppm) - (s32)qec_log2_q8(ppm) + 32) >> 6;
+    return clamp(weight, 1, QEC_WEIGHT_MAX);
+}
+
+/* Weigh data faults and measurement faults of a graph by their rates */
+void qec_graph_set_weights(struct qec_graph *graph, u32 data_ppm, u32 measure_ppm)
+{
+    u32 data = qec_edge_weight(data_ppm), measure = qec_edge_weight(measure_ppm), e;
+
+    for (e = 0; e < graph->num_edges; e++)
+        graph->edges[e].weight = graph->edges[e].fault >= 0 ? data : measure;
+}
+
+int qec_uf_init(struct qec_uf *uf, const struct qec_graph *graph)
+{
+    u32 n = graph->num_nodes, m = graph->num_edges, v;
+
+    memset(uf, 0, sizeof(*uf));
+    uf->graph = graph;
+    uf->parent = kvmalloc_array(n, sizeof(u32), GFP_KERNEL);
+    uf->size = kvmalloc_array(n, sizeof(u32), GFP_KERNEL);
+    uf->next = kvmalloc_array(n, sizeof(u32), GFP_KERNEL);
+    uf->flags = kvzalloc(n, GFP_KERNEL);
+    uf->support = kvzalloc(m, GFP_KERNEL);
+    uf->touched = kvmalloc_array(n, sizeof(u32), GFP_KERNEL);
+    uf->grown = kvmalloc_array(m, sizeof(u32), GFP_KERNEL);
+    uf->fused = kvmalloc_array(m, sizeof(u32), GFP_KERNEL);
+    uf->odd = kvmalloc_array(n, sizeof(u32), GFP_KERNEL);
+    uf->queue = kvmalloc_array(n, sizeof(u32), GFP_KERNEL);
+    uf->tree = kvmalloc_array(n, sizeof(u32), GFP_KERNEL);
+    if (!uf->parent || !uf->size || !uf->next || !uf->flags || !uf->support || !uf->touched ||
+        !uf->grown || !uf->fused || !uf->odd || !uf->queue || !uf->tree) {
+        qec_uf_free(uf);
+        return -ENOMEM;
+    }
+
+    /* Every node starts as a cluster of its own */
+    for (v = 0; v < n; v++) {
+        uf->parent[v] = v;
+        uf->size[v] = 1;
+        uf->next[v] = v;
+    }
+    return 0;
+}
+
+void qec_uf_free(struct qec_uf *uf)
+{
+    kvfree(uf->parent);
+    kvfree(uf->size);
+    kvfree(uf->next);
+    kvfree(uf->flags);
+    kvfree(uf->support);
+    kvfree(uf->touched);
+    kvfree(uf->grown);
+    kvfree(uf->fused);
+    kvfree(uf->odd);
+    kvfree(uf->queue);
+    kvfree(uf->tree);
+    memset(uf, 0, sizeof(*uf));
+}
+
+static u32 uf_find(struct qec_uf *uf, u32 v)
+{
+    while (uf->parent[v] != v) {
+        uf->parent[v] = uf->parent[uf->parent[v]];
+        v = uf->parent[v];
+    }
+    return v;
+}
+
+static void uf_touch(struct qec_uf *uf, u32 *num_touched, u32 v)
+{
+    if (!(uf->flags[v] & UF_TOUCHED)) {
+        uf->flags[v] |= UF_TOUCHED;
+        uf->touched[(*num_touched)++] = v;
+    }
+}
+
+static inline u32 uf_other(const struct qec_edge *edge, u32 v)
+{
+    return edge->a == v ? edge->b : edge->a;
+}
+
+/* Merge the clusters at both ends of a grown edge, the larger root stays */
+static void uf_union(struct qec_uf *uf, u32 a, u32 b)
+{
+    u32 tmp;
+
+    a = uf_find(uf, a);
+    b = uf_find(uf, b);
+    if (a == b)
+        return;
+    if (uf->size[a] < uf->size[b])
+        swap(a, b);
+
+    uf->parent[b] = a;
+    uf->size[a] += uf->size[b];
+    uf->flags[a] ^= uf->flags[b] & UF_ODD;
+    uf->flags[a] |= uf->flags[b] & UF_BOUNDARY;
+
+    /* Splice the two node rings */
+    tmp = uf->next[a];
+    uf->next[a] = uf->next[b];
+    uf->next[b] = tmp;
+}
+
+/* Grow every odd cluster by half an edge in all directions, 0 when none could grow */
+static u32 uf_grow(struct qec_uf *uf, u32 num_odd, u32 *num_grown, u32 *num_touched)
+{
+    const struct qec_graph *graph = uf->graph;
+    u32 i, v, k, e, root, num_fused = 0, grew = 0;
+    bool interior;
+
+    for (i = 0; i < num_odd; i++) {
+        root = uf->odd[i];
+        v = root;
+        do {
+            if (uf->flags[v] & UF_INTERIOR) {
+                v = uf->next[v];
+                continue;
+            }
+
+            interior = true;
+            for (k = graph->offsets[v]; k < graph->offsets[v + 1]; k++) {
+                e = graph->adj[k];
+                if (uf->support[e] == 2)
+                    continue;
+                if (uf->support[e]++ == 0)
+                    uf->grown[(*num_grown)++] = e;
+                if (uf->support[e] == 2)
+                    uf->fused[num_fused++] = e;
+                else
+                    interior = false;
+                grew++;
+            }
+            if (interior)
+                uf->flags[v] |= UF_INTERIOR;
+            v = uf->next[v];
+        } while (v != root);
+    }
+
+    for (i = 0; i < num_fused; i++) {
+        e = uf->fused[i];
+        uf_touch(uf, num_touched, graph->edges[e].a);
+        uf_touch(uf, num_touched, graph->edges[e].b);
+        uf_union(uf, graph->edges[e].a, graph->edges[e].b);
+    }
+
+    return grew;
+}
+
+/* Replace the odd roots by the roots of their merged clusters that are still odd */
+static u32 uf_collect_odd(struct qec_uf *uf, u32 num_odd)
+{
+    u32 i, root, count = 0;
+
+    for (i = 0; i < num_odd; i++) {
+        root = uf_find(uf, uf->odd[i]);
+        if ((uf->flags[root] & (UF_ODD | UF_BOUNDARY | UF_LISTED)) != UF_ODD)
+            continue;
+        uf->flags[root] |= UF_LISTED;
+        uf->odd[count++] = root;
+    }
+
+    for (i = 0; i < count; i++)
+        uf->flags[uf->odd[i]] &= ~UF_LISTED;
+    return count;
+}
+
+/* Breadth-first spanning tree over the grown edges from start */
+static u32 uf_span(struct qec_uf *uf, u32 start, u32 tail)
+{
+    const struct qec_graph *graph = uf->graph;
+    u32 head = tail, v, w, k, e;
+
+    uf->flags[start] |= UF_VISITED;
+    uf->tree[start] = U32_MAX;
+    uf->queue[tail++] = start;
+
+    while (head < tail) {
+        v = uf->queue[head++];
+        for (k = graph->offsets[v]; k < graph->offsets[v + 1]; k++) {
+            e = graph->adj[k];
+            if (uf->support[e] != 2)
+                continue;
+            w = uf_other(&graph->edges[e], v);
+            if (uf->flags[w] & UF_VISITED)
+                continue;
+            uf->flags[w] |= UF_VISITED;
+            uf->tree[w] = e;
+            uf->queue[tail++] = w;
+        }
+    }
+
+    return tail;
+}
+
+/*
+ * Peel the forest from the leaves, an edge below a defect goes into the
+ * correction and moves the defect to its parent. The boundary is spanned
+ * first so that it roots its cluster and absorbs the defects left over.
+ */
+static void uf_peel(struct qec_uf *uf, u32 num_touched, unsigned long *correction)
+{
+    const struct qec_graph *graph = uf->graph;
+    const struct qec_edge *edge;
+    u32 i, v, tail;
+
+    tail = uf_span(uf, qec_graph_boundary(graph), 0);
+    for (i = 0; i < num_touched; i++)
+        if (!(uf->flags[uf->touched[i]] & UF_VISITED))
+            tail = uf_span(uf, uf->touched[i], tail);
+
+    while (tail--) {
+        v = uf->queue[tail];
+        if (!(uf->flags[v] & UF_DEFECT) || uf->tree[v] == U32_MAX)
+            continue;
+
+        edge = &graph->edges[uf->tree[v]];
+        if (edge->fault >= 0)
+            __change_bit(edge->fault, correction);
+        uf->flags[v] &= ~UF_DEFECT;
+        uf->flags[uf_other(edge, v)] ^= UF_DEFECT;
+    }
+}
+
+/* Return the touched part of the workspace to single-node clusters */
+static void uf_reset(struct qec_uf *uf, u32 num_touched, u32 num_grown)
+{
+    u32 i, v;
+
+    for (i = 0; i < num_touched; i++) {
+        v = uf->touched[i];
+        uf->parent[v] = v;
+        uf->size[v] = 1;
+        uf->next[v] = v;
+        uf->flags[v] = 0;
+    }
+    for (i = 0; i < num_grown; i++)
+        uf->support[uf->grown[i]] = 0;
+}
+
+/* Decode the given defect nodes into a bitmap of graph->num_faults faults */
+int qec_uf_decode(struct qec_uf *uf, const u32 *defects, u32 num_defects,
+                  unsigned long *correction)
+{
+    const struct qec_graph *graph = uf->graph;
+    u32 boundary = qec_graph_boundary(graph);
+    u32 i, v, num_touched = 0, num_grown = 0, num_odd = 0;
+    int ret = 0;
+
+    bitmap_zero(correction, graph->num_faults);
+    for (i = 0; i < num_defects; i++)
+        if (defects[i] >= boundary)
+            return -EINVAL;
+
+    uf_touch(uf, &num_touched, boundary);
+    uf->flags[boundary] |= UF_BOUNDARY;
+    for (i = 0; i < num_defects; i++) {
+        v = defects[i];
+        uf_touch(uf, &num_touched, v);
+        uf->flags[v] ^= UF_DEFECT | UF_ODD;
+    }
+
+    for (i = 0; i < num_touched; i++)
+        if (uf->flags[uf->touched[i]] & UF_ODD)
+            uf->odd[num_odd++] = uf->touched[i];
+
+    while (num_odd) {
+        if (!uf_grow(uf, num_odd, &num_grown, &num_touched)) {
+            ret = -EINVAL;
+            break;
+        }
+        num_odd = uf_collect_odd(uf, num_odd);
+    }
+
+    if (ret == 0)
+        uf_peel(uf, num_touched, correction);
+    uf_reset(uf, num_touched, num_grown);
+    return ret;
+}
+
+/* Dijkstra from every node, each worker takes every workers-th source */
+struct paths_job {
+    const struct qec_graph *graph;
+    u16 *dist;
+    unsigned int workers;
+    int ret;
+};
+
+static void paths_heap_push(u64 *heap, u32 *size, u64 key)
+{
+    u32 i = (*size)++;
+
+    while (i && heap[(i - 1) / 2] > key) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = key;
+}
+
+static u64 paths_heap_pop(u64 *heap, u32 *size)
+{
+    u64 top = heap[0], last = heap[--(*size)];
+    u32 i = 0, c;
+
+    while ((c = 2 * i + 1) < *size) {
+        if (c + 1 < *size && heap[c + 1] < heap[c])
+            c++;
+        if (heap[c] >= last)
+            break;
+        heap[i] = heap[c];
+        i = c;
+    }
+    heap[i] = last;
+    return top;
+}
+
+static void paths_worker(void *arg, unsigned int idx)
+{
+    struct paths_job *job = arg;
+    const struct qec_graph *graph = job->graph;
+    const struct qec_edge *edge;
+    u32 num = graph->num_nodes, src, v, w, k, size;
+    u64 *heap, key, dist;
+    u16 *row;
+
+    /* Every relaxation pushes once and every node relaxes its edges once */
+    heap = kvmalloc_array(2 * (size_t)graph->num_edges + 1, sizeof(*heap), GFP_KERNEL);
+    if (!heap) {
+        WRITE_ONCE(job->ret, -ENOMEM);
+        return;
+    }
+
+    for (src = idx; src < num; src += job->workers) {
+        row = &job->dist[(size_t)src * num];
+        memset(row, 0xff, num * sizeof(*row));
+        row[src] = 0;
+        size = 0;
+        paths_heap_push(heap, &size, src);
+
+        while (size) {
+            key = paths_heap_pop(heap, &size);
+            v = (u32)key;
+            dist = key >> 32;
+            if (dist > row[v])
+                continue;
+
+            for (k = graph->offsets[v]; k < graph->offsets[v + 1]; k++) {
+                edge = &graph->edges[graph->adj[k]];
+                w = uf_other(edge, v);
+                if (dist + edge->weight >= U16_MAX) {
+                    WRITE_ONCE(job->ret, -EOVERFLOW);
+                    continue;
+                }
+                if (dist + edge->weight < row[w]) {
+                    row[w] = dist + edge->weight;
+                    paths_heap_push(heap, &size, ((u64)row[w] << 32) | w);
+                }
+            }
+        }
+    }
+
+    kvfree(heap);
+}
+
+int qec_paths_init(struct qec_paths *paths, const struct qec_graph *graph)
+{
+    struct paths_job job = { .graph = graph };
+
+    memset(paths, 0, sizeof(*paths));
+    if (graph->num_nodes > QEC_PATHS_MAX_NODES)
+        return -E2BIG;
+
+    paths->graph = graph;
+    paths->dist = kvmalloc_array((size_t)graph->num_nodes * graph->num_nodes,
+                                 sizeof(*paths->dist), GFP_KERNEL);
+    if (!paths->dist)
+        return -ENOMEM;
+
+    job.dist = paths->dist;
+    job.workers = min(quantum_parallel_width(), graph->num_nodes);
+    quantum_parallel_for(job.workers, paths_worker, &job);
+    if (job.ret < 0) {
+        qec_paths_free(paths);
+        return job.ret;
+    }
+    return 0;
+}
+
+void qec_paths_free(struct qec_paths *paths)
+{
+    kvfree(paths->dist);
+    memset(paths, 0, sizeof(*paths));
+}
+
+/*
+ * Weighted blossom matching on a dense graph of at most MWPM_VERTS
+ * vertices, 1-based, with blossoms numbered after the vertices. Duals are
+ * doubled so that every slack stays integral, see Galil's survey of
+ * Edmonds' algorithm. The matching has maximum weight, the decoder turns
+ * minimum path lengths into weights that make it perfect.
+ */
+#define MWPM_VERTS  (2 * QEC_MWPM_MAX_DEFECTS)
+#define MWPM_SLOTS  (2 * MWPM_VERTS + 1)
+
+struct mwpm_edge {
+    u16 u;
+    u16 v;
+    s32 w;                          /* 0 for no edge */
+};
+
+struct qec_mwpm_work {
+    unsigned int n;                 /* vertices */
+    unsigned int n_x;               /* vertices and blossoms */
+    unsigned int head, tail;
+    u32 stamp;
+    u32 nodes[QEC_MWPM_MAX_DEFECTS];
+    u16 bdist[QEC_MWPM_MAX_DEFECTS];
+    s32 lab[MWPM_SLOTS];
+    u16 match[MWPM_SLOTS];
+    u16 slack[MWPM_SLOTS];
+    u16 st[MWPM_SLOTS];             /* outermost blossom */
+    u16 pa[MWPM_SLOTS];
+    u16 queue[MWPM_SLOTS];
+    u16 flower_len[MWPM_SLOTS];
+    s8 label[MWPM_SLOTS];           /* -1 free, 0 outer, 1 inner */
+    u32 vis[MWPM_SLOTS];
+    u16 flower[MWPM_SLOTS][MWPM_SLOTS];
+    u16 from[MWPM_SLOTS][MWPM_VERTS + 1];
+    struct mwpm_edge g[MWPM_SLOTS][MWPM_SLOTS];
+};
+
+static inline s32 mwpm_slack_of(const struct qec_mwpm_work *w, const struct mwpm_edge *e)
+{
+    return w->lab[e->u] + w->lab[e->v] - e->w * 2;
+}
+
+static void mwpm_update_slack(struct qec_mwpm_work *w, unsigned int u, unsigned int x)
+{
+    if (!w->slack[x] || mwpm_slack_of(w, &w->g[u][x]) < mwpm_slack_of(w, &w->g[w->slack[x]][x]))
+        w->slack[x] = u;
+}
+
+static void mwpm_set_slack(struct qec_mwpm_work *w, unsigned int x)
+{
+    unsigned int u;
+
+    w->slack[x] = 0;
+    for (u = 1; u <= w->n; u++)
+        if (w->g[u][x].w > 0 && w->st[u] != x && w->label[w->st[u]] == 0)
+            mwpm_update_slack(w, u, x);
+}
+
+/* Queue the vertices of a blossom, each one turns outer at most once per phase */
+static void mwpm_push(struct qec_mwpm_work *w, unsigned int x)
+{
+    unsigned int i;
+
+    if (x <= w->n) {
+        if (w->tail < MWPM_SLOTS)
+            w->queue[w->tail++] = x;
+        return;
+    }
+    for (i = 0; i < w->flower_len[x]; i++)
+        mwpm_push(w, w->flower[x][i]);
+}
+
+static void mwpm_set_st(struct qec_mwpm_work *w, unsigned int x, unsigned int b)
+{
+    unsigned int i;
+
+    w->st[x] = b;
+    if (x > w->n)
+        for (i = 0; i < w->flower_len[x]; i++)
+            mwpm_set_st(w, w->flower[x][i], b);
+}
+
+static void mwpm_reverse(u16 *a, unsigned int len)
+{
+    unsigned int i;
+
+    for (i = 0; i < len / 2; i++)
+        swap(a[i], a[len - 1 - i]);
+}
+
+static void mwpm_rotate(u16 *a, unsigned int len, unsigned int k)
+{
+    mwpm_reverse(a, k);
+    mwpm_reverse(a + k, len - k);
+    mwpm_reverse(a, len);
+}
+
+/* Even position of xr in the cycle of b, reversing the cycle if needed */
+static unsigned int mwpm_get_pr(struct qec_mwpm_work *w, unsigned int b, unsigned int xr)
+{
+    u16 *f = w->flower[b];
+    unsigned int len = w->flower_len[b], pr = 0;
+
+    while (f[pr] != xr)
+        pr++;
+    if (pr % 2) {
+        mwpm_reverse(f + 1, len - 1);
+        return len - pr;
+    }
+    return pr;
+}
+
+static void mwpm_set_match(struct qec_mwpm_work *w, unsigned int u, unsigned int v)
+{
+    struct mwpm_edge e = w->g[u][v];
+    unsigned int xr, pr, i;
+
+    w->match[u] = e.v;
+    if (u <= w->n)
+        return;
+
+    xr = w->from[u][e.u];
+    pr = mwpm_get_pr(w, u, xr);
+    for (i = 0; i < pr; i++)
+        mwpm_set_match(w, w->flower[u][i], w->flower[u][i ^ 1]);
+    mwpm_set_match(w, xr, v);
+    mwpm_rotate(w->flower[u], w->flower_len[u], pr);
+}
+
+static void mwpm_augment(struct qec_mwpm_work *w, unsigned int u, unsigned int v)
+{
+    unsigned int xnv;
+
+    for (;;) {
+        xnv = w->st[w->match[u]];
+        mwpm_set_match(w, u, v);
+        if (!xnv)
+            return;
+        mwpm_set_match(w, xnv, w->st[w->pa[xnv]]);
+        u = w->st[w->pa[xnv]];
+        v = xnv;
+    }
+}
+
+/* Common outer ancestor of u and v in the alternating forest, 0 for different trees */
+static unsigned int mwpm_lca(struct qec_mwpm_work *w, unsigned int u, unsigned int v)
+{
+    w->stamp++;
+    while (u || v) {
+        if (u) {
+            if (w->vis[u] == w->stamp)
+                return u;
+            w->vis[u] = w->stamp;
+            u = w->st[w->match[u]];
+            if (u)
+                u = w->st[w->pa[u]];
+        }
+        swap(u, v);
+    }
+    return 0;
+}
+
+static void mwpm_add_cycle(struct qec_mwpm_work *w, unsigned int b, unsigned int x,
+                           unsigned int lca)
+{
+    unsigned int y;
+
+    while (x != lca) {
+        w->flower[b][w->flower_len[b]++] = x;
+        y = w->st[w->match[x]];
+        w->flower[b][w->flower_len[b]++] = y;
+        mwpm_push(w, y);
+        x = w->st[w->pa[y]];
+    }
+}
+
+static void mwpm_add_blossom(struct qec_mwpm_work *w, unsigned int u, unsigned int lca,
+                             unsigned int v)
+{
+    unsigned int b = w->n + 1, x, i, xs;
+
+    while (b <= w->n_x && w->st[b])
+        b++;
+    if (b > w->n_x)
+        w->n_x++;
+
+    w->lab[b] = 0;
+    w->label[b] = 0;
+    w->match[b] = w->match[lca];
+    w->flower_len[b] = 0;
+    w->flower[b][w->flower_len[b]++] = lca;
+    mwpm_add_cycle(w, b, u, lca);
+    mwpm_reverse(w->flower[b] + 1, w->flower_len[b] - 1);
+    mwpm_add_cycle(w, b, v, lca);
+    mwpm_set_st(w, b, b);
+
+    for (x = 1; x <= w->n_x; x++)
+        w->g[b][x].w = w->g[x][b].w = 0;
+    for (x = 1; x <= w->n; x++)
+        w->from[b][x] = 0;
+
+    for (i = 0; i < w->flower_len[b]; i++) {
+        xs = w->flower[b][i];
+        for (x = 1; x <= w->n_x; x++) {
+            if (w->g[b][x].w == 0 ||
+                mwpm_slack_of(w, &w->g[xs][x]) < mwpm_slack_of(w, &w->g[b][x])) {
+                w->g[b][x] = w->g[xs][x];
+                w->g[x][b] = w->g[x][xs];
+            }
+        }
+        for (x = 1; x <= w->n; x++)
+            if (w->from[xs][x])
+                w->from[b][x] = xs;
+    }
+    mwpm_set_slack(w, b);
+}
+
+static void mwpm_expand_blossom(struct qec_mwpm_work *w, unsigned int b)
+{
+    unsigned int i, xr, pr, xs, xns;
+
+    for (i = 0; i < w->flower_len[b]; i++)
+        mwpm_set_st(w, w->flower[b][i], w->flower[b][i]);
+
+    xr = w->from[b][w->g[b][w->pa[b]].u];
+    pr = mwpm_get_pr(w, b, xr);
+    for (i = 0; i < pr; i += 2) {
+        xs = w->flower[b][i];
+        xns = w->flower[b][i + 1];
+        w->pa[xs] = w->g[xns][xs].u;
+        w->label[xs] = 1;
+        w->label[xns] = 0;
+        w->slack[xs] = 0;
+        mwpm_set_slack(w, xns);
+        mwpm_push(w, xns);
+    }
+
+    w->label[xr] = 1;
+    w->pa[xr] = w->pa[b];
+    for (i = pr + 1; i < w->flower_len[b]; i++) {
+        xs = w->flower[b][i];
+        w->label[xs] = -1;
+        mwpm_set_slack(w, xs);
+    }
+    w->st[b] = 0;
+}
+
+/* A tight edge either grows the forest, closes a blossom or augments */
+static bool mwpm_found_edge(struct qec_mwpm_work *w, struct mwpm_edge e)
+{
+    unsigned int u = w->st[e.u], v = w->st[e.v], nu, lca;
+
+    if (w->label[v] == -1) {
+        w->pa[v] = e.u;
+        w->label[v] = 1;
+        nu = w->st[w->match[v]];
+        w->slack[v] = w->slack[nu] = 0;
+        w->label[nu] = 0;
+        mwpm_push(w, nu);
+    } else if (w->label[v] == 0) {
+        lca = mwpm_lca(w, u, v);
+        if (!lca) {
+            mwpm_augment(w, u, v);
+            mwpm_augment(w, v, u);
+            return true;
+        }
+        mwpm_add_blossom(w, u, lca, v);
+    }
+    return false;
+}
+
+/* One augmentation, false once no augmenting path improves the weight */
+static bool mwpm_phase(struct qec_mwpm_work *w)
+{
+    unsigned int u, v, x, b;
+    s32 d;
+
+    for (x = 1; x <= w->n_x; x++) {
+        w->label[x] = -1;
+        w->slack[x] = 0;
+    }
+    w->head = w->tail = 0;
+    for (x = 1; x <= w->n_x; x++) {
+        if (w->st[x] == x && !w->match[x]) {
+            w->pa[x] = 0;
+            w->label[x] = 0;
+            mwpm_push(w, x);
+        }
+    }
+    if (w->head == w->tail)
+        return false;
+
+    for (;;) {
+        while (w->head < w->tail) {
+            u = w->queue[w->head++];
+            if (w->label[w->st[u]] == 1)
+                continue;
+            for (v = 1; v <= w->n; v++) {
+                if (w->g[u][v].w <= 0 || w->st[u] == w->st[v])
+                    continue;
+                if (mwpm_slack_of(w, &w->g[u][v]) == 0) {
+                    if (mwpm_found_edge(w, w->g[u][v]))
+                        return true;
+                } else {
+                    mwpm_update_slack(w, u, w->st[v]);
+                }
+            }
+        }
+
+        /* Largest dual step that keeps every slack and blossom dual non-negative */
+        d = S32_MAX;
+        for (b = w->n + 1; b <= w->n_x; b++)
+            if (w->st[b] == b && w->label[b] == 1)
+                d = min(d, w->lab[b] / 2);
+        for (x = 1; x <= w->n_x; x++) {
+            if (w->st[x] != x || !w->slack[x])
+                continue;
+            if (w->label[x] == -1)
+                d = min(d, mwpm_slack_of(w, &w->g[w->slack[x]][x]));
+            else if (w->label[x] == 0)
+                d = min(d, mwpm_slack_of(w, &w->g[w->slack[x]][x]) / 2);
+        }
+
+        for (u = 1; u <= w->n; u++) {
+            if (w->label[w->st[u]] == 0) {
+                if (w->lab[u] <= d)
+                    return false;
+                w->lab[u] -= d;
+            } else if (w->label[w->st[u]] == 1) {
+                w->lab[u] += d;
+            }
+        }
+        for (b = w->n + 1; b <= w->n_x; b++) {
+            if (w->st[b] != b)
+                continue;
+            if (w->label[b] == 0)
+                w->lab[b] += d * 2;
+            else if (w->label[b] == 1)
+                w->lab[b] -= d * 2;
+        }
+
+        w->head = w->tail = 0;
+        for (x = 1; x <= w->n_x; x++) {
+            if (w->st[x] == x && w->slack[x] && w->st[w->slack[x]] != x &&
+                mwpm_slack_of(w, &w->g[w->slack[x]][x]) == 0 &&
+                mwpm_found_edge(w, w->g[w->slack[x]][x]))
+                return true;
+        }
+        for (b = w->n + 1; b <= w->n_x; b++)
+            if (w->st[b] == b && w->label[b] == 1 && w->lab[b] == 0)
+                mwpm_expand_blossom(w, b);
+    }
+}
+
+int qec_mwpm_init(struct qec_mwpm *mwpm, const struct qec_paths *paths)
+{
+    int ret;
+
+    memset(mwpm, 0, sizeof(*mwpm));
+    mwpm->paths = paths;
+    mwpm->work = kvzalloc(sizeof(*mwpm->work), GFP_KERNEL);
+    if (!mwpm->work)
+        return -ENOMEM;
+
+    ret = qec_uf_init(&mwpm->fallback, paths->graph);
+    if (ret < 0)
+        qec_mwpm_free(mwpm);
+    return ret;
+}
+
+void qec_mwpm_free(struct qec_mwpm *mwpm)
+{
+    qec_uf_free(&mwpm->fallback);
+    kvfree(mwpm->work);
+    memset(mwpm, 0, sizeof(*mwpm));
+}
+
+/* Flip the faults along a shortest path, each step lowers the distance to the target */
+static void mwpm_trace(const struct qec_paths *paths, u32 from, u32 to, unsigned long *correction)
+{
+    const struct qec_graph *graph = paths->graph;
+    const struct qec_edge *edge = NULL;
+    u32 k, next = from;
+
+    while (from != to) {
+        for (k = graph->offsets[from]; k < graph->offsets[from + 1]; k++) {
+            edge = &graph->edges[graph->adj[k]];
+            next = uf_other(edge, from);
+            if (qec_paths_dist(paths, to, next) + edge->weight == qec_paths_dist(paths, to, from))
+                break;
+        }
+        if (edge->fault >= 0)
+            __change_bit(edge->fault, correction);
+        from = next;
+    }
+}
+
+/*
+ * Defect i is vertex i + 1 and its boundary copy vertex num + i + 1. Pairs
+ * of defects are joined when closer than both are to the boundary, every
+ * defect is joined to its copy and the copies to each other for free.
+ * Weights become C - length with C above num times the longest length,
+ * so the heaviest matching is perfect and has the shortest total length.
+ */
+static int mwpm_match(struct qec_mwpm *mwpm, u32 num, unsigned long *correction)
+{
+    struct qec_mwpm_work *w = mwpm->work;
+    const struct qec_paths *paths = mwpm->paths;
+    u32 boundary = qec_graph_boundary(paths->graph);
+    unsigned int u, v, i, j;
+    u32 longest = 0, dist;
+    s32 c;
+
+    for (i = 0; i < num; i++) {
+        w->bdist[i] = qec_paths_dist(paths, w->nodes[i], boundary);
+        if (w->bdist[i] != U16_MAX)
+            longest = max_t(u32, longest, w->bdist[i]);
+    }
+    for (i = 0; i < num; i++) {
+        for (j = i + 1; j < num; j++) {
+            dist = qec_paths_dist(paths, w->nodes[i], w->nodes[j]);
+            if (dist < (u32)w->bdist[i] + w->bdist[j])
+                longest = max(longest, dist);
+        }
+    }
+    c = num * longest + 1;
+
+    w->n = w->n_x = 2 * num;
+    for (u = 1; u <= w->n; u++) {
+        for (v = 1; v <= w->n; v++)
+            w->g[u][v] = (struct mwpm_edge){ u, v, 0 };
+    }
+    for (i = 0; i < num; i++) {
+        for (j = i + 1; j < num; j++) {
+            dist = qec_paths_dist(paths, w->nodes[i], w->nodes[j]);
+            if (dist < (u32)w->bdist[i] + w->bdist[j])
+                w->g[i + 1][j + 1].w = w->g[j + 1][i + 1].w = c - dist;
+            w->g[num + i + 1][num + j + 1].w = w->g[num + j + 1][num + i + 1].w = c;
+        }
+        if (w->bdist[i] != U16_MAX)
+            w->g[i + 1][num + i + 1].w = w->g[num + i + 1][i + 1].w = c - w->bdist[i];
+    }
+
+    for (u = 0; u <= 2 * w->n; u++) {
+        w->st[u] = u <= w->n ? u : 0;
+        w->match[u] = 0;
+        w->flower_len[u] = 0;
+    }
+    for (u = 1; u <= w->n; u++) {
+        w->lab[u] = c;
+        for (v = 1; v <= w->n; v++)
+            w->from[u][v] = u == v ? u : 0;
+    }
+
+    while (mwpm_phase(w))
+        ;
+
+    for (u = 1; u <= num; u++) {
+        v = w->match[u];
+        if (!v)
+            return -EINVAL;
+        if (v > num)
+            mwpm_trace(paths, w->nodes[u - 1], boundary, correction);
+        else if (u < v)
+            mwpm_trace(paths, w->nodes[u - 1], w->nodes[v - 1], correction);
+    }
+    return 0;
+}
+
+/* Decode the given defect nodes into a bitmap of graph->num_faults faults */
+int qec_mwpm_decode(struct qec_mwpm *mwpm, const u32 *defects, u32 num_defects,
+                    unsigned long *correction)
+{
+    struct qec_mwpm_work *w = mwpm->work;
+    u32 boundary = qec_graph_boundary(mwpm->paths->graph);
+    u32 i, j, num = 0;
+
+    if (num_defects > QEC_MWPM_MAX_DEFECTS)
+        return qec_uf_decode(&mwpm->fallback, defects, num_defects, correction);
+
+    bitmap_zero(correction, mwpm->paths->graph->num_faults);
+    for (i = 0; i < num_defects; i++) {
+        if (defects[i] >= boundary)
+            return -EINVAL;
+
+        /* A node listed twice cancels */
+        for (j = 0; j < num && w->nodes[j] != defects[i]; j++)
+            ;
+        if (j < num)
+            w->nodes[j] = w->nodes[--num];
+        else
+            w->nodes[num++] = defects[i];
+    }
+
+    return num ? mwpm_match(mwpm, num, correction) : 0;
+}
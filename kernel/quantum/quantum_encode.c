@@ -0,0 +1,284 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/math64.h>
+#include <linux/int_sqrt.h>
+#include "../include/ctrlxt_kernel.h"
+#include "../include/quantum.h"
+#include "../include/quantum_dd.h"
+#include "../include/quantum_encode.h"
+
+/* Shared state of one pass over the register */
+struct encode_job {
+    s32 *lanes;                 /* dense or split vector, see quantum_lane_pos() */
+    unsigned int block_shift;
+    s32 *re;                    /* real vector instead of lanes */
+    u64 mask;                   /* dim - 1 */
+    bool entangle;
+    const u8 *data;
+    size_t size;
+    struct quantum_amp f0;      /* product states: factors of the qubit being added */
+    struct quantum_amp f1;
+    u64 records;                /* basis superpositions: records counted */
+    s32 table[256];             /* amplitude encoding: amplitude of every byte value */
+    size_t count;               /* items of the current pass */
+    size_t slice;               /* items per worker */
+    unsigned int workers;
+};
+
+/*
+ * Where the amplitude of basis state x goes. CNOTs from q to q + 1 for
+ * ascending q turn every bit into the parity of itself and the bits below.
+ */
+static inline size_t encode_pos(const struct encode_job *job, u64 x)
+{
+    if (job->entangle) {
+        x ^= x << 1;
+        x ^= x << 2;
+        x ^= x << 4;
+        x ^= x << 8;
+        x ^= x << 16;
+        x ^= x << 32;
+    }
+    return x & job->mask;
+}
+
+static inline struct quantum_amp encode_load(const struct encode_job *job, u64 x)
+{
+    struct quantum_amp a = { 0, 0 };
+
+    if (job->re) {
+        a.re = job->re[encode_pos(job, x)];
+        return a;
+    }
+    return quantum_lanes_load(job->lanes, job->block_shift, encode_pos(job, x));
+}
+
+static inline void encode_store(struct encode_job *job, u64 x, struct quantum_amp a)
+{
+    if (job->re)
+        job->re[encode_pos(job, x)] = a.re;
+    else
+        quantum_lanes_store(job->lanes, job->block_shift, encode_pos(job, x), a);
+}
+
+/* Split a pass of count items into slices worth a work item each */
+static void encode_run(struct encode_job *job, size_t count, void (*fn)(void *arg, unsigned int idx))
+{
+    job->count = count;
+    job->workers = clamp_t(size_t, count / QUANTUM_ENCODE_MIN_SLICE, 1, quantum_parallel_width());
+    job->slice = DIV_ROUND_UP(count, job->workers);
+    quantum_parallel_for(job->workers, fn, job);
+}
+
+/* Extend the product of the qubits below to one more qubit, count is 2^qubit */
+static void encode_product_worker(void *arg, unsigned int idx)
+{
+    struct encode_job *job = arg;
+    size_t j, end = min(job->count, (idx + 1) * job->slice);
+    struct quantum_amp a;
+
+    for (j = idx * job->slice; j < end; j++) {
+        a = encode_load(job, j);
+        encode_store(job, j + job->count, qamp_mul(a, job->f1));
+        encode_store(job, j, qamp_mul(a, job->f0));
+    }
+}
+
+static void encode_amplitude_worker(void *arg, unsigned int idx)
+{
+    struct encode_job *job = arg;
+    size_t i, end = min(job->count, (idx + 1) * job->slice);
+    struct quantum_amp a = { 0, 0 };
+
+    for (i = idx * job->slice; i < end; i++) {
+        a.re = i < job->size ? job->table[job->data[i]] : 0;
+        encode_store(job, i, a);
+    }
+}
+
+/* Turn the record count of every basis state into sqrt(count / records) */
+static void encode_counts_worker(void *arg, unsigned int idx)
+{
+    struct encode_job *job = arg;
+    size_t i, end = min(job->count, (idx + 1) * job->slice);
+    struct quantum_amp a;
+
+    for (i = idx * job->slice; i < end; i++) {
+        a = encode_load(job, i);
+        if (a.re)
+            a.re = int_sqrt64(mul_u64_u64_div_u64(a.re, 1ULL << (2 * QAMP_SHIFT), job->records));
+        encode_store(job, i, a);
+    }
+}
+
+/* Little-endian value of the record at data */
+static u64 encode_record(const u8 *data, size_t bytes)
+{
+    u64 value = 0;
+    size_t k;
+
+    for (k = 0; k < bytes; k++)
+        value |= (u64)data[k] << (8 * k);
+    return value;
+}
+
+/* Every qubit below size gets the factors of its byte, the rest stays |0> */
+static void encode_product(struct encode_job *job, unsigned int num_qubits, bool angle)
+{
+    struct quantum_amp one = { QAMP_ONE, 0 };
+    unsigned int q;
+    u32 half;
+
+    encode_store(job, 0, one);
+    for (q = 0; q < num_qubits; q++) {
+        job->f0 = one;
+        job->f1 = (struct quantum_amp){ 0, 0 };
+        if (q < job->size && angle) {
+            half = job->data[q] * (QUANTUM_ANGLE_PI / 512);
+            job->f0.re = quantum_angle_cos(half);
+            job->f1.re = quantum_angle_sin(half);
+        } else if (q < job->size) {
+            job->f0.re = QAMP_SQRT1_2;
+            job->f1 = job->data[q] & 1 ? (struct quantum_amp){ 0, QAMP_SQRT1_2 } : job->f0;
+        }
+        encode_run(job, (size_t)1 << q, encode_product_worker);
+    }
+}
+
+/* Count every record into the real part of its basis state, then take the roots */
+static void encode_superposition(struct encode_job *job, size_t dim, size_t bytes)
+{
+    struct quantum_amp a;
+    size_t r;
+
+    job->records = job->size / bytes;
+    for (r = 0; r < job->records; r++) {
+        a = encode_load(job, encode_record(job->data + r * bytes, bytes));
+        a.re++;
+        encode_store(job, encode_record(job->data + r * bytes, bytes), a);
+    }
+    encode_run(job, dim, encode_counts_worker);
+}
+
+/* 1/|data| scaled to Q30 for every byte value */
+static int encode_amplitude_table(struct encode_job *job)
+{
+    u64 total = 0, root;
+    unsigned int shift, v;
+    size_t i;
+
+    for (i = 0; i < job->size; i++)
+        total += job->data[i] * job->data[i];
+    if (!total)
+        return -EINVAL;
+
+    /* The root of total * 4^shift keeps 30 significant bits */
+    shift = (63 - fls64(total)) / 2;
+    root = int_sqrt64(total << (2 * shift));
+    for (v = 0; v < ARRAY_SIZE(job->table); v++)
+        job->table[v] = mul_u64_u64_div_u64(v, 1ULL << (QAMP_SHIFT + shift), root);
+    return 0;
+}
+
+/* Sizes of the encoding and records inside the register */
+static int encode_check(const struct quantum_state *state, enum quantum_encoding encoding,
+                        unsigned int flags, const u8 *data, size_t size)
+{
+    size_t bytes = DIV_ROUND_UP(state->num_qubits, 8), r;
+
+    switch (encoding) {
+        case QUANTUM_ENCODE_PHASE:
+        case QUANTUM_ENCODE_ANGLE:
+            return size <= state->num_qubits ? 0 : -EINVAL;
+        case QUANTUM_ENCODE_BASIS:
+            if (!(flags & QUANTUM_ENCODE_SUPERPOS))
+                return size <= bytes && encode_record(data, size) < state->dim ? 0 : -EINVAL;
+            if (size == 0 || size % bytes)
+                return -EINVAL;
+            for (r = 0; r < size; r += bytes)
+                if (encode_record(data + r, bytes) >= state->dim)
+                    return -EINVAL;
+            return 0;
+        case QUANTUM_ENCODE_AMPLITUDE:
+            return size && size <= state->dim ? 0 : -EINVAL;
+        default:
+            return -EINVAL;
+    }
+}
+
+int quantum_state_encode(struct quantum_state *state, enum quantum_encoding encoding,
+                         unsigned int flags, const void *data, size_t size)
+{
+    struct quantum_amp *dense = NULL;
+    struct encode_job job;
+    int ret;
+
+    if (!state || (!data && size) ||
+        (flags & ~(QUANTUM_ENCODE_SUPERPOS | QUANTUM_ENCODE_ENTANGLE)))
+        return -EINVAL;
+
+    ret = encode_check(state, encoding, flags, data, size);
+    if (ret < 0)
+        return ret;
+
+    memset(&job, 0, sizeof(job));
+    job.mask = state->dim - 1;
+    job.entangle = flags & QUANTUM_ENCODE_ENTANGLE;
+    job.data = data;
+    job.size = size;
+
+    if (encoding == QUANTUM_ENCODE_AMPLITUDE) {
+        ret = encode_amplitude_table(&job);
+        if (ret < 0)
+            return ret;
+    }
+
+    /* A single basis state needs no pass in any representation */
+    if (encoding == QUANTUM_ENCODE_BASIS && !(flags & QUANTUM_ENCODE_SUPERPOS))
+        return quantum_state_init(state, encode_pos(&job, encode_record(job.data, size)));
+
+    /* Diagrams are built from a dense vector, only phases need a complex one */
+    if (state->repr == QUANTUM_REPR_DD) {
+        dense = kvcalloc(state->dim, sizeof(*dense), GFP_KERNEL);
+        if (!dense)
+            return -ENOMEM;
+        job.lanes = (s32 *)dense;
+    } else if (state->repr == QUANTUM_REPR_REAL && encoding == QUANTUM_ENCODE_PHASE) {
+        ret = quantum_state_convert(state, QUANTUM_REPR_DENSE);
+        if (ret < 0)
+            return ret;
+    }
+
+    quantum_state_changed(state);
+    if (!dense && state->repr == QUANTUM_REPR_REAL) {
+        job.re = state->re;
+    } else if (!dense) {
+        job.lanes = quantum_state_lanes(state);
+        job.block_shift = state->block_shift;
+    }
+
+    switch (encoding) {
+        case QUANTUM_ENCODE_PHASE:
+        case QUANTUM_ENCODE_ANGLE:
+            encode_product(&job, state->num_qubits, encoding == QUANTUM_ENCODE_ANGLE);
+            break;
+        case QUANTUM_ENCODE_BASIS:
+            if (job.re)
+                memset(job.re, 0, state->dim * sizeof(s32));
+            else if (!dense)
+                memset(job.lanes, 0, 2 * state->dim * sizeof(s32));
+            encode_superposition(&job, state->dim, DIV_ROUND_UP(state->num_qubits, 8));
+            break;
+        default:
+            encode_run(&job, state->dim, encode_amplitude_worker);
+            break;
+    }
+
+    if (dense) {
+        ret = quantum_dd_from_dense(state->dd, dense);
+        kvfree(dense);
+    }
+    return ret;
+}
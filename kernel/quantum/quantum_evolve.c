@@ -0,0 +1,968 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/bitops.h>
+#include <linux/math64.h>
+#include <linux/int_sqrt.h>
+#include <linux/hash.h>
+#include <linux/sort.h>
+#include <linux/sched/signal.h>
+#include "../include/ctrlxt_kernel.h"
+#include "../include/quantum.h"
+#include "../include/quantum_evolve.h"
+
+/* 2^32 / (2*pi), Q32 radians to 2^-32 turns */
+#define EVOLVE_INV_TWO_PI  683565276U
+
+/* Taylor terms of one small exponential step, whose norm is at most 1/2 */
+#define EVOLVE_TAYLOR_TERMS  14
+
+/*
+ * Diagonal layers take few distinct summed angles, a small direct-mapped
+ * cache per worker saves most of the twiddle evaluations.
+ */
+#define EVOLVE_PHASE_BITS  6
+
+/* Lanczos vectors shorter than this span an invariant subspace */
+#define EVOLVE_KRYLOV_BREAKDOWN  (QAMP_ONE >> 20)
+
+/* One Pauli rotation exp(-i*theta*P) */
+struct evolve_rot {
+    u64 x;
+    u64 z;
+    size_t flip;            /* x and z as masks of tile positions */
+    size_t lz;
+    s64 rad;                /* theta of the whole evolution in Q32 radians */
+    u32 angle;              /* theta of the current pass in 2^-32 turns */
+    struct quantum_amp cs;  /* cos and sin of the current pass */
+    unsigned int quarter;   /* -i * i^(number of Y) as a power of i */
+};
+
+/* Mutually commuting terms [first, first + count) of a plan, ordered by class */
+struct evolve_layer {
+    size_t first;
+    size_t count;
+    size_t num_inner;
+    size_t num_cross;
+    size_t num_diag;
+    u64 span;               /* qubits of a tile, see evolve_plan_build() */
+};
+
+/* Layers of a Hamiltonian in execution order */
+struct evolve_plan {
+    struct evolve_rot *rots;
+    struct evolve_layer *layers;
+    size_t num_layers;
+    unsigned int max_span;
+};
+
+/*
+ * Place of a term in its layer, in this order. Diagonal terms acting only
+ * on tile qubits or only on the others take their phase from a table or
+ * once per tile, the ones crossing both are summed per amplitude.
+ */
+enum evolve_class {
+    EVOLVE_INNER = 0,
+    EVOLVE_CROSS,
+    EVOLVE_OUTER,
+    EVOLVE_FLIP,
+    EVOLVE_CLASSES,
+};
+
+/* Layer under construction, members are chained backwards from last */
+struct evolve_group {
+    u64 x;
+    u64 z;
+    size_t last;
+    size_t count;
+    size_t slot[EVOLVE_CLASSES];
+};
+
+/* Shared state of one pass over the register */
+struct evolve_job {
+    s32 *lanes;                 /* dense or split vector, see quantum_lane_pos() */
+    unsigned int block_shift;
+    struct evolve_rot *rots;
+    const struct evolve_layer *layer;
+    u32 steps;
+    unsigned int span_bits;
+    size_t *offsets;            /* basis offset of every tile position */
+    u32 *inner;                 /* summed angle of the inner diagonal terms at every position */
+    struct quantum_amp *bufs;   /* one tile per worker */
+    size_t tiles;
+    size_t slice;
+    unsigned int workers;
+};
+
+/* Phase of a summed diagonal angle, zero hashes to the first slot which starts out valid */
+struct evolve_phase {
+    u32 angle;
+    struct quantum_amp value;
+};
+
+/* Shared state of one expectation pass over the terms sharing a flip mask */
+struct expect_job {
+    const struct quantum_state *state;
+    const struct quantum_pauli_term *terms;
+    size_t count;
+    s64 *sums;                  /* count sums in Q30 per worker */
+    size_t slice;
+};
+
+/* Wide complex accumulator */
+struct evolve_sum {
+    s64 re;
+    s64 im;
+};
+
+/* Pauli strings commute when they anticommute on an even number of qubits */
+static bool evolve_commute(const struct quantum_pauli_term *a, const struct quantum_pauli_term *b)
+{
+    return !(hweight64((a->x & b->z) ^ (a->z & b->x)) & 1);
+}
+
+/* Q32 radians to 2^-32 turns, wrapping at full turns */
+static u32 evolve_turns(s64 rad)
+{
+    u32 turns = (u32)mul_u64_u32_shr(abs(rad), EVOLVE_INV_TWO_PI, 32);
+
+    return rad < 0 ? -turns : turns;
+}
+
+/* Spread the bits of g over the qubits outside span */
+static inline size_t evolve_spread(size_t g, u64 span)
+{
+    unsigned int b;
+
+    for (; span; span &= span - 1) {
+        b = __ffs64(span);
+        g = ((g >> b) << (b + 1)) | (g & (((size_t)1 << b) - 1));
+    }
+
+    return g;
+}
+
+/* Gather the bits of x on the qubits of span into consecutive low bits */
+static size_t evolve_gather(u64 x, u64 span)
+{
+    size_t r = 0;
+    unsigned int p = 0;
+
+    for (; span; span &= span - 1, p++) {
+        if (x & span & -span)
+            r |= (size_t)1 << p;
+    }
+
+    return r;
+}
+
+/* Scatter the low bits of r onto the qubits of span */
+static size_t evolve_scatter(size_t r, u64 span)
+{
+    size_t k = 0;
+
+    for (; span; span &= span - 1, r >>= 1) {
+        if (r & 1)
+            k |= span & -span;
+    }
+
+    return k;
+}
+
+/* A term joins a group it commutes with entirely, if the tile stays small enough */
+static bool evolve_fits(const struct evolve_group *g, const struct quantum_pauli_term *terms,
+                        const size_t *prev, const struct quantum_pauli_term *t)
+{
+    size_t j;
+
+    if (hweight64(g->x | t->x) > QUANTUM_EVOLVE_MAX_SPAN)
+        return false;
+
+    /* No qubit where one side has X or Y and the other Z or Y */
+    if (!(t->x & g->z) && !(t->z & g->x))
+        return true;
+
+    for (j = g->last; j != SIZE_MAX; j = prev[j]) {
+        if (!evolve_commute(&terms[j], t))
+            return false;
+    }
+
+    return true;
+}
+
+static enum evolve_class evolve_classify(const struct quantum_pauli_term *t, u64 span)
+{
+    if (t->x)
+        return EVOLVE_FLIP;
+    if (!(t->z & ~span))
+        return EVOLVE_INNER;
+    return t->z & span ? EVOLVE_CROSS : EVOLVE_OUTER;
+}
+
+static void evolve_plan_free(struct evolve_plan *plan)
+{
+    kvfree(plan->rots);
+    kvfree(plan->layers);
+}
+
+/*
+ * Group the terms first-fit into layers of mutually commuting terms. Every
+ * order of the terms is a valid Trotter product, so a term may join a
+ * layer ahead of terms it does not commute with.
+ */
+static int evolve_plan_build(struct evolve_plan *plan, const struct quantum_hamiltonian *ham,
+                             unsigned int num_qubits, u32 time)
+{
+    const struct quantum_pauli_term *t;
+    struct evolve_group *groups;
+    struct evolve_layer *layer;
+    struct evolve_rot *rot;
+    size_t *prev, *owner;
+    size_t i, g, n, num_groups = 0, num_rots = 0;
+    int ret = -ENOMEM;
+    unsigned int b, c;
+
+    memset(plan, 0, sizeof(*plan));
+
+    groups = kvmalloc_array(ham->num_terms, sizeof(*groups), GFP_KERNEL);
+    prev = kvmalloc_array(ham->num_terms, 2 * sizeof(*prev), GFP_KERNEL);
+    if (!groups || !prev)
+        goto out;
+    owner = prev + ham->num_terms;
+
+    for (i = 0; i < ham->num_terms; i++) {
+        t = &ham->terms[i];
+        owner[i] = SIZE_MAX;
+        if (!t->coeff)
+            continue;
+
+        for (g = 0; g < num_groups; g++) {
+            if (evolve_fits(&groups[g], ham->terms, prev, t))
+                break;
+        }
+
+        if (g == num_groups) {
+            memset(&groups[g], 0, sizeof(groups[g]));
+            groups[g].last = SIZE_MAX;
+            num_groups++;
+        }
+
+        groups[g].x |= t->x;
+        groups[g].z |= t->z;
+        prev[i] = groups[g].last;
+        groups[g].last = i;
+        groups[g].count++;
+        owner[i] = g;
+        num_rots++;
+    }
+
+    plan->layers = kvcalloc(max_t(size_t, num_groups, 1), sizeof(*plan->layers), GFP_KERNEL);
+    plan->rots = kvmalloc_array(max_t(size_t, num_rots, 1), sizeof(*plan->rots), GFP_KERNEL);
+    if (!plan->layers || !plan->rots)
+        goto out;
+
+    /*
+     * A tile spans the flipped qubits of its layer padded with the lowest
+     * other qubits, so small layers still gather runs of contiguous
+     * amplitudes.
+     */
+    for (g = 0; g < num_groups; g++) {
+        layer = &plan->layers[g];
+        layer->span = groups[g].x;
+        for (b = 0; b < num_qubits && hweight64(layer->span) < QUANTUM_EVOLVE_MAX_SPAN; b++)
+            layer->span |= 1ULL << b;
+        plan->max_span = max_t(unsigned int, plan->max_span, hweight64(layer->span));
+    }
+
+    for (i = 0; i < ham->num_terms; i++) {
+        if (owner[i] != SIZE_MAX)
+            groups[owner[i]].slot[evolve_classify(&ham->terms[i], plan->layers[owner[i]].span)]++;
+    }
+
+    /* Lay the layers out back to back, the class counts become the next free slots */
+    for (g = 0, num_rots = 0; g < num_groups; g++) {
+        layer = &plan->layers[g];
+        layer->first = num_rots;
+        layer->count = groups[g].count;
+        layer->num_inner = groups[g].slot[EVOLVE_INNER];
+        layer->num_cross = groups[g].slot[EVOLVE_CROSS];
+        layer->num_diag = layer->count - groups[g].slot[EVOLVE_FLIP];
+        for (c = 0; c < EVOLVE_CLASSES; c++) {
+            n = groups[g].slot[c];
+            groups[g].slot[c] = num_rots;
+            num_rots += n;
+        }
+    }
+
+    for (i = 0; i < ham->num_terms; i++) {
+        if (owner[i] == SIZE_MAX)
+            continue;
+
+        t = &ham->terms[i];
+        g = owner[i];
+        rot = &plan->rots[groups[g].slot[evolve_classify(t, plan->layers[g].span)]++];
+        rot->x = t->x;
+        rot->z = t->z;
+        rot->flip = evolve_gather(t->x, plan->layers[g].span);
+        rot->lz = evolve_gather(t->z, plan->layers[g].span);
+        rot->rad = (s64)t->coeff * time;
+        rot->quarter = (hweight64(t->x & t->z) + 3) & 3;
+    }
+
+    plan->num_layers = num_groups;
+    ret = 0;
+out:
+    if (ret < 0)
+        evolve_plan_free(plan);
+    kvfree(groups);
+    kvfree(prev);
+    return ret;
+}
+
+/* cos * a + sin * i^q * b */
+static __always_inline struct quantum_amp evolve_mix(struct quantum_amp a, struct quantum_amp b,
+                                                     s32 cos, s32 sin, unsigned int q)
+{
+    s64 re, im;
+
+    switch (q) {
+        case 0:
+            re = b.re;
+            im = b.im;
+            break;
+        case 1:
+            re = -(s64)b.im;
+            im = b.re;
+            break;
+        case 2:
+            re = -(s64)b.re;
+            im = -(s64)b.im;
+            break;
+        default:
+            re = b.im;
+            im = -(s64)b.re;
+            break;
+    }
+
+    a.re = ((s64)cos * a.re + sin * re) >> QAMP_SHIFT;
+    a.im = ((s64)cos * a.im + sin * im) >> QAMP_SHIFT;
+    return a;
+}
+
+/* The pairs of one rotation, inlined for each quarter turn */
+static __always_inline void evolve_rotate_pairs(struct quantum_amp *buf, size_t size,
+                                                const struct evolve_rot *rot, s32 sin,
+                                                unsigned int q)
+{
+    unsigned int pivot = __ffs(rot->flip);
+    struct quantum_amp a, b;
+    size_t h, r;
+
+    for (h = 0; h < size / 2; h++) {
+        r = ((h >> pivot) << (pivot + 1)) | (h & (((size_t)1 << pivot) - 1));
+        a = buf[r];
+        b = buf[r ^ rot->flip];
+        if (!rot->lz) {
+            buf[r] = evolve_mix(a, b, rot->cs.re, sin, q);
+            buf[r ^ rot->flip] = evolve_mix(b, a, rot->cs.re, sin, q);
+            continue;
+        }
+        buf[r] = evolve_mix(a, b, rot->cs.re,
+                            hweight_long((r ^ rot->flip) & rot->lz) & 1 ? -sin : sin, q);
+        buf[r ^ rot->flip] = evolve_mix(b, a, rot->cs.re,
+                                        hweight_long(r & rot->lz) & 1 ? -sin : sin, q);
+    }
+}
+
+/*
+ * exp(-i*theta*P) on a gathered tile. P maps |k> to i^y * (-1)^|k & z| |k ^ x>,
+ * so the pairs of the tile mix with a quarter-turn phase fixed by the term
+ * and a sign from the parity of the source index, split into the parity of
+ * the tile base and of the tile position.
+ */
+static void evolve_rotate(struct quantum_amp *buf, size_t size, size_t base,
+                          const struct evolve_rot *rot)
+{
+    s32 sin = hweight64(base & rot->z) & 1 ? -rot->cs.im : rot->cs.im;
+
+    switch (rot->quarter) {
+        case 0:
+            evolve_rotate_pairs(buf, size, rot, sin, 0);
+            break;
+        case 1:
+            evolve_rotate_pairs(buf, size, rot, sin, 1);
+            break;
+        case 2:
+            evolve_rotate_pairs(buf, size, rot, sin, 2);
+            break;
+        default:
+            evolve_rotate_pairs(buf, size, rot, sin, 3);
+            break;
+    }
+}
+
+/*
+ * One layer over a slice of tiles. A tile holds every amplitude reachable
+ * through the flipped qubits of the layer, so all of its terms run on a
+ * cache-resident copy and the state is read and written once.
+ */
+static void evolve_layer_worker(void *arg, unsigned int idx)
+{
+    struct evolve_job *job = arg;
+    const struct evolve_layer *layer = job->layer;
+    const struct evolve_rot *rots = job->rots + layer->first;
+    struct quantum_amp *buf = job->bufs + ((size_t)idx << job->span_bits);
+    size_t size = (size_t)1 << job->span_bits;
+    size_t g, r, j, base, end = min(job->tiles, (idx + 1) * job->slice);
+    struct evolve_phase cache[1 << EVOLVE_PHASE_BITS] = { { 0, { QAMP_ONE, 0 } } };
+    struct evolve_phase *phase;
+    u32 acc, outer;
+
+    for (g = idx * job->slice; g < end; g++) {
+        base = evolve_spread(g, layer->span);
+        for (r = 0; r < size; r++)
+            buf[r] = quantum_lanes_load(job->lanes, job->block_shift, base | job->offsets[r]);
+
+        /* Diagonal terms add up to a single phase per amplitude */
+        if (layer->num_diag) {
+            for (j = layer->num_inner + layer->num_cross, outer = 0; j < layer->num_diag; j++)
+                outer += hweight64(base & rots[j].z) & 1 ? rots[j].angle : -rots[j].angle;
+
+            for (r = 0; r < size; r++) {
+                acc = outer + job->inner[r];
+                for (j = layer->num_inner; j < layer->num_inner + layer->num_cross; j++) {
+                    acc += (hweight64(base & rots[j].z) ^ hweight_long(r & rots[j].lz)) & 1 ?
+                           rots[j].angle : -rots[j].angle;
+                }
+
+                phase = &cache[hash_32(acc, EVOLVE_PHASE_BITS)];
+                if (phase->angle != acc) {
+                    phase->angle = acc;
+                    phase->value = quantum_angle_twiddle(acc);
+                }
+                buf[r] = qamp_mul(buf[r], phase->value);
+            }
+        }
+
+        for (j = layer->num_diag; j < layer->count; j++)
+            evolve_rotate(buf, size, base, &rots[j]);
+
+        for (r = 0; r < size; r++)
+            quantum_lanes_store(job->lanes, job->block_shift, base | job->offsets[r], buf[r]);
+    }
+}
+
+/* Scheduling point between full-state passes, -EINTR once the caller is killed */
+static int evolve_yield(void)
+{
+    cond_resched();
+    return fatal_signal_pending(current) ? -EINTR : 0;
+}
+
+/* Run one layer for a step, or half a step */
+static int evolve_layer_run(struct evolve_job *job, const struct evolve_layer *layer,
+                            size_t dim, bool half)
+{
+    struct evolve_rot *rot;
+    size_t i, j;
+    int ret;
+
+    ret = evolve_yield();
+    if (ret < 0)
+        return ret;
+
+    for (i = 0; i < layer->count; i++) {
+        rot = &job->rots[layer->first + i];
+        rot->angle = evolve_turns(div_s64(rot->rad, job->steps) >> half);
+        rot->cs = quantum_angle_twiddle(rot->angle);
+    }
+
+    job->layer = layer;
+    job->span_bits = hweight64(layer->span);
+    for (i = 0; i < (size_t)1 << job->span_bits; i++) {
+        job->offsets[i] = evolve_scatter(i, layer->span);
+        for (j = 0, job->inner[i] = 0; j < layer->num_inner; j++) {
+            rot = &job->rots[layer->first + j];
+            job->inner[i] += hweight_long(i & rot->lz) & 1 ? rot->angle : -rot->angle;
+        }
+    }
+
+    job->tiles = dim >> job->span_bits;
+    job->workers = clamp_t(size_t, dim / QUANTUM_EVOLVE_MIN_SLICE, 1,
+                           min_t(size_t, job->tiles, quantum_parallel_width()));
+    job->slice = DIV_ROUND_UP(job->tiles, job->workers);
+    quantum_parallel_for(job->workers, evolve_layer_worker, job);
+    return 0;
+}
+
+/*
+ * Trotter steps over the layers. The second-order step runs the layers
+ * forward and back with half angles, the outermost layer of two steps in a
+ * row merges into one full pass.
+ */
+static int evolve_trotter(struct quantum_state *state, struct evolve_plan *plan,
+                          const struct quantum_evolution *evolution)
+{
+    struct evolve_job job = {
+        .lanes = quantum_state_lanes(state),
+        .block_shift = state->block_shift,
+        .rots = plan->rots,
+        .steps = evolution->steps,
+    };
+    size_t l, last = plan->num_layers - 1;
+    int ret = 0;
+    u32 step;
+
+    job.offsets = kvmalloc_array((size_t)1 << plan->max_span, sizeof(*job.offsets), GFP_KERNEL);
+    job.inner = kvmalloc_array((size_t)1 << plan->max_span, sizeof(*job.inner), GFP_KERNEL);
+    job.bufs = kvmalloc_array((size_t)quantum_parallel_width() << plan->max_span,
+                              sizeof(*job.bufs), GFP_KERNEL);
+    if (!job.offsets || !job.inner || !job.bufs) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    /* A single commuting layer is exact in one pass */
+    if (!last)
+        job.steps = 1;
+
+    for (step = 0; ret == 0 && step < job.steps; step++) {
+        if (evolution->method == QUANTUM_EVOLVE_TROTTER1 || !last) {
+            for (l = 0; ret == 0 && l <= last; l++)
+                ret = evolve_layer_run(&job, &plan->layers[l], state->dim, false);
+            continue;
+        }
+
+        for (l = step ? 1 : 0; ret == 0 && l < last; l++)
+            ret = evolve_layer_run(&job, &plan->layers[l], state->dim, true);
+        if (ret == 0)
+            ret = evolve_layer_run(&job, &plan->layers[last], state->dim, false);
+        for (l = last; ret == 0 && l-- > 0;)
+            ret = evolve_layer_run(&job, &plan->layers[l], state->dim,
+                                   l || step == job.steps - 1);
+    }
+
+out:
+    kvfree(job.offsets);
+    kvfree(job.inner);
+    kvfree(job.bufs);
+    return ret;
+}
+
+/* <u, w> in Q30 */
+static struct evolve_sum krylov_dot(const struct quantum_amp *u, const struct quantum_amp *w,
+                                    size_t dim)
+{
+    struct evolve_sum sum = { 0, 0 };
+    size_t k;
+
+    for (k = 0; k < dim; k++) {
+        sum.re += (s64)u[k].re * w[k].re + (s64)u[k].im * w[k].im;
+        sum.im += (s64)u[k].re * w[k].im - (s64)u[k].im * w[k].re;
+    }
+
+    sum.re >>= QAMP_SHIFT;
+    sum.im >>= QAMP_SHIFT;
+    return sum;
+}
+
+/* w = H * v / 2^shift in Q30, every term reads the partner amplitude it maps onto k */
+static void krylov_apply(const struct quantum_hamiltonian *ham, unsigned int shift,
+                         const struct quantum_amp *v, struct quantum_amp *w, size_t dim)
+{
+    const struct quantum_pauli_term *t;
+    struct evolve_sum sum;
+    struct quantum_amp a;
+    unsigned int q;
+    size_t k, j, src;
+
+    for (k = 0; k < dim; k++) {
+        sum.re = sum.im = 0;
+        for (j = 0; j < ham->num_terms; j++) {
+            t = &ham->terms[j];
+            src = k ^ t->x;
+            a = v[src];
+            q = hweight64(t->x & t->z) + 2 * (hweight64(src & t->z) & 1);
+            switch (q & 3) {
+                case 0:
+                    sum.re += (s64)t->coeff * a.re;
+                    sum.im += (s64)t->coeff * a.im;
+                    break;
+                case 1:
+                    sum.re -= (s64)t->coeff * a.im;
+                    sum.im += (s64)t->coeff * a.re;
+                    break;
+                case 2:
+                    sum.re -= (s64)t->coeff * a.re;
+                    sum.im -= (s64)t->coeff * a.im;
+                    break;
+                default:
+                    sum.re += (s64)t->coeff * a.im;
+                    sum.im -= (s64)t->coeff * a.re;
+                    break;
+            }
+        }
+        w[k].re = sum.re >> (QUANTUM_COEFF_SHIFT + shift);
+        w[k].im = sum.im >> (QUANTUM_COEFF_SHIFT + shift);
+    }
+}
+
+/*
+ * Lanczos on v[0] with full reorthogonalization. Fills the tridiagonal
+ * projection of H / 2^shift and returns the subspace size reached.
+ */
+static size_t krylov_lanczos(const struct quantum_hamiltonian *ham, unsigned int shift,
+                             struct quantum_amp *v, size_t dim, size_t m, s64 *alpha, s64 *beta)
+{
+    struct quantum_amp *w;
+    struct evolve_sum h;
+    size_t i, j, k;
+    u64 norm;
+
+    for (j = 0; j < m; j++) {
+        w = v + (j + 1) * dim;
+        krylov_apply(ham, shift, v + j * dim, w, dim);
+
+        for (i = 0; i <= j; i++) {
+            h = krylov_dot(v + i * dim, w, dim);
+            if (i == j)
+                alpha[j] = h.re;
+            for (k = 0; k < dim; k++) {
+                w[k].re -= (h.re * v[i * dim + k].re - h.im * v[i * dim + k].im) >> QAMP_SHIFT;
+                w[k].im -= (h.re * v[i * dim + k].im + h.im * v[i * dim + k].re) >> QAMP_SHIFT;
+            }
+        }
+
+        if (j == m - 1)
+            break;
+
+        for (k = 0, norm = 0; k < dim; k++)
+            norm += (s64)w[k].re * w[k].re + (s64)w[k].im * w[k].im;
+        beta[j + 1] = int_sqrt64(norm);
+        if (beta[j + 1] < EVOLVE_KRYLOV_BREAKDOWN)
+            return j + 1;
+
+        for (k = 0; k < dim; k++) {
+            w[k].re = div64_s64((s64)w[k].re << QAMP_SHIFT, beta[j + 1]);
+            w[k].im = div64_s64((s64)w[k].im << QAMP_SHIFT, beta[j + 1]);
+        }
+    }
+
+    return m;
+}
+
+/* (T * u)_l of the tridiagonal projection */
+static struct evolve_sum krylov_tri(const s64 *alpha, const s64 *beta, const struct evolve_sum *u,
+                                    size_t size, size_t l)
+{
+    struct evolve_sum r;
+
+    r.re = alpha[l] * u[l].re;
+    r.im = alpha[l] * u[l].im;
+    if (l) {
+        r.re += beta[l] * u[l - 1].re;
+        r.im += beta[l] * u[l - 1].im;
+    }
+    if (l + 1 < size) {
+        r.re += beta[l + 1] * u[l + 1].re;
+        r.im += beta[l + 1] * u[l + 1].im;
+    }
+
+    r.re >>= QAMP_SHIFT;
+    r.im >>= QAMP_SHIFT;
+    return r;
+}
+
+/*
+ * y = exp(-i * T * tau) e1 for tau in Q30. The step is cut into pieces of
+ * norm at most 1/2, each a truncated Taylor series on the small vector.
+ */
+static void krylov_expm(const s64 *alpha, const s64 *beta, size_t size, u64 tau,
+                       struct evolve_sum *y)
+{
+    struct evolve_sum term[QUANTUM_KRYLOV_MAX_DIM], next[QUANTUM_KRYLOV_MAX_DIM], tu;
+    u64 pieces = max_t(u64, DIV_ROUND_UP_ULL(tau, QAMP_ONE / 2), 1);
+    s64 piece = div64_u64(tau, pieces);
+    unsigned int n;
+    size_t l;
+    bool zero;
+    u64 p;
+
+    memset(y, 0, size * sizeof(*y));
+    y[0].re = QAMP_ONE;
+
+    for (p = 0; p < pieces; p++) {
+        memcpy(term, y, size * sizeof(*y));
+        for (n = 1; n <= EVOLVE_TAYLOR_TERMS; n++) {
+            /* term = -i * T * piece * term / n */
+            for (l = 0, zero = true; l < size; l++) {
+                tu = krylov_tri(alpha, beta, term, size, l);
+                next[l].re = div_s64((tu.im * piece) >> QAMP_SHIFT, n);
+                next[l].im = div_s64(-(tu.re * piece) >> QAMP_SHIFT, n);
+                zero &= !next[l].re && !next[l].im;
+            }
+            if (zero)
+                break;
+
+            for (l = 0; l < size; l++) {
+                term[l] = next[l];
+                y[l].re += next[l].re;
+                y[l].im += next[l].im;
+            }
+        }
+    }
+}
+
+/*
+ * Krylov steps: project H on the Lanczos basis of the current state and
+ * exponentiate the small tridiagonal matrix. H is scaled to a norm of at
+ * most 1/4 so every Lanczos vector stays within the Q2.30 range.
+ */
+static int evolve_krylov(struct quantum_state *state, const struct quantum_hamiltonian *ham,
+                         const struct quantum_evolution *evolution, u64 norm)
+{
+    size_t m = evolution->krylov_dim ?: QUANTUM_KRYLOV_DEFAULT_DIM;
+    s64 alpha[QUANTUM_KRYLOV_MAX_DIM], beta[QUANTUM_KRYLOV_MAX_DIM];
+    struct evolve_sum y[QUANTUM_KRYLOV_MAX_DIM], sum;
+    size_t dim = state->dim, size, j, k;
+    unsigned int shift = 0;
+    struct quantum_amp *v;
+    u64 tau, sq;
+    s64 scale;
+    u32 step;
+    int ret;
+
+    if (m > QUANTUM_KRYLOV_MAX_DIM || state->num_qubits > QUANTUM_KRYLOV_MAX_QUBITS)
+        return -EINVAL;
+
+    while (norm << 2 > (u64)1 << (QUANTUM_COEFF_SHIFT + shift))
+        shift++;
+
+    /* Step length in Q30 units of the scaled Hamiltonian */
+    tau = div_u64((u64)evolution->time << (QAMP_SHIFT - QUANTUM_COEFF_SHIFT + shift),
+                  evolution->steps);
+    if (tau > (u64)QUANTUM_EVOLVE_MAX_STEPS << (QAMP_SHIFT - 1))
+        return -EINVAL;
+
+    v = kvmalloc_array((m + 1) * dim, sizeof(*v), GFP_KERNEL);
+    if (!v)
+        return -ENOMEM;
+
+    ret = quantum_state_save(state, v);
+    for (step = 0; ret == 0 && step < evolution->steps; step++) {
+        ret = evolve_yield();
+        if (ret < 0)
+            break;
+
+        for (k = 0, sq = 0; k < dim; k++)
+            sq += (s64)v[k].re * v[k].re + (s64)v[k].im * v[k].im;
+        scale = int_sqrt64(sq);
+        if (!scale) {
+            ret = -EIO;
+            break;
+        }
+
+        for (k = 0; k < dim; k++) {
+            v[k].re = div64_s64((s64)v[k].re << QAMP_SHIFT, scale);
+            v[k].im = div64_s64((s64)v[k].im << QAMP_SHIFT, scale);
+        }
+
+        size = krylov_lanczos(ham, shift, v, dim, m, alpha, beta);
+        krylov_expm(alpha, beta, size, tau, y);
+
+        /* v[0] = scale * sum of y_j v[j], each amplitude only reads its own index */
+        for (k = 0; k < dim; k++) {
+            sum.re = sum.im = 0;
+            for (j = 0; j < size; j++) {
+                sum.re += y[j].re * v[j * dim + k].re - y[j].im * v[j * dim + k].im;
+                sum.im += y[j].re * v[j * dim + k].im + y[j].im * v[j * dim + k].re;
+            }
+            v[k].re = ((sum.re >> QAMP_SHIFT) * scale) >> QAMP_SHIFT;
+            v[k].im = ((sum.im >> QAMP_SHIFT) * scale) >> QAMP_SHIFT;
+        }
+    }
+
+    if (ret == 0)
+        ret = quantum_state_restore(state, v);
+
+    kvfree(v);
+    return ret;
+}
+
+/* Check the Hamiltonian against the state, returns the sum of |coeff| or -EINVAL */
+static s64 evolve_validate(const struct quantum_state *state, const struct quantum_hamiltonian *ham,
+                           const struct quantum_evolution *evolution)
+{
+    u64 mask, norm = 0;
+    size_t i;
+
+    if (!state || !ham || !evolution || (ham->num_terms && !ham->terms))
+        return -EINVAL;
+
+    if (ham->num_qubits > state->num_qubits || ham->num_terms > QUANTUM_HAMILTONIAN_MAX_TERMS ||
+        evolution->method > QUANTUM_EVOLVE_KRYLOV || evolution->steps == 0 ||
+        evolution->steps > QUANTUM_EVOLVE_MAX_STEPS)
+        return -EINVAL;
+
+    mask = ((u64)1 << ham->num_qubits) - 1;
+    for (i = 0; i < ham->num_terms; i++) {
+        if ((ham->terms[i].x | ham->terms[i].z) & ~mask)
+            return -EINVAL;
+        norm += abs((s64)ham->terms[i].coeff);
+    }
+
+    return norm < (1ULL << 31) ? (s64)norm : -EINVAL;
+}
+
+/* Apply exp(-i*H*time) by Trotter steps over commuting layers or Krylov steps */
+int quantum_state_evolve(struct quantum_state *state, const struct quantum_hamiltonian *ham,
+                         const struct quantum_evolution *evolution)
+{
+    struct evolve_plan plan;
+    s64 norm;
+    int ret;
+
+    norm = evolve_validate(state, ham, evolution);
+    if (norm < 0)
+        return norm;
+
+    if (!norm || !evolution->time)
+        return 0;
+
+    if (state->repr == QUANTUM_REPR_DD || state->repr == QUANTUM_REPR_REAL) {
+        ret = quantum_state_convert(state, QUANTUM_REPR_DENSE);
+        if (ret < 0)
+            return ret;
+    }
+
+    if (evolution->method == QUANTUM_EVOLVE_KRYLOV)
+        return evolve_krylov(state, ham, evolution, norm);
+
+    ret = evolve_plan_build(&plan, ham, state->num_qubits, evolution->time);
+    if (ret < 0)
+        return ret;
+
+    quantum_state_changed(state);
+    ret = evolve_trotter(state, &plan, evolution);
+
+    evolve_plan_free(&plan);
+    return ret;
+}
+
+/* Amplitude i of a dense, split or real state */
+static inline struct quantum_amp expect_load(const struct quantum_state *state, size_t i)
+{
+    struct quantum_amp a = { 0, 0 };
+
+    if (state->repr == QUANTUM_REPR_REAL) {
+        a.re = state->re[i];
+        return a;
+    }
+
+    return quantum_lanes_load(quantum_state_lanes(state), state->block_shift, i);
+}
+
+static int expect_cmp_flip(const void *a, const void *b)
+{
+    const struct quantum_pauli_term *s = a, *t = b;
+
+    return s->x < t->x ? -1 : s->x > t->x;
+}
+
+/*
+ * <psi|P|psi> = sum_k conj(a_k) * i^(number of Y) * (-1)^|(k^x)&z| * a_(k^x)
+ * for every term of the group, the product of the amplitude pair is shared.
+ */
+static void expect_worker(void *arg, unsigned int idx)
+{
+    struct expect_job *job = arg;
+    const struct quantum_state *state = job->state;
+    const struct quantum_pauli_term *t;
+    s64 *sums = job->sums + idx * job->count;
+    u64 x = job->terms[0].x;
+    size_t k, j, end = min(state->dim, (idx + 1) * job->slice);
+    struct quantum_amp a, b;
+    s64 re, im, v;
+
+    for (k = idx * job->slice; k < end; k++) {
+        a = expect_load(state, k);
+        b = x ? expect_load(state, k ^ x) : a;
+        re = ((s64)a.re * b.re + (s64)a.im * b.im) >> QAMP_SHIFT;
+        im = ((s64)a.re * b.im - (s64)a.im * b.re) >> QAMP_SHIFT;
+
+        for (j = 0; j < job->count; j++) {
+            t = &job->terms[j];
+            switch (hweight64(x & t->z) & 3) {
+                case 0:
+                    v = re;
+                    break;
+                case 1:
+                    v = -im;
+                    break;
+                case 2:
+                    v = -re;
+                    break;
+                default:
+                    v = im;
+                    break;
+            }
+            sums[j] += hweight64((k ^ x) & t->z) & 1 ? -v : v;
+        }
+    }
+}
+
+/* Sum of coeff * <psi|P|psi> in Q16, one pass per distinct flip mask */
+int quantum_state_expectation(struct quantum_state *state, const struct quantum_hamiltonian *ham,
+                              s64 *energy)
+{
+    struct quantum_evolution probe = { .steps = 1 };
+    struct expect_job job = { .state = state };
+    struct quantum_pauli_term *terms;
+    unsigned int workers;
+    size_t i, j, w;
+    s64 norm, total = 0;
+
+    norm = evolve_validate(state, ham, &probe);
+    if (norm < 0 || !energy || state->repr == QUANTUM_REPR_DD)
+        return -EINVAL;
+
+    *energy = 0;
+    if (!ham->num_terms)
+        return 0;
+
+    terms = kvmalloc_array(ham->num_terms, sizeof(*terms), GFP_KERNEL);
+    workers = clamp_t(size_t, state->dim / QUANTUM_EVOLVE_MIN_SLICE, 1, quantum_parallel_width());
+    job.sums = kvmalloc_array((size_t)workers * ham->num_terms, sizeof(*job.sums), GFP_KERNEL);
+    if (!terms || !job.sums) {
+        kvfree(terms);
+        kvfree(job.sums);
+        return -ENOMEM;
+    }
+
+    memcpy(terms, ham->terms, ham->num_terms * sizeof(*terms));
+    sort(terms, ham->num_terms, sizeof(*terms), expect_cmp_flip, NULL);
+    job.slice = DIV_ROUND_UP(state->dim, workers);
+
+    for (i = 0; i < ham->num_terms; i += job.count) {
+        job.terms = &terms[i];
+        for (job.count = 1; i + job.count < ham->num_terms &&
+             terms[i + job.count].x == terms[i].x; job.count++)
+            ;
+
+        memset(job.sums, 0, (size_t)workers * job.count * sizeof(*job.sums));
+        quantum_parallel_for(workers, expect_worker, &job);
+
+        for (j = 0; j < job.count; j++) {
+            for (w = 1; w < workers; w++)
+                job.sums[j] += job.sums[w * job.count + j];
+            total += job.terms[j].coeff * job.sums[j];
+        }
+    }
+
+    *energy = total >> QAMP_SHIFT;
+
+    kvfree(job.sums);
+    kvfree(terms);
+    return 0;
+}
@@ -0,0 +1,281 @@
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/random.h>
+#include <linux/prandom.h>
+#include <linux/bitmap.h>
+#include <linux/bitops.h>
+#include "../include/quantum.h"
+#include "../include/quantum_frame.h"
+
+enum { FRAME_DATA, FRAME_GATE, FRAME_MEASURE };
+
+/* Angle is a whole number of the given turn fraction */
+static bool frame_angle_in(u32 angle, u32 step)
+{
+    return angle % step == 0;
+}
+
+/* Gates that map Pauli errors to Pauli errors */
+static bool frame_op_is_clifford(const struct quantum_op *op)
+{
+    switch (op->gate) {
+        case QUANTUM_GATE_I:
+        case QUANTUM_GATE_H:
+        case QUANTUM_GATE_X:
+        case QUANTUM_GATE_Y:
+        case QUANTUM_GATE_Z:
+        case QUANTUM_GATE_CNOT:
+        case QUANTUM_GATE_CZ:
+        case QUANTUM_GATE_SWAP:
+            return true;
+        case QUANTUM_GATE_PHASE:
+            return frame_angle_in(op->angle, QUANTUM_ANGLE_TURN / 4);
+        case QUANTUM_GATE_RX:
+        case QUANTUM_GATE_RY:
+        case QUANTUM_GATE_RZ:
+        case QUANTUM_GATE_CPHASE:
+            return frame_angle_in(op->angle, QUANTUM_ANGLE_TURN / 2);
+        default:
+            return false;
+    }
+}
+
+static u64 frame_threshold(u32 ppm)
+{
+    return div_u64((u64)min_t(u32, ppm, QEC_PPM) << 32, QEC_PPM);
+}
+
+int qec_frame_init(struct qec_frame *frame, const struct qec_code *code, unsigned int shots,
+                   const struct qec_frame_noise *noise, u64 seed)
+{
+    const struct quantum_op *op;
+    size_t i;
+
+    memset(frame, 0, sizeof(*frame));
+    if (!code || !noise || shots == 0 || shots > QEC_FRAME_MAX_SHOTS ||
+        (!code->circuit && code->num_data > QEC_MAX_DATA_QUBITS))
+        return -EINVAL;
+
+    frame->code = code;
+    frame->num_qubits = code->num_data + code->num_ancillas;
+    frame->num_checks = code->circuit ? code->num_ancillas : code->num_stabilizers;
+    frame->words = DIV_ROUND_UP(shots, QEC_FRAME_WORD_SHOTS);
+    for (i = 0; i < code->circuit_len && code->circuit; i++) {
+        op = &code->circuit[i];
+        if (!frame_op_is_clifford(op) || op->qubit < 0 || op->qubit >= frame->num_qubits)
+            return -EINVAL;
+        if (op->gate >= QUANTUM_GATE_CNOT && op->gate <= QUANTUM_GATE_SWAP &&
+            (op->target < 0 || op->target >= frame->num_qubits || op->target == op->qubit))
+            return -EINVAL;
+    }
+
+    frame->thresholds[FRAME_DATA] = frame_threshold(noise->data_ppm);
+    frame->thresholds[FRAME_GATE] = frame_threshold(noise->gate_ppm);
+    frame->thresholds[FRAME_MEASURE] = frame_threshold(noise->measure_ppm);
+    prandom_seed_state(&frame->rnd, seed ? seed : get_random_u64());
+
+    frame->x = kvcalloc((size_t)frame->num_qubits * frame->words, sizeof(u64), GFP_KERNEL);
+    frame->z = kvcalloc((size_t)frame->num_qubits * frame->words, sizeof(u64), GFP_KERNEL);
+    frame->last = kvcalloc((size_t)frame->num_checks * frame->words, sizeof(u64), GFP_KERNEL);
+    if (!frame->x || !frame->z || !frame->last) {
+        qec_frame_free(frame);
+        return -ENOMEM;
+    }
+
+    return 0;
+}
+
+void qec_frame_free(struct qec_frame *frame)
+{
+    kvfree(frame->x);
+    kvfree(frame->z);
+    kvfree(frame->last);
+    memset(frame, 0, sizeof(*frame));
+}
+
+static u64 frame_random(struct qec_frame *frame)
+{
+    return (u64)prandom_u32_state(&frame->rnd) << 32 | prandom_u32_state(&frame->rnd);
+}
+
+/*
+ * 64 independent draws below a Q32 threshold, compared bit-sliced from the
+ * most significant bit down. A lane is settled by the first bit where its
+ * random number and the threshold differ, so small rates need only a few
+ * random words before every lane is settled.
+ */
+static u64 frame_bernoulli(struct qec_frame *frame, u64 threshold)
+{
+    u64 open = ~0ULL, below = 0, r;
+    int b;
+
+    if (threshold >> 32)
+        return ~0ULL;
+
+    for (b = 31; b >= 0 && open && threshold; b--) {
+        r = frame_random(frame);
+        if (threshold & BIT_ULL(b)) {
+            below |= open & ~r;
+            open &= r;
+        } else {
+            open &= ~r;
+        }
+    }
+
+    return below;
+}
+
+/* X, Y or Z with equal odds on every lane of a fault mask */
+static void frame_depolarize(struct qec_frame *frame, unsigned int qubit, u64 threshold)
+{
+    u64 *x = frame->x + (size_t)qubit * frame->words;
+    u64 *z = frame->z + (size_t)qubit * frame->words;
+    u64 open, hit, a, b;
+    unsigned int w;
+
+    for (w = 0; w < frame->words; w++) {
+        for (open = frame_bernoulli(frame, threshold); open; open &= ~hit) {
+            a = frame_random(frame);
+            b = frame_random(frame);
+            hit = open & (a | b);
+            x[w] ^= hit & a;
+            z[w] ^= hit & b;
+        }
+    }
+}
+
+/* Conjugate the frames of every shot through one gate */
+static void frame_apply_op(struct qec_frame *frame, const struct quantum_op *op)
+{
+    unsigned int words = frame->words, w;
+    size_t a = (size_t)op->qubit * words;
+    size_t b = op->target >= 0 ? (size_t)op->target * words : a;
+    u64 *xa = frame->x + a, *za = frame->z + a, *xb = frame->x + b, *zb = frame->z + b;
+
+    switch (op->gate) {
+        case QUANTUM_GATE_H:
+            for (w = 0; w < words; w++)
+                swap(xa[w], za[w]);
+            break;
+        case QUANTUM_GATE_PHASE:
+            if (frame_angle_in(op->angle, QUANTUM_ANGLE_TURN / 2))
+                break;
+            for (w = 0; w < words; w++)
+                za[w] ^= xa[w];
+            break;
+        case QUANTUM_GATE_CNOT:
+            for (w = 0; w < words; w++) {
+                xb[w] ^= xa[w];
+                za[w] ^= zb[w];
+            }
+            break;
+        case QUANTUM_GATE_CPHASE:
+            if (frame_angle_in(op->angle, QUANTUM_ANGLE_TURN))
+                break;
+            fallthrough;
+        case QUANTUM_GATE_CZ:
+            for (w = 0; w < words; w++) {
+                za[w] ^= xb[w];
+                zb[w] ^= xa[w];
+            }
+            break;
+        case QUANTUM_GATE_SWAP:
+            for (w = 0; w < words; w++) {
+                swap(xa[w], xb[w]);
+                swap(za[w], zb[w]);
+            }
+            break;
+        default:
+            /* Paulis and half-turn rotations commute with the frame up to phase */
+            break;
+    }
+}
+
+/* Readout flips of one round, the circuit leaves check k on ancilla num_data + k */
+static void frame_read(struct qec_frame *frame, unsigned int k, u64 *flips)
+{
+    const struct qec_code *code = frame->code;
+    const struct qec_stabilizer *stab;
+    unsigned int words = frame->words, q, w;
+    u64 mask;
+
+    if (code->circuit) {
+        q = code->num_data + k;
+        for (w = 0; w < words; w++) {
+            flips[w] = frame->x[(size_t)q * words + w];
+            frame->x[(size_t)q * words + w] = 0;
+            frame->z[(size_t)q * words + w] = 0;
+        }
+        return;
+    }
+
+    stab = &code->stabilizers[k];
+    memset(flips, 0, words * sizeof(u64));
+    for (mask = stab->z; mask; mask &= mask - 1)
+        for (q = __ffs64(mask), w = 0; w < words; w++)
+            flips[w] ^= frame->x[(size_t)q * words + w];
+    for (mask = stab->x; mask; mask &= mask - 1)
+        for (q = __ffs64(mask), w = 0; w < words; w++)
+            flips[w] ^= frame->z[(size_t)q * words + w];
+}
+
+/* Rounds of noisy extraction, detectors are readout changes between rounds */
+int qec_frame_sample(struct qec_frame *frame, unsigned int rounds, u64 *detectors)
+{
+    const struct qec_code *code = frame->code;
+    unsigned int words = frame->words, t, k, q, w;
+    u64 flips[QEC_FRAME_MAX_WORDS], *last, *det;
+    const struct quantum_op *op;
+    size_t i;
+
+    if (!frame->x || !detectors || rounds == 0)
+        return -EINVAL;
+
+    memset(frame->x, 0, (size_t)frame->num_qubits * words * sizeof(u64));
+    memset(frame->z, 0, (size_t)frame->num_qubits * words * sizeof(u64));
+    memset(frame->last, 0, (size_t)frame->num_checks * words * sizeof(u64));
+
+    for (t = 0; t < rounds; t++) {
+        for (q = 0; q < code->num_data && frame->thresholds[FRAME_DATA]; q++)
+            frame_depolarize(frame, q, frame->thresholds[FRAME_DATA]);
+
+        for (i = 0; i < code->circuit_len && code->circuit; i++) {
+            op = &code->circuit[i];
+            frame_apply_op(frame, op);
+            if (op->gate < QUANTUM_GATE_CNOT || op->gate > QUANTUM_GATE_SWAP ||
+                !frame->thresholds[FRAME_GATE])
+                continue;
+            frame_depolarize(frame, op->qubit, frame->thresholds[FRAME_GATE]);
+            frame_depolarize(frame, op->target, frame->thresholds[FRAME_GATE]);
+        }
+
+        for (k = 0; k < frame->num_checks; k++) {
+            frame_read(frame, k, flips);
+            last = frame->last + (size_t)k * words;
+            det = detectors + ((size_t)t * frame->num_checks + k) * words;
+            for (w = 0; w < words; w++) {
+                if (t + 1 < rounds)
+                    flips[w] ^= frame_bernoulli(frame, frame->thresholds[FRAME_MEASURE]);
+                det[w] = flips[w] ^ last[w];
+                last[w] = flips[w];
+            }
+        }
+    }
+
+    return 0;
+}
+
+/* Unpack the data frame of one shot */
+void qec_frame_errors(const struct qec_frame *frame, unsigned int shot, bool z,
+                      unsigned long *errors)
+{
+    const u64 *bits = (z ? frame->z : frame->x) + shot / QEC_FRAME_WORD_SHOTS;
+    u64 lane = BIT_ULL(shot % QEC_FRAME_WORD_SHOTS);
+    unsigned int q;
+
+    bitmap_zero(errors, frame->code->num_data);
+    for (q = 0; q < frame->code->num_data; q++)
+        if (bits[(size_t)q * frame->words] & lane)
+            __set_bit(q, errors);
+}
@@ -0,0 +1,351 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/string.h>
+#include <linux/log2.h>
+#include <linux/sched/signal.h>
+#include "../include/ctrlxt_kernel.h"
+#include "../include/quantum.h"
+#include "../include/quantum_hybrid.h"
+
+/* Step kinds of an executable plan */
+#define HYBRID_STEP_LOW  0  /* gate local to qubits [0, split) */
+#define HYBRID_STEP_HIGH 1  /* gate local to qubits [split, n) */
+#define HYBRID_STEP_CUT  2  /* gate crossing the split */
+
+/*
+ * A cut gate is decomposed as P0(a) x I + P1(a) x U(b): path term t projects
+ * qubit a onto |t> and, for t == 1, applies U to qubit b on the other half.
+ */
+struct hybrid_step {
+    unsigned int kind;
+    unsigned int proj_half;     /* half holding the projected qubit */
+    int proj_qubit;             /* local index of the projected qubit */
+    struct quantum_op op;       /* local gate, or U for a cut */
+};
+
+struct hybrid_plan {
+    unsigned int split;
+    unsigned int num_qubits;
+    unsigned int num_cuts;
+    size_t num_steps;
+    struct hybrid_step *steps;
+};
+
+/* Shared state of one path-sum job */
+struct hybrid_job {
+    const struct hybrid_plan *plan;
+    const u64 *indices;
+    size_t count;
+    u64 num_paths;
+    unsigned int workers;
+    s64 *acc;                   /* workers x count x {re, im} */
+    struct task_struct *owner;  /* caller, whose fatal signal ends the run */
+    int error;
+};
+
+static bool is_two_qubit(enum quantum_gate_type gate)
+{
+    return gate >= QUANTUM_GATE_CNOT && gate <= QUANTUM_GATE_SWAP;
+}
+
+static bool crosses_split(const struct quantum_op *op, unsigned int split)
+{
+    return is_two_qubit(op->gate) && ((op->qubit < split) != (op->target < split));
+}
+
+/* Number of Schmidt terms of the split gates, as a power of two */
+static unsigned int count_cuts(const struct quantum_circuit *circuit, unsigned int split)
+{
+    unsigned int cuts = 0;
+    size_t i;
+
+    for (i = 0; i < circuit->num_ops; i++) {
+        if (!crosses_split(&circuit->ops[i], split))
+            continue;
+        /* A SWAP across the split is executed as three CNOTs */
+        cuts += circuit->ops[i].gate == QUANTUM_GATE_SWAP ? 3 : 1;
+    }
+
+    return cuts;
+}
+
+/* Pick the cheapest contiguous split */
+unsigned int quantum_hybrid_choose_split(const struct quantum_circuit *circuit,
+                                         unsigned int *num_cuts)
+{
+    unsigned int n, split, cuts, best = 0, best_cuts = 0;
+    u64 cost, best_cost = U64_MAX;
+
+    if (!circuit || circuit->num_qubits < 2 ||
+        circuit->num_qubits > QUANTUM_HYBRID_MAX_QUBITS)
+        return 0;
+
+    n = circuit->num_qubits;
+    for (split = 1; split < n; split++) {
+        if (split > QUANTUM_STATE_MAX_QUBITS || n - split > QUANTUM_STATE_MAX_QUBITS)
+            continue;
+
+        cuts = count_cuts(circuit, split);
+        if (cuts > QUANTUM_HYBRID_MAX_CUTS)
+            continue;
+
+        /* Work per path is one pass over each half */
+        cost = (1ULL << cuts) * ((1ULL << split) + (1ULL << (n - split)));
+        if (cost < best_cost) {
+            best_cost = cost;
+            best = split;
+            best_cuts = cuts;
+        }
+    }
+
+    if (num_cuts)
+        *num_cuts = best_cuts;
+    return best;
+}
+
+/* Rewrite a cut gate as projector on a and U on b */
+static void plan_cut(struct hybrid_step *step, unsigned int split,
+                     enum quantum_gate_type gate, int a, int b, u32 angle)
+{
+    step->kind = HYBRID_STEP_CUT;
+    step->proj_half = a >= split;
+    step->proj_qubit = a >= split ? a - split : a;
+
+    memset(&step->op, 0, sizeof(step->op));
+    step->op.qubit = b >= split ? b - split : b;
+    step->op.target = -1;
+    step->op.angle = angle;
+
+    switch (gate) {
+        case QUANTUM_GATE_CNOT:
+            step->op.gate = QUANTUM_GATE_X;
+            break;
+        case QUANTUM_GATE_CZ:
+            step->op.gate = QUANTUM_GATE_Z;
+            break;
+        default: /* CPHASE */
+            step->op.gate = QUANTUM_GATE_PHASE;
+            break;
+    }
+}
+
+static int hybrid_plan_build(struct hybrid_plan *plan, const struct quantum_circuit *circuit,
+                             unsigned int split)
+{
+    const struct quantum_op *op;
+    struct hybrid_step *step;
+    size_t i;
+
+    plan->split = split;
+    plan->num_qubits = circuit->num_qubits;
+    plan->num_cuts = count_cuts(circuit, split);
+    if (plan->num_cuts > QUANTUM_HYBRID_MAX_CUTS)
+        return -E2BIG;
+
+    plan->steps = kvcalloc(circuit->num_ops + 2 * plan->num_cuts,
+                           sizeof(*plan->steps), GFP_KERNEL);
+    if (!plan->steps)
+        return -ENOMEM;
+
+    step = plan->steps;
+    for (i = 0; i < circuit->num_ops; i++) {
+        op = &circuit->ops[i];
+
+        /* Macro gates span a whole register and have no cut decomposition */
+        if (quantum_gate_is_macro(op->gate)) {
+            kvfree(plan->steps);
+            return -EOPNOTSUPP;
+        }
+
+        if (op->qubit < 0 || op->qubit >= circuit->num_qubits ||
+            (is_two_qubit(op->gate) &&
+             (op->target < 0 || op->target >= circuit->num_qubits))) {
+            kvfree(plan->steps);
+            return -EINVAL;
+        }
+
+        if (!crosses_split(op, split)) {
+            step->kind = op->qubit < split ? HYBRID_STEP_LOW : HYBRID_STEP_HIGH;
+            step->op = *op;
+            if (step->kind == HYBRID_STEP_HIGH) {
+                step->op.qubit -= split;
+                if (is_two_qubit(op->gate))
+                    step->op.target -= split;
+            }
+            step++;
+            continue;
+        }
+
+        if (op->gate == QUANTUM_GATE_SWAP) {
+            plan_cut(step++, split, QUANTUM_GATE_CNOT, op->qubit, op->target, 0);
+            plan_cut(step++, split, QUANTUM_GATE_CNOT, op->target, op->qubit, 0);
+            plan_cut(step++, split, QUANTUM_GATE_CNOT, op->qubit, op->target, 0);
+        } else {
+            plan_cut(step++, split, op->gate, op->qubit, op->target, op->angle);
+        }
+    }
+
+    plan->num_steps = step - plan->steps;
+    return 0;
+}
+
+/* Simulate one path, returns false when the path has zero weight */
+static bool hybrid_run_path(const struct hybrid_plan *plan, u64 path,
+                            struct quantum_state *half[2], int *error)
+{
+    const struct hybrid_step *step;
+    unsigned int cut = 0, term;
+    size_t i;
+    int ret;
+
+    quantum_state_init(half[0], 0);
+    quantum_state_init(half[1], 0);
+
+    for (i = 0; i < plan->num_steps; i++) {
+        step = &plan->steps[i];
+
+        if (step->kind != HYBRID_STEP_CUT) {
+            ret = quantum_state_apply_op(half[step->kind], &step->op);
+            if (ret < 0) {
+                *error = ret;
+                return false;
+            }
+            continue;
+        }
+
+        term = (path >> cut++) & 1;
+        if (!quantum_state_project(half[step->proj_half], step->proj_qubit, term))
+            return false;
+
+        if (term) {
+            ret = quantum_state_apply_op(half[!step->proj_half], &step->op);
+            if (ret < 0) {
+                *error = ret;
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+static void hybrid_worker(void *arg, unsigned int idx)
+{
+    struct hybrid_job *job = arg;
+    const struct hybrid_plan *plan = job->plan;
+    struct quantum_state *half[2];
+    s64 *acc = job->acc + (size_t)idx * job->count * 2;
+    u64 low_mask = (1ULL << plan->split) - 1;
+    u64 path, first, last;
+    struct quantum_amp a;
+    int error = 0;
+    size_t i;
+
+    first = div_u64(job->num_paths * idx, job->workers);
+    last = div_u64(job->num_paths * (idx + 1), job->workers);
+    if (first == last)
+        return;
+
+    half[0] = quantum_state_alloc(plan->split);
+    half[1] = quantum_state_alloc(plan->num_qubits - plan->split);
+    if (!half[0] || !half[1]) {
+        WRITE_ONCE(job->error, -ENOMEM);
+        goto out;
+    }
+
+    for (path = first; path < last && !READ_ONCE(job->error); path++) {
+        cond_resched();
+        if (fatal_signal_pending(job->owner)) {
+            WRITE_ONCE(job->error, -EINTR);
+            goto out;
+        }
+
+        if (!hybrid_run_path(plan, path, half, &error)) {
+            if (error) {
+                WRITE_ONCE(job->error, error);
+                goto out;
+            }
+            continue;
+        }
+
+        for (i = 0; i < job->count; i++) {
+            a = qamp_mul(half[0]->amps[job->indices[i] & low_mask],
+                         half[1]->amps[job->indices[i] >> plan->split]);
+            acc[2 * i] += a.re;
+            acc[2 * i + 1] += a.im;
+        }
+    }
+
+out:
+    quantum_state_free(half[0]);
+    quantum_state_free(half[1]);
+}
+
+/* Amplitudes via Schrödinger-Feynman path sum */
+int quantum_hybrid_amplitudes(const struct quantum_circuit *circuit, unsigned int split,
+                              const u64 *indices, size_t count, struct quantum_amp *out)
+{
+    struct hybrid_plan plan;
+    struct hybrid_job job;
+    unsigned int w;
+    s64 re, im;
+    size_t i;
+    int ret;
+
+    if (!circuit || !indices || !out || count == 0 ||
+        circuit->num_qubits < 2 || circuit->num_qubits > QUANTUM_HYBRID_MAX_QUBITS)
+        return -EINVAL;
+
+    for (i = 0; i < count; i++) {
+        if (indices[i] >> circuit->num_qubits)
+            return -EINVAL;
+    }
+
+    if (split == 0) {
+        split = quantum_hybrid_choose_split(circuit, NULL);
+        if (split == 0)
+            return -E2BIG;
+    }
+
+    if (split >= circuit->num_qubits || split > QUANTUM_STATE_MAX_QUBITS ||
+        circuit->num_qubits - split > QUANTUM_STATE_MAX_QUBITS)
+        return -EINVAL;
+
+    ret = hybrid_plan_build(&plan, circuit, split);
+    if (ret < 0)
+        return ret;
+
+    job.plan = &plan;
+    job.indices = indices;
+    job.count = count;
+    job.num_paths = 1ULL << plan.num_cuts;
+    job.workers = min_t(u64, quantum_parallel_width(), job.num_paths);
+    job.owner = current;
+    job.error = 0;
+    job.acc = kvcalloc(job.workers * count * 2, sizeof(s64), GFP_KERNEL);
+    if (!job.acc) {
+        kvfree(plan.steps);
+        return -ENOMEM;
+    }
+
+    quantum_parallel_for(job.workers, hybrid_worker, &job);
+
+    ret = READ_ONCE(job.error);
+    if (ret == 0) {
+        for (i = 0; i < count; i++) {
+            re = im = 0;
+            for (w = 0; w < job.workers; w++) {
+                re += job.acc[(w * count + i) * 2];
+                im += job.acc[(w * count + i) * 2 + 1];
+            }
+            out[i].re = clamp_t(s64, re, S32_MIN, S32_MAX);
+            out[i].im = clamp_t(s64, im, S32_MIN, S32_MAX);
+        }
+    }
+
+    kvfree(job.acc);
+    kvfree(plan.steps);
+    return ret;
+}
@@ -0,0 +1,442 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/bitrev.h>
+#include "../include/ctrlxt_kernel.h"
+#include "../include/quantum.h"
+#include "../include/quantum_macro.h"
+
+/* Wide partial sum of amplitudes */
+struct macro_sum {
+    s64 re;
+    s64 im;
+};
+
+/* Shared state of one pass over the register */
+struct macro_job {
+    s32 *lanes;                 /* dense or split vector, see quantum_lane_pos() */
+    unsigned int block_shift;
+    unsigned int base;          /* lowest register qubit */
+    unsigned int width;         /* register qubits */
+    unsigned int stage;         /* register qubit of the current butterfly pass */
+    bool inverse;
+    size_t count;               /* items of the current pass */
+    size_t slice;               /* items per worker */
+    unsigned int workers;
+    const struct quantum_amp *lo;   /* twiddles split by the low and high index bits */
+    const struct quantum_amp *hi;
+    unsigned int lo_bits;
+    size_t groups;              /* diffusion: independent register copies */
+    struct macro_sum *sums;
+};
+
+/* Index of the k-th basis state with the given qubit cleared */
+static inline size_t macro_insert_zero_bit(size_t k, unsigned int qubit)
+{
+    size_t low = k & (((size_t)1 << qubit) - 1);
+
+    return ((k >> qubit) << (qubit + 1)) | low;
+}
+
+/* Load and store amplitude i of the vector */
+static inline struct quantum_amp macro_load(const struct macro_job *job, size_t i)
+{
+    return quantum_lanes_load(job->lanes, job->block_shift, i);
+}
+
+static inline void macro_store(struct macro_job *job, size_t i, struct quantum_amp a)
+{
+    quantum_lanes_store(job->lanes, job->block_shift, i, a);
+}
+
+/* Basis index of register value r in register copy g */
+static inline size_t macro_index(const struct macro_job *job, size_t g, size_t r)
+{
+    size_t low = g & (((size_t)1 << job->base) - 1);
+
+    return ((g >> job->base) << (job->base + job->width)) | (r << job->base) | low;
+}
+
+/* Split a pass of count items into slices worth a work item each */
+static void macro_run(struct macro_job *job, size_t count, void (*fn)(void *arg, unsigned int idx))
+{
+    job->count = count;
+    job->workers = clamp_t(size_t, count / QUANTUM_MACRO_MIN_SLICE, 1, quantum_parallel_width());
+    job->slice = DIV_ROUND_UP(count, job->workers);
+    quantum_parallel_for(job->workers, fn, job);
+}
+
+/*
+ * One QFT stage: H on register qubit s fused with every controlled phase it
+ * takes from the qubits below it, which together multiply the |1> half by
+ * e^(2*pi*i*x/2^(s+1)) for x the register bits below s.
+ */
+static void macro_butterfly_worker(void *arg, unsigned int idx)
+{
+    struct macro_job *job = arg;
+    unsigned int qubit = job->base + job->stage;
+    size_t bit = (size_t)1 << qubit;
+    size_t low_mask = ((size_t)1 << job->stage) - 1;
+    size_t lo_mask = ((size_t)1 << job->lo_bits) - 1;
+    size_t k, i0, j, end = min(job->count, (idx + 1) * job->slice);
+    struct quantum_amp a0, a1, sum, tw = { QAMP_ONE, 0 };
+
+    for (k = idx * job->slice; k < end; k++) {
+        i0 = macro_insert_zero_bit(k, qubit);
+        a0 = macro_load(job, i0);
+        a1 = macro_load(job, i0 | bit);
+
+        /* The phase is exactly one for j == 0, skip the rounding */
+        j = ((i0 >> job->base) & low_mask) << (job->width - 1 - job->stage);
+        if (j) {
+            tw = qamp_mul(job->hi[j >> job->lo_bits], job->lo[j & lo_mask]);
+            if (job->inverse) {
+                tw.im = -tw.im;
+                a1 = qamp_mul(a1, tw);
+            }
+        }
+
+        sum.re = (((s64)a0.re + a1.re) * QAMP_SQRT1_2) >> QAMP_SHIFT;
+        sum.im = (((s64)a0.im + a1.im) * QAMP_SQRT1_2) >> QAMP_SHIFT;
+        a1.re = (((s64)a0.re - a1.re) * QAMP_SQRT1_2) >> QAMP_SHIFT;
+        a1.im = (((s64)a0.im - a1.im) * QAMP_SQRT1_2) >> QAMP_SHIFT;
+        macro_store(job, i0, sum);
+        macro_store(job, i0 | bit, j && !job->inverse ? qamp_mul(a1, tw) : a1);
+    }
+}
+
+/* Reverse the register bits, each pair is swapped by the slice holding its lower index */
+static void macro_bitrev_worker(void *arg, unsigned int idx)
+{
+    struct macro_job *job = arg;
+    size_t mask = ((size_t)1 << job->width) - 1;
+    size_t i, j, x, r, end = min(job->count, (idx + 1) * job->slice);
+    struct quantum_amp tmp;
+
+    for (i = idx * job->slice; i < end; i++) {
+        x = (i >> job->base) & mask;
+        r = bitrev32(x) >> (32 - job->width);
+        if (r <= x)
+            continue;
+
+        j = (i & ~(mask << job->base)) | (r << job->base);
+        tmp = macro_load(job, i);
+        macro_store(job, i, macro_load(job, j));
+        macro_store(job, j, tmp);
+    }
+}
+
+/* Radix-2 FFT over the register, one pass per register qubit */
+static int macro_qft(struct macro_job *job, size_t dim, bool inverse, bool reverse)
+{
+    unsigned int hi_bits, shift = 32 - job->width;
+    struct quantum_amp *tables;
+    size_t j;
+    int s;
+
+    job->lo_bits = (job->width - 1) / 2;
+    hi_bits = job->width - 1 - job->lo_bits;
+
+    /* Twiddle e^(2*pi*i*j/2^width) = hi[j >> lo_bits] * lo[j & lo_mask] */
+    tables = kvmalloc_array(((size_t)1 << job->lo_bits) + ((size_t)1 << hi_bits),
+                            sizeof(*tables), GFP_KERNEL);
+    if (!tables)
+        return -ENOMEM;
+
+    for (j = 0; j < (size_t)1 << job->lo_bits; j++)
+        tables[j] = quantum_angle_twiddle((u32)j << shift);
+    job->lo = tables;
+
+    for (j = 0; j < (size_t)1 << hi_bits; j++)
+        tables[((size_t)1 << job->lo_bits) + j] = quantum_angle_twiddle((u32)(j << job->lo_bits) << shift);
+    job->hi = tables + ((size_t)1 << job->lo_bits);
+
+    job->inverse = inverse;
+
+    if (inverse) {
+        if (reverse)
+            macro_run(job, dim, macro_bitrev_worker);
+        for (s = 0; s < job->width; s++) {
+            job->stage = s;
+            macro_run(job, dim / 2, macro_butterfly_worker);
+        }
+    } else {
+        for (s = job->width - 1; s >= 0; s--) {
+            job->stage = s;
+            macro_run(job, dim / 2, macro_butterfly_worker);
+        }
+        if (reverse)
+            macro_run(job, dim, macro_bitrev_worker);
+    }
+
+    kvfree(tables);
+    return 0;
+}
+
+/* Reflect register copies about their mean, each slice owns whole copies */
+static void macro_diffusion_worker(void *arg, unsigned int idx)
+{
+    struct macro_job *job = arg;
+    size_t g, r, i, end = min(job->count, (idx + 1) * job->slice);
+    size_t size = (size_t)1 << job->width;
+    struct quantum_amp a;
+    struct macro_sum sum;
+
+    for (g = idx * job->slice; g < end; g++) {
+        sum.re = sum.im = 0;
+        for (r = 0; r < size; r++) {
+            a = macro_load(job, macro_index(job, g, r));
+            sum.re += a.re;
+            sum.im += a.im;
+        }
+
+        sum.re >>= job->width;
+        sum.im >>= job->width;
+        for (r = 0; r < size; r++) {
+            i = macro_index(job, g, r);
+            a = macro_load(job, i);
+            a.re = 2 * sum.re - a.re;
+            a.im = 2 * sum.im - a.im;
+            macro_store(job, i, a);
+        }
+    }
+}
+
+/* Partial sums of a slice of register values, for every copy */
+static void macro_reduce_worker(void *arg, unsigned int idx)
+{
+    struct macro_job *job = arg;
+    struct macro_sum *sums = job->sums + idx * job->groups;
+    size_t g, r, end = min(job->count, (idx + 1) * job->slice);
+    struct quantum_amp a;
+
+    for (r = idx * job->slice; r < end; r++) {
+        for (g = 0; g < job->groups; g++) {
+            a = macro_load(job, macro_index(job, g, r));
+            sums[g].re += a.re;
+            sums[g].im += a.im;
+        }
+    }
+}
+
+/* a' = 2 * mean - a with the means left in the first slice of sums */
+static void macro_reflect_worker(void *arg, unsigned int idx)
+{
+    struct macro_job *job = arg;
+    size_t g, r, i, end = min(job->count, (idx + 1) * job->slice);
+    struct quantum_amp a;
+
+    for (r = idx * job->slice; r < end; r++) {
+        for (g = 0; g < job->groups; g++) {
+            i = macro_index(job, g, r);
+            a = macro_load(job, i);
+            a.re = 2 * job->sums[g].re - a.re;
+            a.im = 2 * job->sums[g].im - a.im;
+            macro_store(job, i, a);
+        }
+    }
+}
+
+/*
+ * Grover diffusion: 2|s><s| - I on the register is a reflection about the
+ * mean amplitude of every copy of the register.
+ */
+static void macro_diffusion(struct macro_job *job, size_t dim)
+{
+    unsigned int workers = quantum_parallel_width();
+    size_t g, w, size = (size_t)1 << job->width;
+
+    job->groups = dim >> job->width;
+
+    /* Few large copies: reduce in parallel, then reflect in parallel */
+    if (job->groups < workers && size >= 2 * QUANTUM_MACRO_MIN_SLICE)
+        job->sums = kcalloc(workers * job->groups, sizeof(*job->sums), GFP_KERNEL);
+
+    if (!job->sums) {
+        macro_run(job, job->groups, macro_diffusion_worker);
+        return;
+    }
+
+    macro_run(job, size, macro_reduce_worker);
+    for (g = 0; g < job->groups; g++) {
+        for (w = 1; w < job->workers; w++) {
+            job->sums[g].re += job->sums[w * job->groups + g].re;
+            job->sums[g].im += job->sums[w * job->groups + g].im;
+        }
+        job->sums[g].re >>= job->width;
+        job->sums[g].im >>= job->width;
+    }
+    macro_run(job, size, macro_reflect_worker);
+
+    kfree(job->sums);
+    job->sums = NULL;
+}
+
+/* Run a macro gate on a dense or split state */
+int quantum_macro_apply(struct quantum_state *state, const struct quantum_op *op)
+{
+    struct macro_job job = {
+        .lanes = quantum_state_lanes(state),
+        .block_shift = state->block_shift,
+        .base = op->qubit,
+        .width = op->target,
+    };
+
+    switch (op->gate) {
+        case QUANTUM_GATE_QFT:
+        case QUANTUM_GATE_IQFT:
+            return macro_qft(&job, state->dim, op->gate == QUANTUM_GATE_IQFT,
+                             !(op->angle & QUANTUM_MACRO_NO_SWAP));
+        case QUANTUM_GATE_DIFFUSION:
+            macro_diffusion(&job, state->dim);
+            return 0;
+        default:
+            return -EINVAL;
+    }
+}
+
+/* Controlled rotation between register qubits d - 1 apart, negated for the inverse */
+static u32 macro_phase(unsigned int d, bool inverse)
+{
+    u32 angle = QUANTUM_ANGLE_TURN >> d;
+
+    return inverse ? QUANTUM_ANGLE_TURN - angle : angle;
+}
+
+static bool macro_is_cphase(const struct quantum_op *op, int a, int b, u32 angle)
+{
+    return op->gate == QUANTUM_GATE_CPHASE && op->angle % QUANTUM_ANGLE_TURN == angle &&
+           ((op->qubit == a && op->target == b) || (op->qubit == b && op->target == a));
+}
+
+static bool macro_is_swap(const struct quantum_op *op, int a, int b)
+{
+    return op->gate == QUANTUM_GATE_SWAP &&
+           ((op->qubit == a && op->target == b) || (op->qubit == b && op->target == a));
+}
+
+/* Stage s of a QFT: H then phases from the qubits below, mirrored for the inverse */
+static size_t macro_match_stage(const struct quantum_op *ops, size_t count, int base,
+                                unsigned int s, bool inverse)
+{
+    const struct quantum_op *h = inverse ? &ops[s] : &ops[0];
+    const struct quantum_op *phases = inverse ? &ops[0] : &ops[1];
+    unsigned int k, c;
+
+    if (count < s + 1 || h->gate != QUANTUM_GATE_H || h->qubit != base + s)
+        return 0;
+
+    for (k = 0; k < s; k++) {
+        c = inverse ? k : s - 1 - k;
+        if (!macro_is_cphase(&phases[k], base + c, base + s, macro_phase(s - c + 1, inverse)))
+            return 0;
+    }
+
+    return s + 1;
+}
+
+/* All stages of a QFT of the given width, top qubit first, or bottom first for the inverse */
+static size_t macro_match_stages(const struct quantum_op *ops, size_t count, int base,
+                                 unsigned int width, bool inverse)
+{
+    size_t n = 0, used;
+    unsigned int k;
+
+    for (k = 0; k < width; k++) {
+        used = macro_match_stage(ops + n, count - n, base, inverse ? k : width - 1 - k, inverse);
+        if (!used)
+            return 0;
+        n += used;
+    }
+
+    return n;
+}
+
+/* The bit reversal as width / 2 swaps */
+static size_t macro_match_swaps(const struct quantum_op *ops, size_t count, int base,
+                                unsigned int width)
+{
+    unsigned int j;
+
+    if (count < width / 2)
+        return 0;
+
+    for (j = 0; j < width / 2; j++) {
+        if (!macro_is_swap(&ops[j], base + j, base + width - 1 - j))
+            return 0;
+    }
+
+    return width / 2;
+}
+
+/* Recognize the textbook QFT and its inverse, with or without the bit reversal */
+size_t quantum_macro_match(const struct quantum_op *ops, size_t count, struct quantum_op *macro)
+{
+    size_t n, used, swaps;
+    unsigned int width;
+    int base, top;
+
+    if (count == 0 || ops[0].qubit < 0 || ops[0].qubit >= QUANTUM_STATE_MAX_QUBITS)
+        return 0;
+
+    switch (ops[0].gate) {
+        case QUANTUM_GATE_H:
+            /* Forward: the phases following the first H fix the width */
+            top = ops[0].qubit;
+            for (width = 1; width < QUANTUM_MACRO_MAX_MATCH && width < count &&
+                 top >= (int)width; width++) {
+                if (!macro_is_cphase(&ops[width], top - width, top, macro_phase(width + 1, false)))
+                    break;
+            }
+
+            base = top - width + 1;
+            n = width >= QUANTUM_MACRO_MIN_MATCH ?
+                macro_match_stages(ops, count, base, width, false) : 0;
+            if (n) {
+                swaps = macro_match_swaps(ops + n, count - n, base, width);
+                macro->gate = QUANTUM_GATE_QFT;
+                macro->qubit = base;
+                macro->target = width;
+                macro->angle = swaps ? 0 : QUANTUM_MACRO_NO_SWAP;
+                return n + swaps;
+            }
+
+            /* Inverse without swaps: stages are taken while they match */
+            base = top;
+            for (n = 1, width = 1; width < QUANTUM_MACRO_MAX_MATCH; width++, n += used) {
+                used = macro_match_stage(ops + n, count - n, base, width, true);
+                if (!used)
+                    break;
+            }
+
+            if (width < QUANTUM_MACRO_MIN_MATCH)
+                return 0;
+
+            swaps = 0;
+            break;
+        case QUANTUM_GATE_SWAP:
+            /* Inverse with swaps: the outermost swap fixes the register */
+            if (ops[0].target < 0 || ops[0].target >= QUANTUM_STATE_MAX_QUBITS)
+                return 0;
+
+            base = min(ops[0].qubit, ops[0].target);
+            width = abs(ops[0].target - ops[0].qubit) + 1;
+            if (width < QUANTUM_MACRO_MIN_MATCH || width > QUANTUM_MACRO_MAX_MATCH)
+                return 0;
+
+            swaps = macro_match_swaps(ops, count, base, width);
+            n = swaps ? macro_match_stages(ops + swaps, count - swaps, base, width, true) : 0;
+            if (!n)
+                return 0;
+            break;
+        default:
+            return 0;
+    }
+
+    macro->gate = QUANTUM_GATE_IQFT;
+    macro->qubit = base;
+    macro->target = width;
+    macro->angle = swaps ? 0 : QUANTUM_MACRO_NO_SWAP;
+    return n + swaps;
+}
@@ -9,16 +9,6 @@
 #include "../include/quantum.h"
 #include "../include/quantum_memory.h"
 
-/* Quantum memory block structure */
-struct quantum_memory_block {
-    struct list_head list;
-    struct quantum_state *state;
-    size_t size;
-    unsigned long flags;
-    atomic_t ref_count;
-    void *private_data;
-};
-
 /* Quantum memory manager structure */
 struct ctrlxt_qmem {
     struct list_head free_blocks;
@@ -59,7 +49,15 @@ int __init ctrlxt_qmem_init(void)
     return 0;
 }
 
-/* Allocate quantum memory block */
+/* Release what a block owns */
+static void qmem_block_release(struct quantum_memory_block *block)
+{
+    ctrlxt_qec_free(block->qec);
+    quantum_state_free(block->state);
+    kfree(block);
+}
+
+/* Allocate quantum memory block, error-corrected blocks get a QEC context of their own */
 struct quantum_memory_block *ctrlxt_qmem_alloc(size_t num_qubits, unsigned long flags)
 {
     struct quantum_memory_block *block;
@@ -72,28 +70,37 @@ struct quantum_memory_block *ctrlxt_qmem_alloc(size_t num_qubits, unsigned long
     if (atomic_read(&qmem.allocated_qubits) + num_qubits > atomic_read(&qmem.max_qubits))
         return ERR_PTR(-ENOMEM);
     
-    spin_lock_irqsave(&qmem.lock, irq_flags);
-    
     /* Allocate new memory block */
-    block = kzalloc(sizeof(struct quantum_memory_block), GFP_ATOMIC);
-    if (!block) {
-        spin_unlock_irqrestore(&qmem.lock, irq_flags);
+    block = kzalloc(sizeof(struct quantum_memory_block), GFP_KERNEL);
+    if (!block)
         return ERR_PTR(-ENOMEM);
-    }
     
     /* Allocate quantum state */
-    block->state = quantum_state_alloc(num_qubits);
+    block->state = quantum_state_alloc_repr(num_qubits, flags & QMEM_FLAG_REAL ?
+                                            QUANTUM_REPR_REAL : QUANTUM_REPR_DENSE);
     if (!block->state) {
         kfree(block);
-        spin_unlock_irqrestore(&qmem.lock, irq_flags);
         return ERR_PTR(-ENOMEM);
     }
     
+    if (flags & QMEM_FLAG_ERROR_COR) {
+        block->qec = ctrlxt_qec_alloc(block->state, NULL);
+        if (IS_ERR(block->qec)) {
+            long err = PTR_ERR(block->qec);
+
+            block->qec = NULL;
+            qmem_block_release(block);
+            return ERR_PTR(err);
+        }
+    }
+    
     /* Initialize block */
     block->size = num_qubits;
     block->flags = flags;
     atomic_set(&block->ref_count, 1);
     
+    spin_lock_irqsave(&qmem.lock, irq_flags);
+    
     /* Add to used blocks list */
     list_add(&block->list, &qmem.used_blocks);
     
@@ -114,26 +121,31 @@ void ctrlxt_qmem_free(struct quantum_memory_block *block)
     if (!block)
         return;
     
+    /* Decrement reference count */
+    if (!atomic_dec_and_test(&block->ref_count))
+        return;
+    
     spin_lock_irqsave(&qmem.lock, irq_flags);
     
-    /* Decrement reference count */
-    if (atomic_dec_and_test(&block->ref_count)) {
-        /* Remove from used blocks list */
-        list_del(&block->list);
-        
-        /* Free quantum state */
-        if (block->state)
-            quantum_state_free(block->state);
-        
-        /* Update qubit counts */
-        atomic_sub(block->size, &qmem.total_qubits);
-        atomic_sub(block->size, &qmem.allocated_qubits);
-        
-        /* Free block */
-        kfree(block);
-    }
+    /* Remove from used blocks list */
+    list_del(&block->list);
+    
+    /* Update qubit counts */
+    atomic_sub(block->size, &qmem.total_qubits);
+    atomic_sub(block->size, &qmem.allocated_qubits);
     
     spin_unlock_irqrestore(&qmem.lock, irq_flags);
+    
+    qmem_block_release(block);
+}
+
+/* One error correction round on a block allocated with QMEM_FLAG_ERROR_COR */
+int ctrlxt_qmem_block_correct(struct quantum_memory_block *block)
+{
+    if (!block || !block->qec)
+        return -EINVAL;
+    
+    return ctrlxt_qec_apply(block->qec);
 }
 
 /* Get quantum memory statistics */
@@ -194,9 +206,7 @@ static void __exit qmem_exit(void)
     /* Free all used blocks */
     list_for_each_entry_safe(block, tmp, &qmem.used_blocks, list) {
         list_del(&block->list);
-        if (block->state)
-            quantum_state_free(block->state);
-        kfree(block);
+        qmem_block_release(block);
     }
     
     /* Free memory pool */
@@ -0,0 +1,64 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/cpumask.h>
+#include <linux/workqueue.h>
+#include "../include/ctrlxt_kernel.h"
+#include "../include/quantum.h"
+
+/* One slice of a parallel loop */
+struct quantum_parallel_work {
+    struct work_struct work;
+    void (*fn)(void *arg, unsigned int idx);
+    void *arg;
+    unsigned int idx;
+};
+
+static void quantum_parallel_worker(struct work_struct *work)
+{
+    struct quantum_parallel_work *pw = container_of(work, struct quantum_parallel_work, work);
+
+    pw->fn(pw->arg, pw->idx);
+}
+
+/* Number of slices worth splitting a state-sized job into */
+unsigned int quantum_parallel_width(void)
+{
+    return num_online_cpus();
+}
+
+/*
+ * Run fn(arg, idx) for every idx in [0, count) on the unbound workqueue and
+ * wait for all of them. Slice 0 runs on the calling CPU. Falls back to a
+ * serial loop when the work items cannot be allocated.
+ */
+void quantum_parallel_for(unsigned int count, void (*fn)(void *arg, unsigned int idx), void *arg)
+{
+    struct quantum_parallel_work *works;
+    unsigned int i;
+
+    if (count == 0)
+        return;
+
+    works = count > 1 ? kcalloc(count, sizeof(*works), GFP_KERNEL) : NULL;
+    if (!works) {
+        for (i = 0; i < count; i++)
+            fn(arg, i);
+        return;
+    }
+
+    for (i = 1; i < count; i++) {
+        works[i].fn = fn;
+        works[i].arg = arg;
+        works[i].idx = i;
+        INIT_WORK(&works[i].work, quantum_parallel_worker);
+        queue_work(system_unbound_wq, &works[i].work);
+    }
+
+    fn(arg, 0);
+
+    for (i = 1; i < count; i++)
+        flush_work(&works[i].work);
+
+    kfree(works);
+}
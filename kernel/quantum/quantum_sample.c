@@ -0,0 +1,348 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/sort.h>
+#include <linux/hash.h>
+#include <linux/log2.h>
+#include <linux/random.h>
+#include <linux/math64.h>
+#include "../include/ctrlxt_kernel.h"
+#include "../include/quantum.h"
+#include "../include/quantum_dd.h"
+#include "../include/quantum_sample.h"
+
+/* Shared state of one sampling run */
+struct sample_job {
+    const struct quantum_state *state;
+    const u64 *sums;                    /* cached running sums, NULL to sweep */
+    u64 total;                          /* sum of all probabilities in Q30 */
+    u64 shots;
+    unsigned int workers;
+    struct quantum_histogram *hists;    /* one table per worker */
+    u8 *packed;                         /* bit-packed shots instead of tables */
+    u64 slice;                          /* packed shots per worker, whole bytes each */
+    int error;
+};
+
+/* Packed draw remembering its shot, r first so sample_cmp_draw() orders it */
+struct sample_draw {
+    u64 r;
+    u64 shot;
+};
+
+/* Allocate a table at most half full with the given number of distinct outcomes */
+int quantum_histogram_init(struct quantum_histogram *hist, size_t distinct)
+{
+    hist->bits = ilog2(roundup_pow_of_two(max_t(size_t, distinct, 1))) + 1;
+    hist->slots = kvcalloc((size_t)1 << hist->bits, sizeof(*hist->slots), GFP_KERNEL);
+    hist->used = 0;
+    hist->shots = 0;
+
+    return hist->slots ? 0 : -ENOMEM;
+}
+
+/* Free a histogram */
+void quantum_histogram_free(struct quantum_histogram *hist)
+{
+    kvfree(hist->slots);
+    hist->slots = NULL;
+}
+
+/* Add count shots of outcome, one slot always stays free to end the probes */
+int quantum_histogram_add(struct quantum_histogram *hist, u64 outcome, u64 count)
+{
+    size_t mask = ((size_t)1 << hist->bits) - 1;
+    size_t i;
+
+    if (count == 0)
+        return 0;
+
+    for (i = hash_64(outcome, hist->bits); hist->slots[i].count; i = (i + 1) & mask) {
+        if (hist->slots[i].outcome == outcome)
+            goto found;
+    }
+
+    if (hist->used == mask)
+        return -ENOSPC;
+
+    hist->slots[i].outcome = outcome;
+    hist->used++;
+
+found:
+    hist->slots[i].count += count;
+    hist->shots += count;
+    return 0;
+}
+
+static int hist_cmp_outcome(const void *a, const void *b)
+{
+    const struct quantum_count *x = a, *y = b;
+
+    return x->outcome < y->outcome ? -1 : x->outcome > y->outcome;
+}
+
+static int hist_cmp_count(const void *a, const void *b)
+{
+    const struct quantum_count *x = a, *y = b;
+
+    if (x->count != y->count)
+        return x->count > y->count ? -1 : 1;
+
+    return hist_cmp_outcome(a, b);
+}
+
+/* Compact the used slots and sort them, the table takes no more adds */
+size_t quantum_histogram_finish(struct quantum_histogram *hist,
+                                enum quantum_histogram_order order)
+{
+    size_t i, n = 0;
+
+    for (i = 0; i < (size_t)1 << hist->bits; i++) {
+        if (hist->slots[i].count)
+            hist->slots[n++] = hist->slots[i];
+    }
+
+    sort(hist->slots, n, sizeof(*hist->slots),
+         order == QUANTUM_HIST_BY_COUNT ? hist_cmp_count : hist_cmp_outcome, NULL);
+    return n;
+}
+
+static int sample_cmp_draw(const void *a, const void *b)
+{
+    u64 x = *(const u64 *)a, y = *(const u64 *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * One worker's share of the shots. With cached running sums every draw is a
+ * binary search. Otherwise sorted uniform draws are matched against a
+ * single sweep of the distribution, so a run of draws landing on the same
+ * basis state costs one table update.
+ */
+static void sample_worker(void *arg, unsigned int idx)
+{
+    struct sample_job *job = arg;
+    const struct quantum_state *state = job->state;
+    struct quantum_histogram *hist = &job->hists[idx];
+    u64 n = job->shots / job->workers + (idx < job->shots % job->workers);
+    u64 *draws = NULL, acc = 0, j, run;
+    size_t i;
+
+    if (quantum_histogram_init(hist, min_t(u64, n, state->dim)) < 0) {
+        job->error = -ENOMEM;
+        return;
+    }
+
+    if (job->sums) {
+        for (j = 0; j < n; j++)
+            quantum_histogram_add(hist, quantum_state_cdf_search(job->sums, state->dim,
+                                  mul_u64_u32_shr(job->total, get_random_u32(), 32)), 1);
+        return;
+    }
+
+    draws = kvmalloc_array(n, sizeof(*draws), GFP_KERNEL);
+    if (!draws) {
+        job->error = -ENOMEM;
+        return;
+    }
+
+    for (j = 0; j < n; j++)
+        draws[j] = mul_u64_u32_shr(job->total, get_random_u32(), 32);
+    sort(draws, n, sizeof(*draws), sample_cmp_draw, NULL);
+
+    for (i = 0, j = 0; i < state->dim && j < n; i++) {
+        acc += quantum_state_norm(state, i);
+        for (run = 0; j < n && draws[j] < acc; j++)
+            run++;
+        quantum_histogram_add(hist, i, run);
+    }
+
+    kvfree(draws);
+}
+
+/* Sample without collapsing, per-worker tables merged at the end */
+int quantum_state_sample(struct quantum_state *state, u64 shots,
+                         struct quantum_histogram *hist)
+{
+    struct sample_job job = { .state = state, .shots = shots };
+    size_t i, distinct = 0;
+    unsigned int w;
+    u64 outcome;
+    int ret;
+
+    if (!state || !hist || shots == 0 || shots > QUANTUM_SAMPLE_MAX_SHOTS)
+        return -EINVAL;
+
+    hist->slots = NULL;
+
+    /* Every shot of a basis state lands on it */
+    if (state->cdf.generation == state->generation && state->cdf.point) {
+        ret = quantum_histogram_init(hist, 1);
+        if (ret == 0)
+            ret = quantum_histogram_add(hist, state->cdf.basis, shots);
+        return ret;
+    }
+
+    /* A diagram path costs one node per qubit, no sweep to share */
+    if (state->repr == QUANTUM_REPR_DD) {
+        ret = quantum_histogram_init(hist, min_t(u64, shots, state->dim));
+        for (i = 0; ret == 0 && i < shots; i++) {
+            ret = quantum_dd_sample(state->dd, &outcome);
+            if (ret == 0)
+                ret = quantum_histogram_add(hist, outcome, 1);
+        }
+        if (ret < 0)
+            quantum_histogram_free(hist);
+        return ret;
+    }
+
+    /* Small states keep their distribution for the next sampling run */
+    job.sums = quantum_state_cdf(state);
+    if (job.sums) {
+        job.total = job.sums[state->dim - 1];
+    } else {
+        for (i = 0; i < state->dim; i++)
+            job.total += quantum_state_norm(state, i);
+    }
+
+    if (job.total == 0)
+        return -EIO;
+
+    job.workers = clamp_t(u64, shots / QUANTUM_SAMPLE_MIN_SLICE, 1, quantum_parallel_width());
+    job.hists = kcalloc(job.workers, sizeof(*job.hists), GFP_KERNEL);
+    if (!job.hists)
+        return -ENOMEM;
+
+    quantum_parallel_for(job.workers, sample_worker, &job);
+
+    ret = job.error;
+    for (w = 0; w < job.workers; w++)
+        distinct += job.hists[w].used;
+
+    if (ret == 0)
+        ret = quantum_histogram_init(hist, distinct);
+
+    for (w = 0; w < job.workers; w++) {
+        for (i = 0; ret == 0 && i < (size_t)1 << job.hists[w].bits; i++)
+            ret = quantum_histogram_add(hist, job.hists[w].slots[i].outcome,
+                                        job.hists[w].slots[i].count);
+        quantum_histogram_free(&job.hists[w]);
+    }
+
+    kfree(job.hists);
+    if (ret < 0)
+        quantum_histogram_free(hist);
+    return ret;
+}
+
+/* OR the bits of outcome in at bit pos, in any order into zeroed bytes */
+static inline void sample_pack(u8 *out, u64 pos, unsigned int bits, u64 outcome)
+{
+    unsigned int done = 8 - (pos & 7);
+    size_t i = pos >> 3;
+
+    out[i++] |= outcome << (pos & 7);
+    for (; done < bits; done += 8)
+        out[i++] |= outcome >> done;
+}
+
+/*
+ * One worker's bytes of packed shots. Without cached running sums the
+ * draws are sorted in batches, each matched against one sweep of the
+ * distribution and written back at the position of its shot.
+ */
+static void sample_packed_worker(void *arg, unsigned int idx)
+{
+    struct sample_job *job = arg;
+    const struct quantum_state *state = job->state;
+    unsigned int bits = state->num_qubits;
+    u64 first = idx * job->slice, end = min(job->shots, first + job->slice), acc, s;
+    struct sample_draw *draws;
+    size_t i, j, n;
+
+    if (first >= end)
+        return;
+
+    memset(job->packed + first * bits / 8, 0, DIV_ROUND_UP((end - first) * bits, 8));
+
+    if (job->sums) {
+        for (s = first; s < end; s++)
+            sample_pack(job->packed, s * bits, bits,
+                        quantum_state_cdf_search(job->sums, state->dim,
+                                                 mul_u64_u32_shr(job->total, get_random_u32(), 32)));
+        return;
+    }
+
+    draws = kvmalloc_array(min_t(u64, end - first, QUANTUM_SAMPLE_SWEEP_DRAWS), sizeof(*draws),
+                           GFP_KERNEL);
+    if (!draws) {
+        job->error = -ENOMEM;
+        return;
+    }
+
+    for (; first < end; first += n) {
+        n = min_t(u64, end - first, QUANTUM_SAMPLE_SWEEP_DRAWS);
+        for (j = 0; j < n; j++) {
+            draws[j].r = mul_u64_u32_shr(job->total, get_random_u32(), 32);
+            draws[j].shot = first + j;
+        }
+        sort(draws, n, sizeof(*draws), sample_cmp_draw, NULL);
+
+        acc = 0;
+        for (i = 0, j = 0; i < state->dim && j < n; i++) {
+            acc += quantum_state_norm(state, i);
+            for (; j < n && draws[j].r < acc; j++)
+                sample_pack(job->packed, draws[j].shot * bits, bits, i);
+        }
+    }
+
+    kvfree(draws);
+}
+
+/* Packed shots in draw order, every worker owning a multiple of 8 shots */
+int quantum_state_sample_packed(struct quantum_state *state, u64 shots,
+                                void *out, size_t size)
+{
+    struct sample_job job = { .state = state, .shots = shots, .packed = out };
+    u64 s, outcome;
+    size_t i;
+    int ret;
+
+    if (!state || !out || shots == 0 || shots > (u64)size * 8 / state->num_qubits)
+        return -EINVAL;
+
+    /* Basis states and diagrams draw one shot at a time */
+    if ((state->cdf.generation == state->generation && state->cdf.point) ||
+        state->repr == QUANTUM_REPR_DD) {
+        memset(out, 0, DIV_ROUND_UP(shots * state->num_qubits, 8));
+        outcome = state->cdf.basis;
+        for (s = 0; s < shots; s++) {
+            if (state->repr == QUANTUM_REPR_DD) {
+                ret = quantum_dd_sample(state->dd, &outcome);
+                if (ret < 0)
+                    return ret;
+            }
+            sample_pack(out, s * state->num_qubits, state->num_qubits, outcome);
+        }
+        return 0;
+    }
+
+    job.sums = quantum_state_cdf(state);
+    if (job.sums) {
+        job.total = job.sums[state->dim - 1];
+    } else {
+        for (i = 0; i < state->dim; i++)
+            job.total += quantum_state_norm(state, i);
+    }
+
+    if (job.total == 0)
+        return -EIO;
+
+    job.workers = clamp_t(u64, shots / QUANTUM_SAMPLE_MIN_SLICE, 1, quantum_parallel_width());
+    job.slice = round_up(DIV_ROUND_UP(shots, job.workers), 8);
+    quantum_parallel_for(job.workers, sample_packed_worker, &job);
+
+    return job.error;
+}
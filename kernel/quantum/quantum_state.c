@@ -0,0 +1,1289 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/string.h>
+#include <linux/random.h>
+#include <linux/math64.h>
+#include <linux/int_sqrt.h>
+#include <linux/bitops.h>
+#include <linux/fixp-arith.h>
+#include <linux/sched/signal.h>
+#include "../include/ctrlxt_kernel.h"
+#include "../include/quantum.h"
+#include "../include/quantum_dd.h"
+#include "../include/quantum_macro.h"
+
+/* pi/2 in Q30, the size of a 2^-32 turn step scaled by 2^31 */
+#define QAMP_HALF_PI  1686629713LL
+
+/* cos of a binary-radian angle in Q30 */
+s32 quantum_angle_cos(u32 angle)
+{
+    return fixp_cos32_rad(angle % QUANTUM_ANGLE_TURN, QUANTUM_ANGLE_TURN) >> 1;
+}
+
+/* sin of a binary-radian angle in Q30 */
+s32 quantum_angle_sin(u32 angle)
+{
+    return fixp_sin32_rad(angle % QUANTUM_ANGLE_TURN, QUANTUM_ANGLE_TURN) >> 1;
+}
+
+/*
+ * e^(i*angle) for an angle in 2^-32 turns. The top 16 bits go through the
+ * regular angle functions, the remainder is below 1e-4 radians where
+ * cos = 1 - t^2/2 and sin = t are exact in Q30.
+ */
+struct quantum_amp quantum_angle_twiddle(u32 angle)
+{
+    s64 theta = ((s64)(angle & 0xffff) * QAMP_HALF_PI) >> QAMP_SHIFT;
+    struct quantum_amp coarse, fine;
+
+    coarse.re = quantum_angle_cos(angle >> 16);
+    coarse.im = quantum_angle_sin(angle >> 16);
+    fine.re = QAMP_ONE - ((theta * theta) >> (QAMP_SHIFT + 1));
+    fine.im = theta;
+
+    return qamp_mul(coarse, fine);
+}
+
+/* Allocate a register in |0...0> with the given representation, may sleep */
+struct quantum_state *quantum_state_alloc_repr(unsigned int num_qubits,
+                                              enum quantum_state_repr repr)
+{
+    struct quantum_state *state;
+
+    if (num_qubits == 0)
+        return NULL;
+
+    if (repr != QUANTUM_REPR_DD && num_qubits > QUANTUM_STATE_MAX_QUBITS)
+        return NULL;
+
+    state = kzalloc(sizeof(*state), GFP_KERNEL);
+    if (!state)
+        return NULL;
+
+    state->num_qubits = num_qubits;
+    state->dim = (size_t)1 << num_qubits;
+    state->repr = repr;
+
+    switch (repr) {
+        case QUANTUM_REPR_DENSE:
+            state->amps = kvcalloc(state->dim, sizeof(struct quantum_amp), GFP_KERNEL);
+            if (state->amps)
+                state->amps[0].re = QAMP_ONE;
+            else
+                goto fail;
+            break;
+        case QUANTUM_REPR_DD:
+            state->dd = quantum_dd_create(num_qubits);
+            if (!state->dd)
+                goto fail;
+            break;
+        case QUANTUM_REPR_REAL:
+            state->re = kvcalloc(state->dim, sizeof(s32), GFP_KERNEL);
+            if (state->re)
+                state->re[0] = QAMP_ONE;
+            else
+                goto fail;
+            break;
+        case QUANTUM_REPR_SPLIT:
+            state->block_shift = num_qubits;
+            state->lanes = kvcalloc(2 * state->dim, sizeof(s32), GFP_KERNEL);
+            if (state->lanes)
+                state->lanes[0] = QAMP_ONE;
+            else
+                goto fail;
+            break;
+        default:
+            goto fail;
+    }
+
+    /* A new register is the point distribution of |0...0> */
+    state->generation = 1;
+    state->cdf.generation = 1;
+    state->cdf.point = true;
+    return state;
+
+fail:
+    kfree(state);
+    return NULL;
+}
+
+/* Allocate a state vector, may sleep */
+struct quantum_state *quantum_state_alloc(unsigned int num_qubits)
+{
+    return quantum_state_alloc_repr(num_qubits, QUANTUM_REPR_DENSE);
+}
+
+/* Free a state */
+void quantum_state_free(struct quantum_state *state)
+{
+    if (!state)
+        return;
+
+    kvfree(state->amps);
+    kvfree(state->re);
+    kvfree(state->lanes);
+    kvfree(state->cdf.sums);
+    quantum_dd_destroy(state->dd);
+    kfree(state);
+}
+
+/* Reset state to the basis state |value> */
+int quantum_state_init(struct quantum_state *state, unsigned long value)
+{
+    int ret = 0;
+
+    if (!state || value >= state->dim)
+        return -EINVAL;
+
+    quantum_state_changed(state);
+
+    if (state->repr == QUANTUM_REPR_DD) {
+        ret = quantum_dd_init(state->dd, value);
+        if (ret < 0)
+            return ret;
+    } else if (state->repr == QUANTUM_REPR_REAL) {
+        memset(state->re, 0, state->dim * sizeof(s32));
+        state->re[value] = QAMP_ONE;
+    } else {
+        memset(quantum_state_lanes(state), 0, 2 * state->dim * sizeof(s32));
+        quantum_state_lanes(state)[quantum_lane_pos(value, state->block_shift)] = QAMP_ONE;
+    }
+
+    state->cdf.generation = state->generation;
+    state->cdf.point = true;
+    state->cdf.basis = value;
+    return 0;
+}
+
+/* Copy amplitudes between states of equal width, representation and layout */
+int quantum_state_copy(struct quantum_state *dst, const struct quantum_state *src)
+{
+    if (!dst || !src || dst->num_qubits != src->num_qubits || dst->repr != src->repr ||
+        dst->block_shift != src->block_shift)
+        return -EINVAL;
+
+    quantum_state_changed(dst);
+
+    if (src->repr == QUANTUM_REPR_DD)
+        return quantum_dd_copy(dst->dd, src->dd);
+
+    if (src->repr == QUANTUM_REPR_REAL) {
+        memcpy(dst->re, src->re, src->dim * sizeof(s32));
+        return 0;
+    }
+
+    memcpy(quantum_state_lanes(dst), quantum_state_lanes(src), 2 * src->dim * sizeof(s32));
+    return 0;
+}
+
+/* Regroup a dense state into blocks of 2^shift lanes */
+static int state_split(struct quantum_state *state, unsigned int shift)
+{
+    size_t i, pos, block = (size_t)1 << shift;
+    s32 *lanes;
+
+    lanes = kvmalloc_array(2 * state->dim, sizeof(*lanes), GFP_KERNEL);
+    if (!lanes)
+        return -ENOMEM;
+
+    for (i = 0; i < state->dim; i++) {
+        pos = quantum_lane_pos(i, shift);
+        lanes[pos] = state->amps[i].re;
+        lanes[pos + block] = state->amps[i].im;
+    }
+
+    kvfree(state->amps);
+    state->amps = NULL;
+    state->lanes = lanes;
+    state->block_shift = shift;
+    state->repr = QUANTUM_REPR_SPLIT;
+    return 0;
+}
+
+/*
+ * Switch the representation in place, a dense result must fit the state
+ * vector limit. Only states without imaginary parts convert to real.
+ */
+int quantum_state_convert(struct quantum_state *state, enum quantum_state_repr repr)
+{
+    struct quantum_amp *amps;
+    struct quantum_dd *dd;
+    s32 *re;
+    size_t i;
+    int ret;
+
+    if (!state || repr > QUANTUM_REPR_SPLIT)
+        return -EINVAL;
+
+    if (state->repr == repr)
+        return 0;
+
+    quantum_state_changed(state);
+
+    /* Everything else goes through the dense vector */
+    if (state->repr != QUANTUM_REPR_DENSE && repr != QUANTUM_REPR_DENSE) {
+        ret = quantum_state_convert(state, QUANTUM_REPR_DENSE);
+        if (ret < 0)
+            return ret;
+        return quantum_state_convert(state, repr);
+    }
+
+    switch (repr) {
+        case QUANTUM_REPR_DENSE:
+            if (state->num_qubits > QUANTUM_STATE_MAX_QUBITS)
+                return -E2BIG;
+            amps = kvcalloc(state->dim, sizeof(*amps), GFP_KERNEL);
+            if (!amps)
+                return -ENOMEM;
+            if (state->repr == QUANTUM_REPR_REAL) {
+                for (i = 0; i < state->dim; i++)
+                    amps[i].re = state->re[i];
+                kvfree(state->re);
+                state->re = NULL;
+            } else if (state->repr == QUANTUM_REPR_SPLIT) {
+                quantum_state_save(state, amps);
+                kvfree(state->lanes);
+                state->lanes = NULL;
+                state->block_shift = 0;
+            } else {
+                quantum_dd_to_dense(state->dd, amps);
+                quantum_dd_destroy(state->dd);
+                state->dd = NULL;
+            }
+            state->amps = amps;
+            break;
+        case QUANTUM_REPR_DD:
+            dd = quantum_dd_create(state->num_qubits);
+            if (!dd)
+                return -ENOMEM;
+            ret = quantum_dd_from_dense(dd, state->amps);
+            if (ret < 0) {
+                quantum_dd_destroy(dd);
+                return ret;
+            }
+            kvfree(state->amps);
+            state->amps = NULL;
+            state->dd = dd;
+            break;
+        case QUANTUM_REPR_REAL:
+            for (i = 0; i < state->dim; i++) {
+                if (state->amps[i].im)
+                    return -EINVAL;
+            }
+            re = kvmalloc_array(state->dim, sizeof(*re), GFP_KERNEL);
+            if (!re)
+                return -ENOMEM;
+            for (i = 0; i < state->dim; i++)
+                re[i] = state->amps[i].re;
+            kvfree(state->amps);
+            state->amps = NULL;
+            state->re = re;
+            break;
+        case QUANTUM_REPR_SPLIT:
+            return state_split(state, state->num_qubits);
+    }
+
+    state->repr = repr;
+    return 0;
+}
+
+/* Store the state in the given layout, converting through the dense vector */
+int quantum_state_set_layout(struct quantum_state *state, enum quantum_state_layout layout)
+{
+    unsigned int shift;
+    int ret;
+
+    if (!state)
+        return -EINVAL;
+
+    switch (layout) {
+        case QUANTUM_LAYOUT_AOS:
+            return quantum_state_convert(state, QUANTUM_REPR_DENSE);
+        case QUANTUM_LAYOUT_SOA:
+            shift = state->num_qubits;
+            break;
+        case QUANTUM_LAYOUT_AOSOA4:
+            shift = 2;
+            break;
+        case QUANTUM_LAYOUT_AOSOA8:
+            shift = 3;
+            break;
+        default:
+            return -EINVAL;
+    }
+
+    shift = min(shift, state->num_qubits);
+    if (state->repr == QUANTUM_REPR_SPLIT && state->block_shift == shift)
+        return 0;
+
+    ret = quantum_state_convert(state, QUANTUM_REPR_DENSE);
+    if (ret < 0)
+        return ret;
+
+    return state_split(state, shift);
+}
+
+/* Write all amplitudes in index order */
+int quantum_state_save(const struct quantum_state *state, struct quantum_amp *amps)
+{
+    size_t i;
+
+    if (!state || !amps)
+        return -EINVAL;
+
+    switch (state->repr) {
+        case QUANTUM_REPR_DENSE:
+            memcpy(amps, state->amps, state->dim * sizeof(*amps));
+            break;
+        case QUANTUM_REPR_DD:
+            return quantum_dd_to_dense(state->dd, amps);
+        default:
+            for (i = 0; i < state->dim; i++)
+                quantum_state_amplitude(state, i, &amps[i]);
+            break;
+    }
+
+    return 0;
+}
+
+/* Load all amplitudes in index order, a real state turns dense on imaginary parts */
+int quantum_state_restore(struct quantum_state *state, const struct quantum_amp *amps)
+{
+    size_t i, pos, block;
+    int ret;
+
+    if (!state || !amps)
+        return -EINVAL;
+
+    quantum_state_changed(state);
+
+    if (state->repr == QUANTUM_REPR_DD)
+        return quantum_dd_from_dense(state->dd, amps);
+
+    if (state->repr == QUANTUM_REPR_REAL) {
+        for (i = 0; i < state->dim && !amps[i].im; i++)
+            state->re[i] = amps[i].re;
+        if (i == state->dim)
+            return 0;
+        ret = quantum_state_convert(state, QUANTUM_REPR_DENSE);
+        if (ret < 0)
+            return ret;
+    }
+
+    if (state->repr == QUANTUM_REPR_DENSE) {
+        memcpy(state->amps, amps, state->dim * sizeof(*amps));
+        return 0;
+    }
+
+    block = (size_t)1 << state->block_shift;
+    for (i = 0; i < state->dim; i++) {
+        pos = quantum_lane_pos(i, state->block_shift);
+        state->lanes[pos] = amps[i].re;
+        state->lanes[pos + block] = amps[i].im;
+    }
+
+    return 0;
+}
+
+/* Read a single amplitude of either representation */
+int quantum_state_amplitude(const struct quantum_state *state, u64 index,
+                            struct quantum_amp *amp)
+{
+    if (!state || !amp || index >= state->dim)
+        return -EINVAL;
+
+    if (state->repr == QUANTUM_REPR_DD)
+        return quantum_dd_amplitude(state->dd, index, amp);
+
+    if (state->repr == QUANTUM_REPR_REAL) {
+        amp->re = state->re[index];
+        amp->im = 0;
+        return 0;
+    }
+
+    if (state->repr == QUANTUM_REPR_SPLIT) {
+        index = quantum_lane_pos(index, state->block_shift);
+        amp->re = state->lanes[index];
+        amp->im = state->lanes[index + ((size_t)1 << state->block_shift)];
+        return 0;
+    }
+
+    *amp = state->amps[index];
+    return 0;
+}
+
+/* Index of the k-th basis state with the given qubit cleared */
+static inline size_t insert_zero_bit(size_t k, unsigned int qubit)
+{
+    size_t low = k & (((size_t)1 << qubit) - 1);
+
+    return ((k >> qubit) << (qubit + 1)) | low;
+}
+
+/*
+ * Split states keep blocks of 2^block_shift real parts followed by their
+ * imaginary parts. Their kernels walk whole blocks so that the inner loops
+ * run over consecutive lanes of re and im without separating them.
+ */
+
+/* 2x2 matrix on len lane pairs x[j], y[j], imaginary parts one block further */
+static void split_mat2_run(const struct quantum_amp *m, s32 *x, s32 *y, size_t block,
+                           size_t len)
+{
+    struct quantum_amp a0, a1;
+    size_t j;
+
+    for (j = 0; j < len; j++) {
+        a0.re = x[j];
+        a0.im = x[j + block];
+        a1.re = y[j];
+        a1.im = y[j + block];
+
+        x[j] = qamp_mul_re(m[0], a0) + qamp_mul_re(m[1], a1);
+        x[j + block] = qamp_mul_im(m[0], a0) + qamp_mul_im(m[1], a1);
+        y[j] = qamp_mul_re(m[2], a0) + qamp_mul_re(m[3], a1);
+        y[j + block] = qamp_mul_im(m[2], a0) + qamp_mul_im(m[3], a1);
+    }
+}
+
+/* Pairs lie in two blocks above the block width, in runs of one block below it */
+static void split_mat2(struct quantum_state *state, unsigned int qubit,
+                       const struct quantum_amp *m)
+{
+    unsigned int shift = state->block_shift;
+    size_t block = (size_t)1 << shift, bit = (size_t)1 << qubit;
+    size_t blocks = state->dim >> shift, b, j;
+    s32 *x;
+
+    for (b = 0; b < blocks; b++) {
+        x = state->lanes + (b << (shift + 1));
+        if (qubit >= shift) {
+            if (b & (bit >> shift))
+                continue;
+            split_mat2_run(m, x, x + ((bit >> shift) << (shift + 1)), block, block);
+        } else {
+            for (j = 0; j < block; j += 2 * bit)
+                split_mat2_run(m, x + j, x + j + bit, block, bit);
+        }
+    }
+}
+
+/* Multiply amplitudes whose mask bits are all set by phase, negate for a NULL phase */
+static void split_phase_mask(struct quantum_state *state, size_t mask,
+                             const struct quantum_amp *phase)
+{
+    unsigned int shift = state->block_shift;
+    size_t block = (size_t)1 << shift;
+    size_t blocks = state->dim >> shift, b, j;
+    struct quantum_amp a;
+    s32 *x;
+
+    for (b = 0; b < blocks; b++) {
+        if (((b << shift) & mask) != (mask & ~(block - 1)))
+            continue;
+        x = state->lanes + (b << (shift + 1));
+        for (j = 0; j < block; j++) {
+            if ((j & mask) != (mask & (block - 1)))
+                continue;
+            if (!phase) {
+                x[j] = -x[j];
+                x[j + block] = -x[j + block];
+                continue;
+            }
+            a.re = x[j];
+            a.im = x[j + block];
+            x[j] = qamp_mul_re(a, *phase);
+            x[j + block] = qamp_mul_im(a, *phase);
+        }
+    }
+}
+
+/* Swap amplitude pairs differing in flip bits, for indices matching cond */
+static void split_swap_pairs(struct quantum_state *state, size_t cond_mask,
+                             size_t cond_value, size_t flip)
+{
+    unsigned int shift = state->block_shift;
+    size_t block = (size_t)1 << shift;
+    size_t i, p, q;
+
+    for (i = 0; i < state->dim; i++) {
+        if ((i & cond_mask) != cond_value)
+            continue;
+        p = quantum_lane_pos(i, shift);
+        q = quantum_lane_pos(i ^ flip, shift);
+        swap(state->lanes[p], state->lanes[q]);
+        swap(state->lanes[p + block], state->lanes[q + block]);
+    }
+}
+
+/* Apply a general 2x2 matrix to one qubit */
+static void apply_mat2(struct quantum_state *state, unsigned int qubit,
+                       const struct quantum_amp *m)
+{
+    size_t bit = (size_t)1 << qubit;
+    size_t k, i0;
+    struct quantum_amp a0, a1;
+
+    if (state->repr == QUANTUM_REPR_SPLIT) {
+        split_mat2(state, qubit, m);
+        return;
+    }
+
+    for (k = 0; k < state->dim / 2; k++) {
+        i0 = insert_zero_bit(k, qubit);
+        a0 = state->amps[i0];
+        a1 = state->amps[i0 | bit];
+
+        state->amps[i0].re = qamp_mul_re(m[0], a0) + qamp_mul_re(m[1], a1);
+        state->amps[i0].im = qamp_mul_im(m[0], a0) + qamp_mul_im(m[1], a1);
+        state->amps[i0 | bit].re = qamp_mul_re(m[2], a0) + qamp_mul_re(m[3], a1);
+        state->amps[i0 | bit].im = qamp_mul_im(m[2], a0) + qamp_mul_im(m[3], a1);
+    }
+}
+
+/* Multiply every amplitude whose mask bits are all set by a phase */
+static void apply_phase_mask(struct quantum_state *state, size_t mask,
+                             struct quantum_amp phase)
+{
+    size_t i;
+
+    if (state->repr == QUANTUM_REPR_SPLIT) {
+        split_phase_mask(state, mask, &phase);
+        return;
+    }
+
+    for (i = 0; i < state->dim; i++) {
+        if ((i & mask) == mask)
+            state->amps[i] = qamp_mul(state->amps[i], phase);
+    }
+}
+
+/* Negate every amplitude whose mask bits are all set */
+static void apply_negate_mask(struct quantum_state *state, size_t mask)
+{
+    size_t i;
+
+    if (state->repr == QUANTUM_REPR_SPLIT) {
+        split_phase_mask(state, mask, NULL);
+        return;
+    }
+
+    for (i = 0; i < state->dim; i++) {
+        if ((i & mask) == mask) {
+            state->amps[i].re = -state->amps[i].re;
+            state->amps[i].im = -state->amps[i].im;
+        }
+    }
+}
+
+/* Swap amplitude pairs differing in flip bits, for indices matching cond */
+static void apply_swap_pairs(struct quantum_state *state, size_t cond_mask,
+                             size_t cond_value, size_t flip)
+{
+    struct quantum_amp tmp;
+    size_t i, j;
+
+    if (state->repr == QUANTUM_REPR_SPLIT) {
+        split_swap_pairs(state, cond_mask, cond_value, flip);
+        return;
+    }
+
+    for (i = 0; i < state->dim; i++) {
+        if ((i & cond_mask) != cond_value)
+            continue;
+        j = i ^ flip;
+        tmp = state->amps[i];
+        state->amps[i] = state->amps[j];
+        state->amps[j] = tmp;
+    }
+}
+
+/* Real counterpart of apply_mat2, m must have no imaginary parts */
+static void real_mat2(struct quantum_state *state, unsigned int qubit,
+                      const struct quantum_amp *m)
+{
+    size_t bit = (size_t)1 << qubit;
+    size_t k, i0;
+    s64 a0, a1;
+
+    for (k = 0; k < state->dim / 2; k++) {
+        i0 = insert_zero_bit(k, qubit);
+        a0 = state->re[i0];
+        a1 = state->re[i0 | bit];
+
+        state->re[i0] = (s32)((m[0].re * a0) >> QAMP_SHIFT) + (s32)((m[1].re * a1) >> QAMP_SHIFT);
+        state->re[i0 | bit] = (s32)((m[2].re * a0) >> QAMP_SHIFT) +
+                              (s32)((m[3].re * a1) >> QAMP_SHIFT);
+    }
+}
+
+/* Real counterpart of apply_negate_mask */
+static void real_negate_mask(struct quantum_state *state, size_t mask)
+{
+    size_t i;
+
+    for (i = 0; i < state->dim; i++) {
+        if ((i & mask) == mask)
+            state->re[i] = -state->re[i];
+    }
+}
+
+/* Real counterpart of apply_swap_pairs */
+static void real_swap_pairs(struct quantum_state *state, size_t cond_mask,
+                            size_t cond_value, size_t flip)
+{
+    size_t i;
+    s32 tmp;
+
+    for (i = 0; i < state->dim; i++) {
+        if ((i & cond_mask) != cond_value)
+            continue;
+        tmp = state->re[i];
+        state->re[i] = state->re[i ^ flip];
+        state->re[i ^ flip] = tmp;
+    }
+}
+
+/* Row-major 2x2 matrix of a one-qubit gate */
+int quantum_gate_matrix(enum quantum_gate_type gate, u32 angle, struct quantum_amp mat[4])
+{
+    s32 c = quantum_angle_cos(angle / 2);
+    s32 s = quantum_angle_sin(angle / 2);
+
+    memset(mat, 0, 4 * sizeof(*mat));
+
+    switch (gate) {
+        case QUANTUM_GATE_I:
+            mat[0].re = mat[3].re = QAMP_ONE;
+            break;
+        case QUANTUM_GATE_H:
+            mat[0].re = mat[1].re = mat[2].re = QAMP_SQRT1_2;
+            mat[3].re = -QAMP_SQRT1_2;
+            break;
+        case QUANTUM_GATE_X:
+            mat[1].re = mat[2].re = QAMP_ONE;
+            break;
+        case QUANTUM_GATE_Y:
+            mat[1].im = -QAMP_ONE;
+            mat[2].im = QAMP_ONE;
+            break;
+        case QUANTUM_GATE_Z:
+            mat[0].re = QAMP_ONE;
+            mat[3].re = -QAMP_ONE;
+            break;
+        case QUANTUM_GATE_T:
+            angle = QUANTUM_ANGLE_TURN / 8;
+            fallthrough;
+        case QUANTUM_GATE_PHASE:
+            mat[0].re = QAMP_ONE;
+            mat[3].re = quantum_angle_cos(angle);
+            mat[3].im = quantum_angle_sin(angle);
+            break;
+        case QUANTUM_GATE_RX:
+            mat[0].re = mat[3].re = c;
+            mat[1].im = mat[2].im = -s;
+            break;
+        case QUANTUM_GATE_RY:
+            mat[0].re = mat[3].re = c;
+            mat[1].re = -s;
+            mat[2].re = s;
+            break;
+        case QUANTUM_GATE_RZ:
+            mat[0].re = mat[3].re = c;
+            mat[0].im = -s;
+            mat[3].im = s;
+            break;
+        default:
+            return -EINVAL;
+    }
+
+    return 0;
+}
+
+/* Whether a gate maps real amplitudes to real amplitudes */
+bool quantum_op_is_real(const struct quantum_op *op)
+{
+    switch (op->gate) {
+        case QUANTUM_GATE_I:
+        case QUANTUM_GATE_H:
+        case QUANTUM_GATE_X:
+        case QUANTUM_GATE_Z:
+        case QUANTUM_GATE_RY:
+        case QUANTUM_GATE_CNOT:
+        case QUANTUM_GATE_CZ:
+        case QUANTUM_GATE_SWAP:
+            return true;
+        case QUANTUM_GATE_PHASE:
+        case QUANTUM_GATE_CPHASE:
+            return op->angle % QUANTUM_ANGLE_PI == 0;
+        default:
+            return false;
+    }
+}
+
+/* Whether every gate of a circuit keeps amplitudes real */
+bool quantum_circuit_is_real(const struct quantum_circuit *circuit)
+{
+    size_t i;
+
+    for (i = 0; i < circuit->num_ops; i++) {
+        if (!quantum_op_is_real(&circuit->ops[i]))
+            return false;
+    }
+
+    return true;
+}
+
+/* Apply a validated real gate to a real state */
+static void real_apply_op(struct quantum_state *state, const struct quantum_op *op,
+                          size_t bit, size_t tbit)
+{
+    struct quantum_amp mat[4];
+
+    switch (op->gate) {
+        case QUANTUM_GATE_X:
+            real_swap_pairs(state, bit, 0, bit);
+            break;
+        case QUANTUM_GATE_Z:
+            real_negate_mask(state, bit);
+            break;
+        case QUANTUM_GATE_PHASE:
+            if (op->angle % QUANTUM_ANGLE_TURN)
+                real_negate_mask(state, bit);
+            break;
+        case QUANTUM_GATE_H:
+        case QUANTUM_GATE_RY:
+            quantum_gate_matrix(op->gate, op->angle, mat);
+            real_mat2(state, op->qubit, mat);
+            break;
+        case QUANTUM_GATE_CNOT:
+            real_swap_pairs(state, bit | tbit, bit, tbit);
+            break;
+        case QUANTUM_GATE_CZ:
+            real_negate_mask(state, bit | tbit);
+            break;
+        case QUANTUM_GATE_CPHASE:
+            if (op->angle % QUANTUM_ANGLE_TURN)
+                real_negate_mask(state, bit | tbit);
+            break;
+        case QUANTUM_GATE_SWAP:
+            real_swap_pairs(state, bit | tbit, bit, bit | tbit);
+            break;
+        default:
+            break;
+    }
+}
+
+/* Apply a decoded operation to the state vector */
+int quantum_state_apply_op(struct quantum_state *state, const struct quantum_op *op)
+{
+    struct quantum_amp mat[4];
+    struct quantum_amp phase;
+    size_t bit, tbit = 0;
+    u32 angle;
+    int ret;
+
+    if (!state || !op)
+        return -EINVAL;
+
+    if (op->qubit < 0 || op->qubit >= state->num_qubits)
+        return -EINVAL;
+
+    bit = (size_t)1 << op->qubit;
+
+    if (op->gate >= QUANTUM_GATE_CNOT && op->gate <= QUANTUM_GATE_SWAP) {
+        if (op->target < 0 || op->target >= state->num_qubits || op->target == op->qubit)
+            return -EINVAL;
+        tbit = (size_t)1 << op->target;
+    }
+
+    if (op->gate >= QUANTUM_GATE_COUNT)
+        return -EINVAL;
+
+    /* Macro gates span target qubits starting at qubit */
+    if (quantum_gate_is_macro(op->gate) &&
+        (op->target < 1 || op->target > state->num_qubits - op->qubit))
+        return -EINVAL;
+
+    quantum_state_changed(state);
+
+    if (state->repr == QUANTUM_REPR_DD)
+        return quantum_dd_apply_op(state->dd, op);
+
+    /* Real states stay real until the first complex gate */
+    if (state->repr == QUANTUM_REPR_REAL) {
+        if (quantum_op_is_real(op)) {
+            real_apply_op(state, op, bit, tbit);
+            return 0;
+        }
+        ret = quantum_state_convert(state, QUANTUM_REPR_DENSE);
+        if (ret < 0)
+            return ret;
+    }
+
+    if (quantum_gate_is_macro(op->gate))
+        return quantum_macro_apply(state, op);
+
+    switch (op->gate) {
+        case QUANTUM_GATE_I:
+            break;
+        case QUANTUM_GATE_X:
+            apply_swap_pairs(state, bit, 0, bit);
+            break;
+        case QUANTUM_GATE_Z:
+            apply_negate_mask(state, bit);
+            break;
+        case QUANTUM_GATE_PHASE:
+        case QUANTUM_GATE_T:
+            angle = op->gate == QUANTUM_GATE_T ? QUANTUM_ANGLE_TURN / 8 : op->angle;
+            phase.re = quantum_angle_cos(angle);
+            phase.im = quantum_angle_sin(angle);
+            apply_phase_mask(state, bit, phase);
+            break;
+        case QUANTUM_GATE_H:
+        case QUANTUM_GATE_Y:
+        case QUANTUM_GATE_RX:
+        case QUANTUM_GATE_RY:
+        case QUANTUM_GATE_RZ:
+            quantum_gate_matrix(op->gate, op->angle, mat);
+            apply_mat2(state, op->qubit, mat);
+            break;
+        case QUANTUM_GATE_CNOT:
+            apply_swap_pairs(state, bit | tbit, bit, tbit);
+            break;
+        case QUANTUM_GATE_CZ:
+            apply_negate_mask(state, bit | tbit);
+            break;
+        case QUANTUM_GATE_CPHASE:
+            phase.re = quantum_angle_cos(op->angle);
+            phase.im = quantum_angle_sin(op->angle);
+            apply_phase_mask(state, bit | tbit, phase);
+            break;
+        case QUANTUM_GATE_SWAP:
+            apply_swap_pairs(state, bit | tbit, bit, bit | tbit);
+            break;
+        default:
+            return -EINVAL;
+    }
+
+    return 0;
+}
+
+/* Apply a gate, params optionally points to struct quantum_gate_args */
+int quantum_gate_apply(enum quantum_gate_type gate, struct quantum_state *state,
+                       int qubit, void *params, size_t param_size)
+{
+    struct quantum_gate_args *args = params;
+    struct quantum_op op = {
+        .gate = gate,
+        .qubit = qubit,
+        .target = -1,
+        .angle = QUANTUM_ANGLE_TURN / 4,
+    };
+
+    if (args) {
+        if (param_size < sizeof(*args))
+            return -EINVAL;
+        op.target = args->target;
+        op.angle = args->angle;
+    }
+
+    return quantum_state_apply_op(state, &op);
+}
+
+/* Decision diagrams take the Pauli string one factor at a time */
+static int dd_apply_pauli(struct quantum_state *state, u64 x, u64 z)
+{
+    struct quantum_op op = { QUANTUM_GATE_Z, 0, -1, 0 };
+    int ret = 0;
+
+    for (; z && ret == 0; z &= z - 1) {
+        op.qubit = __ffs64(z);
+        ret = quantum_dd_apply_op(state->dd, &op);
+    }
+    op.gate = QUANTUM_GATE_X;
+    for (; x && ret == 0; x &= x - 1) {
+        op.qubit = __ffs64(x);
+        ret = quantum_dd_apply_op(state->dd, &op);
+    }
+
+    return ret;
+}
+
+/*
+ * Apply X^x Z^z in a single pass, every amplitude moves to its index
+ * flipped by x with the sign of its parity over z. Y factors come out as
+ * XZ, which only differs from Y by a global phase.
+ */
+int quantum_state_apply_pauli(struct quantum_state *state, u64 x, u64 z)
+{
+    unsigned int shift;
+    size_t i, j, p, q, block;
+    s32 *lanes, a, b;
+    bool si, sj;
+
+    if (!state || (state->num_qubits < 64 && (x | z) >> state->num_qubits))
+        return -EINVAL;
+    if (!(x | z))
+        return 0;
+
+    quantum_state_changed(state);
+
+    if (state->repr == QUANTUM_REPR_DD)
+        return dd_apply_pauli(state, x, z);
+
+    if (state->repr == QUANTUM_REPR_REAL) {
+        for (i = 0; i < state->dim; i++) {
+            j = i ^ x;
+            if (j < i)
+                continue;
+            si = hweight64(i & z) & 1;
+            sj = hweight64(j & z) & 1;
+            a = state->re[i];
+            b = state->re[j];
+            state->re[i] = sj ? -b : b;
+            state->re[j] = si ? -a : a;
+        }
+        return 0;
+    }
+
+    shift = state->block_shift;
+    block = (size_t)1 << shift;
+    lanes = quantum_state_lanes(state);
+    for (i = 0; i < state->dim; i++) {
+        j = i ^ x;
+        if (j < i)
+            continue;
+        si = hweight64(i & z) & 1;
+        sj = hweight64(j & z) & 1;
+        p = quantum_lane_pos(i, shift);
+        q = quantum_lane_pos(j, shift);
+
+        a = lanes[p];
+        b = lanes[q];
+        lanes[p] = sj ? -b : b;
+        lanes[q] = si ? -a : a;
+        a = lanes[p + block];
+        b = lanes[q + block];
+        lanes[p + block] = sj ? -b : b;
+        lanes[q + block] = si ? -a : a;
+    }
+
+    return 0;
+}
+
+/*
+ * Run every gate of a circuit against the state, gate-level QFTs run fused on
+ * vector states. May sleep, returns -EINTR if the caller is killed midway.
+ */
+int quantum_circuit_run(struct quantum_state *state, const struct quantum_circuit *circuit)
+{
+    struct quantum_op macro;
+    size_t i, used;
+    int ret;
+
+    if (!state || !circuit || circuit->num_qubits > state->num_qubits)
+        return -EINVAL;
+
+    for (i = 0; i < circuit->num_ops; i += used) {
+        /* A long circuit over a wide state runs for seconds, stay preemptible and killable */
+        cond_resched();
+        if (fatal_signal_pending(current))
+            return -EINTR;
+
+        used = state->repr != QUANTUM_REPR_DD ?
+               quantum_macro_match(&circuit->ops[i], circuit->num_ops - i, &macro) : 0;
+        if (used) {
+            ret = quantum_state_apply_op(state, &macro);
+        } else {
+            ret = quantum_state_apply_op(state, &circuit->ops[i]);
+            used = 1;
+        }
+        if (ret < 0)
+            return ret;
+    }
+
+    return 0;
+}
+
+/* Zero amplitudes whose parity over mask differs from value, returns the remaining norm */
+static u64 quantum_state_project_parity(struct quantum_state *state, u64 mask, int value)
+{
+    size_t i, pos;
+    u64 norm = 0;
+
+    for (i = 0; i < state->dim; i++) {
+        if ((hweight64(i & mask) & 1) == value) {
+            norm += quantum_state_norm(state, i);
+        } else if (state->repr == QUANTUM_REPR_REAL) {
+            state->re[i] = 0;
+        } else {
+            pos = quantum_lane_pos(i, state->block_shift);
+            quantum_state_lanes(state)[pos] = 0;
+            quantum_state_lanes(state)[pos + ((size_t)1 << state->block_shift)] = 0;
+        }
+    }
+
+    return norm;
+}
+
+u64 quantum_state_project(struct quantum_state *state, int qubit, int value)
+{
+    if (!state || qubit < 0 || qubit >= state->num_qubits)
+        return 0;
+
+    quantum_state_changed(state);
+
+    if (state->repr == QUANTUM_REPR_DD)
+        return quantum_dd_project(state->dd, qubit, value);
+
+    return quantum_state_project_parity(state, 1ULL << qubit, !!value);
+}
+
+/* Scale all amplitudes so that a state of the given norm has norm one */
+static void quantum_state_normalize(struct quantum_state *state, u64 norm)
+{
+    size_t i, count;
+    s64 scale;
+    s32 *lanes;
+
+    scale = int_sqrt64(norm << QAMP_SHIFT);
+    if (scale == 0 || scale == QAMP_ONE)
+        return;
+
+    /* Scaling is the same for every lane whatever the layout */
+    lanes = state->repr == QUANTUM_REPR_REAL ? state->re : quantum_state_lanes(state);
+    count = state->repr == QUANTUM_REPR_REAL ? state->dim : 2 * state->dim;
+    for (i = 0; i < count; i++)
+        lanes[i] = div_s64((s64)lanes[i] << QAMP_SHIFT, scale);
+}
+
+/* Uniform random number in [0, total) */
+static u64 quantum_random_below(u64 total)
+{
+    return mul_u64_u32_shr(total, get_random_u32(), 32);
+}
+
+/* Measure a single qubit and collapse the state */
+int quantum_state_measure_qubit(struct quantum_state *state, int qubit, int *result)
+{
+    u64 total = 0, p1 = 0, norm;
+    size_t bit, i;
+    int outcome;
+
+    if (!state || !result || qubit < 0 || qubit >= state->num_qubits)
+        return -EINVAL;
+
+    /* A basis state is left as it is */
+    if (state->cdf.generation == state->generation && state->cdf.point) {
+        *result = (state->cdf.basis >> qubit) & 1;
+        return 0;
+    }
+
+    if (state->repr == QUANTUM_REPR_DD) {
+        quantum_state_changed(state);
+        return quantum_dd_measure_qubit(state->dd, qubit, result);
+    }
+
+    bit = (size_t)1 << qubit;
+    for (i = 0; i < state->dim; i++) {
+        norm = quantum_state_norm(state, i);
+        total += norm;
+        if (i & bit)
+            p1 += norm;
+    }
+
+    if (total == 0)
+        return -EIO;
+
+    outcome = quantum_random_below(total) < p1;
+    norm = quantum_state_project(state, qubit, outcome);
+    quantum_state_normalize(state, norm);
+
+    *result = outcome;
+    return 0;
+}
+
+/*
+ * Measure the parity of the qubits in mask, the observable Z...Z on them,
+ * and collapse. Diagrams are converted to dense first.
+ */
+int quantum_state_measure_parity(struct quantum_state *state, u64 mask, int *result)
+{
+    u64 total = 0, odd = 0, norm;
+    size_t i;
+    int outcome, ret;
+
+    if (!state || !result || !mask || (mask >> 1 >> (state->num_qubits - 1)))
+        return -EINVAL;
+
+    if (state->cdf.generation == state->generation && state->cdf.point) {
+        *result = hweight64(state->cdf.basis & mask) & 1;
+        return 0;
+    }
+
+    if (state->repr == QUANTUM_REPR_DD) {
+        ret = quantum_state_convert(state, QUANTUM_REPR_DENSE);
+        if (ret < 0)
+            return ret;
+    }
+
+    for (i = 0; i < state->dim; i++) {
+        norm = quantum_state_norm(state, i);
+        total += norm;
+        if (hweight64(i & mask) & 1)
+            odd += norm;
+    }
+
+    if (total == 0)
+        return -EIO;
+
+    /* A certain outcome leaves the state alone */
+    outcome = quantum_random_below(total) < odd;
+    if (odd != (outcome ? total : 0)) {
+        quantum_state_changed(state);
+        norm = quantum_state_project_parity(state, mask, outcome);
+        quantum_state_normalize(state, norm);
+    }
+
+    *result = outcome;
+    return 0;
+}
+
+/* Build the running sums of the current generation */
+const u64 *quantum_state_cdf(struct quantum_state *state)
+{
+    struct quantum_cdf *cdf = &state->cdf;
+    u64 acc = 0;
+    size_t i;
+
+    if (state->repr == QUANTUM_REPR_DD || state->num_qubits > QUANTUM_STATE_CDF_MAX_QUBITS)
+        return NULL;
+
+    if (cdf->generation == state->generation && !cdf->point)
+        return cdf->sums;
+
+    if (!cdf->sums) {
+        cdf->sums = kvmalloc_array(state->dim, sizeof(*cdf->sums), GFP_KERNEL);
+        if (!cdf->sums)
+            return NULL;
+    }
+
+    for (i = 0; i < state->dim; i++) {
+        acc += quantum_state_norm(state, i);
+        cdf->sums[i] = acc;
+    }
+
+    cdf->generation = state->generation;
+    cdf->point = false;
+    return cdf->sums;
+}
+
+/* First basis state whose running sum exceeds r */
+size_t quantum_state_cdf_search(const u64 *sums, size_t dim, u64 r)
+{
+    size_t lo = 0, hi = dim - 1, mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (sums[mid] > r)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+
+    return lo;
+}
+
+/*
+ * Measure the whole register and collapse to the sampled basis state. A
+ * cached distribution turns the pass over the state into a binary search,
+ * and measuring a collapsed state again touches no amplitudes.
+ */
+int quantum_state_measure(struct quantum_state *state, void *result)
+{
+    const struct quantum_cdf *cdf;
+    u64 total = 0, r, acc = 0, outcome;
+    u8 *out = result;
+    size_t i;
+    int ret;
+
+    if (!state || !result)
+        return -EINVAL;
+
+    cdf = &state->cdf;
+
+    if (cdf->generation == state->generation && cdf->point) {
+        outcome = cdf->basis;
+        goto pack;
+    }
+
+    if (state->repr == QUANTUM_REPR_DD) {
+        ret = quantum_dd_sample(state->dd, &outcome);
+        if (ret < 0)
+            return ret;
+        goto collapse;
+    }
+
+    if (cdf->generation == state->generation) {
+        total = cdf->sums[state->dim - 1];
+        if (total == 0)
+            return -EIO;
+        outcome = quantum_state_cdf_search(cdf->sums, state->dim, quantum_random_below(total));
+        goto collapse;
+    }
+
+    for (i = 0; i < state->dim; i++)
+        total += quantum_state_norm(state, i);
+
+    if (total == 0)
+        return -EIO;
+
+    r = quantum_random_below(total);
+    outcome = state->dim - 1;
+    for (i = 0; i < state->dim; i++) {
+        acc += quantum_state_norm(state, i);
+        if (r < acc) {
+            outcome = i;
+            break;
+        }
+    }
+
+collapse:
+    quantum_state_init(state, outcome);
+
+pack:
+    for (i = 0; i < DIV_ROUND_UP(state->num_qubits, 8); i++)
+        out[i] = (outcome >> (i * 8)) & 0xff;
+
+    return 0;
+}
+
+/* Most probable basis state, the collapsed value after a measurement */
+int quantum_state_get_value(struct quantum_state *state)
+{
+    u64 best = 0, norm;
+    size_t i, value = 0;
+
+    if (!state)
+        return -EINVAL;
+
+    if (state->cdf.generation == state->generation && state->cdf.point)
+        return state->cdf.basis;
+
+    if (state->repr == QUANTUM_REPR_DD)
+        return quantum_dd_argmax(state->dd);
+
+    for (i = 0; i < state->dim; i++) {
+        norm = quantum_state_norm(state, i);
+        if (norm > best) {
+            best = norm;
+            value = i;
+        }
+    }
+
+    return value;
+}
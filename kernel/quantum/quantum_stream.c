@@ -0,0 +1,260 @@
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/bitmap.h>
+#include <linux/bitops.h>
+#include <linux/ktime.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include "../include/quantum.h"
+#include "../include/quantum_stream.h"
+
+/* Readouts of ring round r */
+static unsigned long *stream_slot(struct qec_stream *stream, u64 r)
+{
+    return stream->ring + (size_t)(r % QEC_STREAM_RING) * stream->slot_longs;
+}
+
+static u64 stream_pending(struct qec_stream *stream)
+{
+    unsigned long flags;
+    u64 pending;
+
+    spin_lock_irqsave(&stream->lock, flags);
+    pending = stream->head - stream->base;
+    spin_unlock_irqrestore(&stream->lock, flags);
+    return pending;
+}
+
+/*
+ * Decode the oldest rounds of the ring on the given graphs and commit the
+ * first commit of them. Only the decoding side moves base, so the rounds
+ * read here stay put while producers fill the ring behind them.
+ */
+static int stream_window(struct qec_stream *stream, struct qec_uf *uf, unsigned int rounds,
+                         unsigned int commit)
+{
+    unsigned int m = stream->code->num_checks, n = stream->code->num_data;
+    unsigned long fix_longs = BITS_TO_LONGS(n), flags;
+    unsigned long *slot, *prev, *carry;
+    unsigned int t, k, q, bit;
+    u32 num_defects;
+    u64 now;
+    int type, ret;
+
+    for (type = 0; type < QEC_CHECK_TYPES; type++) {
+        carry = stream->carry + type * BITS_TO_LONGS(m);
+        prev = stream->last;
+        num_defects = 0;
+        for (t = 0; t < rounds; t++) {
+            slot = stream_slot(stream, stream->base + t);
+            for (k = 0; k < m; k++) {
+                bit = type * m + k;
+                if (test_bit(bit, slot) ^ test_bit(bit, prev) ^ (t == 0 && test_bit(k, carry)))
+                    stream->defects[num_defects++] = t * m + k;
+            }
+            prev = slot;
+        }
+
+        ret = qec_uf_decode(&uf[type], stream->defects, num_defects, stream->fault);
+        if (ret < 0)
+            return ret;
+
+        /* A wrong readout just before the commit line also flips the next window's first detector */
+        bitmap_zero(carry, m);
+        for (k = 0; commit < rounds && k < m; k++)
+            if (test_bit(rounds * n + (commit - 1) * m + k, stream->fault))
+                __set_bit(k, carry);
+
+        spin_lock_irqsave(&stream->lock, flags);
+        for (t = 0; t < commit; t++)
+            for (q = 0; q < n; q++)
+                if (test_bit(t * n + q, stream->fault))
+                    __change_bit(q, stream->fix + type * fix_longs);
+        spin_unlock_irqrestore(&stream->lock, flags);
+    }
+
+    bitmap_copy(stream->last, stream_slot(stream, stream->base + commit - 1), 2 * m);
+
+    now = ktime_get_ns();
+    spin_lock_irqsave(&stream->lock, flags);
+    for (t = 0; t < commit; t++) {
+        stream->stats.latency_ns = now - stream->pushed_ns[(stream->base + t) % QEC_STREAM_RING];
+        stream->stats.max_latency_ns = max(stream->stats.max_latency_ns, stream->stats.latency_ns);
+        stream->stats.total_latency_ns += stream->stats.latency_ns;
+    }
+    stream->stats.rounds += commit;
+    stream->stats.windows++;
+    stream->base += commit;
+    spin_unlock_irqrestore(&stream->lock, flags);
+    return 0;
+}
+
+/* Decode complete windows until the ring runs short */
+static int stream_drain(struct qec_stream *stream)
+{
+    int ret = 0;
+
+    while (ret == 0 && stream_pending(stream) >= stream->window)
+        ret = stream_window(stream, stream->uf, stream->window, stream->commit);
+    return ret;
+}
+
+static void stream_worker(struct work_struct *work)
+{
+    struct qec_stream *stream = container_of(work, struct qec_stream, work);
+    unsigned long flags;
+    int ret;
+
+    mutex_lock(&stream->decode_lock);
+    ret = stream_drain(stream);
+    mutex_unlock(&stream->decode_lock);
+
+    if (ret < 0) {
+        spin_lock_irqsave(&stream->lock, flags);
+        stream->error = ret;
+        spin_unlock_irqrestore(&stream->lock, flags);
+    }
+}
+
+int qec_stream_init(struct qec_stream *stream, const struct qec_surface *code,
+                    unsigned int window, unsigned int commit)
+{
+    unsigned int m = code->num_checks, n = code->num_data;
+    int type, ret = 0;
+
+    memset(stream, 0, sizeof(*stream));
+    window = window ? window : 2 * code->distance;
+    commit = commit ? commit : min(code->distance, window - 1);
+    if (commit == 0 || commit >= window || window > QEC_STREAM_RING / 2)
+        return -EINVAL;
+
+    stream->code = code;
+    stream->window = window;
+    stream->commit = commit;
+    stream->slot_longs = BITS_TO_LONGS(2 * m);
+    spin_lock_init(&stream->lock);
+    mutex_init(&stream->decode_lock);
+    INIT_WORK(&stream->work, stream_worker);
+
+    stream->defects = kvmalloc_array((size_t)window * m, sizeof(u32), GFP_KERNEL);
+    stream->fault = kvcalloc(BITS_TO_LONGS(window * (n + m)), sizeof(long), GFP_KERNEL);
+    stream->ring = kvcalloc((size_t)QEC_STREAM_RING * stream->slot_longs, sizeof(long),
+                            GFP_KERNEL);
+    stream->pushed_ns = kvcalloc(QEC_STREAM_RING, sizeof(u64), GFP_KERNEL);
+    stream->last = kcalloc(stream->slot_longs, sizeof(long), GFP_KERNEL);
+    stream->carry = kcalloc(QEC_CHECK_TYPES * BITS_TO_LONGS(m), sizeof(long), GFP_KERNEL);
+    stream->fix = kcalloc(QEC_CHECK_TYPES * BITS_TO_LONGS(n), sizeof(long), GFP_KERNEL);
+    stream->wq = alloc_ordered_workqueue("ctrlxt_qec_stream", WQ_HIGHPRI);
+    if (!stream->defects || !stream->fault || !stream->ring || !stream->pushed_ns ||
+        !stream->last || !stream->carry || !stream->fix || !stream->wq)
+        ret = -ENOMEM;
+
+    for (type = 0; type < QEC_CHECK_TYPES && ret == 0; type++) {
+        ret = qec_surface_window_graph(code, type, window, true, &stream->graphs[type]);
+        if (ret == 0)
+            ret = qec_uf_init(&stream->uf[type], &stream->graphs[type]);
+    }
+    if (ret < 0)
+        qec_stream_free(stream);
+    return ret;
+}
+
+void qec_stream_free(struct qec_stream *stream)
+{
+    int type;
+
+    if (stream->wq)
+        destroy_workqueue(stream->wq);
+    for (type = 0; type < QEC_CHECK_TYPES; type++) {
+        qec_uf_free(&stream->uf[type]);
+        qec_graph_free(&stream->graphs[type]);
+    }
+    kvfree(stream->defects);
+    kvfree(stream->fault);
+    kvfree(stream->ring);
+    kvfree(stream->pushed_ns);
+    kfree(stream->last);
+    kfree(stream->carry);
+    kfree(stream->fix);
+    memset(stream, 0, sizeof(*stream));
+}
+
+/* Queue one round and wake the worker once a window is complete */
+int qec_stream_push(struct qec_stream *stream, const unsigned long *readouts)
+{
+    unsigned long flags;
+    bool ready = false;
+    int ret = 0;
+
+    spin_lock_irqsave(&stream->lock, flags);
+    if (stream->error) {
+        ret = stream->error;
+    } else if (stream->head - stream->base >= QEC_STREAM_RING) {
+        ret = -EBUSY;
+    } else {
+        bitmap_copy(stream_slot(stream, stream->head), readouts, 2 * stream->code->num_checks);
+        stream->pushed_ns[stream->head % QEC_STREAM_RING] = ktime_get_ns();
+        stream->head++;
+        ready = stream->head - stream->base >= stream->window;
+    }
+    spin_unlock_irqrestore(&stream->lock, flags);
+
+    if (ready)
+        queue_work(stream->wq, &stream->work);
+    return ret;
+}
+
+/* The last window closes on an exact readout and commits all of its rounds */
+int qec_stream_flush(struct qec_stream *stream)
+{
+    struct qec_graph graphs[QEC_CHECK_TYPES] = { 0 };
+    struct qec_uf uf[QEC_CHECK_TYPES] = { 0 };
+    unsigned int rounds;
+    int type, ret;
+
+    flush_work(&stream->work);
+    mutex_lock(&stream->decode_lock);
+
+    ret = stream->error ? stream->error : stream_drain(stream);
+    rounds = stream_pending(stream);
+    for (type = 0; type < QEC_CHECK_TYPES && ret == 0 && rounds; type++) {
+        ret = qec_surface_window_graph(stream->code, type, rounds, false, &graphs[type]);
+        if (ret == 0)
+            ret = qec_uf_init(&uf[type], &graphs[type]);
+    }
+    if (ret == 0 && rounds)
+        ret = stream_window(stream, uf, rounds, rounds);
+
+    mutex_unlock(&stream->decode_lock);
+    for (type = 0; type < QEC_CHECK_TYPES; type++) {
+        qec_uf_free(&uf[type]);
+        qec_graph_free(&graphs[type]);
+    }
+    return ret;
+}
+
+bool qec_stream_take(struct qec_stream *stream, unsigned long *x, unsigned long *z)
+{
+    unsigned int n = stream->code->num_data;
+    unsigned long *fix_z = stream->fix + BITS_TO_LONGS(n), flags;
+    bool any;
+
+    spin_lock_irqsave(&stream->lock, flags);
+    bitmap_copy(x, stream->fix, n);
+    bitmap_copy(z, fix_z, n);
+    any = !bitmap_empty(x, n) || !bitmap_empty(z, n);
+    bitmap_zero(stream->fix, n);
+    bitmap_zero(fix_z, n);
+    spin_unlock_irqrestore(&stream->lock, flags);
+    return any;
+}
+
+void qec_stream_get_stats(struct qec_stream *stream, struct qec_stream_stats *stats)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&stream->lock, flags);
+    *stats = stream->stats;
+    spin_unlock_irqrestore(&stream->lock, flags);
+}
@@ -0,0 +1,219 @@
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/bitmap.h>
+#include <linux/bitops.h>
+#include "../include/quantum.h"
+#include "../include/quantum_surface.h"
+
+/* Corner order of the CNOT layers, Z shape for X checks and N shape for Z checks */
+static const u8 surface_order[QEC_CHECK_TYPES][4] = {
+    [QEC_CHECK_Z] = { 0, 2, 1, 3 },
+    [QEC_CHECK_X] = { 0, 1, 2, 3 },
+};
+
+/* Type of the check on corner (i, j), -1 where the lattice has none */
+static int surface_corner_type(unsigned int d, unsigned int i, unsigned int j)
+{
+    bool x = (i + j) % 2 == 0;
+    bool row_edge = i == 0 || i == d, col_edge = j == 0 || j == d;
+
+    if (row_edge && col_edge)
+        return -1;
+    if (row_edge)
+        return x ? QEC_CHECK_X : -1;
+    if (col_edge)
+        return x ? -1 : QEC_CHECK_Z;
+    return x ? QEC_CHECK_X : QEC_CHECK_Z;
+}
+
+int qec_surface_init(struct qec_surface *code, unsigned int distance)
+{
+    struct qec_check *check;
+    unsigned int i, j, count[QEC_CHECK_TYPES] = { 0 };
+    int type;
+
+    memset(code, 0, sizeof(*code));
+    if (distance < QEC_SURFACE_MIN_DISTANCE || distance > QEC_SURFACE_MAX_DISTANCE ||
+        distance % 2 == 0)
+        return -EINVAL;
+
+    code->distance = distance;
+    code->num_data = distance * distance;
+    code->num_checks = (code->num_data - 1) / 2;
+    for (type = 0; type < QEC_CHECK_TYPES; type++) {
+        code->checks[type] = kcalloc(code->num_checks, sizeof(struct qec_check), GFP_KERNEL);
+        if (!code->checks[type]) {
+            qec_surface_free(code);
+            return -ENOMEM;
+        }
+    }
+
+    for (i = 0; i <= distance; i++) {
+        for (j = 0; j <= distance; j++) {
+            type = surface_corner_type(distance, i, j);
+            if (type < 0)
+                continue;
+
+            check = &code->checks[type][count[type]++];
+            check->data[0] = i > 0 && j > 0 ? (i - 1) * distance + j - 1 : QEC_SURFACE_NONE;
+            check->data[1] = i > 0 && j < distance ? (i - 1) * distance + j : QEC_SURFACE_NONE;
+            check->data[2] = i < distance && j > 0 ? i * distance + j - 1 : QEC_SURFACE_NONE;
+            check->data[3] = i < distance && j < distance ? i * distance + j : QEC_SURFACE_NONE;
+        }
+    }
+
+    return 0;
+}
+
+void qec_surface_free(struct qec_surface *code)
+{
+    kfree(code->checks[QEC_CHECK_Z]);
+    kfree(code->checks[QEC_CHECK_X]);
+    memset(code, 0, sizeof(*code));
+}
+
+/* Hadamards around the X ancillas plus one CNOT per check corner */
+size_t qec_surface_circuit_len(const struct qec_surface *code)
+{
+    return 2 * (size_t)code->num_checks + 4 * (size_t)code->distance * (code->distance - 1);
+}
+
+size_t qec_surface_circuit(const struct qec_surface *code, struct quantum_op *ops)
+{
+    const struct qec_check *check;
+    unsigned int layer, k, data, ancilla;
+    unsigned int x_base = code->num_data + code->num_checks;
+    size_t n = 0;
+    int type;
+
+    for (k = 0; k < code->num_checks; k++)
+        ops[n++] = (struct quantum_op){ QUANTUM_GATE_H, x_base + k, -1, 0 };
+
+    for (layer = 0; layer < 4; layer++) {
+        for (type = 0; type < QEC_CHECK_TYPES; type++) {
+            for (k = 0; k < code->num_checks; k++) {
+                check = &code->checks[type][k];
+                data = check->data[surface_order[type][layer]];
+                if (data == QEC_SURFACE_NONE)
+                    continue;
+
+                ancilla = code->num_data + type * code->num_checks + k;
+                if (type == QEC_CHECK_X)
+                    ops[n++] = (struct quantum_op){ QUANTUM_GATE_CNOT, ancilla, data, 0 };
+                else
+                    ops[n++] = (struct quantum_op){ QUANTUM_GATE_CNOT, data, ancilla, 0 };
+            }
+        }
+    }
+
+    for (k = 0; k < code->num_checks; k++)
+        ops[n++] = (struct quantum_op){ QUANTUM_GATE_H, x_base + k, -1, 0 };
+
+    return n;
+}
+
+/*
+ * Detector graph of the checks of one type over rounds of extraction. Split
+ * graphs give every fault of every round its own id, open ones let the
+ * readouts of the last round end on the boundary.
+ */
+static int surface_graph(const struct qec_surface *code, enum qec_check_type type,
+                         unsigned int rounds, bool split, bool open, struct qec_graph *graph)
+{
+    const struct qec_check *checks;
+    unsigned int m = code->num_checks, n = code->num_data, t, k, c, q;
+    u32 (*owners)[2], boundary, e = 0;
+    u8 *count;
+    int ret;
+
+    if (type >= QEC_CHECK_TYPES || rounds == 0 || rounds > U32_MAX / 2 / n)
+        return -EINVAL;
+
+    checks = code->checks[type];
+    owners = kvmalloc_array(n, sizeof(*owners), GFP_KERNEL);
+    count = kvzalloc(n, GFP_KERNEL);
+    ret = owners && count ? 0 : -ENOMEM;
+    if (ret == 0)
+        ret = qec_graph_alloc(graph, rounds * m + 1, rounds * n + (rounds - !open) * m,
+                              split ? rounds * (n + m) : n);
+    if (ret < 0)
+        goto out;
+
+    /* Every data qubit is in one or two checks of each type */
+    for (k = 0; k < m; k++) {
+        for (c = 0; c < 4; c++) {
+            q = checks[k].data[c];
+            if (q != QEC_SURFACE_NONE)
+                owners[q][count[q]++] = k;
+        }
+    }
+
+    boundary = qec_graph_boundary(graph);
+    for (t = 0; t < rounds; t++) {
+        for (q = 0; q < n; q++) {
+            graph->edges[e].a = t * m + owners[q][0];
+            graph->edges[e].b = count[q] == 2 ? t * m + owners[q][1] : boundary;
+            graph->edges[e].weight = 1;
+            graph->edges[e++].fault = split ? t * n + q : q;
+        }
+        for (k = 0; (t + 1 < rounds || open) && k < m; k++) {
+            graph->edges[e].a = t * m + k;
+            graph->edges[e].b = t + 1 < rounds ? (t + 1) * m + k : boundary;
+            graph->edges[e].weight = 1;
+            graph->edges[e++].fault = split ? rounds * n + t * m + k : -1;
+        }
+    }
+
+    ret = qec_graph_finish(graph);
+    if (ret < 0)
+        qec_graph_free(graph);
+out:
+    kvfree(owners);
+    kvfree(count);
+    return ret;
+}
+
+int qec_surface_graph(const struct qec_surface *code, enum qec_check_type type,
+                      unsigned int rounds, struct qec_graph *graph)
+{
+    return surface_graph(code, type, rounds, false, false, graph);
+}
+
+int qec_surface_window_graph(const struct qec_surface *code, enum qec_check_type type,
+                             unsigned int rounds, bool open, struct qec_graph *graph)
+{
+    return surface_graph(code, type, rounds, true, open, graph);
+}
+
+/* Parities of the checks of one type under the given error bitmap */
+void qec_surface_syndrome(const struct qec_surface *code, enum qec_check_type type,
+                          const unsigned long *errors, unsigned long *syndrome)
+{
+    const struct qec_check *check;
+    unsigned int k, c;
+    bool bit;
+
+    bitmap_zero(syndrome, code->num_checks);
+    for (k = 0; k < code->num_checks; k++) {
+        check = &code->checks[type][k];
+        bit = false;
+        for (c = 0; c < 4; c++)
+            if (check->data[c] != QEC_SURFACE_NONE)
+                bit ^= test_bit(check->data[c], errors);
+        if (bit)
+            __set_bit(k, syndrome);
+    }
+}
+
+/* X errors flip logical Z along row 0, Z errors flip logical X down column 0 */
+bool qec_surface_logical(const struct qec_surface *code, enum qec_check_type type,
+                         const unsigned long *errors)
+{
+    unsigned int d = code->distance, i;
+    bool flip = false;
+
+    for (i = 0; i < d; i++)
+        flip ^= test_bit(type == QEC_CHECK_Z ? i : i * d, errors);
+    return flip;
+}
@@ -0,0 +1,986 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/string.h>
+#include <linux/random.h>
+#include <linux/math64.h>
+#include <linux/bitops.h>
+#include <linux/sched/signal.h>
+#include "../include/ctrlxt_kernel.h"
+#include "../include/quantum.h"
+#include "../include/quantum_tn.h"
+
+#define TN_MAX_LEGS 64
+#define TN_PLAN_RANK_CAP 62
+
+/*
+ * Dense tensor, bit k of an entry index is the value of edge legs[k]. Entries
+ * carry a shared power-of-two scale so intermediates cannot overflow Q2.30.
+ */
+struct tn_tensor {
+    unsigned int rank;
+    int legs[TN_MAX_LEGS];
+    int scale;
+    struct quantum_amp *data;
+};
+
+/* Every edge joins two tensors unless it is fixed by the query */
+struct tn_network {
+    unsigned int num_qubits;
+    unsigned int num_tensors;
+    unsigned int max_tensors;
+    struct tn_tensor *tensors;
+    unsigned int num_edges;
+    unsigned int max_edges;
+    int *edge_qubit;            /* qubit whose query bit fixes the edge, or -1 */
+};
+
+/* Pairwise contraction order, the result of a step replaces steps[i][0] */
+struct tn_plan {
+    unsigned int num_steps;
+    unsigned int (*steps)[2];
+    bool *sliced;
+    int sliced_edges[QUANTUM_TN_MAX_SLICED];
+    unsigned int num_sliced;
+    unsigned int max_rank;
+    u64 flops;
+};
+
+/* Shared state of one contraction job */
+struct tn_job {
+    const struct tn_network *net;
+    const struct tn_plan *plan;
+    const u64 *queries;
+    size_t count;
+    u64 num_slices;
+    unsigned int workers;
+    s64 *acc;                   /* workers x count x {re, im} */
+    struct task_struct *owner;  /* caller, whose fatal signal ends the run */
+    int error;
+};
+
+static bool tn_is_two_qubit(enum quantum_gate_type gate)
+{
+    return gate >= QUANTUM_GATE_CNOT && gate <= QUANTUM_GATE_SWAP;
+}
+
+static int tn_net_init(struct tn_network *net, const struct quantum_circuit *circuit,
+                       unsigned int copies)
+{
+    size_t tensors = copies * (circuit->num_qubits + 2 * circuit->num_ops);
+    size_t edges = copies * (circuit->num_qubits + 3 * circuit->num_ops);
+
+    memset(net, 0, sizeof(*net));
+    if (tensors > QUANTUM_TN_MAX_TENSORS)
+        return -E2BIG;
+
+    net->num_qubits = circuit->num_qubits;
+    net->max_tensors = tensors;
+    net->max_edges = edges;
+    net->tensors = kvcalloc(tensors, sizeof(*net->tensors), GFP_KERNEL);
+    net->edge_qubit = kvcalloc(edges, sizeof(*net->edge_qubit), GFP_KERNEL);
+    if (!net->tensors || !net->edge_qubit)
+        return -ENOMEM;
+
+    return 0;
+}
+
+static void tn_net_free(struct tn_network *net)
+{
+    unsigned int i;
+
+    if (net->tensors) {
+        for (i = 0; i < net->num_tensors; i++)
+            kfree(net->tensors[i].data);
+    }
+    kvfree(net->tensors);
+    kvfree(net->edge_qubit);
+}
+
+static int tn_new_edge(struct tn_network *net)
+{
+    net->edge_qubit[net->num_edges] = -1;
+    return net->num_edges++;
+}
+
+static int tn_add_tensor(struct tn_network *net, unsigned int rank, const int *legs)
+{
+    struct tn_tensor *t = &net->tensors[net->num_tensors];
+
+    t->rank = rank;
+    memcpy(t->legs, legs, rank * sizeof(*legs));
+    t->data = kcalloc(1 << rank, sizeof(*t->data), GFP_KERNEL);
+    if (!t->data)
+        return -ENOMEM;
+
+    return net->num_tensors++;
+}
+
+static int tn_leg_pos(const struct tn_tensor *t, int edge)
+{
+    unsigned int k;
+
+    for (k = 0; k < t->rank; k++) {
+        if (t->legs[k] == edge)
+            return k;
+    }
+
+    return -1;
+}
+
+/* Multiply a one-qubit matrix into the leg of a tensor */
+static void tn_apply_mat2(struct tn_tensor *t, int pos, const struct quantum_amp *m)
+{
+    size_t bit = (size_t)1 << pos;
+    struct quantum_amp a0, a1;
+    size_t i;
+
+    for (i = 0; i < ((size_t)1 << t->rank); i++) {
+        if (i & bit)
+            continue;
+        a0 = t->data[i];
+        a1 = t->data[i | bit];
+        t->data[i].re = qamp_mul_re(m[0], a0) + qamp_mul_re(m[1], a1);
+        t->data[i].im = qamp_mul_im(m[0], a0) + qamp_mul_im(m[1], a1);
+        t->data[i | bit].re = qamp_mul_re(m[2], a0) + qamp_mul_re(m[3], a1);
+        t->data[i | bit].im = qamp_mul_im(m[2], a0) + qamp_mul_im(m[3], a1);
+    }
+}
+
+static void tn_conj_mat2(struct quantum_amp *m, bool conj)
+{
+    int k;
+
+    if (!conj)
+        return;
+    for (k = 0; k < 4; k++)
+        m[k].im = -m[k].im;
+}
+
+/*
+ * Append the network of C|0...0>, or of its complex conjugate. One-qubit
+ * gates are folded into the tensor owning the wire, SWAPs relabel wires and
+ * controlled gates become two rank-3 tensors joined by a Schmidt bond:
+ * a COPY tensor on the control and I/U on the target.
+ */
+static int tn_build(struct tn_network *net, const struct quantum_circuit *circuit,
+                    bool conj, int *open, int *owner)
+{
+    const struct quantum_op *op;
+    struct quantum_amp m[4];
+    int legs[3], a, b, bond;
+    unsigned int q;
+    size_t i;
+    int t;
+
+    for (q = 0; q < circuit->num_qubits; q++) {
+        legs[0] = tn_new_edge(net);
+        t = tn_add_tensor(net, 1, legs);
+        if (t < 0)
+            return t;
+        net->tensors[t].data[0].re = QAMP_ONE;
+        open[q] = legs[0];
+        owner[q] = t;
+    }
+
+    for (i = 0; i < circuit->num_ops; i++) {
+        op = &circuit->ops[i];
+        a = op->qubit;
+        b = op->target;
+
+        if (a < 0 || a >= circuit->num_qubits)
+            return -EINVAL;
+
+        if (!tn_is_two_qubit(op->gate)) {
+            if (quantum_gate_matrix(op->gate, op->angle, m) < 0)
+                return -EINVAL;
+            tn_conj_mat2(m, conj);
+            tn_apply_mat2(&net->tensors[owner[a]], tn_leg_pos(&net->tensors[owner[a]], open[a]), m);
+            continue;
+        }
+
+        if (b < 0 || b >= circuit->num_qubits || a == b)
+            return -EINVAL;
+
+        if (op->gate == QUANTUM_GATE_SWAP) {
+            swap(open[a], open[b]);
+            swap(owner[a], owner[b]);
+            continue;
+        }
+
+        bond = tn_new_edge(net);
+
+        /* COPY tensor (in, out, bond) on the control */
+        legs[0] = open[a];
+        legs[1] = tn_new_edge(net);
+        legs[2] = bond;
+        t = tn_add_tensor(net, 3, legs);
+        if (t < 0)
+            return t;
+        net->tensors[t].data[0].re = QAMP_ONE;
+        net->tensors[t].data[7].re = QAMP_ONE;
+        open[a] = legs[1];
+        owner[a] = t;
+
+        /* I for bond 0, U for bond 1, index (in, out, bond) on the target */
+        quantum_gate_matrix(op->gate == QUANTUM_GATE_CNOT ? QUANTUM_GATE_X :
+                            op->gate == QUANTUM_GATE_CZ ? QUANTUM_GATE_Z : QUANTUM_GATE_PHASE,
+                            op->angle, m);
+        tn_conj_mat2(m, conj);
+        legs[0] = open[b];
+        legs[1] = tn_new_edge(net);
+        t = tn_add_tensor(net, 3, legs);
+        if (t < 0)
+            return t;
+        net->tensors[t].data[0].re = QAMP_ONE;
+        net->tensors[t].data[3].re = QAMP_ONE;
+        net->tensors[t].data[4] = m[0];
+        net->tensors[t].data[5] = m[1];
+        net->tensors[t].data[6] = m[2];
+        net->tensors[t].data[7] = m[3];
+        open[b] = legs[1];
+        owner[b] = t;
+    }
+
+    return 0;
+}
+
+static bool tn_removed(const struct tn_network *net, const struct tn_plan *plan, int edge)
+{
+    return net->edge_qubit[edge] >= 0 || plan->sliced[edge];
+}
+
+/* Leg structure of the network with fixed and sliced edges dropped */
+static void tn_sym_init(const struct tn_network *net, const struct tn_plan *plan,
+                        struct tn_tensor *sym, int (*ends)[2])
+{
+    unsigned int i, k;
+    int e;
+
+    for (e = 0; e < net->num_edges; e++)
+        ends[e][0] = ends[e][1] = -1;
+
+    for (i = 0; i < net->num_tensors; i++) {
+        sym[i].rank = 0;
+        for (k = 0; k < net->tensors[i].rank; k++) {
+            e = net->tensors[i].legs[k];
+            if (tn_removed(net, plan, e))
+                continue;
+            sym[i].legs[sym[i].rank++] = e;
+            ends[e][ends[e][0] < 0 ? 0 : 1] = i;
+        }
+    }
+}
+
+/* Rank and shared-leg count of contracting a with b */
+static unsigned int tn_merge_rank(const struct tn_tensor *a, const struct tn_tensor *b,
+                                  unsigned int *shared)
+{
+    unsigned int i, s = 0;
+
+    for (i = 0; i < a->rank; i++) {
+        if (tn_leg_pos(b, a->legs[i]) >= 0)
+            s++;
+    }
+
+    *shared = s;
+    return a->rank + b->rank - 2 * s;
+}
+
+/* Replace a by the leg structure of a contracted with b */
+static void tn_merge_legs(struct tn_tensor *a, const struct tn_tensor *b)
+{
+    int legs[TN_MAX_LEGS];
+    unsigned int i, n = 0;
+
+    for (i = 0; i < a->rank; i++) {
+        if (tn_leg_pos(b, a->legs[i]) < 0)
+            legs[n++] = a->legs[i];
+    }
+    for (i = 0; i < b->rank; i++) {
+        if (tn_leg_pos(a, b->legs[i]) < 0)
+            legs[n++] = b->legs[i];
+    }
+
+    memcpy(a->legs, legs, n * sizeof(*legs));
+    a->rank = n;
+}
+
+static u64 tn_sat_add(u64 a, u64 b)
+{
+    return a + b < a ? U64_MAX : a + b;
+}
+
+/*
+ * Greedy order: always contract the connected pair whose result grows the
+ * least. Trials after the first perturb the score to escape ties and local
+ * minima; the caller keeps the cheapest order.
+ */
+static int tn_greedy(const struct tn_network *net, struct tn_tensor *sym, int (*ends)[2],
+                     bool *alive, unsigned int (*steps)[2], unsigned int trial)
+{
+    unsigned int step, i, j, k, r, s, ri, rj;
+    int bi, bj, e, n;
+    s64 score, best;
+
+    for (i = 0; i < net->num_tensors; i++)
+        alive[i] = true;
+
+    for (step = 0; step + 1 < net->num_tensors; step++) {
+        best = S64_MAX;
+        bi = bj = -1;
+
+        for (i = 0; i < net->num_tensors; i++) {
+            if (!alive[i])
+                continue;
+            for (k = 0; k < sym[i].rank; k++) {
+                e = sym[i].legs[k];
+                n = ends[e][0] == i ? ends[e][1] : ends[e][0];
+                if (n < 0)
+                    continue;
+                j = n;
+                if (j <= i || !alive[j])
+                    continue;
+
+                r = tn_merge_rank(&sym[i], &sym[j], &s);
+                if (r > TN_PLAN_RANK_CAP)
+                    continue;
+
+                ri = sym[i].rank;
+                rj = sym[j].rank;
+                score = (1LL << r) - (1LL << ri) - (1LL << rj);
+                if (trial)
+                    score += mul_u64_u32_shr(1ULL << max(ri, rj), get_random_u32(), 34);
+
+                if (score < best) {
+                    best = score;
+                    bi = i;
+                    bj = j;
+                }
+            }
+        }
+
+        /* Disconnected components, take an outer product of the two smallest */
+        if (bi < 0) {
+            for (i = 0; i < net->num_tensors; i++) {
+                if (!alive[i])
+                    continue;
+                if (bi < 0 || sym[i].rank < sym[bi].rank) {
+                    bj = bi;
+                    bi = i;
+                } else if (bj < 0 || sym[i].rank < sym[bj].rank) {
+                    bj = i;
+                }
+            }
+            if (sym[bi].rank + sym[bj].rank > TN_PLAN_RANK_CAP)
+                return -E2BIG;
+            if (bi > bj)
+                swap(bi, bj);
+        }
+
+        for (k = 0; k < sym[bj].rank; k++) {
+            e = sym[bj].legs[k];
+            for (n = 0; n < 2; n++) {
+                if (ends[e][n] == bj)
+                    ends[e][n] = bi;
+            }
+        }
+        tn_merge_legs(&sym[bi], &sym[bj]);
+        alive[bj] = false;
+        steps[step][0] = bi;
+        steps[step][1] = bj;
+    }
+
+    return 0;
+}
+
+/*
+ * Replay an order on the leg structure. Returns the largest intermediate
+ * rank; counts[e] is bumped for every intermediate above the rank limit that
+ * carries edge e, which drives the choice of edges to slice.
+ */
+static unsigned int tn_replay(const struct tn_network *net, const struct tn_plan *plan,
+                              const unsigned int (*steps)[2], struct tn_tensor *sym,
+                              int (*ends)[2], unsigned int *counts, u64 *flops)
+{
+    unsigned int step, r, s, k, max_rank = 0;
+    struct tn_tensor *a, *b;
+
+    tn_sym_init(net, plan, sym, ends);
+    *flops = 0;
+
+    for (step = 0; step + 1 < net->num_tensors; step++) {
+        a = &sym[steps[step][0]];
+        b = &sym[steps[step][1]];
+        r = tn_merge_rank(a, b, &s);
+
+        *flops = tn_sat_add(*flops, r + s >= 64 ? U64_MAX : 1ULL << (r + s));
+        tn_merge_legs(a, b);
+        max_rank = max(max_rank, r);
+
+        if (counts && r > QUANTUM_TN_MAX_RANK) {
+            for (k = 0; k < a->rank; k++)
+                counts[a->legs[k]]++;
+        }
+    }
+
+    return max_rank;
+}
+
+/* Pick the cheapest of several greedy orders and slice it down to size */
+static int tn_plan_build(const struct tn_network *net, struct tn_plan *plan)
+{
+    unsigned int (*trial_steps)[2] = NULL;
+    unsigned int *counts = NULL;
+    unsigned int trial, best_count;
+    struct tn_tensor *sym = NULL;
+    int (*ends)[2] = NULL;
+    bool *alive = NULL;
+    u64 flops, best = U64_MAX;
+    int e, best_edge, ret;
+
+    memset(plan, 0, sizeof(*plan));
+    plan->num_steps = net->num_tensors - 1;
+    plan->sliced = kvcalloc(net->num_edges, sizeof(*plan->sliced), GFP_KERNEL);
+    plan->steps = kvcalloc(max(plan->num_steps, 1U), sizeof(*plan->steps), GFP_KERNEL);
+    trial_steps = kvcalloc(max(plan->num_steps, 1U), sizeof(*trial_steps), GFP_KERNEL);
+    counts = kvcalloc(net->num_edges, sizeof(*counts), GFP_KERNEL);
+    sym = kvcalloc(net->num_tensors, sizeof(*sym), GFP_KERNEL);
+    ends = kvcalloc(net->num_edges, sizeof(*ends), GFP_KERNEL);
+    alive = kvcalloc(net->num_tensors, sizeof(*alive), GFP_KERNEL);
+    if (!plan->sliced || !plan->steps || !trial_steps || !counts || !sym || !ends || !alive) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    for (trial = 0; trial < QUANTUM_TN_ORDER_TRIALS; trial++) {
+        tn_sym_init(net, plan, sym, ends);
+        ret = tn_greedy(net, sym, ends, alive, trial_steps, trial);
+        if (ret < 0)
+            continue;
+
+        tn_replay(net, plan, (const unsigned int (*)[2])trial_steps, sym, ends, NULL, &flops);
+        if (flops < best) {
+            best = flops;
+            memcpy(plan->steps, trial_steps, plan->num_steps * sizeof(*trial_steps));
+        }
+    }
+
+    if (best == U64_MAX) {
+        ret = -E2BIG;
+        goto out;
+    }
+
+    for (;;) {
+        memset(counts, 0, net->num_edges * sizeof(*counts));
+        plan->max_rank = tn_replay(net, plan, (const unsigned int (*)[2])plan->steps,
+                                   sym, ends, counts, &plan->flops);
+        if (plan->max_rank <= QUANTUM_TN_MAX_RANK)
+            break;
+
+        if (plan->num_sliced == QUANTUM_TN_MAX_SLICED) {
+            ret = -E2BIG;
+            goto out;
+        }
+
+        best_edge = -1;
+        best_count = 0;
+        for (e = 0; e < net->num_edges; e++) {
+            if (counts[e] > best_count) {
+                best_count = counts[e];
+                best_edge = e;
+            }
+        }
+
+        plan->sliced[best_edge] = true;
+        plan->sliced_edges[plan->num_sliced++] = best_edge;
+    }
+
+    ret = 0;
+
+out:
+    kvfree(trial_steps);
+    kvfree(counts);
+    kvfree(sym);
+    kvfree(ends);
+    kvfree(alive);
+    if (ret < 0) {
+        kvfree(plan->sliced);
+        kvfree(plan->steps);
+    }
+    return ret;
+}
+
+static void tn_plan_free(struct tn_plan *plan)
+{
+    kvfree(plan->sliced);
+    kvfree(plan->steps);
+}
+
+/* Offsets of every combination of the given leg positions */
+static void tn_scatter_table(u32 *table, const unsigned int *pos, unsigned int n)
+{
+    u32 v;
+
+    table[0] = 0;
+    for (v = 1; v < (1U << n); v++)
+        table[v] = table[v & (v - 1)] + (1U << pos[__ffs(v)]);
+}
+
+/* Copy a tensor with the legs set in edge_val fixed to their values */
+static int tn_fix(const struct tn_tensor *src, const s8 *edge_val, struct tn_tensor *dst)
+{
+    unsigned int pos[TN_MAX_LEGS], k, n = 0;
+    u32 base = 0, *table;
+    u32 i;
+
+    for (k = 0; k < src->rank; k++) {
+        if (edge_val[src->legs[k]] < 0) {
+            dst->legs[n] = src->legs[k];
+            pos[n++] = k;
+        } else if (edge_val[src->legs[k]]) {
+            base |= 1U << k;
+        }
+    }
+
+    dst->rank = n;
+    dst->scale = 0;
+    dst->data = kvmalloc_array(1 << n, sizeof(*dst->data), GFP_KERNEL);
+    table = kvmalloc_array(1 << n, sizeof(*table), GFP_KERNEL);
+    if (!dst->data || !table) {
+        kvfree(table);
+        return -ENOMEM;
+    }
+
+    tn_scatter_table(table, pos, n);
+    for (i = 0; i < (1U << n); i++)
+        dst->data[i] = src->data[base + table[i]];
+
+    kvfree(table);
+    return 0;
+}
+
+/* Largest |re| or |im| of a block */
+static u64 tn_max_abs(const s64 *v, size_t n)
+{
+    u64 m = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++)
+        m = max_t(u64, m, v[i] < 0 ? -v[i] : v[i]);
+    return m;
+}
+
+/* Contract a with b into r, renormalizing the block scale */
+static int tn_contract(const struct tn_tensor *a, const struct tn_tensor *b, struct tn_tensor *r)
+{
+    unsigned int fa_pos[TN_MAX_LEGS], sa_pos[TN_MAX_LEGS], fb_pos[TN_MAX_LEGS], sb_pos[TN_MAX_LEGS];
+    unsigned int fa = 0, fb = 0, s = 0, k;
+    u32 *ta_free = NULL, *ta_sh = NULL, *tb_free = NULL, *tb_sh = NULL;
+    u32 va, vb, vs;
+    struct quantum_amp x;
+    s64 *acc = NULL;
+    size_t idx, n;
+    u64 peak;
+    int shift, pos, ret = -ENOMEM;
+
+    r->rank = 0;
+    for (k = 0; k < a->rank; k++) {
+        pos = tn_leg_pos(b, a->legs[k]);
+        if (pos < 0) {
+            r->legs[r->rank++] = a->legs[k];
+            fa_pos[fa++] = k;
+        } else {
+            sa_pos[s] = k;
+            sb_pos[s++] = pos;
+        }
+    }
+    for (k = 0; k < b->rank; k++) {
+        if (tn_leg_pos(a, b->legs[k]) < 0) {
+            r->legs[r->rank++] = b->legs[k];
+            fb_pos[fb++] = k;
+        }
+    }
+
+    n = (size_t)1 << r->rank;
+    r->data = kvmalloc_array(n, sizeof(*r->data), GFP_KERNEL);
+    acc = kvcalloc(2 * n, sizeof(*acc), GFP_KERNEL);
+    ta_free = kvmalloc_array(1 << fa, sizeof(u32), GFP_KERNEL);
+    tb_free = kvmalloc_array(1 << fb, sizeof(u32), GFP_KERNEL);
+    ta_sh = kvmalloc_array(1 << s, sizeof(u32), GFP_KERNEL);
+    tb_sh = kvmalloc_array(1 << s, sizeof(u32), GFP_KERNEL);
+    if (!r->data || !acc || !ta_free || !tb_free || !ta_sh || !tb_sh)
+        goto out;
+
+    tn_scatter_table(ta_free, fa_pos, fa);
+    tn_scatter_table(tb_free, fb_pos, fb);
+    tn_scatter_table(ta_sh, sa_pos, s);
+    tn_scatter_table(tb_sh, sb_pos, s);
+
+    for (vb = 0; vb < (1U << fb); vb++) {
+        for (va = 0; va < (1U << fa); va++) {
+            idx = ((size_t)vb << fa) | va;
+            for (vs = 0; vs < (1U << s); vs++) {
+                x = qamp_mul(a->data[ta_free[va] + ta_sh[vs]], b->data[tb_free[vb] + tb_sh[vs]]);
+                acc[2 * idx] += x.re;
+                acc[2 * idx + 1] += x.im;
+            }
+        }
+    }
+
+    /* Keep the peak magnitude in [2^28, 2^29) */
+    peak = tn_max_abs(acc, 2 * n);
+    shift = peak ? (int)fls64(peak) - 29 : 0;
+
+    r->scale = a->scale + b->scale + shift;
+    for (idx = 0; idx < 2 * n; idx++)
+        acc[idx] = shift >= 0 ? acc[idx] >> shift : acc[idx] * (1LL << -shift);
+    for (idx = 0; idx < n; idx++) {
+        r->data[idx].re = acc[2 * idx];
+        r->data[idx].im = acc[2 * idx + 1];
+    }
+    ret = 0;
+
+out:
+    kvfree(acc);
+    kvfree(ta_free);
+    kvfree(tb_free);
+    kvfree(ta_sh);
+    kvfree(tb_sh);
+    if (ret < 0) {
+        kvfree(r->data);
+        r->data = NULL;
+    }
+    return ret;
+}
+
+static s64 tn_unscale(s32 v, int scale)
+{
+    if (scale >= 0)
+        return scale >= 32 ? (v ? (v < 0 ? S64_MIN : S64_MAX) : 0) : (s64)v << scale;
+    return scale <= -32 ? 0 : (s64)v >> -scale;
+}
+
+/* Contract the whole network for one assignment of the removed edges */
+static int tn_contract_one(const struct tn_network *net, const struct tn_plan *plan,
+                           const s8 *edge_val, struct tn_tensor *work, s64 *re, s64 *im)
+{
+    struct tn_tensor tmp;
+    unsigned int i, a, b, last = 0;
+    int ret = 0;
+
+    for (i = 0; i < net->num_tensors; i++)
+        work[i].data = NULL;
+
+    for (i = 0; i < net->num_tensors; i++) {
+        ret = tn_fix(&net->tensors[i], edge_val, &work[i]);
+        if (ret < 0)
+            goto out;
+    }
+
+    for (i = 0; i < plan->num_steps; i++) {
+        a = plan->steps[i][0];
+        b = plan->steps[i][1];
+        ret = tn_contract(&work[a], &work[b], &tmp);
+        if (ret < 0)
+            goto out;
+        kvfree(work[a].data);
+        kvfree(work[b].data);
+        work[b].data = NULL;
+        work[a] = tmp;
+        last = a;
+    }
+
+    *re = tn_unscale(work[last].data[0].re, work[last].scale);
+    *im = tn_unscale(work[last].data[0].im, work[last].scale);
+
+out:
+    for (i = 0; i < net->num_tensors; i++)
+        kvfree(work[i].data);
+    return ret;
+}
+
+static void tn_worker(void *arg, unsigned int idx)
+{
+    struct tn_job *job = arg;
+    const struct tn_network *net = job->net;
+    const struct tn_plan *plan = job->plan;
+    s64 *acc = job->acc + (size_t)idx * job->count * 2;
+    u64 jobs = job->count * job->num_slices;
+    struct tn_tensor *work;
+    u64 j, slice, query;
+    s64 re, im;
+    unsigned int k;
+    s8 *edge_val;
+    int e, ret;
+
+    work = kvcalloc(net->num_tensors, sizeof(*work), GFP_KERNEL);
+    edge_val = kvmalloc(net->num_edges, GFP_KERNEL);
+    if (!work || !edge_val) {
+        WRITE_ONCE(job->error, -ENOMEM);
+        goto out;
+    }
+
+    for (j = idx; j < jobs && !READ_ONCE(job->error); j += job->workers) {
+        cond_resched();
+        if (fatal_signal_pending(job->owner)) {
+            WRITE_ONCE(job->error, -EINTR);
+            break;
+        }
+
+        query = div64_u64_rem(j, job->num_slices, &slice);
+
+        for (e = 0; e < net->num_edges; e++) {
+            if (net->edge_qubit[e] >= 0)
+                edge_val[e] = (job->queries[query] >> net->edge_qubit[e]) & 1;
+            else
+                edge_val[e] = -1;
+        }
+        for (k = 0; k < plan->num_sliced; k++)
+            edge_val[plan->sliced_edges[k]] = (slice >> k) & 1;
+
+        ret = tn_contract_one(net, plan, edge_val, work, &re, &im);
+        if (ret < 0) {
+            WRITE_ONCE(job->error, ret);
+            break;
+        }
+        acc[2 * query] += re;
+        acc[2 * query + 1] += im;
+    }
+
+out:
+    kvfree(work);
+    kvfree(edge_val);
+}
+
+/* Contract the planned network once per query, summing over slices */
+static int tn_run(const struct tn_network *net, const struct tn_plan *plan,
+                  const u64 *queries, size_t count, struct quantum_amp *out)
+{
+    struct tn_job job;
+    unsigned int w;
+    s64 re, im;
+    size_t i;
+    int ret;
+
+    job.net = net;
+    job.plan = plan;
+    job.queries = queries;
+    job.count = count;
+    job.num_slices = 1ULL << plan->num_sliced;
+    job.workers = min_t(u64, quantum_parallel_width(), count * job.num_slices);
+    job.owner = current;
+    job.error = 0;
+    job.acc = kvcalloc(job.workers * count * 2, sizeof(s64), GFP_KERNEL);
+    if (!job.acc)
+        return -ENOMEM;
+
+    quantum_parallel_for(job.workers, tn_worker, &job);
+
+    ret = READ_ONCE(job.error);
+    if (ret == 0) {
+        for (i = 0; i < count; i++) {
+            re = im = 0;
+            for (w = 0; w < job.workers; w++) {
+                re += job.acc[(w * count + i) * 2];
+                im += job.acc[(w * count + i) * 2 + 1];
+            }
+            out[i].re = clamp_t(s64, re, S32_MIN, S32_MAX);
+            out[i].im = clamp_t(s64, im, S32_MIN, S32_MAX);
+        }
+    }
+
+    kvfree(job.acc);
+    return ret;
+}
+
+static void tn_fill_info(const struct tn_network *net, const struct tn_plan *plan,
+                         struct quantum_tn_info *info)
+{
+    if (!info)
+        return;
+
+    info->num_tensors = net->num_tensors;
+    info->max_rank = plan->max_rank;
+    info->sliced_edges = plan->num_sliced;
+    info->flops = plan->flops;
+}
+
+/* Build <x|C|0> with every output wire fixed by the query */
+static int tn_build_amplitude(struct tn_network *net, const struct quantum_circuit *circuit)
+{
+    int *open, *owner;
+    unsigned int q;
+    int ret;
+
+    if (!circuit || circuit->num_qubits == 0 || circuit->num_qubits > 64)
+        return -EINVAL;
+
+    ret = tn_net_init(net, circuit, 1);
+    if (ret < 0)
+        return ret;
+
+    open = kcalloc(2 * circuit->num_qubits, sizeof(int), GFP_KERNEL);
+    if (!open)
+        return -ENOMEM;
+    owner = open + circuit->num_qubits;
+
+    ret = tn_build(net, circuit, false, open, owner);
+    if (ret == 0) {
+        for (q = 0; q < circuit->num_qubits; q++)
+            net->edge_qubit[open[q]] = q;
+    }
+
+    kfree(open);
+    return ret;
+}
+
+/* Plan the amplitude network without contracting it */
+int quantum_tn_estimate(const struct quantum_circuit *circuit, struct quantum_tn_info *info)
+{
+    struct tn_network net;
+    struct tn_plan plan;
+    int ret;
+
+    if (!info)
+        return -EINVAL;
+
+    ret = tn_build_amplitude(&net, circuit);
+    if (ret == 0) {
+        ret = tn_plan_build(&net, &plan);
+        if (ret == 0) {
+            tn_fill_info(&net, &plan, info);
+            tn_plan_free(&plan);
+        }
+    }
+
+    tn_net_free(&net);
+    return ret;
+}
+
+/* Amplitudes by tensor-network contraction */
+int quantum_tn_amplitudes(const struct quantum_circuit *circuit, const u64 *indices,
+                          size_t count, struct quantum_amp *out,
+                          struct quantum_tn_info *info)
+{
+    struct tn_network net;
+    struct tn_plan plan;
+    size_t i;
+    int ret;
+
+    if (!indices || !out || count == 0)
+        return -EINVAL;
+
+    ret = tn_build_amplitude(&net, circuit);
+    if (ret < 0)
+        goto out;
+
+    for (i = 0; i < count; i++) {
+        if (circuit->num_qubits < 64 && indices[i] >> circuit->num_qubits) {
+            ret = -EINVAL;
+            goto out;
+        }
+    }
+
+    ret = tn_plan_build(&net, &plan);
+    if (ret < 0)
+        goto out;
+
+    tn_fill_info(&net, &plan, info);
+    ret = tn_run(&net, &plan, indices, count, out);
+    tn_plan_free(&plan);
+
+out:
+    tn_net_free(&net);
+    return ret;
+}
+
+/* Marginal probabilities through the doubled network */
+int quantum_tn_marginal(const struct quantum_circuit *circuit, u64 mask, u64 *probs,
+                        struct quantum_tn_info *info)
+{
+    struct quantum_amp *vals = NULL;
+    unsigned int q, k, kept;
+    struct tn_network net;
+    struct tn_plan plan;
+    int *ket, *conj;
+    u64 *queries = NULL;
+    struct tn_tensor *t;
+    size_t j, outcomes;
+    int ret;
+
+    if (!circuit || !probs || circuit->num_qubits == 0 || circuit->num_qubits > 64)
+        return -EINVAL;
+
+    kept = hweight64(mask);
+    if (kept == 0 || kept > QUANTUM_TN_MAX_MARGINAL ||
+        (circuit->num_qubits < 64 && mask >> circuit->num_qubits))
+        return -EINVAL;
+
+    ret = tn_net_init(&net, circuit, 2);
+    if (ret < 0)
+        goto out_net;
+
+    ket = kcalloc(4 * circuit->num_qubits, sizeof(int), GFP_KERNEL);
+    if (!ket) {
+        ret = -ENOMEM;
+        goto out_net;
+    }
+    conj = ket + 2 * circuit->num_qubits;
+
+    ret = tn_build(&net, circuit, false, ket, ket + circuit->num_qubits);
+    if (ret == 0)
+        ret = tn_build(&net, circuit, true, conj, conj + circuit->num_qubits);
+    if (ret < 0)
+        goto out_wires;
+
+    /* Fix kept wires on both sides, trace the others out */
+    for (q = 0; q < circuit->num_qubits; q++) {
+        if (mask & (1ULL << q)) {
+            net.edge_qubit[ket[q]] = q;
+            net.edge_qubit[conj[q]] = q;
+            continue;
+        }
+        t = &net.tensors[conj[circuit->num_qubits + q]];
+        t->legs[tn_leg_pos(t, conj[q])] = ket[q];
+    }
+
+    outcomes = (size_t)1 << kept;
+    queries = kvcalloc(outcomes, sizeof(*queries), GFP_KERNEL);
+    vals = kvcalloc(outcomes, sizeof(*vals), GFP_KERNEL);
+    if (!queries || !vals) {
+        ret = -ENOMEM;
+        goto out_wires;
+    }
+
+    for (j = 0; j < outcomes; j++) {
+        k = 0;
+        for (q = 0; q < circuit->num_qubits; q++) {
+            if (mask & (1ULL << q)) {
+                if (j & ((size_t)1 << k))
+                    queries[j] |= 1ULL << q;
+                k++;
+            }
+        }
+    }
+
+    ret = tn_plan_build(&net, &plan);
+    if (ret < 0)
+        goto out_wires;
+
+    tn_fill_info(&net, &plan, info);
+    ret = tn_run(&net, &plan, queries, outcomes, vals);
+    tn_plan_free(&plan);
+
+    for (j = 0; ret == 0 && j < outcomes; j++)
+        probs[j] = vals[j].re > 0 ? vals[j].re : 0;
+
+out_wires:
+    kvfree(queries);
+    kvfree(vals);
+    kfree(ket);
+out_net:
+    tn_net_free(&net);
+    return ret;
+}
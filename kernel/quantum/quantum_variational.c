@@ -0,0 +1,423 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/random.h>
+#include <linux/prandom.h>
+#include <linux/math64.h>
+#include <linux/int_sqrt.h>
+#include <linux/sched/signal.h>
+#include "../include/ctrlxt_kernel.h"
+#include "../include/quantum.h"
+#include "../include/quantum_backend.h"
+#include "../include/quantum_evolve.h"
+#include "../include/quantum_variational.h"
+
+/* Returned by var_eval() once the budget is spent, not an error */
+#define VAR_SPENT  1
+
+/* Most probes at the starting point that calibrate the SPSA gain */
+#define VAR_SPSA_PROBES  8
+
+/* Running job */
+struct var_ctx {
+    struct quantum_variational *job;
+    struct quantum_state *state;
+    struct quantum_circuit circuit;     /* ops with the angles of the current point */
+    s32 *best;
+    s64 best_energy;
+    s64 mark;                           /* best energy at the last real improvement */
+    u32 idle;                           /* iterations since then */
+    u32 reserve;                        /* evaluations of the budget kept back */
+};
+
+/* A parameter modulo one turn, in [-pi, pi) */
+static inline s32 var_wrap(s64 param)
+{
+    return (s32)((u32)(param + QUANTUM_ANGLE_PI) % QUANTUM_ANGLE_TURN) - QUANTUM_ANGLE_PI;
+}
+
+/* (x + 1)^(1/8) in Q6, the SPSA perturbation decay */
+static inline u64 var_root8(u64 x)
+{
+    return int_sqrt64(int_sqrt64(int_sqrt64((x + 1) << 48)));
+}
+
+/* Angles of the circuit at a point, scale * param wraps with the angle */
+static void var_bind(struct var_ctx *ctx, const s32 *params)
+{
+    const struct quantum_param_op *p;
+    size_t i;
+
+    for (i = 0; i < ctx->job->num_ops; i++) {
+        p = &ctx->job->ops[i];
+        ctx->circuit.ops[i] = p->op;
+        if (p->param >= 0)
+            ctx->circuit.ops[i].angle += (u32)p->scale * (u32)params[p->param];
+    }
+}
+
+/* Energy at a point, remembering the best point seen. -EINTR once the caller is killed */
+static int var_eval(struct var_ctx *ctx, const s32 *params, s64 *energy)
+{
+    struct quantum_variational *job = ctx->job;
+    int ret;
+
+    if (fatal_signal_pending(current))
+        return -EINTR;
+    cond_resched();
+
+    if (job->evaluations + ctx->reserve >= job->budget)
+        return VAR_SPENT;
+
+    var_bind(ctx, params);
+    ret = quantum_state_init(ctx->state, 0);
+    if (ret == 0)
+        ret = quantum_circuit_run(ctx->state, &ctx->circuit);
+    if (ret == 0)
+        ret = quantum_state_expectation(ctx->state, job->observable, energy);
+    if (ret < 0)
+        return ret;
+
+    job->evaluations++;
+    if (*energy < ctx->best_energy) {
+        ctx->best_energy = *energy;
+        memcpy(ctx->best, params, job->num_params * sizeof(*params));
+    }
+    return 0;
+}
+
+/* Record an iteration, true once PATIENCE iterations gained less than the tolerance */
+static bool var_iterate(struct var_ctx *ctx)
+{
+    struct quantum_variational *job = ctx->job;
+
+    if (job->iterations < job->trace_len)
+        job->trace[job->iterations] = ctx->best_energy;
+    job->iterations++;
+
+    if (ctx->best_energy < ctx->mark - job->tolerance) {
+        ctx->mark = ctx->best_energy;
+        ctx->idle = 0;
+        return false;
+    }
+
+    return job->tolerance && ++ctx->idle >= QUANTUM_VARIATIONAL_PATIENCE;
+}
+
+/* Energy difference between theta +/- c * delta for random signs, only set on success */
+static int var_spsa_probe(struct var_ctx *ctx, const s32 *theta, s32 *plus, s32 *minus, u64 c,
+                          struct rnd_state *rnd, s64 *diff)
+{
+    size_t i, n = ctx->job->num_params;
+    s64 ep, em;
+    u32 bits = 0;
+    int ret;
+
+    for (i = 0; i < n; i++) {
+        if (i % 32 == 0)
+            bits = prandom_u32_state(rnd);
+        plus[i] = var_wrap(theta[i] + (bits & 1 ? -(s64)c : (s64)c));
+        minus[i] = var_wrap(theta[i] + (bits & 1 ? (s64)c : -(s64)c));
+        bits >>= 1;
+    }
+
+    ret = var_eval(ctx, plus, &ep);
+    if (ret == 0)
+        ret = var_eval(ctx, minus, &em);
+    if (ret)
+        return ret;
+
+    *diff = ep - em;
+    return 0;
+}
+
+/*
+ * Simultaneous perturbation stochastic approximation. Every iteration
+ * measures the energy at theta +/- c_k * delta for a random sign vector
+ * delta and moves against the gradient estimate. The gains decay as
+ * (k + 1 + A)^-1/2 and c_k as (k + 1)^-1/8. A few probes at the starting
+ * point calibrate the gain so that an average first move equals the step,
+ * a single probe may well sit on a saddle.
+ */
+static int var_spsa(struct var_ctx *ctx, u64 seed)
+{
+    struct quantum_variational *job = ctx->job;
+    size_t i, n = job->num_params;
+    s32 *theta, *plus, *minus;
+    u64 stable = job->budget / 20 + 1, probes, gain = 0, spread = 0, c0, ck, move;
+    struct rnd_state rnd;
+    s64 diff;
+    u32 k;
+    int ret = 0;
+
+    theta = kvmalloc_array(3 * n, sizeof(*theta), GFP_KERNEL);
+    if (!theta)
+        return -ENOMEM;
+    plus = theta + n;
+    minus = plus + n;
+
+    memcpy(theta, job->params, n * sizeof(*theta));
+    prandom_seed_state(&rnd, seed);
+    c0 = max(job->step / 2, 1);
+
+    /* The probes straddle theta, which is measured once more at the end */
+    ctx->reserve = 1;
+    probes = clamp_t(u64, job->budget / 40, 1, VAR_SPSA_PROBES);
+    for (k = 0; k < probes && ret == 0; k++) {
+        ret = var_spsa_probe(ctx, theta, plus, minus, c0, &rnd, &diff);
+        if (ret == 0)
+            spread += abs(diff);
+    }
+
+    for (k = 0; ret == 0; k++) {
+        /* gain is Q16, (k + 1 + A)^-1/2 relative to the first iteration */
+        if (!gain && spread)
+            gain = mul_u64_u64_div_u64(div64_u64((u64)job->step * c0 * probes << 17, spread),
+                                       int_sqrt64((stable + k) << 32),
+                                       int_sqrt64(stable << 32));
+
+        ck = max_t(u64, (c0 << 6) / var_root8(k), 1);
+        ret = var_spsa_probe(ctx, theta, plus, minus, ck, &rnd, &diff);
+        if (ret)
+            break;
+
+        if (!gain)
+            spread = abs(diff);
+
+        if (gain && diff) {
+            /* Moves stay within twice the decayed step whatever the gradient */
+            move = mul_u64_u64_div_u64(min_t(u64, gain, 1ULL << 40), abs(diff), ck << 17);
+            move = min_t(u64, move, 2 * (u64)job->step);
+            move = mul_u64_u64_div_u64(move, int_sqrt64(stable << 32),
+                                       int_sqrt64((stable + k) << 32));
+            for (i = 0; i < n; i++) {
+                if ((var_wrap((s64)plus[i] - theta[i]) > 0) == (diff > 0))
+                    theta[i] = var_wrap(theta[i] - (s64)move);
+                else
+                    theta[i] = var_wrap(theta[i] + (s64)move);
+            }
+        }
+
+        if (var_iterate(ctx))
+            break;
+    }
+
+    ctx->reserve = 0;
+    if (ret == VAR_SPENT || ret == 0)
+        ret = var_eval(ctx, theta, &diff);
+
+    kvfree(theta);
+    return ret;
+}
+
+/* Lowest, highest and second highest vertex of a simplex */
+static void var_simplex_order(const s64 *f, size_t rows, size_t *lo, size_t *hi, size_t *nh)
+{
+    size_t i;
+
+    *lo = *hi = 0;
+    for (i = 1; i < rows; i++) {
+        if (f[i] < f[*lo])
+            *lo = i;
+        if (f[i] > f[*hi])
+            *hi = i;
+    }
+
+    *nh = *lo;
+    for (i = 0; i < rows; i++) {
+        if (i != *hi && f[i] > f[*nh])
+            *nh = i;
+    }
+}
+
+/* to = from + (from - away) * num / 2, the reflections of a simplex */
+static void var_simplex_move(s32 *to, const s32 *from, const s32 *away, s32 num, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++)
+        to[i] = clamp_t(s64, from[i] + div_s64(((s64)from[i] - away[i]) * num, 2),
+                        S32_MIN / 4, S32_MAX / 4);
+}
+
+/*
+ * Nelder-Mead on integer angles with the usual coefficients: reflect 1,
+ * expand 2, contract and shrink 1/2. Stops early once the energies of the
+ * simplex lie within the tolerance or every vertex is the same point.
+ */
+static int var_nelder_mead(struct var_ctx *ctx, s64 start)
+{
+    struct quantum_variational *job = ctx->job;
+    size_t i, j, lo, hi, nh, n = job->num_params, rows = n + 1;
+    s32 *pts, *c, *r, *t;
+    s64 *f, fr, ft, sum;
+    bool same;
+    int ret = 0;
+
+    pts = kvmalloc_array((rows + 3) * n, sizeof(*pts), GFP_KERNEL);
+    f = kvmalloc_array(rows, sizeof(*f), GFP_KERNEL);
+    if (!pts || !f) {
+        kvfree(pts);
+        kvfree(f);
+        return -ENOMEM;
+    }
+    c = pts + rows * n;
+    r = c + n;
+    t = r + n;
+
+    memcpy(pts, job->params, n * sizeof(*pts));
+    f[0] = start;
+    for (i = 1; i < rows && ret == 0; i++) {
+        memcpy(&pts[i * n], job->params, n * sizeof(*pts));
+        pts[i * n + i - 1] += job->step;
+        ret = var_eval(ctx, &pts[i * n], &f[i]);
+    }
+
+    while (ret == 0 && !var_iterate(ctx)) {
+        var_simplex_order(f, rows, &lo, &hi, &nh);
+        if (job->tolerance && f[hi] - f[lo] <= job->tolerance)
+            break;
+
+        for (i = 0, same = true; i < rows * n && same; i++)
+            same = pts[i] == pts[lo * n + i % n];
+        if (same)
+            break;
+
+        for (j = 0; j < n; j++) {
+            for (i = 0, sum = 0; i < rows; i++)
+                sum += i != hi ? pts[i * n + j] : 0;
+            c[j] = div_s64(sum, n);
+        }
+
+        var_simplex_move(r, c, &pts[hi * n], 2, n);
+        ret = var_eval(ctx, r, &fr);
+        if (ret)
+            break;
+
+        if (fr < f[lo]) {
+            var_simplex_move(t, c, &pts[hi * n], 4, n);
+            ret = var_eval(ctx, t, &ft);
+            if (ret)
+                break;
+            memcpy(&pts[hi * n], ft < fr ? t : r, n * sizeof(*pts));
+            f[hi] = min(ft, fr);
+            continue;
+        }
+
+        if (fr < f[nh]) {
+            memcpy(&pts[hi * n], r, n * sizeof(*pts));
+            f[hi] = fr;
+            continue;
+        }
+
+        /* Contract outside towards the reflection or inside towards the worst vertex */
+        var_simplex_move(t, c, fr < f[hi] ? r : &pts[hi * n], -1, n);
+        ret = var_eval(ctx, t, &ft);
+        if (ret)
+            break;
+
+        if (ft < min(fr, f[hi])) {
+            memcpy(&pts[hi * n], t, n * sizeof(*pts));
+            f[hi] = ft;
+            continue;
+        }
+
+        for (i = 0; i < rows && ret == 0; i++) {
+            if (i == lo)
+                continue;
+            var_simplex_move(&pts[i * n], &pts[lo * n], &pts[i * n], -1, n);
+            ret = var_eval(ctx, &pts[i * n], &f[i]);
+        }
+    }
+
+    kvfree(f);
+    kvfree(pts);
+    return ret;
+}
+
+static int var_validate(const struct quantum_variational *job)
+{
+    size_t i;
+
+    if (!job || (job->num_ops && !job->ops) || !job->observable ||
+        (job->num_params && !job->params) || (job->trace_len && !job->trace))
+        return -EINVAL;
+
+    if (job->num_qubits == 0 || job->num_qubits > QUANTUM_STATE_MAX_QUBITS ||
+        job->num_ops > QUANTUM_CIRCUIT_MAX_OPS ||
+        job->num_params > QUANTUM_VARIATIONAL_MAX_PARAMS ||
+        job->optimizer > QUANTUM_OPTIMIZER_NELDER_MEAD ||
+        job->budget == 0 || job->budget > QUANTUM_VARIATIONAL_MAX_BUDGET ||
+        job->step < 0 || job->step > QUANTUM_ANGLE_PI || job->tolerance < 0)
+        return -EINVAL;
+
+    for (i = 0; i < job->num_ops; i++) {
+        if (job->ops[i].param < -1 || job->ops[i].param >= (s64)job->num_params)
+            return -EINVAL;
+    }
+
+    return 0;
+}
+
+/* Optimize the circuit parameters in place, one circuit run per evaluation */
+int quantum_variational_run(struct quantum_variational *job)
+{
+    struct var_ctx ctx = { .job = job, .best_energy = S64_MAX };
+    s64 start;
+    size_t i;
+    int ret;
+
+    ret = var_validate(job);
+    if (ret < 0)
+        return ret;
+
+    job->iterations = 0;
+    job->evaluations = 0;
+    if (!job->step)
+        job->step = QUANTUM_VARIATIONAL_DEFAULT_STEP;
+
+    ctx.circuit.num_qubits = job->num_qubits;
+    ctx.circuit.num_ops = job->num_ops;
+    ctx.circuit.ops = kvmalloc_array(max_t(size_t, job->num_ops, 1), sizeof(*ctx.circuit.ops),
+                                     GFP_KERNEL);
+    ctx.best = kvmalloc_array(max_t(size_t, job->num_params, 1), sizeof(*ctx.best), GFP_KERNEL);
+    if (!ctx.circuit.ops || !ctx.best) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    for (i = 0; i < job->num_params; i++)
+        job->params[i] = var_wrap(job->params[i]);
+
+    /* Real ansatze keep half the state, a complex angle later promotes it */
+    var_bind(&ctx, job->params);
+    ctx.state = quantum_state_alloc_repr(job->num_qubits, quantum_circuit_is_real(&ctx.circuit) ?
+                                         QUANTUM_REPR_REAL : QUANTUM_REPR_DENSE);
+    if (!ctx.state) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    ret = var_eval(&ctx, job->params, &start);
+    ctx.mark = start;
+    if (ret == 0 && job->num_params) {
+        if (job->optimizer == QUANTUM_OPTIMIZER_SPSA)
+            ret = var_spsa(&ctx, job->seed ? job->seed : get_random_u64());
+        else
+            ret = var_nelder_mead(&ctx, start);
+    }
+
+    if (ret == VAR_SPENT)
+        ret = 0;
+    if (ret == 0) {
+        memcpy(job->params, ctx.best, job->num_params * sizeof(*job->params));
+        job->energy = ctx.best_energy;
+    }
+
+out:
+    quantum_state_free(ctx.state);
+    kvfree(ctx.best);
+    kvfree(ctx.circuit.ops);
+    return ret;
+}
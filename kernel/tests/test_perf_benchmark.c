@@ -5,8 +5,14 @@
 #include <linux/time.h>
 #include <linux/delay.h>
 #include <linux/slab.h>
+#include <linux/prandom.h>
+#include <linux/bitmap.h>
+#include <linux/sort.h>
 #include "../include/performance.h"
 #include "../include/quantum.h"
+#include "../include/quantum_error.h"
+#include "../include/quantum_surface.h"
+#include "../include/quantum_frame.h"
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("CTRLxT_STUDIOS");
@@ -16,6 +22,25 @@ MODULE_VERSION("0.1.0");
 #define BENCHMARK_ITERATIONS 1000
 #define BENCHMARK_DELAY_MS 1
 
+/* Surface code decoding, d rounds per block at a physical error rate in parts per million */
+#define SURFACE_BENCH_BLOCKS 2000
+#define SURFACE_BENCH_PPM 1000
+#define SURFACE_ROUND_NS 1000   /* syndrome cycle of superconducting hardware */
+#define MATCHING_BENCH_SHOTS 20000
+#define MATCHING_SHOTS_PER_MINUTE 1000000
+#define FRAME_BENCH_BATCHES 20
+#define FRAME_BENCH_STATE_ROUNDS 10
+#define FRAME_BENCH_SPEEDUP 100
+#define BATCH_BENCH_REGISTERS 256
+#define BATCH_BENCH_ROUNDS 20
+
+/* Threshold sweep, Monte Carlo shots of every code, decoder, distance and error rate */
+#define THRESHOLD_BENCH_SHOTS 4000
+#define THRESHOLD_BENCH_MAX_DISTANCE 9
+#define THRESHOLD_BENCH_BELOW_PPM 10000 /* where larger codes must fail less */
+
+static const u32 threshold_bench_ppm[] = { 1000, 2000, 5000, 10000, 20000 };
+
 /* Helper function to measure operation time */
 static ktime_t measure_operation_time(void (*operation)(void *), void *arg)
 {
@@ -197,6 +222,569 @@ static void test_memory_usage(struct kunit *test)
     KUNIT_EXPECT_LT(test, final_mem - initial_mem, 1024 * 1024); /* Should use less than 1MB */
 }
 
+/* Detectors of d rounds with data and measurement flips, the last round read exactly */
+static u32 surface_bench_sample(const struct qec_surface *code, struct rnd_state *rnd, u32 ppm,
+                                unsigned long *errors, u32 *defects)
+{
+    DECLARE_BITMAP(syndrome, QEC_SURFACE_MAX_DISTANCE * QEC_SURFACE_MAX_DISTANCE);
+    DECLARE_BITMAP(prev, QEC_SURFACE_MAX_DISTANCE * QEC_SURFACE_MAX_DISTANCE);
+    u32 threshold = div_u64((u64)ppm << 32, 1000000);
+    unsigned int d = code->distance, t, q, k;
+    u32 num_defects = 0;
+
+    bitmap_zero(errors, code->num_data);
+    bitmap_zero(prev, code->num_checks);
+    for (t = 0; t < d; t++) {
+        for (q = 0; q < code->num_data; q++)
+            if (prandom_u32_state(rnd) < threshold)
+                __change_bit(q, errors);
+
+        qec_surface_syndrome(code, QEC_CHECK_Z, errors, syndrome);
+        for (k = 0; t + 1 < d && k < code->num_checks; k++)
+            if (prandom_u32_state(rnd) < threshold)
+                __change_bit(k, syndrome);
+
+        for (k = 0; k < code->num_checks; k++) {
+            if (test_bit(k, syndrome) != test_bit(k, prev))
+                defects[num_defects++] = t * code->num_checks + k;
+        }
+        bitmap_copy(prev, syndrome, code->num_checks);
+    }
+
+    return num_defects;
+}
+
+/* Union-find decoding of d rounds at a time must keep up with the syndrome cycle */
+static void test_surface_decoder_benchmark(struct kunit *test)
+{
+    DECLARE_BITMAP(errors, QEC_SURFACE_MAX_DISTANCE * QEC_SURFACE_MAX_DISTANCE);
+    DECLARE_BITMAP(correction, QEC_SURFACE_MAX_DISTANCE * QEC_SURFACE_MAX_DISTANCE);
+    struct qec_surface code;
+    struct qec_graph graph;
+    struct qec_uf uf;
+    struct rnd_state rnd;
+    unsigned int d, failures;
+    ktime_t total_time, start;
+    u32 *defects, num_defects;
+    s64 round_time;
+    int i;
+
+    for (d = 5; d <= 15; d += 2) {
+        KUNIT_ASSERT_EQ(test, qec_surface_init(&code, d), 0);
+        KUNIT_ASSERT_EQ(test, qec_surface_graph(&code, QEC_CHECK_Z, d, &graph), 0);
+        KUNIT_ASSERT_EQ(test, qec_uf_init(&uf, &graph), 0);
+        defects = kmalloc_array(graph.num_nodes, sizeof(*defects), GFP_KERNEL);
+        KUNIT_ASSERT_NOT_NULL(test, defects);
+        prandom_seed_state(&rnd, d);
+
+        total_time = 0;
+        failures = 0;
+        for (i = 0; i < SURFACE_BENCH_BLOCKS; i++) {
+            num_defects = surface_bench_sample(&code, &rnd, SURFACE_BENCH_PPM, errors, defects);
+
+            start = ktime_get();
+            KUNIT_EXPECT_EQ(test, qec_uf_decode(&uf, defects, num_defects, correction), 0);
+            total_time = ktime_add(total_time, ktime_sub(ktime_get(), start));
+
+            bitmap_xor(errors, errors, correction, code.num_data);
+            failures += qec_surface_logical(&code, QEC_CHECK_Z, errors);
+        }
+
+        round_time = ktime_divns(total_time, (s64)SURFACE_BENCH_BLOCKS * d);
+        pr_info("CTRLxT_STUDIOS: Surface d=%u union-find decode %lld ns/round, %u/%d logical failures\n",
+                d, round_time, failures, SURFACE_BENCH_BLOCKS);
+        KUNIT_EXPECT_LT(test, round_time, SURFACE_ROUND_NS);
+
+        kfree(defects);
+        qec_uf_free(&uf);
+        qec_graph_free(&graph);
+        qec_surface_free(&code);
+    }
+}
+
+/* Shots decoded by one worker with a matching workspace of its own */
+struct matching_bench {
+    const struct qec_surface *code;
+    const struct qec_paths *paths;
+    unsigned int workers;
+    atomic_t failures;
+    atomic_t errors;
+};
+
+static void matching_bench_worker(void *arg, unsigned int idx)
+{
+    DECLARE_BITMAP(errors, QEC_SURFACE_MAX_DISTANCE * QEC_SURFACE_MAX_DISTANCE);
+    DECLARE_BITMAP(correction, QEC_SURFACE_MAX_DISTANCE * QEC_SURFACE_MAX_DISTANCE);
+    struct matching_bench *bench = arg;
+    struct qec_mwpm mwpm;
+    struct rnd_state rnd;
+    u32 *defects, num_defects;
+    unsigned int i;
+
+    defects = kmalloc_array(bench->paths->graph->num_nodes, sizeof(*defects), GFP_KERNEL);
+    if (!defects || qec_mwpm_init(&mwpm, bench->paths) < 0) {
+        kfree(defects);
+        atomic_inc(&bench->errors);
+        return;
+    }
+    prandom_seed_state(&rnd, idx + 1);
+
+    for (i = idx; i < MATCHING_BENCH_SHOTS; i += bench->workers) {
+        num_defects = surface_bench_sample(bench->code, &rnd, SURFACE_BENCH_PPM, errors,
+                                           defects);
+        if (qec_mwpm_decode(&mwpm, defects, num_defects, correction) < 0)
+            atomic_inc(&bench->errors);
+
+        bitmap_xor(errors, errors, correction, bench->code->num_data);
+        if (qec_surface_logical(bench->code, QEC_CHECK_Z, errors))
+            atomic_inc(&bench->failures);
+    }
+
+    qec_mwpm_free(&mwpm);
+    kfree(defects);
+}
+
+/* Matching decoders on all cores must decode millions of d-round shots per minute */
+static void test_matching_decoder_benchmark(struct kunit *test)
+{
+    struct matching_bench bench;
+    struct qec_surface code;
+    struct qec_graph graph;
+    struct qec_paths paths;
+    ktime_t start, paths_time, total_time;
+    s64 shots_per_minute;
+    unsigned int d;
+
+    for (d = 5; d <= 15; d += 2) {
+        KUNIT_ASSERT_EQ(test, qec_surface_init(&code, d), 0);
+        KUNIT_ASSERT_EQ(test, qec_surface_graph(&code, QEC_CHECK_Z, d, &graph), 0);
+        qec_graph_set_weights(&graph, SURFACE_BENCH_PPM, SURFACE_BENCH_PPM);
+
+        /* Shortest paths are computed once and shared by every shot */
+        start = ktime_get();
+        KUNIT_ASSERT_EQ(test, qec_paths_init(&paths, &graph), 0);
+        paths_time = ktime_sub(ktime_get(), start);
+
+        bench.code = &code;
+        bench.paths = &paths;
+        bench.workers = quantum_parallel_width();
+        atomic_set(&bench.failures, 0);
+        atomic_set(&bench.errors, 0);
+
+        start = ktime_get();
+        quantum_parallel_for(bench.workers, matching_bench_worker, &bench);
+        total_time = ktime_sub(ktime_get(), start);
+
+        shots_per_minute = div64_s64((s64)MATCHING_BENCH_SHOTS * 60 * NSEC_PER_SEC,
+                                     max_t(s64, total_time, 1));
+        pr_info("CTRLxT_STUDIOS: Surface d=%u matching %lld shots/min on %u workers, paths %lld us, %d/%d logical failures\n",
+                d, shots_per_minute, bench.workers, ktime_divns(paths_time, NSEC_PER_USEC),
+                atomic_read(&bench.failures), MATCHING_BENCH_SHOTS);
+        KUNIT_EXPECT_EQ(test, atomic_read(&bench.errors), 0);
+        KUNIT_EXPECT_GT(test, shots_per_minute, MATCHING_SHOTS_PER_MINUTE);
+
+        qec_paths_free(&paths);
+        qec_graph_free(&graph);
+        qec_surface_free(&code);
+    }
+}
+
+/* Frame sampling must beat state-vector rounds by orders of magnitude */
+static void test_frame_sampler_benchmark(struct kunit *test)
+{
+    struct qec_frame_noise noise = {
+        .data_ppm = SURFACE_BENCH_PPM,
+        .gate_ppm = SURFACE_BENCH_PPM,
+        .measure_ppm = SURFACE_BENCH_PPM,
+    };
+    struct qec_params params = { .code_type = QEC_CODE_SURFACE, .distance = 3 };
+    struct quantum_state *state;
+    struct ctrlxt_qec_ctx *ctx;
+    struct quantum_op *ops;
+    struct qec_surface surface;
+    struct qec_frame frame;
+    struct qec_code code;
+    s64 rate, frame_rate = 0, state_rate;
+    ktime_t start, total_time;
+    u64 *det, events;
+    size_t i, len;
+    unsigned int d;
+    int b;
+
+    for (d = 3; d <= 15; d += 2) {
+        KUNIT_ASSERT_EQ(test, qec_surface_init(&surface, d), 0);
+        ops = kmalloc_array(qec_surface_circuit_len(&surface), sizeof(*ops), GFP_KERNEL);
+        KUNIT_ASSERT_NOT_NULL(test, ops);
+        code = (struct qec_code){
+            .type = QEC_CODE_SURFACE,
+            .num_data = surface.num_data,
+            .num_ancillas = 2 * surface.num_checks,
+            .num_stabilizers = 2 * surface.num_checks,
+            .circuit = ops,
+            .circuit_len = qec_surface_circuit(&surface, ops),
+        };
+        KUNIT_ASSERT_EQ(test, qec_frame_init(&frame, &code, QEC_FRAME_MAX_SHOTS, &noise, d), 0);
+        len = (size_t)d * frame.num_checks * frame.words;
+        det = kvmalloc_array(len, sizeof(*det), GFP_KERNEL);
+        KUNIT_ASSERT_NOT_NULL(test, det);
+
+        events = 0;
+        start = ktime_get();
+        for (b = 0; b < FRAME_BENCH_BATCHES; b++) {
+            KUNIT_EXPECT_EQ(test, qec_frame_sample(&frame, d, det), 0);
+            for (i = 0; i < len; i++)
+                events += hweight64(det[i]);
+        }
+        total_time = ktime_sub(ktime_get(), start);
+
+        rate = div64_s64((s64)FRAME_BENCH_BATCHES * QEC_FRAME_MAX_SHOTS * d * NSEC_PER_SEC,
+                         max_t(s64, total_time, 1));
+        pr_info("CTRLxT_STUDIOS: Surface d=%u frame sampler %lld shot-rounds/s, %llu detection events\n",
+                d, rate, events);
+        if (d == 3)
+            frame_rate = rate;
+
+        kvfree(det);
+        qec_frame_free(&frame);
+        kfree(ops);
+        qec_surface_free(&surface);
+    }
+
+    /* The same distance-3 rounds on a 17-qubit register */
+    state = quantum_state_alloc(17);
+    KUNIT_ASSERT_NOT_NULL(test, state);
+    ctx = ctrlxt_qec_alloc(state, &params);
+    KUNIT_ASSERT_FALSE(test, IS_ERR(ctx));
+
+    start = ktime_get();
+    for (b = 0; b < FRAME_BENCH_STATE_ROUNDS; b++)
+        KUNIT_EXPECT_EQ(test, ctrlxt_qec_apply(ctx), 0);
+    total_time = ktime_sub(ktime_get(), start);
+
+    state_rate = div64_s64((s64)FRAME_BENCH_STATE_ROUNDS * NSEC_PER_SEC, max_t(s64, total_time, 1));
+    pr_info("CTRLxT_STUDIOS: Surface d=3 state vector %lld rounds/s\n", state_rate);
+    KUNIT_EXPECT_GT(test, frame_rate, FRAME_BENCH_SPEEDUP * state_rate);
+
+    ctrlxt_qec_free(ctx);
+    quantum_state_free(state);
+}
+
+/* Rounds over many small registers, one call per register against one batch */
+static void test_qec_batch_benchmark(struct kunit *test)
+{
+    struct qec_params params = { .code_type = QEC_CODE_BITFLIP };
+    struct quantum_state **states;
+    struct ctrlxt_qec_ctx **ctxs;
+    ktime_t start, serial_time, batch_time;
+    int i, r;
+
+    states = kcalloc(BATCH_BENCH_REGISTERS, sizeof(*states), GFP_KERNEL);
+    ctxs = kcalloc(BATCH_BENCH_REGISTERS, sizeof(*ctxs), GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, states);
+    KUNIT_ASSERT_NOT_NULL(test, ctxs);
+    for (i = 0; i < BATCH_BENCH_REGISTERS; i++) {
+        states[i] = quantum_state_alloc(3);
+        KUNIT_ASSERT_NOT_NULL(test, states[i]);
+        ctxs[i] = ctrlxt_qec_alloc(states[i], &params);
+        KUNIT_ASSERT_FALSE(test, IS_ERR(ctxs[i]));
+    }
+
+    start = ktime_get();
+    for (r = 0; r < BATCH_BENCH_ROUNDS; r++)
+        for (i = 0; i < BATCH_BENCH_REGISTERS; i++)
+            KUNIT_EXPECT_EQ(test, ctrlxt_qec_apply(ctxs[i]), 0);
+    serial_time = ktime_sub(ktime_get(), start);
+
+    start = ktime_get();
+    for (r = 0; r < BATCH_BENCH_ROUNDS; r++)
+        KUNIT_EXPECT_EQ(test, ctrlxt_qec_apply_batch(ctxs, BATCH_BENCH_REGISTERS), 0);
+    batch_time = ktime_sub(ktime_get(), start);
+
+    pr_info("CTRLxT_STUDIOS: %d registers, %lld ns per round one by one, %lld ns batched\n",
+            BATCH_BENCH_REGISTERS, div64_s64(serial_time, BATCH_BENCH_ROUNDS),
+            div64_s64(batch_time, BATCH_BENCH_ROUNDS));
+
+    for (i = 0; i < BATCH_BENCH_REGISTERS; i++) {
+        ctrlxt_qec_free(ctxs[i]);
+        quantum_state_free(states[i]);
+    }
+    kfree(ctxs);
+    kfree(states);
+}
+
+/* One point of the threshold sweep, shots spread over every core */
+struct threshold_bench {
+    const struct qec_code *small;       /* one exact round per shot on a register of each worker */
+    const struct qec_surface *surface;  /* decoded over d noisy rounds otherwise */
+    struct qec_graph *graph;
+    struct qec_paths paths;
+    bool matching;                      /* on paths weighted for ppm, union-find otherwise */
+    u32 ppm;
+    unsigned int workers;
+    u64 *latency_ns;                    /* decode time of every shot */
+    atomic_t failures;
+    atomic_t errors;
+};
+
+static int threshold_bench_cmp(const void *a, const void *b)
+{
+    const u64 *x = a, *y = b;
+
+    return *x < *y ? -1 : *x > *y;
+}
+
+/* Residual errors that no product of stabilizers matches are logical */
+static bool threshold_bench_logical(const struct qec_code *code, u64 x, u64 z)
+{
+    u64 sx, sz;
+    unsigned int set, i;
+
+    for (set = 0; set < 1U << code->num_stabilizers; set++) {
+        sx = sz = 0;
+        for (i = 0; i < code->num_stabilizers; i++) {
+            if (set & BIT(i)) {
+                sx ^= code->stabilizers[i].x;
+                sz ^= code->stabilizers[i].z;
+            }
+        }
+        if (sx == x && sz == z)
+            return false;
+    }
+    return true;
+}
+
+/*
+ * The channel a small code is built for, bit flips, phase flips or
+ * depolarizing for Shor's. The errors go onto a register in the code space
+ * and the timed part is the kernel round that extracts, decodes and
+ * corrects them. Its syndrome tells which correction was applied.
+ */
+static int threshold_bench_small_shot(struct threshold_bench *bench, struct ctrlxt_qec_ctx *ctx,
+                                      struct rnd_state *rnd, u64 *ns)
+{
+    const struct qec_code *code = bench->small;
+    u32 threshold = div_u64((u64)bench->ppm << 32, 1000000);
+    const struct qec_stabilizer *fix;
+    unsigned int q;
+    u64 x = 0, z = 0;
+    ktime_t start;
+    u32 pauli;
+    int ret;
+
+    for (q = 0; q < code->num_data; q++) {
+        if (prandom_u32_state(rnd) >= threshold)
+            continue;
+        pauli = code->type == QEC_CODE_BITFLIP ? 1 : code->type == QEC_CODE_PHASEFLIP ? 2 :
+                prandom_u32_state(rnd) % 3 + 1;
+        x ^= pauli & 1 ? BIT_ULL(q) : 0;
+        z ^= pauli & 2 ? BIT_ULL(q) : 0;
+    }
+
+    ret = quantum_state_apply_pauli(ctx->state, x, z);
+    if (ret < 0)
+        return ret;
+
+    start = ktime_get();
+    ret = ctrlxt_qec_apply(ctx);
+    *ns = ktime_sub(ktime_get(), start);
+    if (ret < 0)
+        return ret;
+
+    fix = &code->lut[ctx->syndrome];
+    if (threshold_bench_logical(code, x ^ fix->x, z ^ fix->z))
+        atomic_inc(&bench->failures);
+    return 0;
+}
+
+/* Shots of a small code on a register of the worker, its first round projects |0...0> into the code */
+static int threshold_bench_small(struct threshold_bench *bench, struct rnd_state *rnd,
+                                 unsigned int idx)
+{
+    struct qec_params params = { .code_type = bench->small->type };
+    struct quantum_state *state;
+    struct ctrlxt_qec_ctx *ctx;
+    unsigned int i;
+    int ret;
+
+    state = quantum_state_alloc(bench->small->num_data);
+    if (!state)
+        return -ENOMEM;
+
+    ctx = ctrlxt_qec_alloc(state, &params);
+    ret = IS_ERR(ctx) ? PTR_ERR(ctx) : ctrlxt_qec_apply(ctx);
+    for (i = idx; ret == 0 && i < THRESHOLD_BENCH_SHOTS; i += bench->workers)
+        ret = threshold_bench_small_shot(bench, ctx, rnd, &bench->latency_ns[i]);
+
+    ctrlxt_qec_free(ctx);
+    quantum_state_free(state);
+    return ret;
+}
+
+static void threshold_bench_worker(void *arg, unsigned int idx)
+{
+    DECLARE_BITMAP(errors, QEC_SURFACE_MAX_DISTANCE * QEC_SURFACE_MAX_DISTANCE);
+    DECLARE_BITMAP(correction, QEC_SURFACE_MAX_DISTANCE * QEC_SURFACE_MAX_DISTANCE);
+    struct threshold_bench *bench = arg;
+    struct qec_mwpm mwpm = { 0 };
+    struct qec_uf uf = { 0 };
+    struct rnd_state rnd;
+    u32 *defects = NULL, num_defects;
+    unsigned int i;
+    ktime_t start;
+    int ret = 0;
+
+    prandom_seed_state(&rnd, (u64)bench->ppm << 16 | idx);
+    if (bench->small) {
+        if (threshold_bench_small(bench, &rnd, idx) < 0)
+            atomic_inc(&bench->errors);
+        return;
+    }
+
+    defects = kmalloc_array(bench->graph->num_nodes, sizeof(*defects), GFP_KERNEL);
+    if (!defects)
+        ret = -ENOMEM;
+    else if (bench->matching)
+        ret = qec_mwpm_init(&mwpm, &bench->paths);
+    else
+        ret = qec_uf_init(&uf, bench->graph);
+
+    for (i = idx; ret == 0 && i < THRESHOLD_BENCH_SHOTS; i += bench->workers) {
+        num_defects = surface_bench_sample(bench->surface, &rnd, bench->ppm, errors, defects);
+
+        start = ktime_get();
+        if (bench->matching)
+            ret = qec_mwpm_decode(&mwpm, defects, num_defects, correction);
+        else
+            ret = qec_uf_decode(&uf, defects, num_defects, correction);
+        bench->latency_ns[i] = ktime_sub(ktime_get(), start);
+
+        bitmap_xor(errors, errors, correction, bench->surface->num_data);
+        if (qec_surface_logical(bench->surface, QEC_CHECK_Z, errors))
+            atomic_inc(&bench->failures);
+    }
+
+    if (ret < 0)
+        atomic_inc(&bench->errors);
+    if (bench->matching)
+        qec_mwpm_free(&mwpm);
+    else
+        qec_uf_free(&uf);
+    kfree(defects);
+}
+
+/*
+ * Run every error rate of one code and decoder and print one line per
+ * point as key=value pairs. Returns the failures at
+ * THRESHOLD_BENCH_BELOW_PPM.
+ */
+static int threshold_bench_run(struct kunit *test, struct threshold_bench *bench,
+                               const char *code, const char *decoder, unsigned int d)
+{
+    unsigned int rounds = bench->small ? 1 : d, i;
+    int failures, below = 0, ret;
+    u64 busy_ns;
+    size_t p;
+
+    bench->workers = quantum_parallel_width();
+    for (p = 0; p < ARRAY_SIZE(threshold_bench_ppm); p++) {
+        bench->ppm = threshold_bench_ppm[p];
+        atomic_set(&bench->failures, 0);
+        atomic_set(&bench->errors, 0);
+
+        /* Matching weighs paths by the odds of the point */
+        if (bench->matching) {
+            qec_graph_set_weights(bench->graph, bench->ppm, bench->ppm);
+            ret = qec_paths_init(&bench->paths, bench->graph);
+            KUNIT_EXPECT_EQ(test, ret, 0);
+            if (ret < 0)
+                continue;
+        }
+        quantum_parallel_for(bench->workers, threshold_bench_worker, bench);
+        if (bench->matching)
+            qec_paths_free(&bench->paths);
+        KUNIT_EXPECT_EQ(test, atomic_read(&bench->errors), 0);
+
+        busy_ns = 0;
+        for (i = 0; i < THRESHOLD_BENCH_SHOTS; i++)
+            busy_ns += bench->latency_ns[i];
+        sort(bench->latency_ns, THRESHOLD_BENCH_SHOTS, sizeof(u64), threshold_bench_cmp, NULL);
+
+        failures = atomic_read(&bench->failures);
+        if (bench->ppm == THRESHOLD_BENCH_BELOW_PPM)
+            below = failures;
+        pr_info("CTRLxT_STUDIOS: qec_threshold code=%s decoder=%s d=%u p_ppm=%u shots=%d failures=%d logical_ppm=%llu rounds_per_sec=%llu p50_ns=%llu p99_ns=%llu\n",
+                code, decoder, d, bench->ppm, THRESHOLD_BENCH_SHOTS, failures,
+                div_u64((u64)failures * 1000000, THRESHOLD_BENCH_SHOTS),
+                div64_u64((u64)THRESHOLD_BENCH_SHOTS * rounds * NSEC_PER_SEC * bench->workers,
+                          max_t(u64, busy_ns, 1)),
+                bench->latency_ns[THRESHOLD_BENCH_SHOTS / 2],
+                bench->latency_ns[THRESHOLD_BENCH_SHOTS * 99 / 100]);
+    }
+
+    return below;
+}
+
+/*
+ * Logical error rate against physical error rate, distance, code and
+ * decoder. Below threshold a larger surface code must not do worse.
+ */
+static void test_qec_threshold_benchmark(struct kunit *test)
+{
+    static const unsigned int codes[] = { QEC_CODE_BITFLIP, QEC_CODE_PHASEFLIP, QEC_CODE_SHOR };
+    static const char *const names[] = {
+        [QEC_CODE_BITFLIP] = "bitflip",
+        [QEC_CODE_PHASEFLIP] = "phaseflip",
+        [QEC_CODE_SHOR] = "shor",
+    };
+    struct threshold_bench bench = { 0 };
+    struct qec_params params = { 0 };
+    struct quantum_state *state;
+    struct ctrlxt_qec_ctx *ctx;
+    struct qec_surface surface;
+    struct qec_graph graph;
+    int failures[2][THRESHOLD_BENCH_MAX_DISTANCE + 1];
+    unsigned int d, matching;
+    size_t c;
+
+    bench.latency_ns = kvmalloc_array(THRESHOLD_BENCH_SHOTS, sizeof(u64), GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, bench.latency_ns);
+
+    /* Small codes decode a single exact round by table lookup */
+    state = quantum_state_alloc(9);
+    KUNIT_ASSERT_NOT_NULL(test, state);
+    for (c = 0; c < ARRAY_SIZE(codes); c++) {
+        params.code_type = codes[c];
+        ctx = ctrlxt_qec_alloc(state, &params);
+        KUNIT_ASSERT_FALSE(test, IS_ERR(ctx));
+        bench.small = &ctx->code;
+        threshold_bench_run(test, &bench, names[codes[c]], "lookup", ctx->code.distance);
+        ctrlxt_qec_free(ctx);
+    }
+    bench.small = NULL;
+    quantum_state_free(state);
+
+    /* The surface code decodes d rounds with noisy readouts */
+    for (d = 3; d <= THRESHOLD_BENCH_MAX_DISTANCE; d += 2) {
+        KUNIT_ASSERT_EQ(test, qec_surface_init(&surface, d), 0);
+        KUNIT_ASSERT_EQ(test, qec_surface_graph(&surface, QEC_CHECK_Z, d, &graph), 0);
+        bench.surface = &surface;
+        bench.graph = &graph;
+
+        bench.matching = false;
+        failures[0][d] = threshold_bench_run(test, &bench, "surface", "union_find", d);
+        bench.matching = true;
+        failures[1][d] = threshold_bench_run(test, &bench, "surface", "matching", d);
+
+        qec_graph_free(&graph);
+        qec_surface_free(&surface);
+    }
+
+    for (matching = 0; matching < 2; matching++)
+        KUNIT_EXPECT_LE(test, failures[matching][THRESHOLD_BENCH_MAX_DISTANCE], failures[matching][3]);
+
+    kvfree(bench.latency_ns);
+}
+
 /* Test suite definition */
 static struct kunit_case perf_benchmark_test_cases[] = {
     KUNIT_CASE(test_context_creation_benchmark),
@@ -205,6 +793,11 @@ static struct kunit_case perf_benchmark_test_cases[] = {
     KUNIT_CASE(test_stats_operations_benchmark),
     KUNIT_CASE(test_concurrent_operations),
     KUNIT_CASE(test_memory_usage),
+    KUNIT_CASE(test_surface_decoder_benchmark),
+    KUNIT_CASE(test_matching_decoder_benchmark),
+    KUNIT_CASE(test_frame_sampler_benchmark),
+    KUNIT_CASE(test_qec_batch_benchmark),
+    KUNIT_CASE(test_qec_threshold_benchmark),
     {}
 };
 
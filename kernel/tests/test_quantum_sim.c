@@ -0,0 +1,1868 @@
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/kunit/test.h>
+#include <linux/slab.h>
+#include <linux/prandom.h>
+#include <linux/bitmap.h>
+#include <linux/anon_inodes.h>
+#include <linux/file.h>
+#include <linux/mman.h>
+#include <linux/uaccess.h>
+#include "../include/ctrlxt_kernel.h"
+#include "../include/quantum.h"
+#include "../include/quantum_hybrid.h"
+#include "../include/quantum_tn.h"
+#include "../include/quantum_dd.h"
+#include "../include/quantum_backend.h"
+#include "../include/quantum_macro.h"
+#include "../include/quantum_sample.h"
+#include "../include/quantum_encode.h"
+#include "../include/quantum_evolve.h"
+#include "../include/quantum_variational.h"
+#include "../include/quantum_error.h"
+#include "../include/quantum_surface.h"
+#include "../include/quantum_frame.h"
+#include "../include/quantum_stream.h"
+#include "../include/quantum_classical.h"
+
+#define SIM_TEST_QUBITS 6
+#define SIM_TEST_TOLERANCE 64  /* Q30 units */
+#define SIM_TEST_DD_TOLERANCE 4096  /* diagram weights are snapped to 2^-22 */
+#define SIM_TEST_BATCH 64  /* Shor registers enough for two workers */
+
+/* Brickwork circuit with gates crossing the middle of the register */
+static const struct quantum_op sim_test_ops[] = {
+    { QUANTUM_GATE_H, 0, -1, 0 },
+    { QUANTUM_GATE_H, 1, -1, 0 },
+    { QUANTUM_GATE_H, 4, -1, 0 },
+    { QUANTUM_GATE_CNOT, 0, 3, 0 },
+    { QUANTUM_GATE_RY, 2, -1, QUANTUM_ANGLE_TURN / 6 },
+    { QUANTUM_GATE_CZ, 2, 5, 0 },
+    { QUANTUM_GATE_T, 3, -1, 0 },
+    { QUANTUM_GATE_CPHASE, 4, 1, QUANTUM_ANGLE_TURN / 8 },
+    { QUANTUM_GATE_SWAP, 1, 4, 0 },
+    { QUANTUM_GATE_RX, 5, -1, QUANTUM_ANGLE_TURN / 5 },
+};
+
+static const struct quantum_circuit sim_test_circuit = {
+    .num_qubits = SIM_TEST_QUBITS,
+    .num_ops = ARRAY_SIZE(sim_test_ops),
+    .ops = (struct quantum_op *)sim_test_ops,
+};
+
+/* Reference amplitudes from the full state vector */
+static struct quantum_state *sim_test_reference(struct kunit *test)
+{
+    struct quantum_state *state = quantum_state_alloc(SIM_TEST_QUBITS);
+
+    KUNIT_ASSERT_NOT_NULL(test, state);
+    KUNIT_ASSERT_EQ(test, quantum_circuit_run(state, &sim_test_circuit), 0);
+    return state;
+}
+
+/* Test the hybrid Schrödinger-Feynman executor against the state vector */
+static void test_hybrid_amplitudes(struct kunit *test)
+{
+    struct quantum_state *ref = sim_test_reference(test);
+    unsigned int split, cuts;
+    struct quantum_amp *out;
+    u64 *indices;
+    size_t i;
+
+    out = kunit_kcalloc(test, ref->dim, sizeof(*out), GFP_KERNEL);
+    indices = kunit_kcalloc(test, ref->dim, sizeof(*indices), GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, out);
+    KUNIT_ASSERT_NOT_NULL(test, indices);
+
+    for (i = 0; i < ref->dim; i++)
+        indices[i] = i;
+
+    for (split = 1; split < SIM_TEST_QUBITS; split++) {
+        KUNIT_ASSERT_EQ(test, quantum_hybrid_amplitudes(&sim_test_circuit, split,
+                                                        indices, ref->dim, out), 0);
+        for (i = 0; i < ref->dim; i++) {
+            KUNIT_EXPECT_LE(test, abs(out[i].re - ref->amps[i].re), SIM_TEST_TOLERANCE);
+            KUNIT_EXPECT_LE(test, abs(out[i].im - ref->amps[i].im), SIM_TEST_TOLERANCE);
+        }
+    }
+
+    split = quantum_hybrid_choose_split(&sim_test_circuit, &cuts);
+    KUNIT_EXPECT_GT(test, split, 0U);
+    KUNIT_EXPECT_LE(test, cuts, 5U);
+
+    quantum_state_free(ref);
+}
+
+/* Test tensor-network amplitudes and marginals against the state vector */
+static void test_tn_amplitudes(struct kunit *test)
+{
+    struct quantum_state *ref = sim_test_reference(test);
+    const u64 mask = BIT(0) | BIT(3) | BIT(4);
+    struct quantum_tn_info info;
+    struct quantum_amp *out;
+    u64 probs[8], expect[8];
+    u64 *indices;
+    size_t i;
+
+    out = kunit_kcalloc(test, ref->dim, sizeof(*out), GFP_KERNEL);
+    indices = kunit_kcalloc(test, ref->dim, sizeof(*indices), GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, out);
+    KUNIT_ASSERT_NOT_NULL(test, indices);
+
+    for (i = 0; i < ref->dim; i++)
+        indices[i] = i;
+
+    KUNIT_ASSERT_EQ(test, quantum_tn_amplitudes(&sim_test_circuit, indices, ref->dim,
+                                                out, &info), 0);
+    KUNIT_EXPECT_LE(test, info.max_rank, (unsigned int)QUANTUM_TN_MAX_RANK);
+    for (i = 0; i < ref->dim; i++) {
+        KUNIT_EXPECT_LE(test, abs(out[i].re - ref->amps[i].re), SIM_TEST_TOLERANCE);
+        KUNIT_EXPECT_LE(test, abs(out[i].im - ref->amps[i].im), SIM_TEST_TOLERANCE);
+    }
+
+    memset(expect, 0, sizeof(expect));
+    for (i = 0; i < ref->dim; i++)
+        expect[((i >> 0) & 1) | (((i >> 3) & 1) << 1) | (((i >> 4) & 1) << 2)] +=
+            qamp_norm(ref->amps[i]);
+
+    KUNIT_ASSERT_EQ(test, quantum_tn_marginal(&sim_test_circuit, mask, probs, NULL), 0);
+    for (i = 0; i < ARRAY_SIZE(probs); i++)
+        KUNIT_EXPECT_LE(test, abs((s64)probs[i] - (s64)expect[i]), 4 * SIM_TEST_TOLERANCE);
+
+    quantum_state_free(ref);
+}
+
+/* Test the decision-diagram representation against the state vector */
+static void test_dd_state(struct kunit *test)
+{
+    struct quantum_state *ref = sim_test_reference(test);
+    struct quantum_gate_args args = { .angle = 0 };
+    struct quantum_dd_stats stats;
+    struct quantum_state *state;
+    struct quantum_amp amp;
+    int q, first, result;
+    size_t i;
+
+    state = quantum_state_alloc_repr(SIM_TEST_QUBITS, QUANTUM_REPR_DD);
+    KUNIT_ASSERT_NOT_NULL(test, state);
+    KUNIT_ASSERT_EQ(test, quantum_circuit_run(state, &sim_test_circuit), 0);
+
+    for (i = 0; i < ref->dim; i++) {
+        KUNIT_ASSERT_EQ(test, quantum_state_amplitude(state, i, &amp), 0);
+        KUNIT_EXPECT_LE(test, abs(amp.re - ref->amps[i].re), SIM_TEST_DD_TOLERANCE);
+        KUNIT_EXPECT_LE(test, abs(amp.im - ref->amps[i].im), SIM_TEST_DD_TOLERANCE);
+    }
+
+    /* Round trip through the dense representation */
+    KUNIT_ASSERT_EQ(test, quantum_state_convert(state, QUANTUM_REPR_DENSE), 0);
+    for (i = 0; i < ref->dim; i++)
+        KUNIT_EXPECT_LE(test, abs(state->amps[i].re - ref->amps[i].re), SIM_TEST_DD_TOLERANCE);
+    quantum_state_free(state);
+    quantum_state_free(ref);
+
+    /* A GHZ state stays linear in size far beyond the state vector limit */
+    state = quantum_state_alloc_repr(QUANTUM_DD_MAX_QUBITS, QUANTUM_REPR_DD);
+    KUNIT_ASSERT_NOT_NULL(test, state);
+    KUNIT_ASSERT_EQ(test, quantum_gate_apply(QUANTUM_GATE_H, state, 0, NULL, 0), 0);
+    for (q = 1; q < QUANTUM_DD_MAX_QUBITS; q++) {
+        args.target = q;
+        KUNIT_ASSERT_EQ(test, quantum_gate_apply(QUANTUM_GATE_CNOT, state, q - 1,
+                                                 &args, sizeof(args)), 0);
+    }
+
+    KUNIT_ASSERT_EQ(test, quantum_state_amplitude(state, state->dim - 1, &amp), 0);
+    KUNIT_EXPECT_LE(test, abs(amp.re - QAMP_SQRT1_2), SIM_TEST_DD_TOLERANCE);
+
+    quantum_dd_get_stats(state->dd, &stats);
+    KUNIT_EXPECT_LE(test, stats.peak_nodes, 64ULL * QUANTUM_DD_MAX_QUBITS);
+
+    KUNIT_ASSERT_EQ(test, quantum_state_measure_qubit(state, 7, &first), 0);
+    KUNIT_ASSERT_EQ(test, quantum_state_measure_qubit(state, 31, &result), 0);
+    KUNIT_EXPECT_EQ(test, first, result);
+
+    quantum_state_free(state);
+}
+
+/* Test backend selection from circuit analysis */
+static void test_backend_select(struct kunit *test)
+{
+    struct quantum_state *ref = sim_test_reference(test);
+    struct quantum_circuit_analysis analysis;
+    struct quantum_circuit ghz;
+    struct quantum_amp out[2];
+    struct quantum_op *ops;
+    u64 indices[2];
+    int q;
+
+    /* Small circuits stay on the state vector */
+    KUNIT_ASSERT_EQ(test, quantum_circuit_analyze(&sim_test_circuit, 1, &analysis), 0);
+    KUNIT_EXPECT_FALSE(test, analysis.clifford);
+    KUNIT_EXPECT_EQ(test, analysis.backend, QUANTUM_BACKEND_STATEVECTOR);
+
+    indices[0] = 5;
+    indices[1] = ref->dim - 1;
+    KUNIT_ASSERT_EQ(test, quantum_backend_amplitudes(&sim_test_circuit, QUANTUM_BACKEND_AUTO,
+                                                     indices, 2, out, NULL), 0);
+    KUNIT_EXPECT_EQ(test, out[0].re, ref->amps[5].re);
+    KUNIT_EXPECT_EQ(test, out[1].im, ref->amps[ref->dim - 1].im);
+
+    /* A GHZ state beyond the state vector budget goes elsewhere */
+    ops = kunit_kcalloc(test, 30, sizeof(*ops), GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, ops);
+    ops[0].gate = QUANTUM_GATE_H;
+    for (q = 1; q < 30; q++) {
+        ops[q].gate = QUANTUM_GATE_CNOT;
+        ops[q].qubit = q - 1;
+        ops[q].target = q;
+    }
+    ghz.num_qubits = 30;
+    ghz.num_ops = 30;
+    ghz.ops = ops;
+
+    KUNIT_ASSERT_EQ(test, quantum_circuit_analyze(&ghz, 2, &analysis), 0);
+    KUNIT_EXPECT_TRUE(test, analysis.clifford);
+    KUNIT_EXPECT_EQ(test, analysis.depth, 30U);
+    KUNIT_EXPECT_EQ(test, analysis.max_cut, 1U);
+    KUNIT_EXPECT_NE(test, analysis.backend, QUANTUM_BACKEND_STATEVECTOR);
+    KUNIT_EXPECT_NE(test, analysis.backend, QUANTUM_BACKEND_COUNT);
+    KUNIT_EXPECT_EQ(test, quantum_backend_select(&analysis, true), QUANTUM_BACKEND_DD);
+
+    indices[0] = 0;
+    indices[1] = (1ULL << 30) - 1;
+    KUNIT_ASSERT_EQ(test, quantum_backend_amplitudes(&ghz, QUANTUM_BACKEND_AUTO,
+                                                     indices, 2, out, &analysis), 0);
+    KUNIT_EXPECT_LE(test, abs(out[0].re - QAMP_SQRT1_2), SIM_TEST_TOLERANCE);
+    KUNIT_EXPECT_LE(test, abs(out[1].re - QAMP_SQRT1_2), SIM_TEST_TOLERANCE);
+
+    quantum_state_free(ref);
+}
+
+/* Gate-level QFT on qubits [base, base + width) followed by the bit reversal */
+static size_t sim_test_qft_ops(struct quantum_op *ops, int base, int width)
+{
+    size_t n = 0;
+    int s, c;
+
+    for (s = width - 1; s >= 0; s--) {
+        ops[n++] = (struct quantum_op){ QUANTUM_GATE_H, base + s, -1, 0 };
+        for (c = s - 1; c >= 0; c--)
+            ops[n++] = (struct quantum_op){ QUANTUM_GATE_CPHASE, base + c, base + s,
+                                            QUANTUM_ANGLE_TURN >> (s - c + 1) };
+    }
+
+    for (c = 0; c < width / 2; c++)
+        ops[n++] = (struct quantum_op){ QUANTUM_GATE_SWAP, base + c, base + width - 1 - c, 0 };
+
+    return n;
+}
+
+/* Test the QFT and diffusion macro gates against their gate-level circuits */
+static void test_macro_gates(struct kunit *test)
+{
+    struct quantum_state *ref = sim_test_reference(test);
+    struct quantum_op qft = { QUANTUM_GATE_QFT, 1, 4, 0 };
+    struct quantum_op diffusion = { QUANTUM_GATE_DIFFUSION, 0, SIM_TEST_QUBITS, 0 };
+    struct quantum_state *state, *dd;
+    struct quantum_op ops[16], macro;
+    struct quantum_amp amp;
+    size_t i, n;
+
+    state = quantum_state_alloc(SIM_TEST_QUBITS);
+    dd = quantum_state_alloc_repr(SIM_TEST_QUBITS, QUANTUM_REPR_DD);
+    KUNIT_ASSERT_NOT_NULL(test, state);
+    KUNIT_ASSERT_NOT_NULL(test, dd);
+    KUNIT_ASSERT_EQ(test, quantum_state_copy(state, ref), 0);
+    KUNIT_ASSERT_EQ(test, quantum_circuit_run(dd, &sim_test_circuit), 0);
+
+    /* The gate-level QFT is recognized as a whole */
+    n = sim_test_qft_ops(ops, qft.qubit, qft.target);
+    KUNIT_EXPECT_EQ(test, quantum_macro_match(ops, n, &macro), n);
+    KUNIT_EXPECT_EQ(test, macro.gate, QUANTUM_GATE_QFT);
+    KUNIT_EXPECT_EQ(test, macro.qubit, qft.qubit);
+    KUNIT_EXPECT_EQ(test, macro.target, qft.target);
+    KUNIT_EXPECT_EQ(test, macro.angle, 0U);
+    ops[2].angle++;
+    KUNIT_EXPECT_EQ(test, quantum_macro_match(ops, n, &macro), (size_t)0);
+    ops[2].angle--;
+
+    for (i = 0; i < n; i++)
+        KUNIT_ASSERT_EQ(test, quantum_state_apply_op(ref, &ops[i]), 0);
+    KUNIT_ASSERT_EQ(test, quantum_state_apply_op(state, &qft), 0);
+    KUNIT_ASSERT_EQ(test, quantum_state_apply_op(dd, &qft), 0);
+
+    for (i = 0; i < ref->dim; i++) {
+        KUNIT_EXPECT_LE(test, abs(state->amps[i].re - ref->amps[i].re), SIM_TEST_TOLERANCE);
+        KUNIT_EXPECT_LE(test, abs(state->amps[i].im - ref->amps[i].im), SIM_TEST_TOLERANCE);
+        KUNIT_ASSERT_EQ(test, quantum_state_amplitude(dd, i, &amp), 0);
+        KUNIT_EXPECT_LE(test, abs(amp.re - ref->amps[i].re), SIM_TEST_DD_TOLERANCE);
+    }
+
+    /* Diffusion reflects about the mean on both representations */
+    KUNIT_ASSERT_EQ(test, quantum_state_apply_op(state, &diffusion), 0);
+    KUNIT_ASSERT_EQ(test, quantum_state_apply_op(dd, &diffusion), 0);
+    for (i = 0; i < ref->dim; i++) {
+        KUNIT_ASSERT_EQ(test, quantum_state_amplitude(dd, i, &amp), 0);
+        KUNIT_EXPECT_LE(test, abs(amp.re - state->amps[i].re), SIM_TEST_DD_TOLERANCE);
+        KUNIT_EXPECT_LE(test, abs(amp.im - state->amps[i].im), SIM_TEST_DD_TOLERANCE);
+    }
+
+    /* Diffusion is an involution and the inverse QFT undoes the QFT */
+    qft.gate = QUANTUM_GATE_IQFT;
+    KUNIT_ASSERT_EQ(test, quantum_state_apply_op(state, &diffusion), 0);
+    KUNIT_ASSERT_EQ(test, quantum_state_apply_op(state, &qft), 0);
+    KUNIT_ASSERT_EQ(test, quantum_state_apply_op(ref, &qft), 0);
+    for (i = 0; i < ref->dim; i++)
+        KUNIT_EXPECT_LE(test, abs(state->amps[i].re - ref->amps[i].re), SIM_TEST_TOLERANCE);
+
+    qft.target = SIM_TEST_QUBITS;
+    KUNIT_EXPECT_EQ(test, quantum_state_apply_op(state, &qft), -EINVAL);
+
+    quantum_state_free(dd);
+    quantum_state_free(state);
+    quantum_state_free(ref);
+}
+
+/* Real-gate part of the brickwork circuit */
+static const struct quantum_op sim_test_real_ops[] = {
+    { QUANTUM_GATE_H, 0, -1, 0 },
+    { QUANTUM_GATE_H, 4, -1, 0 },
+    { QUANTUM_GATE_CNOT, 0, 3, 0 },
+    { QUANTUM_GATE_RY, 2, -1, QUANTUM_ANGLE_TURN / 6 },
+    { QUANTUM_GATE_CZ, 2, 5, 0 },
+    { QUANTUM_GATE_CPHASE, 4, 1, QUANTUM_ANGLE_PI },
+    { QUANTUM_GATE_SWAP, 1, 4, 0 },
+    { QUANTUM_GATE_Z, 3, -1, 0 },
+};
+
+/* Test real-amplitude states against the complex state vector */
+static void test_real_state(struct kunit *test)
+{
+    struct quantum_circuit circuit = {
+        .num_qubits = SIM_TEST_QUBITS,
+        .num_ops = ARRAY_SIZE(sim_test_real_ops),
+        .ops = (struct quantum_op *)sim_test_real_ops,
+    };
+    struct quantum_op y = { QUANTUM_GATE_Y, 2, -1, 0 };
+    struct quantum_circuit_analysis analysis;
+    struct quantum_state *state, *ref;
+    struct quantum_amp amp;
+    size_t i;
+
+    KUNIT_EXPECT_TRUE(test, quantum_circuit_is_real(&circuit));
+    KUNIT_EXPECT_FALSE(test, quantum_circuit_is_real(&sim_test_circuit));
+    KUNIT_ASSERT_EQ(test, quantum_circuit_analyze(&circuit, 1, &analysis), 0);
+    KUNIT_EXPECT_TRUE(test, analysis.real);
+    KUNIT_EXPECT_EQ(test, analysis.memory[QUANTUM_BACKEND_STATEVECTOR],
+                    (u64)sizeof(s32) << SIM_TEST_QUBITS);
+
+    ref = quantum_state_alloc(SIM_TEST_QUBITS);
+    state = quantum_state_alloc_repr(SIM_TEST_QUBITS, QUANTUM_REPR_REAL);
+    KUNIT_ASSERT_NOT_NULL(test, ref);
+    KUNIT_ASSERT_NOT_NULL(test, state);
+    KUNIT_ASSERT_EQ(test, quantum_circuit_run(ref, &circuit), 0);
+    KUNIT_ASSERT_EQ(test, quantum_circuit_run(state, &circuit), 0);
+    KUNIT_EXPECT_EQ(test, state->repr, QUANTUM_REPR_REAL);
+
+    /* The real kernels round exactly like the complex ones */
+    for (i = 0; i < ref->dim; i++) {
+        KUNIT_ASSERT_EQ(test, quantum_state_amplitude(state, i, &amp), 0);
+        KUNIT_EXPECT_EQ(test, amp.re, ref->amps[i].re);
+        KUNIT_EXPECT_EQ(test, amp.im, 0);
+    }
+
+    /* The first complex gate promotes the state to a complex vector */
+    KUNIT_ASSERT_EQ(test, quantum_state_apply_op(state, &y), 0);
+    KUNIT_ASSERT_EQ(test, quantum_state_apply_op(ref, &y), 0);
+    KUNIT_EXPECT_EQ(test, state->repr, QUANTUM_REPR_DENSE);
+    for (i = 0; i < ref->dim; i++) {
+        KUNIT_EXPECT_EQ(test, state->amps[i].re, ref->amps[i].re);
+        KUNIT_EXPECT_EQ(test, state->amps[i].im, ref->amps[i].im);
+    }
+    KUNIT_EXPECT_EQ(test, quantum_state_convert(state, QUANTUM_REPR_REAL), -EINVAL);
+
+    /* Going back undoes the phase and the state converts to real again */
+    KUNIT_ASSERT_EQ(test, quantum_state_apply_op(state, &y), 0);
+    KUNIT_ASSERT_EQ(test, quantum_state_apply_op(ref, &y), 0);
+    KUNIT_ASSERT_EQ(test, quantum_state_convert(state, QUANTUM_REPR_REAL), 0);
+    KUNIT_EXPECT_EQ(test, quantum_state_get_value(state), quantum_state_get_value(ref));
+
+    quantum_state_free(state);
+    quantum_state_free(ref);
+}
+
+/* Test split amplitude layouts against the interleaved state vector */
+static void test_state_layouts(struct kunit *test)
+{
+    static const enum quantum_state_layout layouts[] = {
+        QUANTUM_LAYOUT_SOA, QUANTUM_LAYOUT_AOSOA4, QUANTUM_LAYOUT_AOSOA8,
+    };
+    struct quantum_op qft = { QUANTUM_GATE_QFT, 1, 4, 0 };
+    struct quantum_state *ref = sim_test_reference(test);
+    struct quantum_state *state;
+    struct quantum_amp *saved;
+    size_t i, l;
+
+    saved = kunit_kcalloc(test, ref->dim, sizeof(*saved), GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, saved);
+    KUNIT_ASSERT_EQ(test, quantum_state_apply_op(ref, &qft), 0);
+
+    for (l = 0; l < ARRAY_SIZE(layouts); l++) {
+        state = quantum_state_alloc(SIM_TEST_QUBITS);
+        KUNIT_ASSERT_NOT_NULL(test, state);
+        KUNIT_ASSERT_EQ(test, quantum_state_set_layout(state, layouts[l]), 0);
+        KUNIT_EXPECT_EQ(test, state->repr, QUANTUM_REPR_SPLIT);
+
+        /* Every kernel rounds exactly like the interleaved one */
+        KUNIT_ASSERT_EQ(test, quantum_circuit_run(state, &sim_test_circuit), 0);
+        KUNIT_ASSERT_EQ(test, quantum_state_apply_op(state, &qft), 0);
+        KUNIT_ASSERT_EQ(test, quantum_state_save(state, saved), 0);
+        for (i = 0; i < ref->dim; i++) {
+            KUNIT_EXPECT_EQ(test, saved[i].re, ref->amps[i].re);
+            KUNIT_EXPECT_EQ(test, saved[i].im, ref->amps[i].im);
+        }
+        KUNIT_EXPECT_EQ(test, quantum_state_get_value(state), quantum_state_get_value(ref));
+
+        /* Restoring and switching layouts keep the amplitudes */
+        KUNIT_ASSERT_EQ(test, quantum_state_init(state, 3), 0);
+        KUNIT_ASSERT_EQ(test, quantum_state_restore(state, saved), 0);
+        KUNIT_ASSERT_EQ(test, quantum_state_set_layout(state, layouts[(l + 1) % ARRAY_SIZE(layouts)]), 0);
+        KUNIT_ASSERT_EQ(test, quantum_state_set_layout(state, QUANTUM_LAYOUT_AOS), 0);
+        KUNIT_EXPECT_EQ(test, state->repr, QUANTUM_REPR_DENSE);
+        KUNIT_EXPECT_EQ(test, memcmp(state->amps, ref->amps, ref->dim * sizeof(*saved)), 0);
+
+        quantum_state_free(state);
+    }
+
+    quantum_state_free(ref);
+}
+
+/* Test single-pass encodings against the gates they stand for */
+static void test_state_encode(struct kunit *test)
+{
+    static const u8 bytes[SIM_TEST_QUBITS] = { 1, 0, 3, 200, 77, 128 };
+    static const u8 records[] = { 5, 9, 5, 12 };
+    struct quantum_state *state, *ref;
+    struct quantum_op op;
+    struct quantum_amp amp;
+    u8 *pixels;
+    u64 norm;
+    size_t i;
+    int q;
+
+    ref = quantum_state_alloc(SIM_TEST_QUBITS);
+    state = quantum_state_alloc(SIM_TEST_QUBITS);
+    KUNIT_ASSERT_NOT_NULL(test, ref);
+    KUNIT_ASSERT_NOT_NULL(test, state);
+
+    /* Phase encoding replaces the register with H and S per byte on |0...0> */
+    KUNIT_ASSERT_EQ(test, quantum_state_init(ref, 0), 0);
+    for (q = 0; q < 4; q++) {
+        KUNIT_ASSERT_EQ(test, quantum_gate_apply(QUANTUM_GATE_H, ref, q, NULL, 0), 0);
+        if (bytes[q] & 1)
+            KUNIT_ASSERT_EQ(test, quantum_gate_apply(QUANTUM_GATE_PHASE, ref, q, NULL, 0), 0);
+    }
+    KUNIT_ASSERT_EQ(test, quantum_gate_apply(QUANTUM_GATE_X, state, 5, NULL, 0), 0);
+    KUNIT_ASSERT_EQ(test, quantum_state_encode(state, QUANTUM_ENCODE_PHASE, 0, bytes, 4), 0);
+    for (i = 0; i < ref->dim; i++) {
+        KUNIT_EXPECT_LE(test, abs(state->amps[i].re - ref->amps[i].re), SIM_TEST_TOLERANCE);
+        KUNIT_EXPECT_LE(test, abs(state->amps[i].im - ref->amps[i].im), SIM_TEST_TOLERANCE);
+    }
+
+    /* Angle encoding with the CNOT ladder folded in, on a real register */
+    KUNIT_ASSERT_EQ(test, quantum_state_init(ref, 0), 0);
+    for (q = 0; q < SIM_TEST_QUBITS; q++) {
+        op = (struct quantum_op){ QUANTUM_GATE_RY, q, -1, bytes[q] * (QUANTUM_ANGLE_PI / 256) };
+        KUNIT_ASSERT_EQ(test, quantum_state_apply_op(ref, &op), 0);
+    }
+    for (q = 0; q + 1 < SIM_TEST_QUBITS; q++) {
+        op = (struct quantum_op){ QUANTUM_GATE_CNOT, q, q + 1, 0 };
+        KUNIT_ASSERT_EQ(test, quantum_state_apply_op(ref, &op), 0);
+    }
+    quantum_state_free(state);
+    state = quantum_state_alloc_repr(SIM_TEST_QUBITS, QUANTUM_REPR_REAL);
+    KUNIT_ASSERT_NOT_NULL(test, state);
+    KUNIT_ASSERT_EQ(test, quantum_state_encode(state, QUANTUM_ENCODE_ANGLE, QUANTUM_ENCODE_ENTANGLE,
+                                               bytes, SIM_TEST_QUBITS), 0);
+    KUNIT_EXPECT_EQ(test, state->repr, QUANTUM_REPR_REAL);
+    for (i = 0; i < ref->dim; i++) {
+        KUNIT_EXPECT_LE(test, abs(state->re[i] - ref->amps[i].re), SIM_TEST_TOLERANCE);
+        KUNIT_EXPECT_EQ(test, ref->amps[i].im, 0);
+    }
+
+    /* Basis encoding, of one value or weighted by record counts */
+    KUNIT_ASSERT_EQ(test, quantum_state_encode(state, QUANTUM_ENCODE_BASIS, 0, &records[1], 1), 0);
+    KUNIT_EXPECT_EQ(test, quantum_state_get_value(state), 9);
+    KUNIT_ASSERT_EQ(test, quantum_state_encode(state, QUANTUM_ENCODE_BASIS, QUANTUM_ENCODE_ENTANGLE,
+                                               &records[1], 1), 0);
+    KUNIT_EXPECT_EQ(test, quantum_state_get_value(state), 7);
+    KUNIT_ASSERT_EQ(test, quantum_state_encode(state, QUANTUM_ENCODE_BASIS, QUANTUM_ENCODE_SUPERPOS,
+                                               records, sizeof(records)), 0);
+    for (i = 0, norm = 0; i < state->dim; i++)
+        norm += ((s64)state->re[i] * state->re[i]) >> QAMP_SHIFT;
+    KUNIT_EXPECT_LE(test, abs((s64)norm - QAMP_ONE), SIM_TEST_TOLERANCE);
+    KUNIT_EXPECT_LE(test, abs(state->re[5] - QAMP_SQRT1_2), 1);
+    KUNIT_EXPECT_EQ(test, state->re[9], QAMP_ONE / 2);
+    KUNIT_EXPECT_EQ(test, state->re[12], QAMP_ONE / 2);
+
+    /* Amplitude encoding of a split register, normalized over the bytes given */
+    pixels = kunit_kzalloc(test, state->dim, GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, pixels);
+    for (i = 0; i < 40; i++)
+        pixels[i] = i * 6;
+    KUNIT_ASSERT_EQ(test, quantum_state_set_layout(ref, QUANTUM_LAYOUT_AOSOA4), 0);
+    KUNIT_ASSERT_EQ(test, quantum_state_encode(ref, QUANTUM_ENCODE_AMPLITUDE, 0, pixels, 40), 0);
+    for (i = 0, norm = 0; i < ref->dim; i++) {
+        KUNIT_ASSERT_EQ(test, quantum_state_amplitude(ref, i, &amp), 0);
+        KUNIT_EXPECT_EQ(test, amp.re == 0, i == 0 || i >= 40);
+        KUNIT_EXPECT_EQ(test, amp.im, 0);
+        norm += qamp_norm(amp);
+    }
+    KUNIT_EXPECT_LE(test, abs((s64)norm - QAMP_ONE), SIM_TEST_TOLERANCE);
+
+    /* Decision diagrams are built from the encoded vector */
+    quantum_state_free(ref);
+    ref = quantum_state_alloc_repr(SIM_TEST_QUBITS, QUANTUM_REPR_DD);
+    KUNIT_ASSERT_NOT_NULL(test, ref);
+    KUNIT_ASSERT_EQ(test, quantum_state_encode(ref, QUANTUM_ENCODE_BASIS, QUANTUM_ENCODE_SUPERPOS,
+                                               records, sizeof(records)), 0);
+    KUNIT_ASSERT_EQ(test, quantum_state_amplitude(ref, 5, &amp), 0);
+    KUNIT_EXPECT_LE(test, abs(amp.re - QAMP_SQRT1_2), SIM_TEST_DD_TOLERANCE);
+    KUNIT_ASSERT_EQ(test, quantum_state_amplitude(ref, 6, &amp), 0);
+    KUNIT_EXPECT_EQ(test, amp.re, 0);
+
+    /* Data that does not fit the register */
+    KUNIT_EXPECT_EQ(test, quantum_state_encode(state, QUANTUM_ENCODE_PHASE, 0, pixels, 7), -EINVAL);
+    KUNIT_EXPECT_EQ(test, quantum_state_encode(state, QUANTUM_ENCODE_BASIS, 0, pixels + 39, 1), -EINVAL);
+    KUNIT_EXPECT_EQ(test, quantum_state_encode(state, QUANTUM_ENCODE_AMPLITUDE, 0, pixels, 65), -EINVAL);
+    KUNIT_EXPECT_EQ(test, quantum_state_encode(state, QUANTUM_ENCODE_AMPLITUDE, 0, pixels, 1), -EINVAL);
+
+    quantum_state_free(ref);
+    quantum_state_free(state);
+}
+
+/* Test shot histograms against the state probabilities */
+static void test_sample_histogram(struct kunit *test)
+{
+    struct quantum_state *ref = sim_test_reference(test);
+    struct quantum_histogram hist;
+    struct quantum_state *dd;
+    u64 shots = 1 << 16, expected, total;
+    size_t i, n;
+
+    KUNIT_ASSERT_EQ(test, quantum_state_sample(ref, shots, &hist), 0);
+    KUNIT_EXPECT_EQ(test, hist.shots, shots);
+
+    /* Counts stay within five standard deviations of shots * p */
+    n = quantum_histogram_finish(&hist, QUANTUM_HIST_BY_OUTCOME);
+    KUNIT_ASSERT_LE(test, n, ref->dim);
+    for (i = 0, total = 0; i < n; i++) {
+        if (i > 0)
+            KUNIT_EXPECT_LT(test, hist.slots[i - 1].outcome, hist.slots[i].outcome);
+        expected = (qamp_norm(ref->amps[hist.slots[i].outcome]) * shots) >> QAMP_SHIFT;
+        KUNIT_EXPECT_LE(test, abs((s64)hist.slots[i].count - (s64)expected),
+                        5 * (s64)int_sqrt(expected) + 8);
+        total += hist.slots[i].count;
+    }
+    KUNIT_EXPECT_EQ(test, total, shots);
+    quantum_histogram_free(&hist);
+
+    /* Top-k order, and the state is left as it was */
+    dd = quantum_state_alloc_repr(SIM_TEST_QUBITS, QUANTUM_REPR_DD);
+    KUNIT_ASSERT_NOT_NULL(test, dd);
+    KUNIT_ASSERT_EQ(test, quantum_circuit_run(dd, &sim_test_circuit), 0);
+    KUNIT_ASSERT_EQ(test, quantum_state_sample(dd, shots, &hist), 0);
+    n = quantum_histogram_finish(&hist, QUANTUM_HIST_BY_COUNT);
+    for (i = 1; i < n; i++)
+        KUNIT_EXPECT_GE(test, hist.slots[i - 1].count, hist.slots[i].count);
+    expected = (qamp_norm(ref->amps[quantum_state_get_value(ref)]) * shots) >> QAMP_SHIFT;
+    KUNIT_EXPECT_GE(test, hist.slots[0].count + 5 * int_sqrt(expected), expected);
+    quantum_histogram_free(&hist);
+    KUNIT_EXPECT_EQ(test, quantum_state_get_value(dd), quantum_state_get_value(ref));
+
+    /* A full table refuses new outcomes */
+    KUNIT_ASSERT_EQ(test, quantum_histogram_init(&hist, 2), 0);
+    for (i = 0; i < 3; i++)
+        KUNIT_EXPECT_EQ(test, quantum_histogram_add(&hist, i, 1), 0);
+    KUNIT_EXPECT_EQ(test, quantum_histogram_add(&hist, 3, 1), -ENOSPC);
+    KUNIT_EXPECT_EQ(test, quantum_histogram_add(&hist, 1, 5), 0);
+    quantum_histogram_free(&hist);
+
+    quantum_state_free(dd);
+    quantum_state_free(ref);
+}
+
+/* Outcome of shot s of bit-packed sampler output with the given qubits per shot */
+static u64 sim_test_shot(const u8 *out, u64 s, unsigned int qubits)
+{
+    u64 bit, outcome = 0;
+    unsigned int q;
+
+    for (q = 0; q < qubits; q++) {
+        bit = s * qubits + q;
+        outcome |= (u64)((out[bit / 8] >> (bit % 8)) & 1) << q;
+    }
+
+    return outcome;
+}
+
+/* Test bit-packed shots against the state probabilities */
+static void test_sample_packed(struct kunit *test)
+{
+    struct quantum_state *ref = sim_test_reference(test);
+    u64 counts[1 << SIM_TEST_QUBITS] = { 0 };
+    u64 shots = 1 << 16, expected, s;
+    size_t size = DIV_ROUND_UP(shots * SIM_TEST_QUBITS, 8) + 1, i;
+    struct quantum_state *dd;
+    u8 *out, first;
+
+    out = kunit_kzalloc(test, size, GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, out);
+
+    /* Counts stay within five standard deviations of shots * p, nothing past the last shot */
+    memset(out, 0xff, size);
+    KUNIT_ASSERT_EQ(test, quantum_state_sample_packed(ref, shots, out, size), 0);
+    KUNIT_EXPECT_EQ(test, out[size - 1], 0xff);
+    for (s = 0; s < shots; s++)
+        counts[sim_test_shot(out, s, SIM_TEST_QUBITS)]++;
+    for (i = 0; i < ref->dim; i++) {
+        expected = (qamp_norm(ref->amps[i]) * shots) >> QAMP_SHIFT;
+        KUNIT_EXPECT_LE(test, abs((s64)counts[i] - (s64)expected), 5 * (s64)int_sqrt(expected) + 8);
+    }
+
+    /* Diagrams only draw outcomes of nonzero probability */
+    dd = quantum_state_alloc_repr(SIM_TEST_QUBITS, QUANTUM_REPR_DD);
+    KUNIT_ASSERT_NOT_NULL(test, dd);
+    KUNIT_ASSERT_EQ(test, quantum_circuit_run(dd, &sim_test_circuit), 0);
+    KUNIT_ASSERT_EQ(test, quantum_state_sample_packed(dd, 1000, out, size), 0);
+    for (s = 0; s < 1000; s++)
+        KUNIT_EXPECT_GT(test, qamp_norm(ref->amps[sim_test_shot(out, s, SIM_TEST_QUBITS)]), 0);
+
+    /* A collapsed register gives its outcome every shot, packed as measured */
+    KUNIT_ASSERT_EQ(test, quantum_state_measure(ref, &first), 0);
+    KUNIT_ASSERT_EQ(test, quantum_state_sample_packed(ref, 13, out, size), 0);
+    KUNIT_EXPECT_EQ(test, out[0] & ((1 << SIM_TEST_QUBITS) - 1), first);
+    for (s = 0; s < 13; s++)
+        KUNIT_EXPECT_EQ(test, sim_test_shot(out, s, SIM_TEST_QUBITS), (u64)first);
+
+    /* The shots have to fit */
+    KUNIT_EXPECT_EQ(test, quantum_state_sample_packed(ref, 10, out, 8), 0);
+    KUNIT_EXPECT_EQ(test, quantum_state_sample_packed(ref, 11, out, 8), -EINVAL);
+    KUNIT_EXPECT_EQ(test, quantum_state_sample_packed(ref, 0, out, 8), -EINVAL);
+
+    quantum_state_free(dd);
+    quantum_state_free(ref);
+}
+
+/* Test the cached measurement distribution and its invalidation */
+static void test_cached_cdf(struct kunit *test)
+{
+    static const u64 sums[] = { 1, 1, 3 };
+    struct quantum_op x = { QUANTUM_GATE_X, 1, -1, 0 };
+    struct quantum_state *state = sim_test_reference(test);
+    u64 generation, acc = 0;
+    const u64 *cdf;
+    u8 first, again;
+    size_t i;
+    int bit;
+
+    KUNIT_EXPECT_EQ(test, quantum_state_cdf_search(sums, 3, 0), (size_t)0);
+    KUNIT_EXPECT_EQ(test, quantum_state_cdf_search(sums, 3, 1), (size_t)2);
+    KUNIT_EXPECT_EQ(test, quantum_state_cdf_search(sums, 3, 2), (size_t)2);
+
+    /* Built once per generation */
+    cdf = quantum_state_cdf(state);
+    KUNIT_ASSERT_NOT_NULL(test, cdf);
+    generation = state->generation;
+    for (i = 0; i < state->dim; i++) {
+        acc += qamp_norm(state->amps[i]);
+        KUNIT_EXPECT_EQ(test, cdf[i], acc);
+    }
+    KUNIT_EXPECT_PTR_EQ(test, quantum_state_cdf(state), cdf);
+    KUNIT_EXPECT_EQ(test, state->cdf.generation, generation);
+
+    /* Every gate invalidates it */
+    KUNIT_ASSERT_EQ(test, quantum_state_apply_op(state, &x), 0);
+    KUNIT_EXPECT_NE(test, state->cdf.generation, state->generation);
+    cdf = quantum_state_cdf(state);
+    KUNIT_ASSERT_NOT_NULL(test, cdf);
+    KUNIT_EXPECT_EQ(test, cdf[0], qamp_norm(state->amps[0]));
+
+    /* A collapsed state measures the same without changing */
+    KUNIT_ASSERT_EQ(test, quantum_state_measure(state, &first), 0);
+    generation = state->generation;
+    for (i = 0; i < 8; i++) {
+        KUNIT_ASSERT_EQ(test, quantum_state_measure(state, &again), 0);
+        KUNIT_EXPECT_EQ(test, again, first);
+        KUNIT_ASSERT_EQ(test, quantum_state_measure_qubit(state, i % SIM_TEST_QUBITS, &bit), 0);
+        KUNIT_EXPECT_EQ(test, bit, (first >> (i % SIM_TEST_QUBITS)) & 1);
+    }
+    KUNIT_EXPECT_EQ(test, state->generation, generation);
+    KUNIT_EXPECT_EQ(test, quantum_state_get_value(state), (int)first);
+    KUNIT_EXPECT_EQ(test, state->amps[first].re, QAMP_ONE);
+
+    quantum_state_free(state);
+}
+
+/* Largest difference between two vector states in Q30 units */
+static s32 sim_test_distance(struct kunit *test, const struct quantum_state *a,
+                             const struct quantum_state *b)
+{
+    struct quantum_amp x, y;
+    s32 dist = 0;
+    size_t i;
+
+    for (i = 0; i < a->dim; i++) {
+        KUNIT_ASSERT_EQ(test, quantum_state_amplitude(a, i, &x), 0);
+        KUNIT_ASSERT_EQ(test, quantum_state_amplitude(b, i, &y), 0);
+        dist = max(dist, abs(x.re - y.re));
+        dist = max(dist, abs(x.im - y.im));
+    }
+
+    return dist;
+}
+
+/* Test Trotter and Krylov time evolution against gates and each other */
+static void test_time_evolution(struct kunit *test)
+{
+    const s32 one = 1 << QUANTUM_COEFF_SHIFT;
+    /* exp(-i*pi/4*Z0Z1) = CNOT RZ(pi/2) CNOT and exp(-i*pi/4*Y2) = RY(pi/2) */
+    static const struct quantum_op gates[] = {
+        { QUANTUM_GATE_CNOT, 0, 1, 0 },
+        { QUANTUM_GATE_RZ, 1, -1, QUANTUM_ANGLE_TURN / 4 },
+        { QUANTUM_GATE_CNOT, 0, 1, 0 },
+        { QUANTUM_GATE_RY, 2, -1, QUANTUM_ANGLE_TURN / 4 },
+    };
+    struct quantum_pauli_term single[] = {
+        { 0, 0x3, one },
+        { 0x4, 0x4, one },
+    };
+    struct quantum_pauli_term ising[3 * SIM_TEST_QUBITS];
+    struct quantum_hamiltonian ham = { SIM_TEST_QUBITS, ARRAY_SIZE(single), single };
+    struct quantum_evolution evolution = { QUANTUM_EVOLVE_TROTTER1, 1, 51472, 0 };  /* pi/4 */
+    struct quantum_state *ref, *state, *krylov;
+    size_t i, n = 0;
+    u32 method;
+
+    ref = quantum_state_alloc(SIM_TEST_QUBITS);
+    KUNIT_ASSERT_NOT_NULL(test, ref);
+    quantum_gate_apply(QUANTUM_GATE_H, ref, 0, NULL, 0);
+    quantum_gate_apply(QUANTUM_GATE_H, ref, 1, NULL, 0);
+    for (i = 0; i < ARRAY_SIZE(gates); i++)
+        KUNIT_ASSERT_EQ(test, quantum_state_apply_op(ref, &gates[i]), 0);
+
+    /* Commuting terms are exact in a single step whatever the method */
+    for (method = QUANTUM_EVOLVE_TROTTER1; method <= QUANTUM_EVOLVE_KRYLOV; method++) {
+        state = quantum_state_alloc(SIM_TEST_QUBITS);
+        KUNIT_ASSERT_NOT_NULL(test, state);
+        quantum_gate_apply(QUANTUM_GATE_H, state, 0, NULL, 0);
+        quantum_gate_apply(QUANTUM_GATE_H, state, 1, NULL, 0);
+        evolution.method = method;
+        KUNIT_ASSERT_EQ(test, quantum_state_evolve(state, &ham, &evolution), 0);
+        KUNIT_EXPECT_LE(test, sim_test_distance(test, state, ref), 1 << 12);
+        quantum_state_free(state);
+    }
+
+    /* Transverse-field Ising chain with a YY coupling across the first bond */
+    for (i = 0; i + 1 < SIM_TEST_QUBITS; i++)
+        ising[n++] = (struct quantum_pauli_term){ 0, 0x3ULL << i, one };
+    for (i = 0; i < SIM_TEST_QUBITS; i++)
+        ising[n++] = (struct quantum_pauli_term){ 1ULL << i, 0, one / 2 };
+    ising[n++] = (struct quantum_pauli_term){ 0x3, 0x3, one / 4 };
+    ham.num_terms = n;
+    ham.terms = ising;
+
+    krylov = quantum_state_alloc(SIM_TEST_QUBITS);
+    state = quantum_state_alloc(SIM_TEST_QUBITS);
+    KUNIT_ASSERT_NOT_NULL(test, krylov);
+    KUNIT_ASSERT_NOT_NULL(test, state);
+    quantum_gate_apply(QUANTUM_GATE_H, krylov, 2, NULL, 0);
+    quantum_gate_apply(QUANTUM_GATE_H, state, 2, NULL, 0);
+    KUNIT_ASSERT_EQ(test, quantum_state_set_layout(state, QUANTUM_LAYOUT_SOA), 0);
+
+    evolution = (struct quantum_evolution){ QUANTUM_EVOLVE_KRYLOV, 4, one, 0 };
+    KUNIT_ASSERT_EQ(test, quantum_state_evolve(krylov, &ham, &evolution), 0);
+
+    /* Second-order steps converge to the Krylov result at 1/steps^2 */
+    evolution = (struct quantum_evolution){ QUANTUM_EVOLVE_TROTTER2, 64, one, 0 };
+    KUNIT_ASSERT_EQ(test, quantum_state_evolve(state, &ham, &evolution), 0);
+    KUNIT_EXPECT_EQ(test, state->repr, QUANTUM_REPR_SPLIT);
+    KUNIT_EXPECT_LE(test, sim_test_distance(test, state, krylov), QAMP_ONE >> 12);
+
+    /* First-order steps converge at 1/steps */
+    KUNIT_ASSERT_EQ(test, quantum_state_init(state, 0), 0);
+    quantum_gate_apply(QUANTUM_GATE_H, state, 2, NULL, 0);
+    evolution = (struct quantum_evolution){ QUANTUM_EVOLVE_TROTTER1, 1024, one, 0 };
+    KUNIT_ASSERT_EQ(test, quantum_state_evolve(state, &ham, &evolution), 0);
+    KUNIT_EXPECT_LE(test, sim_test_distance(test, state, krylov), QAMP_ONE >> 10);
+    KUNIT_EXPECT_GT(test, sim_test_distance(test, state, krylov), QAMP_ONE >> 14);
+
+    /* Terms beyond the register are rejected */
+    ising[0].z = 1ULL << SIM_TEST_QUBITS;
+    KUNIT_EXPECT_EQ(test, quantum_state_evolve(state, &ham, &evolution), -EINVAL);
+
+    quantum_state_free(krylov);
+    quantum_state_free(state);
+    quantum_state_free(ref);
+}
+
+/* Test Pauli expectations and both optimizers of a variational job */
+static void test_variational(struct kunit *test)
+{
+    const s32 one = 1 << QUANTUM_COEFF_SHIFT;
+    /* XX + YY/2 + ZZ/4 on a Bell pair is 1 - 1/2 + 1/4 */
+    struct quantum_pauli_term bell[] = {
+        { 0x3, 0, one },
+        { 0x3, 0x3, one / 2 },
+        { 0, 0x3, one / 4 },
+    };
+    /* Z0 + X0 + Z1/2 has the ground energy -sqrt(2) - 1/2 */
+    struct quantum_pauli_term field[] = {
+        { 0, 0x1, one },
+        { 0x1, 0, one },
+        { 0, 0x2, one / 2 },
+    };
+    static const struct quantum_param_op ansatz[] = {
+        { { QUANTUM_GATE_RY, 0, -1, 0 }, 0, 1 },
+        { { QUANTUM_GATE_RY, 1, -1, 0 }, 1, 1 },
+    };
+    static const struct quantum_op cnot = { QUANTUM_GATE_CNOT, 0, 1, 0 };
+    struct quantum_hamiltonian ham = { 2, ARRAY_SIZE(bell), bell };
+    struct quantum_variational job;
+    struct quantum_state *state;
+    s32 params[2], first[2];
+    s64 energy, trace[64];
+    u32 optimizer, i;
+
+    state = quantum_state_alloc(2);
+    KUNIT_ASSERT_NOT_NULL(test, state);
+    quantum_gate_apply(QUANTUM_GATE_H, state, 0, NULL, 0);
+    KUNIT_ASSERT_EQ(test, quantum_state_apply_op(state, &cnot), 0);
+    KUNIT_ASSERT_EQ(test, quantum_state_expectation(state, &ham, &energy), 0);
+    KUNIT_EXPECT_LE(test, abs(energy - 3 * one / 4), 4);
+    quantum_state_free(state);
+
+    ham.terms = field;
+    for (optimizer = QUANTUM_OPTIMIZER_SPSA; optimizer <= QUANTUM_OPTIMIZER_NELDER_MEAD;
+         optimizer++) {
+        params[0] = QUANTUM_ANGLE_TURN / 16;
+        params[1] = QUANTUM_ANGLE_TURN / 8;
+        job = (struct quantum_variational) {
+            .num_qubits = 2,
+            .num_ops = ARRAY_SIZE(ansatz),
+            .ops = ansatz,
+            .observable = &ham,
+            .optimizer = optimizer,
+            .budget = 400,
+            .tolerance = 1,
+            .seed = 1,
+            .num_params = ARRAY_SIZE(params),
+            .params = params,
+            .trace_len = ARRAY_SIZE(trace),
+            .trace = trace,
+        };
+        KUNIT_ASSERT_EQ(test, quantum_variational_run(&job), 0);
+        KUNIT_EXPECT_LE(test, job.evaluations, 400U);
+        KUNIT_EXPECT_LE(test, abs(job.energy + 92682 + one / 2), one >> 8);
+        for (i = 1; i < min(job.iterations, job.trace_len); i++)
+            KUNIT_EXPECT_LE(test, trace[i], trace[i - 1]);
+
+        /* A fixed seed repeats the run */
+        if (optimizer == QUANTUM_OPTIMIZER_SPSA) {
+            memcpy(first, params, sizeof(first));
+            params[0] = QUANTUM_ANGLE_TURN / 16;
+            params[1] = QUANTUM_ANGLE_TURN / 8;
+            KUNIT_ASSERT_EQ(test, quantum_variational_run(&job), 0);
+            KUNIT_EXPECT_EQ(test, params[0], first[0]);
+            KUNIT_EXPECT_EQ(test, params[1], first[1]);
+        }
+    }
+
+    /* Parameter indices beyond the job are rejected */
+    job.num_params = 1;
+    KUNIT_EXPECT_EQ(test, quantum_variational_run(&job), -EINVAL);
+}
+
+/* |<a|b>| in Q30, one for states equal up to a global phase */
+static u64 sim_test_overlap(struct kunit *test, const struct quantum_state *a,
+                            const struct quantum_state *b)
+{
+    struct quantum_amp x, y;
+    s64 re = 0, im = 0;
+    size_t i;
+
+    for (i = 0; i < a->dim; i++) {
+        KUNIT_EXPECT_EQ(test, quantum_state_amplitude(a, i, &x), 0);
+        KUNIT_EXPECT_EQ(test, quantum_state_amplitude(b, i, &y), 0);
+        re += ((s64)x.re * y.re + (s64)x.im * y.im) >> QAMP_SHIFT;
+        im += ((s64)x.re * y.im - (s64)x.im * y.re) >> QAMP_SHIFT;
+    }
+
+    return int_sqrt64(re * re + im * im);
+}
+
+/* Shor encoding of RY(pi/3)|0> on qubits 0..8 */
+static struct quantum_state *sim_test_shor_state(struct kunit *test)
+{
+    static const struct quantum_op encode[] = {
+        { QUANTUM_GATE_RY, 0, -1, QUANTUM_ANGLE_TURN / 6 },
+        { QUANTUM_GATE_CNOT, 0, 3, 0 },
+        { QUANTUM_GATE_CNOT, 0, 6, 0 },
+        { QUANTUM_GATE_H, 0, -1, 0 },
+        { QUANTUM_GATE_H, 3, -1, 0 },
+        { QUANTUM_GATE_H, 6, -1, 0 },
+        { QUANTUM_GATE_CNOT, 0, 1, 0 },
+        { QUANTUM_GATE_CNOT, 0, 2, 0 },
+        { QUANTUM_GATE_CNOT, 3, 4, 0 },
+        { QUANTUM_GATE_CNOT, 3, 5, 0 },
+        { QUANTUM_GATE_CNOT, 6, 7, 0 },
+        { QUANTUM_GATE_CNOT, 6, 8, 0 },
+    };
+    struct quantum_state *state;
+    size_t i;
+
+    state = quantum_state_alloc(10);
+    KUNIT_ASSERT_NOT_NULL(test, state);
+    for (i = 0; i < ARRAY_SIZE(encode); i++)
+        KUNIT_ASSERT_EQ(test, quantum_state_apply_op(state, &encode[i]), 0);
+    return state;
+}
+
+/* Test that independent QEC contexts correct their own registers */
+static void test_qec_contexts(struct kunit *test)
+{
+    struct qec_params shor = { .code_type = QEC_CODE_SHOR };
+    struct qec_params bitflip = { .code_type = QEC_CODE_BITFLIP };
+    struct quantum_state *ref, *state, *small;
+    struct ctrlxt_qec_ctx *ctx, *other;
+    struct quantum_error_stats stats;
+    enum quantum_gate_type error;
+    int qubit;
+
+    ref = sim_test_shor_state(test);
+    state = sim_test_shor_state(test);
+    ctx = ctrlxt_qec_alloc(state, &shor);
+    KUNIT_ASSERT_FALSE(test, IS_ERR(ctx));
+
+    /* Every single-qubit Pauli error is undone up to a stabilizer and a global phase */
+    for (qubit = 0; qubit < 9; qubit++) {
+        for (error = QUANTUM_GATE_X; error <= QUANTUM_GATE_Z; error++) {
+            KUNIT_ASSERT_EQ(test, quantum_gate_apply(error, state, qubit, NULL, 0), 0);
+            KUNIT_ASSERT_EQ(test, ctrlxt_qec_apply(ctx), 0);
+            KUNIT_EXPECT_NE(test, ctx->syndrome, 0ULL);
+            KUNIT_EXPECT_GE(test, sim_test_overlap(test, state, ref), QAMP_ONE - (1 << 12));
+        }
+    }
+
+    /* A clean register keeps its syndrome trivial */
+    KUNIT_ASSERT_EQ(test, ctrlxt_qec_apply(ctx), 0);
+    KUNIT_EXPECT_EQ(test, ctx->syndrome, 0ULL);
+    ctrlxt_qec_ctx_get_stats(ctx, &stats);
+    KUNIT_EXPECT_EQ(test, atomic_read(&stats.error_count), 27);
+    KUNIT_EXPECT_EQ(test, atomic_read(&stats.correction_count), 28);
+
+    /* A second context has its own code, syndrome and counters */
+    small = quantum_state_alloc(2);
+    KUNIT_ASSERT_NOT_NULL(test, small);
+    other = ctrlxt_qec_alloc(small, &bitflip);
+    KUNIT_EXPECT_EQ(test, PTR_ERR(other), -EINVAL);
+    other = ctrlxt_qec_alloc(ref, &bitflip);
+    KUNIT_ASSERT_FALSE(test, IS_ERR(other));
+    KUNIT_ASSERT_EQ(test, ctrlxt_qec_apply(other), 0);
+    ctrlxt_qec_ctx_get_stats(other, &stats);
+    KUNIT_EXPECT_EQ(test, atomic_read(&stats.correction_count), 1);
+    KUNIT_EXPECT_EQ(test, ctrlxt_qec_bind(other, small), -EINVAL);
+
+    ctrlxt_qec_free(other);
+    ctrlxt_qec_free(ctx);
+    quantum_state_free(small);
+    quantum_state_free(state);
+    quantum_state_free(ref);
+}
+
+/* Test one round over many registers from a single call */
+static void test_qec_batch(struct kunit *test)
+{
+    struct qec_params shor = { .code_type = QEC_CODE_SHOR };
+    struct ctrlxt_qec_ctx *ctxs[SIM_TEST_BATCH], *ctx;
+    struct quantum_state *ref, *states[SIM_TEST_BATCH];
+    struct quantum_error_stats stats;
+    int i;
+
+    ref = sim_test_shor_state(test);
+    for (i = 0; i < SIM_TEST_BATCH; i++) {
+        states[i] = sim_test_shor_state(test);
+        ctxs[i] = ctrlxt_qec_alloc(states[i], &shor);
+        KUNIT_ASSERT_FALSE(test, IS_ERR(ctxs[i]));
+    }
+
+    /* A different error on every register, odd ones stay clean */
+    for (i = 0; i < SIM_TEST_BATCH; i += 2)
+        KUNIT_ASSERT_EQ(test, quantum_gate_apply(QUANTUM_GATE_X + i % 3, states[i], i % 9, NULL, 0), 0);
+    KUNIT_ASSERT_EQ(test, ctrlxt_qec_apply_batch(ctxs, SIM_TEST_BATCH), 0);
+    for (i = 0; i < SIM_TEST_BATCH; i++) {
+        KUNIT_EXPECT_EQ(test, ctxs[i]->syndrome != 0, i % 2 == 0);
+        KUNIT_EXPECT_GE(test, sim_test_overlap(test, states[i], ref), QAMP_ONE - (1 << 12));
+    }
+
+    KUNIT_ASSERT_EQ(test, ctrlxt_qec_apply_batch(ctxs, SIM_TEST_BATCH), 0);
+    for (i = 0; i < SIM_TEST_BATCH; i++) {
+        KUNIT_EXPECT_EQ(test, ctxs[i]->syndrome, 0ULL);
+        ctrlxt_qec_ctx_get_stats(ctxs[i], &stats);
+        KUNIT_EXPECT_EQ(test, atomic_read(&stats.correction_count), 2);
+    }
+
+    KUNIT_EXPECT_EQ(test, ctrlxt_qec_apply_batch(ctxs, 0), 0);
+    KUNIT_EXPECT_EQ(test, ctrlxt_qec_apply_batch(NULL, 1), -EINVAL);
+    ctx = ctxs[1];
+    ctxs[1] = NULL;
+    KUNIT_EXPECT_EQ(test, ctrlxt_qec_apply_batch(ctxs, SIM_TEST_BATCH), -EINVAL);
+    ctxs[1] = ctx;
+    ctrlxt_qec_ctx_get_stats(ctxs[0], &stats);
+    KUNIT_EXPECT_EQ(test, atomic_read(&stats.correction_count), 2);
+
+    for (i = 0; i < SIM_TEST_BATCH; i++) {
+        ctrlxt_qec_free(ctxs[i]);
+        quantum_state_free(states[i]);
+    }
+    quantum_state_free(ref);
+}
+
+/* Test rounds that follow the decoded error rate of a register */
+static void test_qec_adaptive(struct kunit *test)
+{
+    struct qec_params params = {
+        .code_type = QEC_CODE_BITFLIP,
+        .error_threshold = 10,
+        .max_iterations = 32,
+        .adaptive_correction = true,
+    };
+    struct quantum_state *state, *ref;
+    struct ctrlxt_qec_ctx *ctx;
+    int i, rounds;
+
+    state = quantum_state_alloc(3);
+    ref = quantum_state_alloc(3);
+    KUNIT_ASSERT_NOT_NULL(test, state);
+    KUNIT_ASSERT_NOT_NULL(test, ref);
+    ctx = ctrlxt_qec_alloc(state, &params);
+    KUNIT_ASSERT_FALSE(test, IS_ERR(ctx));
+    KUNIT_EXPECT_EQ(test, ctx->interval, 1U);
+
+    /* A quiet register backs off to the longest interval */
+    for (i = 0; i < 1000; i++)
+        KUNIT_ASSERT_EQ(test, ctrlxt_qec_step(ctx), 0);
+    KUNIT_EXPECT_EQ(test, ctx->interval, 32U);
+    rounds = atomic_read(&ctx->correction_count);
+    KUNIT_EXPECT_LT(test, rounds, 200);
+
+    /* A rare error is caught by the next round and tightens the schedule */
+    KUNIT_ASSERT_EQ(test, quantum_gate_apply(QUANTUM_GATE_X, state, 1, NULL, 0), 0);
+    for (i = 0; i < 32; i++)
+        KUNIT_ASSERT_EQ(test, ctrlxt_qec_step(ctx), 0);
+    KUNIT_EXPECT_GE(test, sim_test_overlap(test, state, ref), QAMP_ONE - (1 << 12));
+    KUNIT_EXPECT_LT(test, ctx->interval, 32U);
+
+    /* Frequent errors bring back a round after almost every gate */
+    rounds = atomic_read(&ctx->correction_count);
+    for (i = 0; i < 400; i++) {
+        if (i % 4 == 0)
+            KUNIT_ASSERT_EQ(test, quantum_gate_apply(QUANTUM_GATE_X, state, 0, NULL, 0), 0);
+        KUNIT_ASSERT_EQ(test, ctrlxt_qec_step(ctx), 0);
+    }
+    KUNIT_EXPECT_GT(test, atomic_read(&ctx->correction_count) - rounds, 300);
+    KUNIT_EXPECT_LE(test, ctx->interval, 2U);
+    KUNIT_ASSERT_EQ(test, ctrlxt_qec_apply(ctx), 0);
+    KUNIT_EXPECT_GE(test, sim_test_overlap(test, state, ref), QAMP_ONE - (1 << 12));
+
+    /* Switching adaptive correction off corrects every gate again */
+    ctrlxt_qec_set_adaptive(false);
+    rounds = atomic_read(&ctx->correction_count);
+    for (i = 0; i < 10; i++)
+        KUNIT_ASSERT_EQ(test, ctrlxt_qec_step(ctx), 0);
+    KUNIT_EXPECT_EQ(test, atomic_read(&ctx->correction_count) - rounds, 10);
+    KUNIT_EXPECT_EQ(test, ctrlxt_qec_step(NULL), -EINVAL);
+
+    ctrlxt_qec_free(ctx);
+    quantum_state_free(ref);
+    quantum_state_free(state);
+}
+
+/* Test lookup-table decoding of the small codes and the fused Pauli correction */
+static void test_qec_lookup(struct kunit *test)
+{
+    static const unsigned int codes[] = { QEC_CODE_BITFLIP, QEC_CODE_PHASEFLIP, QEC_CODE_SHOR };
+    struct quantum_circuit circuit = {
+        .num_qubits = SIM_TEST_QUBITS,
+        .num_ops = ARRAY_SIZE(sim_test_real_ops),
+        .ops = (struct quantum_op *)sim_test_real_ops,
+    };
+    const struct qec_stabilizer *fix, *stab;
+    struct qec_params params = { 0 };
+    struct quantum_state *ref, *state;
+    struct ctrlxt_qec_ctx *ctx;
+    struct quantum_amp amp;
+    u64 x = 0x19, z = 0x0e, bits;
+    unsigned int s, i, syndrome;
+    size_t c, v;
+
+    /* Every entry has its own syndrome, with at most one error per block of the Shor code */
+    ref = sim_test_shor_state(test);
+    for (c = 0; c < ARRAY_SIZE(codes); c++) {
+        params.code_type = codes[c];
+        ctx = ctrlxt_qec_alloc(ref, &params);
+        KUNIT_ASSERT_FALSE(test, IS_ERR(ctx));
+        KUNIT_ASSERT_NOT_NULL(test, ctx->code.lut);
+
+        for (s = 0; s < BIT(ctx->code.num_stabilizers); s++) {
+            fix = &ctx->code.lut[s];
+            syndrome = 0;
+            for (i = 0; i < ctx->code.num_stabilizers; i++) {
+                stab = &ctx->code.stabilizers[i];
+                syndrome |= (hweight64((fix->x & stab->z) ^ (fix->z & stab->x)) & 1) << i;
+            }
+            KUNIT_EXPECT_EQ(test, syndrome, s);
+            KUNIT_EXPECT_LE(test, hweight64(fix->x | fix->z), ctx->code.num_data == 9 ? 4 : 1);
+        }
+        KUNIT_EXPECT_EQ(test, ctx->code.lut[0].x | ctx->code.lut[0].z, 0ULL);
+        ctrlxt_qec_free(ctx);
+    }
+
+    /* Errors in separate blocks of the Shor code are corrected together */
+    state = sim_test_shor_state(test);
+    params.code_type = QEC_CODE_SHOR;
+    ctx = ctrlxt_qec_alloc(state, &params);
+    KUNIT_ASSERT_FALSE(test, IS_ERR(ctx));
+    KUNIT_ASSERT_EQ(test, quantum_gate_apply(QUANTUM_GATE_X, state, 1, NULL, 0), 0);
+    KUNIT_ASSERT_EQ(test, quantum_gate_apply(QUANTUM_GATE_Y, state, 5, NULL, 0), 0);
+    KUNIT_ASSERT_EQ(test, quantum_gate_apply(QUANTUM_GATE_X, state, 6, NULL, 0), 0);
+    KUNIT_ASSERT_EQ(test, ctrlxt_qec_apply(ctx), 0);
+    KUNIT_EXPECT_GE(test, sim_test_overlap(test, state, ref), QAMP_ONE - (1 << 12));
+    ctrlxt_qec_free(ctx);
+    quantum_state_free(state);
+    quantum_state_free(ref);
+
+    /* One pass matches the Z gates followed by the X gates on every representation */
+    ref = quantum_state_alloc(SIM_TEST_QUBITS);
+    KUNIT_ASSERT_NOT_NULL(test, ref);
+    KUNIT_ASSERT_EQ(test, quantum_circuit_run(ref, &circuit), 0);
+    for (bits = z; bits; bits &= bits - 1)
+        KUNIT_ASSERT_EQ(test, quantum_gate_apply(QUANTUM_GATE_Z, ref, __ffs64(bits), NULL, 0), 0);
+    for (bits = x; bits; bits &= bits - 1)
+        KUNIT_ASSERT_EQ(test, quantum_gate_apply(QUANTUM_GATE_X, ref, __ffs64(bits), NULL, 0), 0);
+
+    for (v = 0; v < 3; v++) {
+        state = quantum_state_alloc_repr(SIM_TEST_QUBITS,
+                                         v == 0 ? QUANTUM_REPR_REAL : QUANTUM_REPR_DENSE);
+        KUNIT_ASSERT_NOT_NULL(test, state);
+        if (v == 2)
+            KUNIT_ASSERT_EQ(test, quantum_state_set_layout(state, QUANTUM_LAYOUT_AOSOA4), 0);
+        KUNIT_ASSERT_EQ(test, quantum_circuit_run(state, &circuit), 0);
+        KUNIT_ASSERT_EQ(test, quantum_state_apply_pauli(state, x, z), 0);
+        KUNIT_EXPECT_EQ(test, quantum_state_apply_pauli(state, BIT_ULL(SIM_TEST_QUBITS), 0),
+                        -EINVAL);
+
+        for (i = 0; i < ref->dim; i++) {
+            KUNIT_ASSERT_EQ(test, quantum_state_amplitude(state, i, &amp), 0);
+            KUNIT_EXPECT_EQ(test, amp.re, ref->amps[i].re);
+            KUNIT_EXPECT_EQ(test, amp.im, ref->amps[i].im);
+        }
+        quantum_state_free(state);
+    }
+
+    quantum_state_free(ref);
+}
+
+/* Detector k of round t for one shot of a frame sample */
+static bool sim_test_detector(const struct qec_frame *frame, const u64 *det, unsigned int t,
+                              unsigned int k, unsigned int shot)
+{
+    return det[((size_t)t * frame->num_checks + k) * frame->words + shot / 64] & BIT_ULL(shot % 64);
+}
+
+/* Test the Pauli-frame sampler against the syndromes of the errors it drew */
+static void test_pauli_frame(struct kunit *test)
+{
+    struct qec_params params = { .code_type = QEC_CODE_SURFACE, .distance = 3 };
+    struct qec_params shor = { .code_type = QEC_CODE_SHOR };
+    struct qec_frame_noise noise = { .data_ppm = 300000 };
+    struct quantum_op t_gate = { QUANTUM_GATE_T, 0, -1, 0 };
+    DECLARE_BITMAP(errors, QEC_MAX_DATA_QUBITS);
+    DECLARE_BITMAP(syndrome, QEC_MAX_STABILIZERS);
+    const struct qec_stabilizer *stab;
+    struct quantum_state *state, *small;
+    struct ctrlxt_qec_ctx *ctx, *other;
+    unsigned int shot, k, q, m, flips = 0;
+    struct qec_surface surface;
+    struct qec_frame frame;
+    struct qec_code code;
+    u64 *det, x, z;
+    int type;
+
+    state = quantum_state_alloc(17);
+    KUNIT_ASSERT_NOT_NULL(test, state);
+    ctx = ctrlxt_qec_alloc(state, &params);
+    KUNIT_ASSERT_FALSE(test, IS_ERR(ctx));
+    KUNIT_ASSERT_EQ(test, qec_surface_init(&surface, 3), 0);
+    m = surface.num_checks;
+
+    KUNIT_ASSERT_EQ(test, qec_frame_init(&frame, &ctx->code, 500, &noise, 1), 0);
+    KUNIT_EXPECT_EQ(test, qec_frame_shots(&frame), 512U);
+    det = kunit_kcalloc(test, 3 * frame.num_checks * frame.words, sizeof(u64), GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, det);
+
+    /* One round through the extraction circuit reads the checks the data errors violate */
+    KUNIT_ASSERT_EQ(test, qec_frame_sample(&frame, 1, det), 0);
+    for (shot = 0; shot < qec_frame_shots(&frame); shot++) {
+        for (type = 0; type < QEC_CHECK_TYPES; type++) {
+            qec_frame_errors(&frame, shot, type == QEC_CHECK_X, errors);
+            qec_surface_syndrome(&surface, type, errors, syndrome);
+            for (k = 0; k < m; k++)
+                KUNIT_EXPECT_EQ(test, sim_test_detector(&frame, det, 0, k + type * m, shot),
+                                test_bit(k, syndrome));
+            flips += bitmap_weight(errors, surface.num_data);
+        }
+    }
+
+    /* Depolarizing at 30% leaves an X and a Z component on a fifth of the qubits each */
+    KUNIT_EXPECT_GT(test, flips, 1600U);
+    KUNIT_EXPECT_LT(test, flips, 2100U);
+    qec_frame_free(&frame);
+
+    /* Readout errors show up twice, the last round reads exactly */
+    noise = (struct qec_frame_noise){ .measure_ppm = QEC_PPM };
+    KUNIT_ASSERT_EQ(test, qec_frame_init(&frame, &ctx->code, 64, &noise, 2), 0);
+    KUNIT_ASSERT_EQ(test, qec_frame_sample(&frame, 3, det), 0);
+    for (k = 0; k < frame.num_checks; k++) {
+        KUNIT_EXPECT_EQ(test, det[k], ~0ULL);
+        KUNIT_EXPECT_EQ(test, det[frame.num_checks + k], 0ULL);
+        KUNIT_EXPECT_EQ(test, det[2 * frame.num_checks + k], ~0ULL);
+    }
+    qec_frame_free(&frame);
+
+    /* Codes without a circuit read their stabilizers off the frame */
+    small = sim_test_shor_state(test);
+    other = ctrlxt_qec_alloc(small, &shor);
+    KUNIT_ASSERT_FALSE(test, IS_ERR(other));
+    noise = (struct qec_frame_noise){ .data_ppm = 100000 };
+    KUNIT_ASSERT_EQ(test, qec_frame_init(&frame, &other->code, 128, &noise, 3), 0);
+    KUNIT_ASSERT_EQ(test, qec_frame_sample(&frame, 1, det), 0);
+    for (shot = 0; shot < qec_frame_shots(&frame); shot++) {
+        x = z = 0;
+        qec_frame_errors(&frame, shot, false, errors);
+        for_each_set_bit(q, errors, 9)
+            x |= BIT_ULL(q);
+        qec_frame_errors(&frame, shot, true, errors);
+        for_each_set_bit(q, errors, 9)
+            z |= BIT_ULL(q);
+        for (k = 0; k < frame.num_checks; k++) {
+            stab = &other->code.stabilizers[k];
+            KUNIT_EXPECT_EQ(test, sim_test_detector(&frame, det, 0, k, shot),
+                            (bool)(hweight64((x & stab->z) ^ (z & stab->x)) & 1));
+        }
+    }
+    qec_frame_free(&frame);
+
+    /* Only Clifford circuits propagate Pauli frames */
+    code = ctx->code;
+    code.circuit = &t_gate;
+    code.circuit_len = 1;
+    KUNIT_EXPECT_EQ(test, qec_frame_init(&frame, &code, 64, &noise, 4), -EINVAL);
+    KUNIT_EXPECT_EQ(test, qec_frame_init(&frame, &ctx->code, QEC_FRAME_MAX_SHOTS + 1, &noise, 4),
+                    -EINVAL);
+    KUNIT_EXPECT_EQ(test, qec_frame_init(&frame, &ctx->code, 0, &noise, 4), -EINVAL);
+    KUNIT_EXPECT_EQ(test, qec_frame_init(&frame, NULL, 64, &noise, 4), -EINVAL);
+
+    ctrlxt_qec_free(other);
+    ctrlxt_qec_free(ctx);
+    qec_surface_free(&surface);
+    quantum_state_free(small);
+    quantum_state_free(state);
+}
+
+/* Test windowed decoding of a round stream and of a surface code context */
+static void test_stream_decoder(struct kunit *test)
+{
+    struct qec_params params = { .code_type = QEC_CODE_SURFACE, .distance = 3 };
+    struct qec_params bitflip = { .code_type = QEC_CODE_BITFLIP };
+    DECLARE_BITMAP(errors, QEC_MAX_DATA_QUBITS);
+    DECLARE_BITMAP(readouts, 2 * QEC_MAX_STABILIZERS);
+    DECLARE_BITMAP(x, QEC_MAX_DATA_QUBITS);
+    DECLARE_BITMAP(z, QEC_MAX_DATA_QUBITS);
+    struct quantum_state *state, *ref;
+    struct quantum_error_stats stats;
+    struct qec_stream_stats sstats;
+    struct ctrlxt_qec_ctx *ctx;
+    struct qec_surface code;
+    struct qec_stream stream;
+    unsigned int t;
+    int i;
+
+    /* A data error from round 20 on and a single wrong readout in round 50 */
+    KUNIT_ASSERT_EQ(test, qec_surface_init(&code, 5), 0);
+    KUNIT_ASSERT_EQ(test, qec_stream_init(&stream, &code, 0, 0), 0);
+    KUNIT_EXPECT_EQ(test, stream.window, 10U);
+    KUNIT_EXPECT_EQ(test, stream.commit, 5U);
+    bitmap_zero(errors, code.num_data);
+    for (t = 0; t < 150; t++) {
+        if (t == 20)
+            __set_bit(12, errors);
+        qec_surface_syndrome(&code, QEC_CHECK_Z, errors, readouts);
+        if (t == 50)
+            __change_bit(3, readouts);
+        KUNIT_ASSERT_EQ(test, qec_stream_push(&stream, readouts), 0);
+    }
+    KUNIT_ASSERT_EQ(test, qec_stream_flush(&stream), 0);
+    KUNIT_EXPECT_TRUE(test, qec_stream_take(&stream, x, z));
+    KUNIT_EXPECT_TRUE(test, bitmap_equal(x, errors, code.num_data));
+    KUNIT_EXPECT_TRUE(test, bitmap_empty(z, code.num_data));
+    KUNIT_EXPECT_FALSE(test, qec_stream_take(&stream, x, z));
+
+    /* Every round is committed once, 29 full windows and the closing one */
+    qec_stream_get_stats(&stream, &sstats);
+    KUNIT_EXPECT_EQ(test, sstats.rounds, 150ULL);
+    KUNIT_EXPECT_EQ(test, sstats.windows, 30ULL);
+    KUNIT_EXPECT_GE(test, sstats.max_latency_ns, sstats.total_latency_ns / sstats.rounds);
+    qec_stream_free(&stream);
+    KUNIT_EXPECT_EQ(test, qec_stream_init(&stream, &code, 4, 4), -EINVAL);
+    KUNIT_EXPECT_EQ(test, qec_stream_init(&stream, &code, QEC_STREAM_RING, 1), -EINVAL);
+    qec_surface_free(&code);
+
+    /* A context keeps extracting rounds while the worker decodes them */
+    state = quantum_state_alloc(17);
+    ref = quantum_state_alloc(17);
+    KUNIT_ASSERT_NOT_NULL(test, state);
+    KUNIT_ASSERT_NOT_NULL(test, ref);
+    ctx = ctrlxt_qec_alloc(state, &params);
+    KUNIT_ASSERT_FALSE(test, IS_ERR(ctx));
+    KUNIT_ASSERT_EQ(test, ctrlxt_qec_apply(ctx), 0);
+    KUNIT_ASSERT_EQ(test, quantum_state_copy(ref, state), 0);
+
+    KUNIT_EXPECT_EQ(test, ctrlxt_qec_stream_stop(ctx), -EINVAL);
+    KUNIT_ASSERT_EQ(test, ctrlxt_qec_stream_start(ctx, 4, 2), 0);
+    KUNIT_EXPECT_EQ(test, ctrlxt_qec_stream_start(ctx, 4, 2), -EBUSY);
+    KUNIT_ASSERT_EQ(test, quantum_gate_apply(QUANTUM_GATE_X, state, 4, NULL, 0), 0);
+    for (i = 0; i < 6; i++) {
+        if (i == 3)
+            KUNIT_ASSERT_EQ(test, quantum_gate_apply(QUANTUM_GATE_Z, state, 2, NULL, 0), 0);
+        KUNIT_ASSERT_EQ(test, ctrlxt_qec_apply(ctx), 0);
+    }
+    KUNIT_ASSERT_EQ(test, ctrlxt_qec_stream_stop(ctx), 0);
+    KUNIT_EXPECT_GE(test, sim_test_overlap(test, state, ref), QAMP_ONE - (1 << 12));
+
+    /* Rounds are corrected in place again and latencies cover both modes */
+    KUNIT_ASSERT_EQ(test, ctrlxt_qec_apply(ctx), 0);
+    KUNIT_EXPECT_EQ(test, ctx->syndrome, 0ULL);
+    ctrlxt_qec_ctx_get_stats(ctx, &stats);
+    KUNIT_EXPECT_EQ(test, ctx->latency_rounds, 8ULL);
+    KUNIT_EXPECT_GE(test, stats.max_latency_ns, stats.latency_ns);
+    KUNIT_EXPECT_GT(test, stats.latency_ns, 0ULL);
+    ctrlxt_qec_free(ctx);
+
+    ctx = ctrlxt_qec_alloc(state, &bitflip);
+    KUNIT_ASSERT_FALSE(test, IS_ERR(ctx));
+    KUNIT_EXPECT_EQ(test, ctrlxt_qec_stream_start(ctx, 0, 0), -EINVAL);
+    ctrlxt_qec_free(ctx);
+
+    quantum_state_free(ref);
+    quantum_state_free(state);
+}
+
+/* Every single-qubit error on a distance-3 surface code register with the given decoder */
+static void sim_test_surface_ctx(struct kunit *test, unsigned int decoder)
+{
+    static const struct quantum_op logical_rx[] = {
+        { QUANTUM_GATE_CNOT, 0, 3, 0 },
+        { QUANTUM_GATE_CNOT, 0, 6, 0 },
+        { QUANTUM_GATE_RX, 0, -1, QUANTUM_ANGLE_TURN / 6 },
+        { QUANTUM_GATE_CNOT, 0, 3, 0 },
+        { QUANTUM_GATE_CNOT, 0, 6, 0 },
+    };
+    struct qec_params params = {
+        .code_type = QEC_CODE_SURFACE,
+        .distance = 3,
+        .decoder = decoder,
+    };
+    struct quantum_state *state, *ref;
+    enum quantum_gate_type error;
+    struct ctrlxt_qec_ctx *ctx;
+    int qubit;
+    size_t j;
+
+    state = quantum_state_alloc(17);
+    ref = quantum_state_alloc(17);
+    KUNIT_ASSERT_NOT_NULL(test, state);
+    KUNIT_ASSERT_NOT_NULL(test, ref);
+    ctx = ctrlxt_qec_alloc(state, &params);
+    KUNIT_ASSERT_FALSE(test, IS_ERR(ctx));
+
+    /* The first round projects onto logical |0>, then X_L on column 0 is rotated */
+    KUNIT_ASSERT_EQ(test, ctrlxt_qec_apply(ctx), 0);
+    for (j = 0; j < ARRAY_SIZE(logical_rx); j++)
+        KUNIT_ASSERT_EQ(test, quantum_state_apply_op(state, &logical_rx[j]), 0);
+    KUNIT_ASSERT_EQ(test, quantum_state_copy(ref, state), 0);
+
+    for (qubit = 0; qubit < 9; qubit++) {
+        for (error = QUANTUM_GATE_X; error <= QUANTUM_GATE_Z; error++) {
+            KUNIT_ASSERT_EQ(test, quantum_gate_apply(error, state, qubit, NULL, 0), 0);
+            KUNIT_ASSERT_EQ(test, ctrlxt_qec_apply(ctx), 0);
+            KUNIT_EXPECT_NE(test, ctx->syndrome, 0ULL);
+            KUNIT_EXPECT_GE(test, sim_test_overlap(test, state, ref), QAMP_ONE - (1 << 12));
+        }
+    }
+    KUNIT_ASSERT_EQ(test, ctrlxt_qec_apply(ctx), 0);
+    KUNIT_EXPECT_EQ(test, ctx->syndrome, 0ULL);
+    ctrlxt_qec_free(ctx);
+
+    /* Distance 5 needs 49 qubits, even distances do not exist */
+    params.distance = 5;
+    KUNIT_EXPECT_EQ(test, PTR_ERR(ctrlxt_qec_alloc(state, &params)), -EINVAL);
+    params.distance = 4;
+    KUNIT_EXPECT_EQ(test, PTR_ERR(ctrlxt_qec_alloc(state, &params)), -EINVAL);
+
+    quantum_state_free(ref);
+    quantum_state_free(state);
+}
+
+/* Test surface code registers and both decoders on three rounds of distance 7 */
+static void test_surface_code(struct kunit *test)
+{
+    DECLARE_BITMAP(errors, 64);
+    DECLARE_BITMAP(correction, 64);
+    DECLARE_BITMAP(syndrome, 64);
+    struct qec_surface code;
+    struct qec_graph graph;
+    struct qec_paths paths;
+    struct qec_mwpm mwpm;
+    struct rnd_state rnd;
+    struct qec_uf uf;
+    u32 defects[64], num_defects, k;
+    int trial, i, ret;
+
+    sim_test_surface_ctx(test, QEC_DECODER_UNION_FIND);
+    sim_test_surface_ctx(test, QEC_DECODER_MATCHING);
+
+    KUNIT_ASSERT_EQ(test, qec_surface_init(&code, 7), 0);
+    KUNIT_ASSERT_EQ(test, qec_surface_graph(&code, QEC_CHECK_Z, 3, &graph), 0);
+    qec_graph_set_weights(&graph, 1000, 10000);
+    KUNIT_ASSERT_EQ(test, qec_uf_init(&uf, &graph), 0);
+    KUNIT_ASSERT_EQ(test, qec_paths_init(&paths, &graph), 0);
+    KUNIT_ASSERT_EQ(test, qec_mwpm_init(&mwpm, &paths), 0);
+    prandom_seed_state(&rnd, 38);
+
+    /* Errors up to weight three appear before round 1 and are corrected by both */
+    for (trial = 0; trial < 1000; trial++) {
+        bitmap_zero(errors, code.num_data);
+        for (i = 0; i < 3; i++)
+            __set_bit(prandom_u32_state(&rnd) % code.num_data, errors);
+        qec_surface_syndrome(&code, QEC_CHECK_Z, errors, syndrome);
+
+        num_defects = 0;
+        for_each_set_bit(k, syndrome, code.num_checks)
+            defects[num_defects++] = code.num_checks + k;
+        if (trial % 2)
+            ret = qec_uf_decode(&uf, defects, num_defects, correction);
+        else
+            ret = qec_mwpm_decode(&mwpm, defects, num_defects, correction);
+        KUNIT_ASSERT_EQ(test, ret, 0);
+
+        bitmap_xor(errors, errors, correction, code.num_data);
+        qec_surface_syndrome(&code, QEC_CHECK_Z, errors, syndrome);
+        KUNIT_EXPECT_EQ(test, bitmap_weight(syndrome, code.num_checks), 0U);
+        KUNIT_EXPECT_FALSE(test, qec_surface_logical(&code, QEC_CHECK_Z, errors));
+    }
+
+    /* A measurement error in round 0 lights the same check twice and needs no correction */
+    defects[0] = 5;
+    defects[1] = code.num_checks + 5;
+    KUNIT_EXPECT_EQ(test, qec_uf_decode(&uf, defects, 2, correction), 0);
+    KUNIT_EXPECT_EQ(test, bitmap_weight(correction, code.num_data), 0U);
+    KUNIT_EXPECT_EQ(test, qec_mwpm_decode(&mwpm, defects, 2, correction), 0);
+    KUNIT_EXPECT_EQ(test, bitmap_weight(correction, code.num_data), 0U);
+
+    /* Listing a node twice cancels it, the boundary is not a detector */
+    defects[1] = 5;
+    KUNIT_EXPECT_EQ(test, qec_mwpm_decode(&mwpm, defects, 2, correction), 0);
+    KUNIT_EXPECT_EQ(test, bitmap_weight(correction, code.num_data), 0U);
+    defects[0] = graph.num_nodes - 1;
+    KUNIT_EXPECT_EQ(test, qec_uf_decode(&uf, defects, 1, correction), -EINVAL);
+    KUNIT_EXPECT_EQ(test, qec_mwpm_decode(&mwpm, defects, 1, correction), -EINVAL);
+
+    /* Measurement faults ten times likelier weigh less than data faults */
+    KUNIT_EXPECT_LT(test, qec_edge_weight(10000), qec_edge_weight(1000));
+    KUNIT_EXPECT_EQ(test, qec_edge_weight(QEC_PPM / 2), 1U);
+
+    qec_mwpm_free(&mwpm);
+    qec_paths_free(&paths);
+    qec_uf_free(&uf);
+    qec_graph_free(&graph);
+    qec_surface_free(&code);
+}
+
+/* Interface with an n-qubit register and error correction off, so flipped qubits stay flipped */
+static struct ctrlxt_qc_interface *sim_test_qc(struct kunit *test, unsigned int num_qubits)
+{
+    struct qc_params params = {
+        .buffer_size = QC_BUFFER_SIZE_DEF,
+        .measurement_type = QC_MEAS_BASIS_Z,
+        .num_qubits = num_qubits,
+    };
+    struct ctrlxt_qc_interface *qc = ctrlxt_qc_alloc(&params);
+
+    KUNIT_ASSERT_FALSE(test, IS_ERR(qc));
+    return qc;
+}
+
+/* Test the request ring: order, a full ring, reaping and freeing with requests queued */
+static void test_qc_ring(struct kunit *test)
+{
+    struct ctrlxt_qc_interface *qc = sim_test_qc(test, 4);
+    struct qc_request reqs[QC_RING_SIZE + 8];
+    struct qc_completion cqes[QC_RING_SIZE];
+    unsigned int i, reaped;
+    u8 *out;
+    int n;
+
+    out = kunit_kzalloc(test, QC_RING_SIZE, GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, out);
+
+    /* Nothing outstanding, waiting returns at once */
+    KUNIT_EXPECT_EQ(test, ctrlxt_qc_reap(qc, cqes, 1, true), 0);
+    KUNIT_EXPECT_FALSE(test, ctrlxt_qc_is_active(qc));
+
+    /* Unreaped completions keep their slots, so a full ring takes part of a batch */
+    for (i = 0; i < ARRAY_SIZE(reqs); i++)
+        reqs[i] = (struct qc_request){ .op = QC_REQ_GATE, .gate = QUANTUM_GATE_X,
+                                       .qubit = i % 4, .user_data = i };
+    KUNIT_EXPECT_EQ(test, ctrlxt_qc_submit(qc, reqs, ARRAY_SIZE(reqs)), QC_RING_SIZE);
+    KUNIT_EXPECT_EQ(test, ctrlxt_qc_submit(qc, reqs, 1), 0);
+
+    /* Completions come back in submission order */
+    for (reaped = 0; reaped < QC_RING_SIZE; reaped += n) {
+        n = ctrlxt_qc_reap(qc, cqes + reaped, QC_RING_SIZE - reaped, true);
+        KUNIT_ASSERT_GT(test, n, 0);
+    }
+    for (i = 0; i < QC_RING_SIZE; i++) {
+        KUNIT_EXPECT_EQ(test, cqes[i].user_data, (u64)i);
+        KUNIT_EXPECT_EQ(test, cqes[i].result, 0);
+        KUNIT_EXPECT_EQ(test, cqes[i].op, (u32)QC_REQ_GATE);
+    }
+    KUNIT_EXPECT_EQ(test, ctrlxt_qc_reap(qc, cqes, QC_RING_SIZE, false), 0);
+    KUNIT_EXPECT_FALSE(test, ctrlxt_qc_is_active(qc));
+
+    /* Malformed requests are refused whole, failing ones complete with their error */
+    reqs[0] = (struct qc_request){ .op = QC_REQ_GATE, .gate = QUANTUM_GATE_X, .qubit = 1 };
+    reqs[1] = (struct qc_request){ .op = QC_REQ_MEASURE_ALL, .data = out, .size = 1, .user_data = 1 };
+    reqs[2] = (struct qc_request){ .op = QC_REQ_GATE, .gate = QUANTUM_GATE_X, .qubit = 9, .user_data = 2 };
+    reqs[3] = (struct qc_request){ .op = 0 };
+    KUNIT_EXPECT_EQ(test, ctrlxt_qc_submit(qc, reqs, 4), -EINVAL);
+    KUNIT_ASSERT_EQ(test, ctrlxt_qc_submit(qc, reqs, 3), 3);
+
+    /* Without waiting a reap takes whatever is done */
+    n = ctrlxt_qc_reap(qc, cqes, 3, false);
+    KUNIT_ASSERT_GE(test, n, 0);
+    for (reaped = n; reaped < 3; reaped += n) {
+        n = ctrlxt_qc_reap(qc, cqes + reaped, 3 - reaped, true);
+        KUNIT_ASSERT_GT(test, n, 0);
+    }
+    KUNIT_EXPECT_EQ(test, cqes[0].result, 0);
+    KUNIT_EXPECT_EQ(test, cqes[1].result, 0);
+    KUNIT_EXPECT_EQ(test, out[0], 0x02);
+    KUNIT_EXPECT_LT(test, cqes[2].result, 0);
+    KUNIT_EXPECT_EQ(test, cqes[2].user_data, 2ULL);
+
+    /* Freeing runs what is still queued before the register goes */
+    memset(out, 0, QC_RING_SIZE);
+    for (i = 0; i < QC_RING_SIZE; i++)
+        reqs[i] = (struct qc_request){ .op = QC_REQ_MEASURE, .data = out + i, .size = 1 };
+    KUNIT_EXPECT_EQ(test, ctrlxt_qc_submit(qc, reqs, QC_RING_SIZE), QC_RING_SIZE);
+    ctrlxt_qc_free(qc);
+    for (i = 0; i < QC_RING_SIZE; i++)
+        KUNIT_EXPECT_EQ(test, out[i], 0x02);
+}
+
+/* Device mmap of the buffers of one interface */
+static int sim_test_qc_mmap(struct file *file, struct vm_area_struct *vma)
+{
+    return ctrlxt_qc_buffer_mmap(file->private_data, vma);
+}
+
+static const struct file_operations sim_test_qc_fops = {
+    .mmap = sim_test_qc_mmap,
+};
+
+/* Test registered buffers: I/O in place, bounds, unknown ids and a mapping outliving its id */
+static void test_qc_buffers(struct kunit *test)
+{
+    struct ctrlxt_qc_interface *qc = sim_test_qc(test, 8);
+    struct qc_request req = { .op = QC_REQ_CONVERT, .flags = QC_REQ_F_BUFFER, .size = 1 };
+    int id, ids[QC_MAX_BUFFERS];
+    u8 value = 0xa5, out;
+    void __user *user;
+    unsigned long addr;
+    struct file *file;
+    unsigned int i;
+
+    KUNIT_EXPECT_EQ(test, ctrlxt_qc_buffer_register(qc, 0), -EINVAL);
+    KUNIT_EXPECT_EQ(test, ctrlxt_qc_buffer_register(qc, QC_BUFFER_REG_MAX + 1), -EINVAL);
+    id = ctrlxt_qc_buffer_register(qc, PAGE_SIZE);
+    KUNIT_ASSERT_GE(test, id, 0);
+    req.buffer = id;
+
+    /* Bytes written through the mapping are converted in place, results land there */
+    file = anon_inode_getfile("ctrlxt_qc_test", &sim_test_qc_fops, qc, O_RDWR);
+    KUNIT_ASSERT_FALSE(test, IS_ERR(file));
+    addr = kunit_vm_mmap(test, file, 0, PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+                         (unsigned long)id << QC_BUFFER_MMAP_SHIFT);
+    KUNIT_ASSERT_FALSE(test, IS_ERR_VALUE(addr));
+    user = (void __user *)addr;
+
+    KUNIT_ASSERT_EQ(test, ctrlxt_qc_set_encoding(qc, QUANTUM_ENCODE_BASIS), 0);
+    KUNIT_ASSERT_EQ(test, copy_to_user(user + 100, &value, 1), 0UL);
+    req.offset = 100;
+    KUNIT_ASSERT_EQ(test, ctrlxt_qc_execute(qc, &req), 0);
+    req.op = QC_REQ_MEASURE_ALL;
+    req.offset = 200;
+    KUNIT_ASSERT_EQ(test, ctrlxt_qc_execute(qc, &req), 0);
+    KUNIT_ASSERT_EQ(test, copy_from_user(&out, user + 200, 1), 0UL);
+    KUNIT_EXPECT_EQ(test, out, value);
+
+    /* Requests stay inside the buffer */
+    req.offset = PAGE_SIZE - 1;
+    KUNIT_EXPECT_EQ(test, ctrlxt_qc_execute(qc, &req), 0);
+    req.size = 2;
+    KUNIT_EXPECT_EQ(test, ctrlxt_qc_execute(qc, &req), -EINVAL);
+    req.size = 1;
+    req.offset = PAGE_SIZE;
+    KUNIT_EXPECT_EQ(test, ctrlxt_qc_execute(qc, &req), -EINVAL);
+    req.offset = U64_MAX;
+    KUNIT_EXPECT_EQ(test, ctrlxt_qc_execute(qc, &req), -EINVAL);
+
+    /* Ids that were never registered */
+    req.offset = 0;
+    req.buffer = QC_MAX_BUFFERS;
+    KUNIT_EXPECT_EQ(test, ctrlxt_qc_execute(qc, &req), -EINVAL);
+    req.buffer = id + 1;
+    KUNIT_EXPECT_EQ(test, ctrlxt_qc_execute(qc, &req), -ENOENT);
+    KUNIT_EXPECT_EQ(test, ctrlxt_qc_buffer_unregister(qc, id + 1), -ENOENT);
+    KUNIT_EXPECT_EQ(test, ctrlxt_qc_buffer_unregister(qc, QC_MAX_BUFFERS), -ENOENT);
+
+    /* The table holds QC_MAX_BUFFERS */
+    for (i = 1; i < QC_MAX_BUFFERS; i++) {
+        ids[i] = ctrlxt_qc_buffer_register(qc, PAGE_SIZE);
+        KUNIT_EXPECT_GE(test, ids[i], 0);
+    }
+    KUNIT_EXPECT_EQ(test, ctrlxt_qc_buffer_register(qc, PAGE_SIZE), -ENOSPC);
+    for (i = 1; i < QC_MAX_BUFFERS; i++)
+        KUNIT_EXPECT_EQ(test, ctrlxt_qc_buffer_unregister(qc, ids[i]), 0);
+
+    /* The mapping keeps the buffer after its id and even the interface are gone */
+    KUNIT_EXPECT_EQ(test, ctrlxt_qc_buffer_unregister(qc, id), 0);
+    req.buffer = id;
+    KUNIT_EXPECT_EQ(test, ctrlxt_qc_execute(qc, &req), -ENOENT);
+    ctrlxt_qc_free(qc);
+    KUNIT_EXPECT_EQ(test, copy_from_user(&out, user + 200, 1), 0UL);
+    KUNIT_EXPECT_EQ(test, out, value);
+    KUNIT_EXPECT_EQ(test, copy_to_user(user, &value, 1), 0UL);
+
+    /* The last close of the mapping frees it */
+    KUNIT_EXPECT_EQ(test, vm_munmap(addr, PAGE_SIZE), 0);
+    fput(file);
+}
+
+/* Test interface conversions against the gates they replace and their size checks */
+static void test_qc_encode(struct kunit *test)
+{
+    struct ctrlxt_qc_interface *qc = sim_test_qc(test, 8);
+    struct quantum_state *ref;
+    struct quantum_op op;
+    unsigned int v, q;
+    u8 *data, out;
+
+    data = kunit_kzalloc(test, QC_BUFFER_SIZE_DEF + 1, GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, data);
+    ref = quantum_state_alloc(8);
+    KUNIT_ASSERT_NOT_NULL(test, ref);
+
+    /* The prefix parities of one pass against X gates and a CNOT ladder from q to q + 1 */
+    KUNIT_ASSERT_EQ(test, ctrlxt_qc_set_encoding(qc, QUANTUM_ENCODE_BASIS), 0);
+    KUNIT_ASSERT_EQ(test, ctrlxt_qc_set_conversion_flags(qc, QC_CONV_ENTANGLE), 0);
+    for (v = 0; v < 256; v += 17) {
+        KUNIT_ASSERT_EQ(test, quantum_state_init(ref, 0), 0);
+        for (q = 0; q < 8; q++) {
+            op = (struct quantum_op){ QUANTUM_GATE_X, q, -1, 0 };
+            if (v & BIT(q))
+                KUNIT_ASSERT_EQ(test, quantum_state_apply_op(ref, &op), 0);
+        }
+        for (q = 0; q + 1 < 8; q++) {
+            op = (struct quantum_op){ QUANTUM_GATE_CNOT, q, q + 1, 0 };
+            KUNIT_ASSERT_EQ(test, quantum_state_apply_op(ref, &op), 0);
+        }
+
+        data[0] = v;
+        KUNIT_ASSERT_EQ(test, ctrlxt_qc_classical_to_quantum(qc, data, 1), 0);
+        KUNIT_ASSERT_EQ(test, ctrlxt_qc_measure_all(qc, &out, 1), 0);
+        KUNIT_EXPECT_EQ(test, out, (u8)quantum_state_get_value(ref));
+    }
+
+    /* Data the register cannot hold, or all zero amplitudes, leaves it as it was */
+    KUNIT_EXPECT_EQ(test, ctrlxt_qc_classical_to_quantum(qc, data, 2), -EINVAL);
+    KUNIT_ASSERT_EQ(test, ctrlxt_qc_set_encoding(qc, QUANTUM_ENCODE_PHASE), 0);
+    KUNIT_EXPECT_EQ(test, ctrlxt_qc_classical_to_quantum(qc, data, 9), -EINVAL);
+    KUNIT_EXPECT_EQ(test, ctrlxt_qc_classical_to_quantum(qc, data, QC_BUFFER_SIZE_DEF + 1), -EINVAL);
+    KUNIT_ASSERT_EQ(test, ctrlxt_qc_set_encoding(qc, QUANTUM_ENCODE_AMPLITUDE), 0);
+    KUNIT_EXPECT_EQ(test, ctrlxt_qc_classical_to_quantum(qc, data, 257), -EINVAL);
+    data[0] = 0;
+    KUNIT_EXPECT_EQ(test, ctrlxt_qc_classical_to_quantum(qc, data, 8), -EINVAL);
+    KUNIT_ASSERT_EQ(test, ctrlxt_qc_measure_all(qc, &out, 1), 0);
+    KUNIT_EXPECT_EQ(test, out, (u8)quantum_state_get_value(ref));
+
+    /* Unknown flags and encodings */
+    KUNIT_EXPECT_EQ(test, ctrlxt_qc_set_conversion_flags(qc, 0x80), -EINVAL);
+    KUNIT_EXPECT_EQ(test, ctrlxt_qc_set_encoding(qc, QUANTUM_ENCODE_COUNT), -EINVAL);
+
+    quantum_state_free(ref);
+    ctrlxt_qc_free(qc);
+}
+
+/* Test separate interfaces, the per-CPU defaults and outcomes of wide diagram registers */
+static void test_qc_instances(struct kunit *test)
+{
+    struct quantum_op ops[] = {
+        { QUANTUM_GATE_X, 0, -1, 0 },
+        { QUANTUM_GATE_X, 33, -1, 0 },
+        { QUANTUM_GATE_X, 35, -1, 0 },
+    };
+    struct quantum_circuit wide = { .num_qubits = 36, .num_ops = ARRAY_SIZE(ops), .ops = ops };
+    struct ctrlxt_qc_interface *a = sim_test_qc(test, 8), *b = sim_test_qc(test, 12);
+    struct quantum_classical_stats stats;
+    struct qc_params params;
+    u8 out[8];
+
+    /* A gate on one register leaves the other alone */
+    KUNIT_ASSERT_EQ(test, ctrlxt_qc_controlled_operation(a, QUANTUM_GATE_X, 5, out), 0);
+    KUNIT_ASSERT_EQ(test, ctrlxt_qc_measure_all(a, out, 1), 0);
+    KUNIT_EXPECT_EQ(test, out[0], 0x20);
+    ctrlxt_qc_get_stats(b, &stats);
+    KUNIT_EXPECT_EQ(test, atomic_read(&stats.measurement_count), 0);
+    KUNIT_ASSERT_EQ(test, ctrlxt_qc_measure_all(b, out, 2), 0);
+    KUNIT_EXPECT_EQ(test, out[0], 0);
+    KUNIT_EXPECT_EQ(test, out[1], 0);
+    KUNIT_ASSERT_EQ(test, ctrlxt_qc_get_params(b, &params), 0);
+    KUNIT_EXPECT_EQ(test, params.num_qubits, 12U);
+
+    /* Freeing one leaves the other working */
+    ctrlxt_qc_free(b);
+    KUNIT_ASSERT_EQ(test, ctrlxt_qc_measure_all(a, out, 1), 0);
+    KUNIT_EXPECT_EQ(test, out[0], 0x20);
+    ctrlxt_qc_get_stats(a, &stats);
+    KUNIT_EXPECT_EQ(test, atomic_read(&stats.measurement_count), 2);
+
+    /* Diagram registers above 32 qubits, one byte per measurement or the whole outcome */
+    KUNIT_ASSERT_EQ(test, ctrlxt_qc_submit_circuit(a, &wide), 0);
+    memset(out, 0xff, sizeof(out));
+    KUNIT_ASSERT_EQ(test, ctrlxt_qc_quantum_to_classical(a, out, 2), 0);
+    KUNIT_EXPECT_EQ(test, out[0], 0x01);
+    KUNIT_EXPECT_EQ(test, out[1], 0x01);
+    KUNIT_EXPECT_EQ(test, out[2], 0xff);
+    KUNIT_EXPECT_EQ(test, ctrlxt_qc_measure_all(a, out, 4), -EINVAL);
+    KUNIT_ASSERT_EQ(test, ctrlxt_qc_measure_all(a, out, 5), 0);
+    KUNIT_EXPECT_EQ(test, out[0], 0x01);
+    KUNIT_EXPECT_EQ(test, out[3], 0x00);
+    KUNIT_EXPECT_EQ(test, out[4], 0x0a);
+    KUNIT_EXPECT_EQ(test, out[5], 0xff);
+    ctrlxt_qc_free(a);
+
+    /* Kernel callers without an interface of their own */
+#ifdef CONFIG_QUANTUM_QC_PERCPU_DEFAULT
+    a = ctrlxt_qc_get_default();
+    KUNIT_ASSERT_NOT_NULL(test, a);
+    KUNIT_EXPECT_EQ(test, ctrlxt_qc_measure_all(a, out, sizeof(out)), 0);
+    get_cpu();
+    KUNIT_EXPECT_PTR_EQ(test, ctrlxt_qc_get_default(), ctrlxt_qc_get_default());
+    put_cpu();
+#else
+    KUNIT_EXPECT_NULL(test, ctrlxt_qc_get_default());
+#endif
+}
+
+/* Test bulk measurement and packed shots through the interface */
+static void test_qc_measure_packed(struct kunit *test)
+{
+    struct ctrlxt_qc_interface *qc = sim_test_qc(test, 20);
+    static const u8 value[3] = { 0x35, 0xc2, 0x0b };
+    u8 out[8];
+    u64 s;
+
+    KUNIT_ASSERT_EQ(test, ctrlxt_qc_set_encoding(qc, QUANTUM_ENCODE_BASIS), 0);
+    KUNIT_ASSERT_EQ(test, ctrlxt_qc_classical_to_quantum(qc, value, sizeof(value)), 0);
+
+    /* One bit per qubit, the buffer has to hold all of them */
+    memset(out, 0xff, sizeof(out));
+    KUNIT_EXPECT_EQ(test, ctrlxt_qc_measure_all(qc, out, 2), -EINVAL);
+    KUNIT_ASSERT_EQ(test, ctrlxt_qc_measure_all(qc, out, 3), 0);
+    KUNIT_EXPECT_EQ(test, memcmp(out, value, sizeof(value)), 0);
+    KUNIT_EXPECT_EQ(test, out[3], 0xff);
+
+    /* Shots every 20 bits, the 4 bits after the third cleared */
+    memset(out, 0xff, sizeof(out));
+    KUNIT_ASSERT_EQ(test, ctrlxt_qc_sample(qc, out, 8), 0);
+    for (s = 0; s < 3; s++)
+        KUNIT_EXPECT_EQ(test, sim_test_shot(out, s, 20), 0xbc235ULL);
+    KUNIT_EXPECT_EQ(test, out[7] >> 4, 0);
+
+    /* Whole bytes after the last shot are cleared, nothing past size is written */
+    memset(out, 0xff, sizeof(out));
+    KUNIT_ASSERT_EQ(test, ctrlxt_qc_sample(qc, out, 6), 0);
+    for (s = 0; s < 2; s++)
+        KUNIT_EXPECT_EQ(test, sim_test_shot(out, s, 20), 0xbc235ULL);
+    KUNIT_EXPECT_EQ(test, out[5], 0);
+    KUNIT_EXPECT_EQ(test, out[6], 0xff);
+
+    /* Room for no shot at all */
+    KUNIT_EXPECT_EQ(test, ctrlxt_qc_sample(qc, out, 2), -EINVAL);
+
+    ctrlxt_qc_free(qc);
+}
+
+/* Test suite definition */
+static struct kunit_case quantum_sim_test_cases[] = {
+    KUNIT_CASE(test_hybrid_amplitudes),
+    KUNIT_CASE(test_tn_amplitudes),
+    KUNIT_CASE(test_dd_state),
+    KUNIT_CASE(test_backend_select),
+    KUNIT_CASE(test_macro_gates),
+    KUNIT_CASE(test_real_state),
+    KUNIT_CASE(test_state_layouts),
+    KUNIT_CASE(test_state_encode),
+    KUNIT_CASE(test_sample_histogram),
+    KUNIT_CASE(test_sample_packed),
+    KUNIT_CASE(test_cached_cdf),
+    KUNIT_CASE(test_time_evolution),
+    KUNIT_CASE(test_variational),
+    KUNIT_CASE(test_qec_contexts),
+    KUNIT_CASE(test_qec_batch),
+    KUNIT_CASE(test_qec_adaptive),
+    KUNIT_CASE(test_qec_lookup),
+    KUNIT_CASE(test_surface_code),
+    KUNIT_CASE(test_pauli_frame),
+    KUNIT_CASE(test_stream_decoder),
+    KUNIT_CASE(test_qc_ring),
+    KUNIT_CASE(test_qc_buffers),
+    KUNIT_CASE(test_qc_encode),
+    KUNIT_CASE(test_qc_instances),
+    KUNIT_CASE(test_qc_measure_packed),
+    {}
+};
+
+static struct kunit_suite quantum_sim_test_suite = {
+    .name = "quantum_sim",
+    .test_cases = quantum_sim_test_cases,
+};
+
+kunit_test_suite(quantum_sim_test_suite);
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("CTRLxT_STUDIOS");
+MODULE_DESCRIPTION("CTRLxT_STUDIOS Omni-Kernel-Prime Quantum Simulation Tests");
+MODULE_VERSION(CTRLXT_KERNEL_VERSION);